@@ -166,6 +166,18 @@ private:
         return --_rc_refcount;
     }
 
+    // Take a reference unless the count has already dropped to zero (and the
+    // value is being deleted).
+    bool _rc_increfIfLive() const {
+        int count = _rc_refcount.load();
+        while (count > 0) {
+            if (_rc_refcount.compare_exchange_weak(count, count + 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     mutable std::atomic<int> _rc_refcount;
 };
 
@@ -287,11 +299,33 @@ public:
         return value;
     }
 
+    /**
+     * The number of references to the value (0 if empty); only exact while
+     * no other thread can take or drop one.
+     */
+    int use_count() const {
+        return value ? static_cast<RCValue *>(value)->_rc_refcount.load() : 0;
+    }
+
     SingleThreadedRCPtr<T> & operator =(const SingleThreadedRCPtr<T> &other) {
         reset(other);
         return *this;
     }
 
+    /**
+     * Get a reference to a value read without holding the lock which
+     * guards its owner. The value's memory must be kept valid by other
+     * means (see EpochManager); if it is already being deleted, the result
+     * is empty.
+     */
+    static SingleThreadedRCPtr<T> acquireIfLive(T *ptr) {
+        SingleThreadedRCPtr<T> rv;
+        if (ptr != NULL && static_cast<RCValue *>(ptr)->_rc_increfIfLive()) {
+            rv.value = ptr;
+        }
+        return rv;
+    }
+
     T &operator *() const {
         return *value;
     }
@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include <algorithm>
+#include <climits>
 #include <vector>
 
 #include "bgfetcher.h"
@@ -31,22 +32,64 @@ void BgFetcher::start() {
     bool inverse = false;
     pendingFetch.compare_exchange_strong(inverse, true);
     ExecutorPool* iom = ExecutorPool::get();
-    ExTask task = new MultiBGFetcherTask(&(store->getEPEngine()), this, false);
-    this->setTaskId(task->getId());
-    iom->schedule(task, READER_TASK_IDX);
+    LockHolder lh(taskMutex);
+    for (size_t ii = taskIds.size(); ii < numFetchers; ++ii) {
+        ExTask task = new MultiBGFetcherTask(&(store->getEPEngine()), this,
+                                             false);
+        taskIds.push_back(task->getId());
+        iom->schedule(task, READER_TASK_IDX);
+    }
 }
 
 void BgFetcher::stop() {
     bool inverse = true;
     pendingFetch.compare_exchange_strong(inverse, false);
-    ExecutorPool::get()->cancel(taskId);
+    LockHolder lh(taskMutex);
+    for (auto id : taskIds) {
+        ExecutorPool::get()->cancel(id);
+    }
+    taskIds.clear();
+    idleTaskIds.clear();
 }
 
 void BgFetcher::notifyBGEvent(void) {
     ++stats.numRemainingBgJobs;
     bool inverse = false;
-    if (pendingFetch.compare_exchange_strong(inverse, true)) {
-        ExecutorPool::get()->wake(taskId);
+    if (pendingFetch.compare_exchange_strong(inverse, true) ||
+        busyFetchers.load() > 0) {
+        // Rather than waiting for the busy tasks to finish, have an idle
+        // one (if any) take the fetch.
+        wakeIdleFetchers(1);
+    }
+}
+
+bool BgFetcher::takePendingVB(VBucket::id_type& vbId, hrtime_t& queuedAt) {
+    LockHolder lh(queueMutex);
+    for (auto it = pendingVbs.begin(); it != pendingVbs.end(); ++it) {
+        if (busyVbs.insert(it->first).second) {
+            vbId = it->first;
+            queuedAt = it->second;
+            pendingVbs.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void BgFetcher::releaseVB(VBucket::id_type vbId) {
+    LockHolder lh(queueMutex);
+    busyVbs.erase(vbId);
+}
+
+void BgFetcher::wakeIdleFetchers(size_t count) {
+    if (busyFetchers.load() >= numFetchers) {
+        return;
+    }
+    LockHolder lh(taskMutex);
+    while (count > 0 && !idleTaskIds.empty()) {
+        ExecutorPool::get()->wake(idleTaskIds.back());
+        idleTaskIds.pop_back();
+        --count;
     }
 }
 
@@ -58,6 +101,7 @@ size_t BgFetcher::doFetch(VBucket::id_type vbId,
         vbId, uint64_t(itemsToFetch.size()), startTime/1000000);
 
     shard->getROUnderlying()->getMulti(vbId, itemsToFetch);
+    stats.bgFetchDiskHisto.add((gethrtime() - startTime) / 1000);
 
     std::vector<bgfetched_item_t> fetchedItems;
     for (const auto& fetch : itemsToFetch) {
@@ -98,28 +142,39 @@ void BgFetcher::clearItems(VBucket::id_type vbId,
 
 bool BgFetcher::run(GlobalTask *task) {
     size_t num_fetched_items = 0;
+    {
+        LockHolder lh(taskMutex);
+        idleTaskIds.erase(std::remove(idleTaskIds.begin(), idleTaskIds.end(),
+                                      task->getId()),
+                          idleTaskIds.end());
+    }
     bool inverse = true;
     pendingFetch.compare_exchange_strong(inverse, false);
 
-    std::vector<uint16_t> bg_vbs(pendingVbs.size());
-    {
-        LockHolder lh(queueMutex);
-        bg_vbs.assign(pendingVbs.begin(), pendingVbs.end());
-        pendingVbs.clear();
-    }
+    ++busyFetchers;
+    std::vector<std::pair<VBucket::id_type, hrtime_t> > requeue;
+    VBucket::id_type vbId;
+    hrtime_t queuedAt;
+    while (takePendingVB(vbId, queuedAt)) {
+        if (numFetchers > 1) {
+            // Let the idle tasks take the remaining vbuckets meanwhile
+            size_t remaining;
+            {
+                LockHolder lh(queueMutex);
+                remaining = pendingVbs.size();
+            }
+            wakeIdleFetchers(remaining);
+        }
 
-    for (const uint16_t vbId : bg_vbs) {
         if (store->getVBuckets().isBucketCreation(vbId)) {
             // Requeue the bg fetch task if a vbucket DB file is not
             // created yet.
-            {
-                LockHolder lh(queueMutex);
-                pendingVbs.insert(vbId);
-            }
-            bool inverse = false;
-            pendingFetch.compare_exchange_strong(inverse, true);
+            requeue.push_back(std::make_pair(vbId, queuedAt));
+            releaseVB(vbId);
             continue;
         }
+        stats.bgFetchQueueWaitHisto.add((gethrtime() - queuedAt) / 1000);
+
         RCPtr<VBucket> vb = shard->getBucket(vbId);
         if (vb) {
             auto items = vb->getBGFetchItems();
@@ -127,14 +182,36 @@ bool BgFetcher::run(GlobalTask *task) {
                 num_fetched_items += doFetch(vbId, items);
             }
         }
+        releaseVB(vbId);
+    }
+    --busyFetchers;
+
+    if (!requeue.empty()) {
+        {
+            LockHolder lh(queueMutex);
+            pendingVbs.insert(requeue.begin(), requeue.end());
+        }
+        bool inverse = false;
+        pendingFetch.compare_exchange_strong(inverse, true);
     }
 
     stats.numRemainingBgJobs.fetch_sub(num_fetched_items);
 
     if (!pendingFetch.load()) {
-        // wait a bit until next fetch request arrives
-        double sleep = std::max(store->getBGFetchDelay(), sleepInterval);
-        task->snooze(sleep);
+        // Wait for the next fetch request. The first task also wakes up
+        // periodically (as the only one used to), the others only when
+        // notified.
+        bool first;
+        {
+            LockHolder lh(taskMutex);
+            first = !taskIds.empty() && taskIds.front() == task->getId();
+            idleTaskIds.push_back(task->getId());
+        }
+        if (first) {
+            task->snooze(std::max(store->getBGFetchDelay(), sleepInterval));
+        } else {
+            task->snooze(INT_MAX);
+        }
 
         if (pendingFetch.load()) {
             // check again a new fetch request could have arrived
@@ -21,8 +21,10 @@
 #include "config.h"
 
 #include <list>
+#include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "item.h"
 #include "kvstore.h"
@@ -37,6 +39,12 @@ class GlobalTask;
 /**
  * Dispatcher job responsible for batching data reads and push to
  * underlying storage
+ *
+ * The fetches of a shard may be performed by several reader tasks. The
+ * vbuckets with pending fetches are queued once each; every task takes the
+ * next vbucket none of the others is fetching, so a vbucket's fetches are
+ * still completed in order while those of other vbuckets proceed alongside.
+ * A fetch queued while some task is busy wakes an idle one, if any.
  */
 class BgFetcher {
 public:
@@ -47,9 +55,12 @@ public:
      * @param s  The store
      * @param k  The shard to which this background fetcher belongs
      * @param st reference to statistics
+     * @param fetchers number of reader tasks fetching for the shard
      */
-    BgFetcher(EventuallyPersistentStore *s, KVShard *k, EPStats &st) :
-        store(s), shard(k), taskId(0), stats(st), pendingFetch(false) {}
+    BgFetcher(EventuallyPersistentStore *s, KVShard *k, EPStats &st,
+              size_t fetchers = 1) :
+        store(s), shard(k), numFetchers(fetchers), busyFetchers(0),
+        stats(st), pendingFetch(false) {}
     ~BgFetcher() {
         LockHolder lh(queueMutex);
         if (!pendingVbs.empty()) {
@@ -65,24 +76,51 @@ public:
     bool run(GlobalTask *task);
     bool pendingJob(void) const;
     void notifyBGEvent(void);
-    void setTaskId(size_t newId) { taskId = newId; }
     void addPendingVB(VBucket::id_type vbId) {
         LockHolder lh(queueMutex);
-        pendingVbs.insert(vbId);
+        // Keeps the time the vbucket was first queued at
+        pendingVbs.insert(std::make_pair(vbId, gethrtime()));
+    }
+
+    size_t getNumFetchers(void) const {
+        return numFetchers;
     }
 
 private:
+    /**
+     * Take the next queued vbucket no other task is fetching for.
+     *
+     * @param vbId set to the vbucket taken
+     * @param queuedAt set to the time the vbucket was queued at
+     * @return false if there is no such vbucket
+     */
+    bool takePendingVB(VBucket::id_type& vbId, hrtime_t& queuedAt);
+    void releaseVB(VBucket::id_type vbId);
+    /**
+     * Wake up to count of the tasks waiting for fetches to be queued.
+     */
+    void wakeIdleFetchers(size_t count);
+
     size_t doFetch(VBucket::id_type vbId, vb_bgfetch_queue_t& items);
     void clearItems(VBucket::id_type vbId, const vb_bgfetch_queue_t& items);
 
     EventuallyPersistentStore *store;
     KVShard *shard;
-    size_t taskId;
+    std::mutex taskMutex;
+    std::vector<size_t> taskIds;
+    // The tasks waiting for fetches to be queued
+    std::vector<size_t> idleTaskIds;
+    const size_t numFetchers;
+    // Number of tasks currently fetching
+    std::atomic<size_t> busyFetchers;
     std::mutex queueMutex;
     EPStats &stats;
 
     std::atomic<bool> pendingFetch;
-    std::set<VBucket::id_type> pendingVbs;
+    // Queued vbuckets, and the time each was queued at
+    std::map<VBucket::id_type, hrtime_t> pendingVbs;
+    // The vbuckets being fetched for
+    std::set<VBucket::id_type> busyVbs;
 };
 
 #endif  // SRC_BGFETCHER_H_
@@ -18,27 +18,203 @@
 #include "bloomfilter.h"
 #include "murmurhash3.h"
 
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BLOOMFILTER_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Hashes computed per call to hashKey(); covers the usual number of hashes
+// in one or two calls whilst keeping the early exit of maybeKeyExists().
+static const uint32_t hashBatchSize = 4;
+
+/**
+ * Hash the key with each of the seeds firstSeed .. firstSeed + n - 1
+ * (n <= hashBatchSize).
+ */
+static void hashKey(const char *key, size_t keylen, uint32_t firstSeed,
+                    uint32_t n, uint64_t *out) {
 #if __x86_64__ || __ppc64__
-#define MURMURHASH_3 MurmurHash3_x64_128
+    MurmurHash3_x64_128_seeds(key, keylen, firstSeed, n, out);
 #else
-#define MURMURHASH_3 MurmurHash3_x86_128
+    for (uint32_t i = 0; i < n; i++) {
+        // The hash is 128 bits wide; only the low half is used.
+        uint64_t hash[2];
+        MurmurHash3_x86_128(key, keylen, firstSeed + i, hash);
+        out[i] = hash[0];
+    }
+#endif
+}
+
+// Multipliers deriving the bit to set in each word of a block from the key's
+// 32-bit pattern (as used by "split block" bloom filters).
+static const uint32_t blockSalts[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+#ifdef BLOOMFILTER_HAVE_AVX2
+
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+static bool haveAVX2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/**
+ * The masks of the bits for the given pattern in words 0-3 and 4-7 of a
+ * block.
+ */
+AVX2_FUNCTION
+static inline void blockMasksAVX2(uint32_t pattern, __m256i &lo, __m256i &hi) {
+    const __m256i salts = _mm256_loadu_si256((const __m256i*)blockSalts);
+    const __m256i shifts = _mm256_srli_epi32(
+            _mm256_mullo_epi32(_mm256_set1_epi32(pattern), salts), 26);
+    const __m256i one = _mm256_set1_epi64x(1);
+    lo = _mm256_sllv_epi64(one,
+            _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shifts)));
+    hi = _mm256_sllv_epi64(one,
+            _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shifts, 1)));
+}
+
+AVX2_FUNCTION
+static bool setBlockBitsAVX2(uint64_t *words, uint32_t pattern) {
+    __m256i mlo, mhi;
+    blockMasksAVX2(pattern, mlo, mhi);
+    __m256i *w = reinterpret_cast<__m256i*>(words);
+    const __m256i lo = _mm256_load_si256(w);
+    const __m256i hi = _mm256_load_si256(w + 1);
+    const bool overlap = _mm256_testc_si256(lo, mlo) &&
+                         _mm256_testc_si256(hi, mhi);
+    _mm256_store_si256(w, _mm256_or_si256(lo, mlo));
+    _mm256_store_si256(w + 1, _mm256_or_si256(hi, mhi));
+    return overlap;
+}
+
+AVX2_FUNCTION
+static bool testBlockBitsAVX2(const uint64_t *words, uint32_t pattern) {
+    __m256i mlo, mhi;
+    blockMasksAVX2(pattern, mlo, mhi);
+    const __m256i *w = reinterpret_cast<const __m256i*>(words);
+    return _mm256_testc_si256(_mm256_load_si256(w), mlo) &&
+           _mm256_testc_si256(_mm256_load_si256(w + 1), mhi);
+}
+
+#endif // BLOOMFILTER_HAVE_AVX2
+
+static inline uint64_t blockMask(uint32_t pattern, int word) {
+    return uint64_t(1) << ((pattern * blockSalts[word]) >> 26);
+}
+
+/**
+ * Set the pattern's bits in the 8 words of a block, returning true if they
+ * were all set already.
+ */
+static bool setBlockBitsScalar(uint64_t *words, uint32_t pattern) {
+    bool overlap = true;
+    for (int i = 0; i < 8; i++) {
+        const uint64_t mask = blockMask(pattern, i);
+        if ((words[i] & mask) == 0) {
+            overlap = false;
+        }
+        words[i] |= mask;
+    }
+    return overlap;
+}
+
+static bool testBlockBitsScalar(const uint64_t *words, uint32_t pattern) {
+    for (int i = 0; i < 8; i++) {
+        if ((words[i] & blockMask(pattern, i)) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef bool (*SetBlockBitsFn)(uint64_t *words, uint32_t pattern);
+typedef bool (*TestBlockBitsFn)(const uint64_t *words, uint32_t pattern);
+
+// The block implementations for this CPU, chosen once at load time rather
+// than on every probe.
+static const SetBlockBitsFn setBlockBits =
+#ifdef BLOOMFILTER_HAVE_AVX2
+        haveAVX2() ? setBlockBitsAVX2 :
+#endif
+        setBlockBitsScalar;
+
+static const TestBlockBitsFn testBlockBits =
+#ifdef BLOOMFILTER_HAVE_AVX2
+        haveAVX2() ? testBlockBitsAVX2 :
 #endif
+        testBlockBitsScalar;
 
 BloomFilter::BloomFilter(size_t key_count, double false_positive_prob,
-                         bfilter_status_t new_status) {
+                         bfilter_status_t new_status,
+                         bfilter_type_t new_type)
+    : keyCapacity(key_count), trueNegatives(0), falsePositives(0),
+      type(new_type), blocks(NULL), numBlocks(0) {
 
     status = new_status;
     filterSize = estimateFilterSize(key_count, false_positive_prob);
     noOfHashes = estimateNoOfHashes(key_count);
     keyCounter = 0;
-    bitArray.assign(filterSize, false);
+    if (type == BFILTER_BLOCKED) {
+        allocateBlocks(filterSize);
+    } else if (type == BFILTER_COUNTING) {
+        counters.assign((filterSize + 1) / 2, 0);
+    } else {
+        bitArray.assign(filterSize, false);
+    }
 }
 
 BloomFilter::~BloomFilter() {
     status = BFILTER_DISABLED;
+    clearBits();
+}
+
+bfilter_type_t BloomFilter::toType(const std::string &name) {
+    if (name == "standard") {
+        return BFILTER_STANDARD;
+    } else if (name == "blocked") {
+        return BFILTER_BLOCKED;
+    } else if (name == "counting") {
+        return BFILTER_COUNTING;
+    }
+    throw std::invalid_argument("BloomFilter::toType: unknown type '" +
+                                name + "'");
+}
+
+std::string BloomFilter::getTypeString() const {
+    switch (type) {
+        case BFILTER_STANDARD:
+            return "standard";
+        case BFILTER_BLOCKED:
+            return "blocked";
+        case BFILTER_COUNTING:
+            return "counting";
+    }
+    return "unknown";
+}
+
+void BloomFilter::allocateBlocks(size_t bits) {
+    numBlocks = std::max<size_t>(1, (bits + blockBits - 1) / blockBits);
+    const size_t wordsPerBlock = sizeof(Block) / sizeof(uint64_t);
+    blockStorage.assign((numBlocks + 1) * wordsPerBlock, 0);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(blockStorage.data());
+    addr = (addr + sizeof(Block) - 1) & ~uintptr_t(sizeof(Block) - 1);
+    blocks = reinterpret_cast<Block*>(addr);
+}
+
+void BloomFilter::clearBits() {
     bitArray.clear();
+    counters.clear();
+    blockStorage.clear();
+    blocks = NULL;
+    numBlocks = 0;
 }
 
 size_t BloomFilter::estimateFilterSize(size_t key_count,
@@ -61,7 +237,7 @@ void BloomFilter::setStatus(bfilter_status_t to) {
         case BFILTER_PENDING:
             if (to == BFILTER_DISABLED) {
                 status = to;
-                bitArray.clear();
+                clearBits();
             } else if (to == BFILTER_COMPACTING) {
                 status = to;
             }
@@ -69,7 +245,7 @@ void BloomFilter::setStatus(bfilter_status_t to) {
         case BFILTER_COMPACTING:
             if (to == BFILTER_DISABLED) {
                 status = to;
-                bitArray.clear();
+                clearBits();
             } else if (to == BFILTER_ENABLED) {
                 status = to;
             }
@@ -77,7 +253,7 @@ void BloomFilter::setStatus(bfilter_status_t to) {
         case BFILTER_ENABLED:
             if (to == BFILTER_DISABLED) {
                 status = to;
-                bitArray.clear();
+                clearBits();
             } else if (to == BFILTER_COMPACTING) {
                 status = to;
             }
@@ -103,17 +279,54 @@ std::string BloomFilter::getStatusString() {
     return "UNKNOWN";
 }
 
+BloomFilter::Block *BloomFilter::getBlock(const char *key, size_t keylen,
+                                          uint32_t &pattern) {
+    if (blocks == NULL) {
+        return NULL;
+    }
+    // The low half of the hash picks the block, the high half the bits.
+    uint64_t hash[2];
+#if __x86_64__ || __ppc64__
+    MurmurHash3_x64_128(key, keylen, 0, hash);
+#else
+    MurmurHash3_x86_128(key, keylen, 0, hash);
+#endif
+    const uint64_t result = hash[0];
+    pattern = static_cast<uint32_t>(result >> 32);
+    return &blocks[static_cast<uint32_t>(result) % numBlocks];
+}
+
+void BloomFilter::addKeyBlocked(const char *key, size_t keylen) {
+    uint32_t pattern;
+    Block *block = getBlock(key, keylen, pattern);
+    if (block && !setBlockBits(block->words, pattern)) {
+        keyCounter++;
+    }
+}
+
+bool BloomFilter::maybeKeyExistsBlocked(const char *key, size_t keylen) {
+    uint32_t pattern;
+    Block *block = getBlock(key, keylen, pattern);
+    return block == NULL || testBlockBits(block->words, pattern);
+}
+
 void BloomFilter::addKey(const char *key, size_t keylen) {
     if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
+        if (type == BFILTER_BLOCKED) {
+            addKeyBlocked(key, keylen);
+            return;
+        }
         bool overlap = true;
-        uint32_t i;
-        uint64_t result;
-        for (i = 0; i < noOfHashes; i++) {
-            MURMURHASH_3(key, keylen, i, &result);
-            if (overlap && bitArray[result % filterSize] == 0) {
-                overlap = false;
+        uint64_t results[hashBatchSize];
+        for (size_t i = 0; i < noOfHashes; i += hashBatchSize) {
+            const uint32_t n = std::min<size_t>(hashBatchSize, noOfHashes - i);
+            hashKey(key, keylen, i, n, results);
+            for (uint32_t j = 0; j < n; j++) {
+                if (overlap && !isSet(results[j] % filterSize)) {
+                    overlap = false;
+                }
+                set(results[j] % filterSize);
             }
-            bitArray[result % filterSize] = 1;
         }
         if (!overlap) {
             keyCounter++;
@@ -123,20 +336,75 @@ void BloomFilter::addKey(const char *key, size_t keylen) {
 
 bool BloomFilter::maybeKeyExists(const char *key, uint32_t keylen) {
     if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
-        uint32_t i;
-        uint64_t result;
-        for (i = 0; i < noOfHashes; i++) {
-            MURMURHASH_3(key, keylen, i, &result);
-            if (bitArray[result % filterSize] == 0) {
-                // The key does NOT exist.
+        if (type == BFILTER_BLOCKED) {
+            if (!maybeKeyExistsBlocked(key, keylen)) {
+                trueNegatives++;
                 return false;
             }
+            return true;
+        }
+        uint64_t results[hashBatchSize];
+        for (size_t i = 0; i < noOfHashes; i += hashBatchSize) {
+            const uint32_t n = std::min<size_t>(hashBatchSize, noOfHashes - i);
+            hashKey(key, keylen, i, n, results);
+            for (uint32_t j = 0; j < n; j++) {
+                if (!isSet(results[j] % filterSize)) {
+                    // The key does NOT exist.
+                    trueNegatives++;
+                    return false;
+                }
+            }
         }
     }
     // The key may exist.
     return true;
 }
 
+void BloomFilter::removeKey(const char *key, size_t keylen) {
+    if (type != BFILTER_COUNTING || filterSize == 0 || counters.empty() ||
+        (status != BFILTER_COMPACTING && status != BFILTER_ENABLED)) {
+        return;
+    }
+
+    std::vector<size_t> positions(noOfHashes);
+    uint64_t results[hashBatchSize];
+    for (size_t i = 0; i < noOfHashes; i += hashBatchSize) {
+        const uint32_t n = std::min<size_t>(hashBatchSize, noOfHashes - i);
+        hashKey(key, keylen, i, n, results);
+        for (uint32_t j = 0; j < n; j++) {
+            positions[i + j] = results[j] % filterSize;
+            if (getCounter(positions[i + j]) == 0) {
+                // Never added (or already removed); decrementing the
+                // other counters could remove keys which are present.
+                return;
+            }
+        }
+    }
+
+    for (size_t pos : positions) {
+        const uint8_t count = getCounter(pos);
+        // A saturated counter may be shared by more keys than it can
+        // count, so it can never safely be decremented.
+        if (count != counterMax) {
+            setCounter(pos, count - 1);
+        }
+    }
+    if (keyCounter > 0) {
+        keyCounter--;
+    }
+}
+
+void BloomFilter::set(size_t pos) {
+    if (type == BFILTER_COUNTING) {
+        const uint8_t count = getCounter(pos);
+        if (count != counterMax) {
+            setCounter(pos, count + 1);
+        }
+    } else {
+        bitArray[pos] = 1;
+    }
+}
+
 size_t BloomFilter::getNumOfKeysInFilter() {
     if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
         return keyCounter;
@@ -147,8 +415,13 @@ size_t BloomFilter::getNumOfKeysInFilter() {
 
 size_t BloomFilter::getFilterSize() {
     if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
-        return filterSize;
+        return type == BFILTER_BLOCKED ? numBlocks * blockBits : filterSize;
     } else {
         return 0;
     }
 }
+
+double BloomFilter::getFalsePositiveRate() {
+    const size_t negatives = trueNegatives + falsePositives;
+    return negatives == 0 ? 0.0 : (double)falsePositives / negatives;
+}
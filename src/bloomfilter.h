@@ -30,6 +30,12 @@ enum bfilter_status_t {
     BFILTER_ENABLED
 };
 
+enum bfilter_type_t {
+    BFILTER_STANDARD,   // Each probe may touch a different part of the filter
+    BFILTER_BLOCKED,    // All probes of a key fall within one cache line
+    BFILTER_COUNTING    // Small counters rather than bits; keys can be removed
+};
+
 /**
  * A bloom filter instance for a vbucket.
  * We are to maintain the vbucket-number of these instances.
@@ -39,9 +45,22 @@ enum bfilter_status_t {
 class BloomFilter {
 public:
     BloomFilter(size_t key_count, double false_positive_prob,
-                bfilter_status_t newStatus = BFILTER_DISABLED);
+                bfilter_status_t newStatus = BFILTER_DISABLED,
+                bfilter_type_t newType = BFILTER_STANDARD);
     ~BloomFilter();
 
+    /**
+     * Parse a filter type name ("standard", "blocked" or "counting").
+     *
+     * @throws std::invalid_argument if the name is unknown
+     */
+    static bfilter_type_t toType(const std::string &name);
+
+    bfilter_type_t getType() const {
+        return type;
+    }
+    std::string getTypeString() const;
+
     void setStatus(bfilter_status_t to);
     bfilter_status_t getStatus();
     std::string getStatusString();
@@ -49,20 +68,105 @@ public:
     void addKey(const char *key, size_t keylen);
     bool maybeKeyExists(const char *key, uint32_t keylen);
 
+    /**
+     * Remove a key which was previously added (BFILTER_COUNTING only).
+     *
+     * Removing a key which wasn't added may remove others, so this must
+     * only be used for keys known to be in the filter. Keys whose counters
+     * have saturated stay in the filter.
+     */
+    void removeKey(const char *key, size_t keylen);
+
+    bool supportsRemoval() const {
+        return type == BFILTER_COUNTING;
+    }
+
+    /**
+     * True if more keys have been added than the filter was sized for, so
+     * its false positive rate will be above the one asked for.
+     */
+    bool isOverCapacity() const {
+        return keyCounter > keyCapacity;
+    }
+
     size_t getNumOfKeysInFilter();
     size_t getFilterSize();
 
+    /**
+     * Record that a key maybeKeyExists() reported as possibly existing was
+     * then found not to exist.
+     */
+    void addFalsePositive() {
+        falsePositives++;
+    }
+
+    /**
+     * The measured false positive rate: the fraction of lookups of keys
+     * which didn't exist that the filter didn't rule out (as reported via
+     * addFalsePositive()).
+     */
+    double getFalsePositiveRate();
+
 private:
+    /**
+     * One cache line of a blocked filter. A key sets (and tests) one bit in
+     * each word of a single block, so k is fixed at the number of words.
+     */
+    struct Block {
+        uint64_t words[8];
+    };
+    static const size_t blockBits = sizeof(Block) * 8;
+
+    // BFILTER_COUNTING: 4-bit counters, two per byte.
+    static const uint8_t counterMax = 0xf;
+
+    uint8_t getCounter(size_t pos) const {
+        return (counters[pos / 2] >> ((pos & 1) * 4)) & counterMax;
+    }
+
+    void setCounter(size_t pos, uint8_t value) {
+        const int shift = (pos & 1) * 4;
+        uint8_t &byte = counters[pos / 2];
+        byte = (byte & ~(counterMax << shift)) | (value << shift);
+    }
+
+    bool isSet(size_t pos) const {
+        return type == BFILTER_COUNTING ? getCounter(pos) != 0
+                                        : bitArray[pos];
+    }
+
+    void set(size_t pos);
+
     size_t estimateFilterSize(size_t key_count, double false_positive_prob);
     size_t estimateNoOfHashes(size_t key_count);
 
+    void allocateBlocks(size_t bits);
+    void clearBits();
+
+    Block *getBlock(const char *key, size_t keylen, uint32_t &pattern);
+    void addKeyBlocked(const char *key, size_t keylen);
+    bool maybeKeyExistsBlocked(const char *key, size_t keylen);
+
     size_t filterSize;
     size_t noOfHashes;
 
     size_t keyCounter;
+    size_t keyCapacity;
+
+    // Lookups the filter ruled out, and those it didn't but should have.
+    size_t trueNegatives;
+    size_t falsePositives;
 
     bfilter_status_t status;
+    bfilter_type_t type;
     std::vector<bool> bitArray;
+    std::vector<uint8_t> counters;
+
+    // BFILTER_BLOCKED: blockStorage is over-allocated by a block so that
+    // blocks can start on a cache line boundary.
+    std::vector<uint64_t> blockStorage;
+    Block *blocks;
+    size_t numBlocks;
 };
 
 #endif // SRC_BLOOMFILTER_H_
@@ -18,7 +18,11 @@
 #include "config.h"
 
 #include <platform/checked_snprintf.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -63,6 +67,144 @@ private:
     CheckpointConfig &config;
 };
 
+void CheckpointQueue::push_back(const queued_item &qi) {
+    if (used == chunks.size() * chunkSize) {
+        chunks.emplace_back(new queued_item[chunkSize]);
+        chunkLive.push_back(0);
+    }
+    ++chunkLive[used / chunkSize];
+    slot(used++) = qi;
+    ++numLive;
+}
+
+void CheckpointQueue::pop_back() {
+    if (numLive == 0) {
+        throw std::logic_error("CheckpointQueue::pop_back: queue is empty");
+    }
+    slot(--used).reset();
+    --chunkLive[used / chunkSize];
+    --numLive;
+    trimBack();
+}
+
+void CheckpointQueue::erase(iterator pos) {
+    if (pos.queue != this || pos.pos >= used || !slot(pos.pos)) {
+        throw std::invalid_argument("CheckpointQueue::erase: position is not "
+                                    "an item in this queue");
+    }
+    slot(pos.pos).reset();
+    --numLive;
+    const size_t chunk = pos.pos / chunkSize;
+    if (--chunkLive[chunk] == 0 && chunk + 1 < chunks.size()) {
+        // Nothing more can be appended to a chunk followed by another.
+        chunks[chunk].reset();
+        numFreed += chunkSize;
+    }
+    trimBack();
+}
+
+void CheckpointQueue::assign(const std::vector<queued_item> &items) {
+    chunks.clear();
+    chunkLive.clear();
+    used = 0;
+    numLive = 0;
+    numFreed = 0;
+    for (const auto &qi : items) {
+        push_back(qi);
+    }
+}
+
+void CheckpointQueue::trimBack() {
+    while (used > 0) {
+        const size_t chunk = (used - 1) / chunkSize;
+        if (chunkLive[chunk] == 0) {
+            used = chunk * chunkSize;
+        } else if (!slot(used - 1)) {
+            --used;
+        } else {
+            break;
+        }
+    }
+    while (chunks.size() * chunkSize >= used + chunkSize) {
+        if (!chunks.back()) {
+            numFreed -= chunkSize;
+        }
+        chunks.pop_back();
+        chunkLive.pop_back();
+    }
+}
+
+CheckpointIndex::Slot &CheckpointIndex::probe(const std::string &key,
+                                              size_t hash) {
+    const size_t mask = capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Slot &s = slots[i];
+        if (!s.key || (s.hash == hash && *s.key == key)) {
+            return s;
+        }
+    }
+}
+
+index_entry *CheckpointIndex::find(const std::string &key) {
+    if (numEntries == 0) {
+        return NULL;
+    }
+    Slot &s = probe(key, std::hash<std::string>()(key));
+    return s.key ? &s.entry : NULL;
+}
+
+void CheckpointIndex::set(const std::string &key, const index_entry &entry) {
+    // Keep the load factor at or below 3/4.
+    if ((numEntries + 1) * 4 > capacity * 3) {
+        grow();
+    }
+    const size_t hash = std::hash<std::string>()(key);
+    Slot &s = probe(key, hash);
+    if (!s.key) {
+        s.hash = hash;
+        ++numEntries;
+    }
+    s.key = &key;
+    s.entry = entry;
+}
+
+bool CheckpointIndex::erase(const std::string &key) {
+    if (numEntries == 0) {
+        return false;
+    }
+    const size_t mask = capacity - 1;
+    Slot *hole = &probe(key, std::hash<std::string>()(key));
+    if (!hole->key) {
+        return false;
+    }
+    // Shift back any later entry of the probe run which may no longer be
+    // reachable from its home slot past the hole, so there's no need
+    // for tombstones.
+    size_t i = hole - slots.get();
+    for (size_t j = (i + 1) & mask; slots[j].key; j = (j + 1) & mask) {
+        const size_t home = slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].key = NULL;
+    --numEntries;
+    return true;
+}
+
+void CheckpointIndex::grow() {
+    std::unique_ptr<Slot[]> old(std::move(slots));
+    const size_t oldCapacity = capacity;
+    capacity = capacity ? capacity * 2 : initialCapacity;
+    slots.reset(new Slot[capacity]());
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (old[i].key) {
+            probe(*old[i].key, old[i].hash) = old[i];
+        }
+    }
+}
+
 void CheckpointCursor::decrOffset(size_t decr) {
     if (offset >= decr) {
         offset.fetch_sub(decr);
@@ -104,13 +246,15 @@ void Checkpoint::setState(checkpoint_state state) {
 void Checkpoint::popBackCheckpointEndItem() {
     if (!toWrite.empty() &&
         toWrite.back()->getOperation() == queue_op_checkpoint_end) {
+        const size_t overhead = getQueueMemUsage();
         metaKeyIndex.erase(toWrite.back()->getKey());
         toWrite.pop_back();
+        updateMemOverhead(overhead, getQueueMemUsage());
     }
 }
 
 bool Checkpoint::keyExists(const std::string &key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(key) != NULL;
 }
 
 queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
@@ -122,7 +266,8 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
     }
     queue_dirty_t rv;
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    index_entry *existing = keyIndex.find(qi->getKey());
+    const size_t overhead = getQueueMemUsage();
 
     // Check if the item is a meta item
     if (qi->isCheckPointMetaItem()) {
@@ -130,10 +275,10 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         toWrite.push_back(qi);
     } else {
         // Check if this checkpoint already had an item for the same key
-        if (it != keyIndex.end()) {
+        if (existing) {
             rv = EXISTING_ITEM;
-            CheckpointQueue::iterator currPos = it->second.position;
-            uint64_t currMutationId = it->second.mutation_id;
+            CheckpointQueue::iterator currPos = existing->position;
+            uint64_t currMutationId = existing->mutation_id;
 
             cursor_index::iterator map_it =
                                         checkpointManager->connCursors.begin();
@@ -142,10 +287,10 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                 if (*(map_it->second.currentCheckpoint) == this) {
                     queued_item &tqi = *(map_it->second.currentPos);
                     const std::string &key = tqi->getKey();
-                    checkpoint_index::iterator ita = keyIndex.find(key);
-                    if (ita != keyIndex.end() && (!tqi->isCheckPointMetaItem()))
+                    index_entry *cursorEntry = keyIndex.find(key);
+                    if (cursorEntry && (!tqi->isCheckPointMetaItem()))
                     {
-                        uint64_t mutationId = ita->second.mutation_id;
+                        uint64_t mutationId = cursorEntry->mutation_id;
                         if (currMutationId <= mutationId) {
                             map_it->second.decrOffset(1);
                             if (map_it->second.name.compare(CheckpointManager::pCursorName)
@@ -163,7 +308,11 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
             }
 
             toWrite.push_back(qi);
-            // Remove the existing item for the same key from the list.
+            // Re-index the key with the new item before the existing one
+            // (whose key the index refers to) is removed from the list.
+            CheckpointQueue::iterator last = toWrite.end();
+            index_entry entry = {--last, qi->getBySeqno()};
+            keyIndex.set(qi->getKey(), entry);
             toWrite.erase(currPos);
         } else {
             ++numItems;
@@ -173,7 +322,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         }
     }
 
-    if (qi->getNKey() > 0) {
+    if (qi->getNKey() > 0 && rv == NEW_ITEM) {
         CheckpointQueue::iterator last = toWrite.end();
         // --last is okay as the list is not empty now.
         index_entry entry = {--last, qi->getBySeqno()};
@@ -181,23 +330,14 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         // the list.
         if (qi->isCheckPointMetaItem()) {
             // We add a meta item only once to a checkpoint
-            metaKeyIndex[qi->getKey()] = entry;
+            metaKeyIndex.set(qi->getKey(), entry);
         } else {
-            keyIndex[qi->getKey()] = entry;
-        }
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getNKey() + sizeof(index_entry) +
-                                  sizeof(queued_item);
-            memOverhead += newEntrySize;
-            stats.memOverhead.fetch_add(newEntrySize);
-            if (stats.memOverhead.load() >= GIGANTOR) {
-                LOG(EXTENSION_LOG_WARNING,
-                    "Checkpoint::queueDirty: stats.memOverhead (which is %" PRId64
-                    ") is greater than %" PRId64, uint64_t(stats.memOverhead.load()),
-                    uint64_t(GIGANTOR));
-            }
+            keyIndex.set(qi->getKey(), entry);
         }
     }
+    // The slot of a replaced item is charged until its chunk is freed, and
+    // the index only allocates memory when it grows.
+    updateMemOverhead(overhead, getQueueMemUsage());
 
     // Notify flusher if in case queued item is a checkpoint meta item
     if (qi->getOperation() == queue_op_checkpoint_start ||
@@ -210,7 +350,6 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
 
 size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     size_t numNewItems = 0;
-    size_t newEntryMemOverhead = 0;
     CheckpointQueue::reverse_iterator rit = pPrevCheckpoint->rbegin();
 
     LOG(EXTENSION_LOG_INFO,
@@ -220,30 +359,33 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
 
     CheckpointQueue::iterator itr = toWrite.begin();
     uint64_t seqno = pPrevCheckpoint->getMutationIdForKey("dummy_key", true);
-    metaKeyIndex["dummy_key"].mutation_id = seqno;
+    setMetaMutationId("dummy_key", seqno);
     (*itr)->setBySeqno(seqno);
 
     seqno = pPrevCheckpoint->getMutationIdForKey("checkpoint_start", true);
-    metaKeyIndex["checkpoint_start"].mutation_id = seqno;
+    setMetaMutationId("checkpoint_start", seqno);
     ++itr;
     (*itr)->setBySeqno(seqno);
 
+    // The items from the previous checkpoint go after the first two meta
+    // items. The queue can only be appended to, so it is rebuilt with them
+    // in place.
+    std::vector<queued_item> prevItems;
+    const size_t overhead = getQueueMemUsage();
     for (; rit != pPrevCheckpoint->rend(); ++rit) {
         const std::string &key = (*rit)->getKey();
         if ((*rit)->getOperation() != queue_op_del &&
             (*rit)->getOperation() != queue_op_set) {
             continue;
         }
-        checkpoint_index::iterator it = keyIndex.find(key);
-        if (it == keyIndex.end()) {
-            CheckpointQueue::iterator pos = toWrite.begin();
-            // Skip the first two meta items
-            ++pos; ++pos;
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, static_cast<int64_t>(pPrevCheckpoint->
+        if (!keyIndex.find(key)) {
+            prevItems.push_back(*rit);
+            // The position is set once the queue is rebuilt. The key belongs
+            // to the item, which moves into this checkpoint.
+            index_entry entry = {CheckpointQueue::iterator(),
+                                 static_cast<int64_t>(pPrevCheckpoint->
                                             getMutationIdForKey(key, false))};
-            keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
+            keyIndex.set(key, entry);
             ++numItems;
             ++numNewItems;
 
@@ -252,6 +394,29 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
         }
     }
 
+    if (!prevItems.empty()) {
+        std::vector<queued_item> items;
+        items.reserve(toWrite.size() + prevItems.size());
+        CheckpointQueue::iterator pos = toWrite.begin();
+        items.push_back(*pos++);
+        items.push_back(*pos++);
+        // prevItems were gathered newest first.
+        items.insert(items.end(), prevItems.rbegin(), prevItems.rend());
+        items.insert(items.end(), pos, toWrite.end());
+        toWrite.assign(items);
+
+        for (pos = toWrite.begin(); pos != toWrite.end(); ++pos) {
+            if ((*pos)->getNKey() > 0) {
+                checkpoint_index &idx = (*pos)->isCheckPointMetaItem() ?
+                                        metaKeyIndex : keyIndex;
+                index_entry *entry = idx.find((*pos)->getKey());
+                if (entry) {
+                    entry->position = pos;
+                }
+            }
+        }
+    }
+
     /**
      * Update snapshot start of current checkpoint to the first
      * item's sequence number, after merge completed, as items
@@ -260,23 +425,42 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
      */
     setSnapshotStartSeqno(getLowSeqno());
 
-    memOverhead += newEntryMemOverhead;
-    stats.memOverhead.fetch_add(newEntryMemOverhead);
-    LOG(EXTENSION_LOG_WARNING,
-        "Checkpoint::mergePrevCheckpoint: stats.memOverhead (which is %" PRId64
-        ") is greater than %" PRId64, uint64_t(stats.memOverhead.load()),
-        uint64_t(GIGANTOR));
+    // Rebuilding the queue also drops the slots of erased items.
+    updateMemOverhead(overhead, getQueueMemUsage());
     return numNewItems;
 }
 
+void Checkpoint::updateMemOverhead(size_t before, size_t after) {
+    if (after >= before) {
+        memOverhead += after - before;
+        stats.memOverhead.fetch_add(after - before);
+        if (stats.memOverhead.load() >= GIGANTOR) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Checkpoint::updateMemOverhead: stats.memOverhead (which is %"
+                PRId64 ") is greater than %" PRId64,
+                uint64_t(stats.memOverhead.load()), uint64_t(GIGANTOR));
+        }
+    } else {
+        memOverhead -= before - after;
+        stats.memOverhead.fetch_sub(before - after);
+    }
+}
+
+void Checkpoint::setMetaMutationId(const std::string &key, uint64_t seqno) {
+    index_entry *entry = metaKeyIndex.find(key);
+    if (entry) {
+        entry->mutation_id = seqno;
+    }
+}
+
 uint64_t Checkpoint::getMutationIdForKey(const std::string &key, bool isMeta)
 {
     uint64_t mid = 0;
     checkpoint_index& chkIdx = isMeta ? metaKeyIndex : keyIndex;
 
-    checkpoint_index::iterator it = chkIdx.find(key);
-    if (it != chkIdx.end()) {
-        mid = it->second.mutation_id;
+    index_entry *entry = chkIdx.find(key);
+    if (entry) {
+        mid = entry->mutation_id;
     } else {
         LOG(EXTENSION_LOG_WARNING, "%s not found in chk index", key.c_str());
     }
@@ -295,6 +479,50 @@ bool Checkpoint::isEligibleToBeUnreferenced() {
     return true;
 }
 
+ExpelResult Checkpoint::expelItems(const std::set<const Item*> &stopAt,
+                                   int64_t &highestExpelled) {
+    ExpelResult result;
+    CheckpointQueue::iterator it = toWrite.begin();
+    for (; it != toWrite.end(); ++it) {
+        queued_item &qi = *it;
+        if (stopAt.count(qi.get()) != 0) {
+            break;
+        }
+        if (qi->isCheckPointMetaItem() || qi->getNBytes() == 0) {
+            // Nothing to release (or already expelled)
+            continue;
+        }
+        if (qi.use_count() != 1) {
+            // Releasing the checkpoint's reference wouldn't free the value,
+            // and the item can't be changed under the other holders.
+            continue;
+        }
+
+        const size_t itemSize = qi->size() + qi->getCompressedValMemSize();
+        qi->releaseValue();
+        const size_t released = itemSize > qi->size() ?
+                                itemSize - qi->size() : 0;
+        highestExpelled = std::max(highestExpelled, qi->getBySeqno());
+
+        effectiveMemUsage -= std::min(effectiveMemUsage, released);
+        ++result.items;
+        result.bytes += released;
+    }
+    return result;
+}
+
+bool Checkpoint::chargeCompressedValue(const queued_item& qi,
+                                       size_t memAdded, size_t memFreed) {
+    index_entry *entry = keyIndex.find(qi->getKey());
+    if (!entry || entry->position == toWrite.end() ||
+        (*entry->position).get() != qi.get()) {
+        return false;
+    }
+    effectiveMemUsage += memAdded;
+    effectiveMemUsage -= std::min(effectiveMemUsage, memFreed);
+    return true;
+}
+
 std::ostream& operator <<(std::ostream& os, const Checkpoint& c) {
     os << "Checkpoint[" << &c << "] with "
        << "seqno:{" << c.getLowSeqno() << "," << c.getHighSeqno() << "} "
@@ -320,7 +548,7 @@ uint64_t CheckpointManager::getOpenCheckpointId_UNLOCKED() {
 }
 
 uint64_t CheckpointManager::getOpenCheckpointId() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return getOpenCheckpointId_UNLOCKED();
 }
 
@@ -333,7 +561,7 @@ uint64_t CheckpointManager::getLastClosedCheckpointId_UNLOCKED() {
 }
 
 uint64_t CheckpointManager::getLastClosedCheckpointId() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return getLastClosedCheckpointId_UNLOCKED();
 }
 
@@ -458,7 +686,7 @@ bool CheckpointManager::closeOpenCheckpoint_UNLOCKED() {
 }
 
 bool CheckpointManager::closeOpenCheckpoint() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return closeOpenCheckpoint_UNLOCKED();
 }
 
@@ -467,7 +695,7 @@ bool CheckpointManager::registerCursor(
                             uint64_t checkpointId,
                             bool alwaysFromBeginning,
                             MustSendCheckpointEnd needsCheckpointEndMetaItem) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return registerCursor_UNLOCKED(name, checkpointId, alwaysFromBeginning,
                                    needsCheckpointEndMetaItem);
 }
@@ -476,7 +704,7 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
                             const std::string &name,
                             uint64_t startBySeqno,
                             MustSendCheckpointEnd needsCheckPointEndMetaItem) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (checkpointList.empty()) {
         throw std::logic_error("CheckpointManager::registerCursorBySeqno: "
                         "checkpointList is empty");
@@ -492,6 +720,14 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
 
     removeCursor_UNLOCKED(name);
 
+    // The values of the items up to highestExpelledSeqno are gone, so the
+    // cursor has to start after them and the stream backfill the rest.
+    bool expelled = false;
+    if (static_cast<int64_t>(startBySeqno) < highestExpelledSeqno) {
+        startBySeqno = highestExpelledSeqno;
+        expelled = true;
+    }
+
     size_t skipped = 0;
     CursorRegResult result;
     result.first = std::numeric_limits<uint64_t>::max();
@@ -535,7 +771,8 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
         }
     }
 
-    result.second = (result.first == checkpointList.front()->getLowSeqno()) ?
+    result.second = (expelled ||
+                     result.first == checkpointList.front()->getLowSeqno()) ?
                     true : false;
 
     if (result.first == std::numeric_limits<uint64_t>::max()) {
@@ -652,11 +889,17 @@ bool CheckpointManager::registerCursor_UNLOCKED(
         (*it)->registerCursorName(name);
     }
 
+    // A cursor can't read expelled items, so those have to come from a
+    // backfill, as if the checkpoint wasn't in memory.
+    if (skipExpelledItems_UNLOCKED(connCursors[name])) {
+        found = false;
+    }
+
     return found;
 }
 
 bool CheckpointManager::removeCursor(const std::string &name) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return removeCursor_UNLOCKED(name);
 }
 
@@ -688,7 +931,7 @@ bool CheckpointManager::removeCursor_UNLOCKED(const std::string &name) {
 }
 
 uint64_t CheckpointManager::getCheckpointIdForCursor(const std::string &name) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end()) {
         return 0;
@@ -698,7 +941,7 @@ uint64_t CheckpointManager::getCheckpointIdForCursor(const std::string &name) {
 }
 
 size_t CheckpointManager::getNumOfCursors() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return connCursors.size();
 }
 
@@ -708,7 +951,7 @@ size_t CheckpointManager::getNumCheckpoints() const {
 }
 
 checkpointCursorInfoList CheckpointManager::getAllCursors() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     checkpointCursorInfoList cursorInfo;
     for (auto& cur_it : connCursors) {
         cursorInfo.push_back(std::make_pair(
@@ -740,7 +983,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
                                               bool &newOpenCheckpointCreated) {
 
     // This function is executed periodically by the non-IO dispatcher.
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (!vbucket) {
         throw std::invalid_argument("CheckpointManager::removeCloseUnrefCheckpoints:"
                         " vbucket must be non-NULL");
@@ -887,6 +1130,18 @@ void CheckpointManager::collapseClosedCheckpoints(
 
         fastCursors.insert((*lastClosedChk)->getCursorNameList().begin(),
                            (*lastClosedChk)->getCursorNameList().end());
+
+        // Merging rebuilds the last closed checkpoint's queue, invalidating
+        // the positions of the cursors in it; remember the item each one is
+        // at, so it can be found again afterwards.
+        std::map<std::string, queued_item> movedCursors;
+        for (const auto &name : (*lastClosedChk)->getCursorNameList()) {
+            cursor_index::iterator cc = connCursors.find(name);
+            if (cc != connCursors.end()) {
+                movedCursors[name] = *(cc->second.currentPos);
+            }
+        }
+
         std::list<Checkpoint*>::reverse_iterator rit = checkpointList.rbegin();
         ++rit; ++rit; //Move to the second last closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
@@ -912,6 +1167,7 @@ void CheckpointManager::collapseClosedCheckpoints(
                                    cursor_on_chk_start);
             }
         }
+        reseekCursors(movedCursors, **lastClosedChk);
         putCursorsInCollapsedChk(slowCursors, lastClosedChk);
 
         size_t total_items = numDuplicatedItems + numMetaItems;
@@ -935,7 +1191,7 @@ void CheckpointManager::collapseClosedCheckpoints(
 }
 
 std::vector<std::string> CheckpointManager::getListOfCursorsToDrop() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
 
     // List of cursor names whose streams will be closed
     std::vector<std::string> cursorsToDrop;
@@ -964,13 +1220,187 @@ std::vector<std::string> CheckpointManager::getListOfCursorsToDrop() {
     return cursorsToDrop;
 }
 
+ExpelResult CheckpointManager::expelUnreferencedItems() {
+    LockHolder lh(lockAndDrain());
+
+    ExpelResult result;
+    for (const auto& it : connCursors) {
+        if (it.second.shouldSendCheckpointEndMetaItem() ==
+            MustSendCheckpointEnd::YES) {
+            return result;
+        }
+    }
+
+    // Every cursor has passed the items before the earliest one, i.e.
+    // those before the first cursor in the oldest referenced checkpoint.
+    std::list<Checkpoint*>::iterator oldest = checkpointList.begin();
+    while (oldest != checkpointList.end() &&
+           (*oldest)->getNumberOfCursors() == 0) {
+        ++oldest;
+    }
+    if (oldest == checkpointList.end()) {
+        return result;
+    }
+
+    // The items the cursors are at, looked up for every item expelled
+    std::set<const Item*> cursorPositions;
+    for (const auto& it : connCursors) {
+        if (it.second.currentCheckpoint == oldest &&
+            it.second.currentPos != (*oldest)->end()) {
+            cursorPositions.insert(it.second.currentPos->get());
+        }
+    }
+
+    const std::set<const Item*> none;
+    std::list<Checkpoint*>::iterator chk = checkpointList.begin();
+    for (;; ++chk) {
+        ExpelResult expelled = (*chk)->expelItems(
+                                    chk == oldest ? cursorPositions : none,
+                                    highestExpelledSeqno);
+        result.items += expelled.items;
+        result.bytes += expelled.bytes;
+        if (chk == oldest) {
+            break;
+        }
+    }
+
+    if (result.items > 0) {
+        LOG(EXTENSION_LOG_INFO, "Expelled %" PRIu64 " items (%" PRIu64
+            " bytes) from the checkpoints of vbucket %" PRIu16
+            ", up to seqno %" PRId64, uint64_t(result.items),
+            uint64_t(result.bytes), vbucketId, highestExpelledSeqno);
+    }
+    return result;
+}
+
 bool CheckpointManager::queueDirty(const RCPtr<VBucket> &vb, queued_item& qi,
                                    bool genSeqno) {
-    LockHolder lh(queueLock);
     if (!vb) {
         throw std::invalid_argument("CheckpointManager::queueDirty: vb must "
                         "be non-NULL");
     }
+    const vbucket_state_t vbState = vb->getState();
+    if (genSeqno && checkpointConfig.isLockfreeAppendEnabled() &&
+        appendDirty(*vb, vbState, qi)) {
+        return true;
+    }
+
+    LockHolder lh(lockAndDrain());
+    return queueDirty_UNLOCKED(*vb, vbState, qi, genSeqno, false);
+}
+
+bool CheckpointManager::appendDirty(VBucket &vb, vbucket_state_t vbState,
+                                    queued_item &qi) {
+    // Appended items are drained as an active vbucket's, with the seqno
+    // generated here.
+    if (vbState != vbucket_state_active) {
+        return false;
+    }
+
+    // Only take a seqno whose slot is free, i.e. once the item published to
+    // it a lap of the ring ago has been drained. If the ring is full (or the
+    // counter too contended) queue the item under the lock instead, rather
+    // than spinning with the caller's hash table lock held.
+    int64_t reserved = reservedSeqno.load();
+    for (int attempt = 0; ; ++attempt) {
+        if (attempt == maxAppendAttempts ||
+            reserved - drainedSeqno.load() >=
+                                static_cast<int64_t>(appendRingSize)) {
+            return false;
+        }
+        if (reservedSeqno.compare_exchange_weak(reserved, reserved + 1)) {
+            break;
+        }
+    }
+    const int64_t seqno = reserved + 1;
+    qi->setBySeqno(seqno);
+
+    AppendSlot &slot = appendRing[seqno % appendRingSize];
+    slot.item = qi;
+    slot.vb = &vb;
+    slot.seqno.store(seqno);
+    if (numPublishWaiters.load() > 0) {
+        std::lock_guard<std::mutex> lg(publishMutex);
+        publishCond.notify_all();
+    }
+
+    // Move the published items into the checkpoint now, unless someone else
+    // holds the lock; whoever takes it next drains them first anyway.
+    LockHolder lh(queueLock, true /*tryLock*/);
+    if (lh.islocked()) {
+        drainAppends_UNLOCKED(false);
+    }
+    return true;
+}
+
+void CheckpointManager::drainAppends_UNLOCKED(bool waitForReserved) {
+    // A seqno is published very shortly after it's reserved, so rather than
+    // leave the queue behind it the lock holder waits for it: briefly
+    // yielding, then (should the appender have been descheduled) sleeping
+    // until it's published.
+    const int64_t reserved = reservedSeqno.load();
+    int spins = 0;
+    while (lastBySeqno < reserved) {
+        const int64_t next = lastBySeqno + 1;
+        AppendSlot &slot = appendRing[next % appendRingSize];
+        if (slot.seqno.load() != next) {
+            if (!waitForReserved) {
+                return;
+            }
+            if (++spins < maxPublishSpins) {
+                std::this_thread::yield();
+            } else {
+                std::unique_lock<std::mutex> lk(publishMutex);
+                ++numPublishWaiters;
+                publishCond.wait_for(lk, std::chrono::milliseconds(1),
+                                     [&slot, next]() {
+                                         return slot.seqno.load() == next;
+                                     });
+                --numPublishWaiters;
+            }
+            continue;
+        }
+        spins = 0;
+        queued_item qi(slot.item);
+        VBucket &vb = *slot.vb;
+        slot.item.reset();
+        slot.seqno.store(0);
+        // This advances lastBySeqno (and drainedSeqno) to next.
+        queueDirty_UNLOCKED(vb, vbucket_state_active, qi, true, true);
+    }
+}
+
+LockHolder CheckpointManager::lockAndDrain() {
+    LockHolder lh(queueLock);
+    drainAppends_UNLOCKED(true);
+    return lh;
+}
+
+int64_t CheckpointManager::reserveSeqno_UNLOCKED() {
+    // Wait out any appender which took a seqno before us.
+    int64_t expected = lastBySeqno;
+    while (!reservedSeqno.compare_exchange_strong(expected, lastBySeqno + 1)) {
+        drainAppends_UNLOCKED(true);
+        expected = lastBySeqno;
+    }
+    drainedSeqno.store(++lastBySeqno);
+    return lastBySeqno;
+}
+
+void CheckpointManager::setLastBySeqno_UNLOCKED(int64_t seqno) {
+    int64_t expected = lastBySeqno;
+    while (!reservedSeqno.compare_exchange_strong(expected, seqno)) {
+        drainAppends_UNLOCKED(true);
+        expected = lastBySeqno;
+    }
+    lastBySeqno = seqno;
+    drainedSeqno.store(seqno);
+}
+
+bool CheckpointManager::queueDirty_UNLOCKED(VBucket &vb,
+                                            vbucket_state_t vbState,
+                                            queued_item &qi, bool genSeqno,
+                                            bool appended) {
     bool canCreateNewCheckpoint = false;
     if (checkpointList.size() < checkpointConfig.getMaxCheckpoints() ||
         (checkpointList.size() == checkpointConfig.getMaxCheckpoints() &&
@@ -978,20 +1408,20 @@ bool CheckpointManager::queueDirty(const RCPtr<VBucket> &vb, queued_item& qi,
         canCreateNewCheckpoint = true;
     }
 
-    if (vb->getState() == vbucket_state_active && canCreateNewCheckpoint) {
+    if (vbState == vbucket_state_active && canCreateNewCheckpoint) {
         // Only the master active vbucket can create a next open checkpoint.
         checkOpenCheckpoint_UNLOCKED(false, true);
     }
 
     if (checkpointList.back()->getState() == CHECKPOINT_CLOSED) {
-        if (vb->getState() == vbucket_state_active) {
+        if (vbState == vbucket_state_active) {
             addNewCheckpoint_UNLOCKED(checkpointList.back()->getId() + 1);
         } else {
             throw std::logic_error("CheckpointManager::queueDirty: vBucket "
                     "state (which is " +
-                    std::string(VBucket::toString(vb->getState())) +
+                    std::string(VBucket::toString(vbState)) +
                     ") is not active. This is not expected. vb:" +
-                    std::to_string(vb->getId()) +
+                    std::to_string(vb.getId()) +
                     " lastBySeqno:" + std::to_string(lastBySeqno) +
                     " genSeqno:" + std::to_string(genSeqno));
         }
@@ -1004,19 +1434,24 @@ bool CheckpointManager::queueDirty(const RCPtr<VBucket> &vb, queued_item& qi,
                 ") is not OPEN");
     }
 
-    if (genSeqno) {
-        qi->setBySeqno(++lastBySeqno);
+    if (appended) {
+        // The seqno was reserved by appendDirty(), and is the next one.
+        lastBySeqno = qi->getBySeqno();
+        drainedSeqno.store(lastBySeqno);
+        checkpointList.back()->setSnapshotEndSeqno(lastBySeqno);
+    } else if (genSeqno) {
+        qi->setBySeqno(reserveSeqno_UNLOCKED());
         checkpointList.back()->setSnapshotEndSeqno(lastBySeqno);
     } else {
-        lastBySeqno = qi->getBySeqno();
+        setLastBySeqno_UNLOCKED(qi->getBySeqno());
     }
     uint64_t st = checkpointList.back()->getSnapshotStartSeqno();
     uint64_t en = checkpointList.back()->getSnapshotEndSeqno();
     if (!(st <= static_cast<uint64_t>(lastBySeqno) &&
           static_cast<uint64_t>(lastBySeqno) <= en)) {
         throw std::logic_error("CheckpointManager::queueDirty: lastBySeqno "
-                "not in snapshot range. vb:" + std::to_string(vb->getId()) +
-                " state:" + std::string(VBucket::toString(vb->getState())) +
+                "not in snapshot range. vb:" + std::to_string(vb.getId()) +
+                " state:" + std::string(VBucket::toString(vbState)) +
                 " snapshotStart:" + std::to_string(st) +
                 " lastBySeqno:" + std::to_string(lastBySeqno) +
                 " snapshotEnd:" + std::to_string(en) +
@@ -1032,7 +1467,7 @@ bool CheckpointManager::queueDirty(const RCPtr<VBucket> &vb, queued_item& qi,
     if (result != EXISTING_ITEM) {
         ++stats.totalEnqueued;
         ++stats.diskQueueSize;
-        vb->doStatsForQueueing(*qi, qi->size());
+        vb.doStatsForQueueing(*qi, qi->size());
 
         // Update the checkpoint's memory usage
         checkpointList.back()->incrementMemConsumption(qi->size());
@@ -1044,25 +1479,48 @@ bool CheckpointManager::queueDirty(const RCPtr<VBucket> &vb, queued_item& qi,
 snapshot_range_t CheckpointManager::getAllItemsForCursor(
                                              const std::string& name,
                                              std::vector<queued_item> &items) {
-    LockHolder lh(queueLock);
-    snapshot_range_t range;
+    return getItemsForCursor(name, items,
+                             std::numeric_limits<size_t>::max(),
+                             std::numeric_limits<size_t>::max()).range;
+}
+
+ItemsForCursor CheckpointManager::getItemsForCursor(
+                                             const std::string& name,
+                                             std::vector<queued_item> &items,
+                                             size_t approxItemLimit,
+                                             size_t approxByteLimit) {
+    LockHolder lh(lockAndDrain());
+    ItemsForCursor result;
+    result.moreAvailable = false;
     cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end()) {
-        range.start = 0;
-        range.end = 0;
-        return range;
+        result.range.start = 0;
+        result.range.end = 0;
+        return result;
     }
 
     bool moreItems;
+    size_t numItemsAdded = 0;
+    size_t bytesAdded = 0;
+    snapshot_range_t &range = result.range;
     range.start = (*it->second.currentCheckpoint)->getSnapshotStartSeqno();
     range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
     while ((moreItems = incrCursor(it->second))) {
         queued_item& qi = *(it->second.currentPos);
         items.push_back(qi);
+        ++numItemsAdded;
+        bytesAdded += qi->size();
 
         if (qi->getOperation() == queue_op_checkpoint_end) {
             range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
             moveCursorToNextCheckpoint(it->second);
+            // A closed checkpoint is always followed by another, so there
+            // is at least its checkpoint_start still to come.
+            if (numItemsAdded >= approxItemLimit ||
+                bytesAdded >= approxByteLimit) {
+                result.moreAvailable = true;
+                break;
+            }
         }
     }
 
@@ -1072,12 +1530,12 @@ snapshot_range_t CheckpointManager::getAllItemsForCursor(
 
     it->second.numVisits++;
 
-    return range;
+    return result;
 }
 
 queued_item CheckpointManager::nextItem(const std::string &name,
                                         bool &isLastMutationItem) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end()) {
         LOG(EXTENSION_LOG_WARNING,
@@ -1121,7 +1579,7 @@ bool CheckpointManager::incrCursor(CheckpointCursor &cursor) {
 }
 
 void CheckpointManager::clear(RCPtr<VBucket> &vb, uint64_t seqno) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     clear_UNLOCKED(vb->getState(), seqno);
 
     // Reset the disk write queue size stat for the vbucket
@@ -1131,6 +1589,8 @@ void CheckpointManager::clear(RCPtr<VBucket> &vb, uint64_t seqno) {
 }
 
 void CheckpointManager::clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno) {
+    // Done first, as it may need to drain appends into the checkpoints.
+    setLastBySeqno_UNLOCKED(seqno);
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
     // Remove all the checkpoints.
     while(it != checkpointList.end()) {
@@ -1139,8 +1599,8 @@ void CheckpointManager::clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno)
     }
     checkpointList.clear();
     numItems = 0;
-    lastBySeqno = seqno;
     pCursorPreCheckpointId = 0;
+    highestExpelledSeqno = 0;
 
     uint64_t checkpointId = vbState == vbucket_state_active ? 1 : 0;
     // Add a new open checkpoint.
@@ -1167,7 +1627,7 @@ void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
 }
 
 void CheckpointManager::resetCursors(checkpointCursorInfoList &cursors) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
 
     for (auto& it : cursors) {
         registerCursor_UNLOCKED(it.first, getOpenCheckpointId_UNLOCKED(), true,
@@ -1197,8 +1657,31 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
     return true;
 }
 
+bool CheckpointManager::skipExpelledItems_UNLOCKED(CheckpointCursor &cursor) {
+    // Items are queued in seqno order, and expelled from the front of the
+    // checkpoint list, so every item up to highestExpelledSeqno is expelled.
+    bool skipped = false;
+    while (highestExpelledSeqno >=
+           static_cast<int64_t>((*(cursor.currentCheckpoint))->getLowSeqno())) {
+        CheckpointQueue::iterator next = cursor.currentPos;
+        if (++next == (*(cursor.currentCheckpoint))->end()) {
+            if (!moveCursorToNextCheckpoint(cursor)) {
+                break;
+            }
+            continue;
+        }
+        if ((*next)->getBySeqno() > highestExpelledSeqno) {
+            break;
+        }
+        cursor.currentPos = next;
+        ++(cursor.offset);
+        skipped = true;
+    }
+    return skipped;
+}
+
 size_t CheckpointManager::getNumOpenChkItems() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (checkpointList.empty()) {
         return 0;
     }
@@ -1231,7 +1714,7 @@ uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation,
 }
 
 size_t CheckpointManager::getNumItemsForCursor(const std::string &name) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return getNumItemsForCursor_UNLOCKED(name);
 }
 
@@ -1279,7 +1762,7 @@ size_t CheckpointManager::getNumOfMetaItemsFromCursor(CheckpointCursor &cursor)
 }
 
 void CheckpointManager::decrCursorFromCheckpointEnd(const std::string &name) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     cursor_index::iterator it = connCursors.find(name);
     if (it != connCursors.end() &&
         (*(it->second.currentPos))->getOperation() ==
@@ -1300,7 +1783,7 @@ bool CheckpointManager::isLastMutationItemInCheckpoint(
 }
 
 void CheckpointManager::setBackfillPhase(uint64_t start, uint64_t end) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     setOpenCheckpointId_UNLOCKED(0);
     checkpointList.back()->setSnapshotStartSeqno(start);
     checkpointList.back()->setSnapshotEndSeqno(end);
@@ -1308,7 +1791,7 @@ void CheckpointManager::setBackfillPhase(uint64_t start, uint64_t end) {
 
 void CheckpointManager::createSnapshot(uint64_t snapStartSeqno,
                                        uint64_t snapEndSeqno) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (checkpointList.empty()) {
         throw std::logic_error("CheckpointManager::createSnapshot: "
                         "checkpointList is empty");
@@ -1331,7 +1814,7 @@ void CheckpointManager::createSnapshot(uint64_t snapStartSeqno,
 }
 
 void CheckpointManager::resetSnapshotRange() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (checkpointList.empty()) {
         throw std::logic_error("CheckpointManager::resetSnapshotRange: "
                         "checkpointList is empty");
@@ -1354,7 +1837,7 @@ void CheckpointManager::resetSnapshotRange() {
 }
 
 snapshot_info_t CheckpointManager::getSnapshotInfo() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (checkpointList.empty()) {
         throw std::logic_error("CheckpointManager::getSnapshotInfo: "
                         "checkpointList is empty");
@@ -1384,7 +1867,7 @@ snapshot_info_t CheckpointManager::getSnapshotInfo() {
 
 void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id,
                                                const RCPtr<VBucket> &vbucket) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
 
     // Ignore CHECKPOINT_START message with ID 0 as 0 is reserved for
     // representing backfill.
@@ -1511,6 +1994,35 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
     putCursorsInCollapsedChk(cursorMap, checkpointList.begin());
 }
 
+void CheckpointManager::reseekCursors(
+        const std::map<std::string, queued_item> &cursors, Checkpoint &chk) {
+    // The checkpoint's items are in seqno order, so a cursor's item is found
+    // at the first position holding its seqno onwards.
+    for (const auto &cursor : cursors) {
+        const int64_t seqno = cursor.second->getBySeqno();
+        CheckpointQueue::iterator pos = chk.begin();
+        while (pos != chk.end() && (*pos)->getBySeqno() < seqno) {
+            ++pos;
+        }
+        while (pos != chk.end() && pos->get() != cursor.second.get()) {
+            ++pos;
+        }
+        CheckpointCursor &cc = connCursors[cursor.first];
+        if (pos == chk.end()) {
+            // Rather than lose the cursor, have it re-read the checkpoint.
+            LOG(EXTENSION_LOG_WARNING,
+                "CheckpointManager::reseekCursors: item of cursor %s (seqno "
+                "%" PRId64 ") isn't in checkpoint %" PRIu64 " for vbucket %d;"
+                " resetting the cursor to the start of the checkpoint",
+                cursor.first.c_str(), seqno, chk.getId(), vbucketId);
+            cc.currentPos = chk.begin();
+            cc.offset = 0;
+            continue;
+        }
+        cc.currentPos = pos;
+    }
+}
+
 void CheckpointManager::
 putCursorsInCollapsedChk(std::map<std::string, std::pair<uint64_t, bool> > &cursors,
                          std::list<Checkpoint*>::iterator chkItr) {
@@ -1568,7 +2080,7 @@ putCursorsInCollapsedChk(std::map<std::string, std::pair<uint64_t, bool> > &curs
 }
 
 bool CheckpointManager::hasNext(const std::string &name) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end() || getOpenCheckpointId_UNLOCKED() == 0) {
         return false;
@@ -1614,7 +2126,7 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id, uint16_t vbid,
 }
 
 uint64_t CheckpointManager::createNewCheckpoint() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     if (checkpointList.back()->getNumItems() > 0) {
         uint64_t chk_id = checkpointList.back()->getId();
         addNewCheckpoint_UNLOCKED(chk_id + 1);
@@ -1623,17 +2135,31 @@ uint64_t CheckpointManager::createNewCheckpoint() {
 }
 
 uint64_t CheckpointManager::getPersistenceCursorPreChkId() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return pCursorPreCheckpointId;
 }
 
 void CheckpointManager::itemsPersisted() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     CheckpointCursor& persistenceCursor = connCursors[pCursorName];
     std::list<Checkpoint*>::iterator itr = persistenceCursor.currentCheckpoint;
     pCursorPreCheckpointId = ((*itr)->getId() > 0) ? (*itr)->getId() - 1 : 0;
 }
 
+void CheckpointManager::chargeCompressedValue(const queued_item& qi,
+                                              size_t memAdded,
+                                              size_t memFreed) {
+    LockHolder lh(lockAndDrain());
+    const uint64_t seqno = qi->getBySeqno();
+    for (auto checkpoint : checkpointList) {
+        if (seqno >= checkpoint->getLowSeqno() &&
+            seqno <= checkpoint->getHighSeqno()) {
+            checkpoint->chargeCompressedValue(qi, memAdded, memFreed);
+            return;
+        }
+    }
+}
+
 size_t CheckpointManager::getMemoryUsage_UNLOCKED() {
     if (checkpointList.empty()) {
         return 0;
@@ -1642,18 +2168,28 @@ size_t CheckpointManager::getMemoryUsage_UNLOCKED() {
     size_t memUsage = 0;
     std::list<Checkpoint*>::const_iterator it = checkpointList.begin();
     for (; it != checkpointList.end(); ++it) {
-        memUsage += (*it)->getMemConsumption();
+        memUsage += (*it)->getMemConsumption() +
+                    (*it)->getKeyIndexMemUsage();
+    }
+    return memUsage;
+}
+
+size_t CheckpointManager::getKeyIndexMemUsage_UNLOCKED() {
+    size_t memUsage = 0;
+    std::list<Checkpoint*>::const_iterator it = checkpointList.begin();
+    for (; it != checkpointList.end(); ++it) {
+        memUsage += (*it)->getKeyIndexMemUsage();
     }
     return memUsage;
 }
 
 size_t CheckpointManager::getMemoryUsage() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     return getMemoryUsage_UNLOCKED();
 }
 
 size_t CheckpointManager::getMemoryUsageOfUnrefCheckpoints() {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
 
     if (checkpointList.empty()) {
         return 0;
@@ -1663,7 +2199,8 @@ size_t CheckpointManager::getMemoryUsageOfUnrefCheckpoints() {
     std::list<Checkpoint*>::const_iterator it = checkpointList.begin();
     for (; it != checkpointList.end(); ++it) {
         if ((*it)->getNumberOfCursors() == 0) {
-            memUsage += (*it)->getMemConsumption();
+            memUsage += (*it)->getMemConsumption() +
+                        (*it)->getKeyIndexMemUsage();
         } else {
             break;
         }
@@ -1696,6 +2233,7 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
     enableChkMerge = config.isEnableChkMerge();
+    lockfreeAppend = config.isChkLockfreeAppend();
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t
@@ -1764,7 +2302,7 @@ void CheckpointConfig::setMaxCheckpoints(size_t value) {
 }
 
 void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
-    LockHolder lh(queueLock);
+    LockHolder lh(lockAndDrain());
     char buf[256];
 
     try {
@@ -1793,6 +2331,9 @@ void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
                         add_stat, cookie);
         checked_snprintf(buf, sizeof(buf), "vb_%d:mem_usage", vbucketId);
         add_casted_stat(buf, getMemoryUsage_UNLOCKED(), add_stat, cookie);
+        checked_snprintf(buf, sizeof(buf), "vb_%d:key_index_mem_usage",
+                         vbucketId);
+        add_casted_stat(buf, getKeyIndexMemUsage_UNLOCKED(), add_stat, cookie);
 
         cursor_index::iterator cur_it = connCursors.begin();
         for (; cur_it != connCursors.end(); ++cur_it) {
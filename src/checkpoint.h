@@ -20,14 +20,17 @@
 
 #include "config.h"
 
+#include <iterator>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include <atomic>
+#include <condition_variable>
 #include "item.h"
 #include "locks.h"
 #include "stats.h"
@@ -53,9 +56,217 @@ enum checkpoint_state {
     CHECKPOINT_CLOSED  //!< The checkpoint is not open.
 };
 
-// List is used for queueing mutations as vector incurs shift operations for
-// deduplication.
-typedef std::list<queued_item> CheckpointQueue;
+/**
+ * The queue of items in a checkpoint.
+ *
+ * Items are appended into fixed-size chunks rather than list nodes, so
+ * queueing only allocates once per chunk and cursors walk contiguous memory.
+ * Erasing an item (when it is deduplicated) just clears its slot, which
+ * iteration skips; the slots are freed a chunk at a time with the queue.
+ *
+ * An iterator is a position (chunk and offset) in the queue. Like the
+ * std::list iterators this replaced, it stays valid as items are appended
+ * and other items are erased.
+ */
+class CheckpointQueue {
+public:
+    //! Items per chunk; a power of two.
+    static const size_t chunkSize = 128;
+
+    template <typename Queue, typename Value>
+    class Iterator : public std::iterator<std::bidirectional_iterator_tag,
+                                          Value> {
+    public:
+        Iterator() : queue(NULL), pos(0) { }
+
+        // Allow an iterator to be converted to a const_iterator.
+        template <typename Q, typename V>
+        Iterator(const Iterator<Q, V> &other)
+            : queue(other.queue), pos(other.pos) { }
+
+        Value &operator*() const {
+            return queue->slot(pos);
+        }
+
+        Value *operator->() const {
+            return &queue->slot(pos);
+        }
+
+        Iterator &operator++() {
+            pos = queue->nextLive(pos);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator rv(*this);
+            ++*this;
+            return rv;
+        }
+
+        Iterator &operator--() {
+            pos = queue->prevLive(pos);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator rv(*this);
+            --*this;
+            return rv;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return pos == other.pos && queue == other.queue;
+        }
+
+        bool operator!=(const Iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class CheckpointQueue;
+        template <typename Q, typename V> friend class Iterator;
+
+        Iterator(Queue *q, size_t p) : queue(q), pos(p) { }
+
+        Queue  *queue;
+        size_t  pos;
+    };
+
+    typedef Iterator<CheckpointQueue, queued_item> iterator;
+    typedef Iterator<const CheckpointQueue, const queued_item> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    CheckpointQueue() : used(0), numLive(0), numFreed(0) { }
+
+    iterator begin() {
+        return iterator(this, firstLive());
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, firstLive());
+    }
+
+    iterator end() {
+        return iterator(this, used);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, used);
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    bool empty() const {
+        return numLive == 0;
+    }
+
+    //! Number of items (not counting erased ones).
+    size_t size() const {
+        return numLive;
+    }
+
+    queued_item &back() {
+        return *--end();
+    }
+
+    void push_back(const queued_item &qi);
+
+    void pop_back();
+
+    /**
+     * Erase the item at the given position; iterators to other items
+     * remain valid. A chunk is freed once all of its items are erased.
+     */
+    void erase(iterator pos);
+
+    /**
+     * Replace the contents of the queue with the given items (invalidating
+     * all iterators).
+     */
+    void assign(const std::vector<queued_item> &items);
+
+    /**
+     * Memory of the slots in use, including those of erased items which
+     * haven't been freed with their chunk yet.
+     */
+    size_t memorySize() const {
+        return (used - numFreed) * sizeof(queued_item);
+    }
+
+private:
+    queued_item &slot(size_t pos) {
+        return chunks[pos / chunkSize][pos % chunkSize];
+    }
+
+    const queued_item &slot(size_t pos) const {
+        return chunks[pos / chunkSize][pos % chunkSize];
+    }
+
+    //! The first live slot at or after pos (or used if there's none).
+    size_t seekLive(size_t pos) const {
+        while (pos < used) {
+            const size_t chunk = pos / chunkSize;
+            if (chunkLive[chunk] == 0) {
+                // Skip the whole (dead) chunk.
+                pos = (chunk + 1) * chunkSize;
+            } else if (slot(pos)) {
+                return pos;
+            } else {
+                ++pos;
+            }
+        }
+        return used;
+    }
+
+    size_t firstLive() const {
+        return seekLive(0);
+    }
+
+    size_t nextLive(size_t pos) const {
+        return seekLive(pos + 1);
+    }
+
+    size_t prevLive(size_t pos) const {
+        while (pos > 0) {
+            --pos;
+            const size_t chunk = pos / chunkSize;
+            if (chunkLive[chunk] == 0) {
+                pos = chunk * chunkSize;
+            } else if (slot(pos)) {
+                break;
+            }
+        }
+        return pos;
+    }
+
+    //! Drop erased slots (and then unused chunks) from the end.
+    void trimBack();
+
+    std::vector<std::unique_ptr<queued_item[]>> chunks;
+    // Live items in each chunk; a chunk with none is skipped when iterating
+    // (and its storage freed unless items may still be appended to it).
+    std::vector<size_t> chunkLive;
+    // Slots used, including erased ones.
+    size_t used;
+    size_t numLive;
+    // Slots (below used) whose chunks have been freed.
+    size_t numFreed;
+};
 
 /**
  * A checkpoint index entry.
@@ -75,6 +286,29 @@ typedef struct {
     snapshot_range_t range;
 } snapshot_info_t;
 
+/**
+ * Result of CheckpointManager::getItemsForCursor().
+ */
+struct ItemsForCursor {
+    // Snapshot range of the checkpoints the items were taken from
+    snapshot_range_t range;
+    // True if the cursor stopped at a limit rather than at the end of the
+    // queue
+    bool moreAvailable;
+};
+
+/**
+ * Result of expelling the values of items from checkpoints.
+ */
+struct ExpelResult {
+    ExpelResult() : items(0), bytes(0) {}
+
+    // Number of items whose values were released
+    size_t items;
+    // Memory released (as accounted for by the checkpoints)
+    size_t bytes;
+};
+
 /**
  * Flag indicating that we must send checkpoint end meta item for the cursor
  */
@@ -85,8 +319,71 @@ enum class MustSendCheckpointEnd {
 
 /**
  * The checkpoint index maps a key to a checkpoint index_entry.
+ *
+ * It is a flat open-addressed (linear probing) table rather than a node based
+ * map, so queueing an item allocates nothing unless the table has to grow.
+ * Keys aren't copied: a slot refers to the key of the queued item the entry
+ * was set for, which must stay alive (i.e. queued) while it is indexed, or be
+ * re-set with the item which replaces it.
  */
-typedef std::unordered_map<std::string, index_entry> checkpoint_index;
+class CheckpointIndex {
+public:
+    CheckpointIndex() : capacity(0), numEntries(0) {}
+
+    /**
+     * Return the entry for the given key, or NULL if it isn't indexed. The
+     * pointer is invalidated by the next set() or erase().
+     */
+    index_entry *find(const std::string &key);
+
+    /**
+     * Index the given entry under the given key (replacing any entry already
+     * indexed under it); key must belong to the item the entry is for.
+     */
+    void set(const std::string &key, const index_entry &entry);
+
+    /**
+     * Remove the given key from the index.
+     * @return true if the key was indexed
+     */
+    bool erase(const std::string &key);
+
+    size_t size() const {
+        return numEntries;
+    }
+
+    /**
+     * Memory allocated for the table.
+     */
+    size_t memorySize() const {
+        return capacity * sizeof(Slot);
+    }
+
+private:
+    struct Slot {
+        // NULL if the slot is free.
+        const std::string *key;
+        size_t hash;
+        index_entry entry;
+    };
+
+    static const size_t initialCapacity = 16;
+
+    /**
+     * Return the slot holding the given key, or the free slot ending its
+     * probe sequence.
+     */
+    Slot &probe(const std::string &key, size_t hash);
+
+    void grow();
+
+    std::unique_ptr<Slot[]> slots;
+    // Always a power of two (or zero).
+    size_t capacity;
+    size_t numEntries;
+};
+
+typedef CheckpointIndex checkpoint_index;
 
 /**
  * List of pairs containing checkpoint cursor name and corresponding flag
@@ -409,7 +706,56 @@ public:
         return effectiveMemUsage;
     }
 
+    /**
+     * Returns the memory allocated for the key indexes used to de-duplicate
+     * items queued into this checkpoint.
+     */
+    size_t getKeyIndexMemUsage() const {
+        return keyIndex.memorySize() + metaKeyIndex.memorySize();
+    }
+
+    /**
+     * Release the values of the items queued before the first of the given
+     * ones, leaving only their key and metadata. Meta items, and items still
+     * referenced elsewhere (e.g. by a flush batch or a DCP response, which
+     * would keep the value anyway), are left as they are.
+     * @param stopAt items (at cursors in this checkpoint) to stop at; the
+     *               whole checkpoint is expelled if empty
+     * @param highestExpelled raised to the highest seqno expelled
+     */
+    ExpelResult expelItems(const std::set<const Item*> &stopAt,
+                           int64_t &highestExpelled);
+
+    /**
+     * Account for a change in the memory held for the compressed value
+     * cached on the given item (see Item::getCompressedValue()), if it is
+     * the item queued in this checkpoint for its key.
+     *
+     * @return false if it isn't
+     */
+    bool chargeCompressedValue(const queued_item& qi, size_t memAdded,
+                               size_t memFreed);
+
 private:
+    /**
+     * Set the mutation id of the given meta key, if it's in this checkpoint.
+     */
+    void setMetaMutationId(const std::string &key, uint64_t seqno);
+
+    /**
+     * Memory of the queue's slots (including those of erased items) and of
+     * the key indexes, which is charged to memOverhead.
+     */
+    size_t getQueueMemUsage() const {
+        return toWrite.memorySize() + getKeyIndexMemUsage();
+    }
+
+    /**
+     * Charge the change of getQueueMemUsage() (from before to after) to
+     * memOverhead.
+     */
+    void updateMemOverhead(size_t before, size_t after);
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint64_t                       snapStartSeqno;
@@ -456,7 +802,11 @@ public:
         lastBySeqno(lastSeqno), lastClosedChkBySeqno(lastSeqno),
         isCollapsedCheckpoint(false),
         pCursorPreCheckpointId(0),
-        flusherCB(cb) {
+        flusherCB(cb),
+        appendRing(new AppendSlot[appendRingSize]),
+        reservedSeqno(lastSeqno), drainedSeqno(lastSeqno),
+        numPublishWaiters(0),
+        highestExpelledSeqno(0) {
         LockHolder lh(queueLock);
         addNewCheckpoint_UNLOCKED(checkpointId, lastSnapStart, lastSnapEnd);
             registerCursor_UNLOCKED("persistence", checkpointId, false,
@@ -474,7 +824,7 @@ public:
     void setOpenCheckpointId_UNLOCKED(uint64_t id);
 
     void setOpenCheckpointId(uint64_t id) {
-        LockHolder lh(queueLock);
+        LockHolder lh(lockAndDrain());
         setOpenCheckpointId_UNLOCKED(id);
     }
 
@@ -553,6 +903,8 @@ public:
      * @param vbucket the vbucket that a new item is pushed into.
      * @param bySeqno the sequence number assigned to this mutation
      * @return true if an item queued increases the size of persistence queue by 1.
+     *         (Always true for an item appended without the queue lock, as
+     *         it's only de-duplicated once drained into the checkpoint.)
      */
     bool queueDirty(const RCPtr<VBucket> &vb, queued_item& qi, bool genSeqno);
 
@@ -565,9 +917,31 @@ public:
      */
     queued_item nextItem(const std::string &name, bool &isLastMutationItem);
 
+    /**
+     * Append all the items remaining for the given cursor to items, moving
+     * the cursor to the end of the queue.
+     * @return the snapshot range of the checkpoints the items belong to
+     */
     snapshot_range_t getAllItemsForCursor(const std::string& name,
                                           std::vector<queued_item> &items);
 
+    /**
+     * Append items for the given cursor to items, under a single acquisition
+     * of the queue lock, until either limit is reached.
+     *
+     * The limits are approximate: a snapshot mustn't be split, so once one is
+     * reached the rest of the current checkpoint is still returned.
+     * @param name the name of the cursor
+     * @param items the vector to append to
+     * @param approxItemLimit stop once this many items have been appended
+     * @param approxByteLimit stop once the appended items' sizes reach this
+     * @return the snapshot range of the items, and whether more remain
+     */
+    ItemsForCursor getItemsForCursor(const std::string& name,
+                                     std::vector<queued_item> &items,
+                                     size_t approxItemLimit,
+                                     size_t approxByteLimit);
+
     /**
      * Return the total number of items (including meta items) that belong to
      * this checkpoint manager.
@@ -587,7 +961,7 @@ public:
     size_t getNumItemsForCursor(const std::string &name);
 
     void clear(vbucket_state_t vbState) {
-        LockHolder lh(queueLock);
+        LockHolder lh(lockAndDrain());
         clear_UNLOCKED(vbState, lastBySeqno);
     }
 
@@ -632,14 +1006,22 @@ public:
     void itemsPersisted();
 
     /**
-     * Return memory consumption of all the checkpoints managed
+     * Return memory consumption of all the checkpoints managed, i.e. their
+     * queued items and key indexes
      */
     size_t getMemoryUsage_UNLOCKED();
 
     size_t getMemoryUsage();
 
     /**
-     * Return memory consumption of unreferenced checkpoints
+     * Return the memory allocated for the key indexes of all the checkpoints
+     * managed (included in getMemoryUsage())
+     */
+    size_t getKeyIndexMemUsage_UNLOCKED();
+
+    /**
+     * Return memory consumption (items and key indexes) of unreferenced
+     * checkpoints
      */
     size_t getMemoryUsageOfUnrefCheckpoints();
 
@@ -649,6 +1031,22 @@ public:
      */
     std::vector<std::string> getListOfCursorsToDrop();
 
+    /**
+     * Release the values of the items which every cursor has already
+     * passed, keeping their keys and seqnos so the checkpoints stay valid.
+     * Invoked by the checkpoint remover before it resorts to dropping
+     * cursors. Nothing is expelled while a TAP cursor is registered, as TAP
+     * may rewind a cursor to the start of its checkpoint.
+     */
+    ExpelResult expelUnreferencedItems();
+
+    /**
+     * Charge a change in the memory held for the compressed value cached on
+     * the given item to the checkpoint holding it, if any still does.
+     */
+    void chargeCompressedValue(const queued_item& qi, size_t memAdded,
+                               size_t memFreed);
+
     /**
      * This method performs the following steps for creating a new checkpoint with a given ID i1:
      * 1) Check if the checkpoint manager contains any checkpoints with IDs >= i1.
@@ -669,7 +1067,7 @@ public:
     void resetSnapshotRange();
 
     void updateCurrentSnapshotEnd(uint64_t snapEnd) {
-        LockHolder lh(queueLock);
+        LockHolder lh(lockAndDrain());
         checkpointList.back()->setSnapshotEndSeqno(snapEnd);
     }
 
@@ -685,23 +1083,23 @@ public:
     }
 
     void setBySeqno(int64_t seqno) {
-        LockHolder lh(queueLock);
-        lastBySeqno = seqno;
+        LockHolder lh(lockAndDrain());
+        setLastBySeqno_UNLOCKED(seqno);
     }
 
     int64_t getHighSeqno() {
-        LockHolder lh(queueLock);
+        LockHolder lh(lockAndDrain());
         return lastBySeqno;
     }
 
     int64_t getLastClosedChkBySeqno() {
-        LockHolder lh(queueLock);
+        LockHolder lh(lockAndDrain());
         return lastClosedChkBySeqno;
     }
 
     int64_t nextBySeqno() {
-        LockHolder lh(queueLock);
-        return ++lastBySeqno;
+        LockHolder lh(lockAndDrain());
+        return reserveSeqno_UNLOCKED();
     }
 
     static const std::string pCursorName;
@@ -747,7 +1145,7 @@ private:
     uint64_t checkOpenCheckpoint_UNLOCKED(bool forceCreation, bool timeBound);
 
     uint64_t checkOpenCheckpoint(bool forceCreation, bool timeBound) {
-        LockHolder lh(queueLock);
+        LockHolder lh(lockAndDrain());
         return checkOpenCheckpoint_UNLOCKED(forceCreation, timeBound);
     }
 
@@ -759,6 +1157,15 @@ private:
 
     void collapseClosedCheckpoints(std::list<Checkpoint*> &collapsedChks);
 
+    /**
+     * Move each of the given cursors back to its item in the given
+     * checkpoint, after the checkpoint's queue has been rebuilt. A cursor
+     * whose item is no longer there is reset to the checkpoint's start.
+     * @param cursors the item each cursor was at, by cursor name
+     */
+    void reseekCursors(const std::map<std::string, queued_item> &cursors,
+                       Checkpoint &chk);
+
     void collapseCheckpoints(uint64_t id);
 
     void resetCursors(bool resetPersistenceCursor = true);
@@ -771,6 +1178,75 @@ private:
 
     size_t getNumOfMetaItemsFromCursor(CheckpointCursor &cursor);
 
+    /**
+     * An item appended to the open checkpoint by appendDirty(), waiting to be
+     * moved (drained) into it under the queue lock.
+     */
+    struct AppendSlot {
+        AppendSlot() : seqno(0), vb(NULL) {}
+
+        // The item's seqno once it is published, 0 while the slot is free.
+        std::atomic<int64_t> seqno;
+        queued_item          item;
+        VBucket             *vb;
+    };
+
+    static const size_t appendRingSize = 64;
+    // Attempts at taking a seqno for an append before queueing under the
+    // lock instead
+    static const int maxAppendAttempts = 16;
+    // Times a lock holder yields waiting for a reserved seqno to be
+    // published before sleeping until it is
+    static const int maxPublishSpins = 64;
+
+    /**
+     * Queue an item of an active vbucket with a generated seqno without
+     * taking the queue lock: the seqno is taken from reservedSeqno, which
+     * also gives the item its slot in the append ring. The item is published
+     * to the slot and drained (in seqno order) by the next holder of the
+     * lock; cursors never get ahead of a slot which hasn't been published.
+     * @return false if the item wasn't queued (the vbucket isn't active, or
+     *         the ring is full), and must be queued under the lock
+     */
+    bool appendDirty(VBucket &vb, vbucket_state_t vbState, queued_item &qi);
+
+    /**
+     * Move the published appended items into the open checkpoint, in seqno
+     * order.
+     * @param waitForReserved wait for items whose seqno has been reserved
+     *                        but which haven't been published yet, rather
+     *                        than stopping at the first one
+     */
+    void drainAppends_UNLOCKED(bool waitForReserved);
+
+    /**
+     * Lock the queue and drain any appended items, so that the checkpoints
+     * hold every item queued so far.
+     */
+    LockHolder lockAndDrain();
+
+    bool queueDirty_UNLOCKED(VBucket &vb, vbucket_state_t vbState,
+                             queued_item &qi, bool genSeqno, bool appended);
+
+    /**
+     * Generate the next seqno under the queue lock (in step with any
+     * concurrent appenders).
+     */
+    int64_t reserveSeqno_UNLOCKED();
+
+    /**
+     * Set lastBySeqno under the queue lock, draining any concurrently
+     * appended items first.
+     */
+    void setLastBySeqno_UNLOCKED(int64_t seqno);
+
+    /**
+     * Move the given (newly registered) cursor past any items whose values
+     * have been expelled.
+     * @return true if the cursor was moved
+     */
+    bool skipExpelledItems_UNLOCKED(CheckpointCursor &cursor);
+
     EPStats                 &stats;
     CheckpointConfig        &checkpointConfig;
     mutable std::mutex       queueLock;
@@ -789,6 +1265,19 @@ private:
 
     FlusherCallback          flusherCB;
 
+    // Items appended without the queue lock, indexed by seqno
+    std::unique_ptr<AppendSlot[]> appendRing;
+    // The last seqno handed out (to an appender, or under the queue lock)
+    std::atomic<int64_t>     reservedSeqno;
+    // lastBySeqno, for appenders checking for a free slot
+    std::atomic<int64_t>     drainedSeqno;
+    // Lock holders sleeping until a reserved seqno is published
+    std::mutex               publishMutex;
+    std::condition_variable  publishCond;
+    std::atomic<int>         numPublishWaiters;
+    // Highest seqno whose value has been expelled from the checkpoints
+    int64_t                  highestExpelledSeqno;
+
     friend std::ostream& operator<<(std::ostream& os, const CheckpointManager& m);
 };
 
@@ -807,18 +1296,20 @@ public:
           maxCheckpoints(DEFAULT_MAX_CHECKPOINTS),
           itemNumBasedNewCheckpoint(true),
           keepClosedCheckpoints(false),
-          enableChkMerge(false)
+          enableChkMerge(false),
+          lockfreeAppend(false)
     { /* empty */ }
 
     CheckpointConfig(rel_time_t period, size_t max_items, size_t max_ckpts,
                      bool item_based_new_ckpt, bool keep_closed_ckpts,
-                     bool enable_ckpt_merge)
+                     bool enable_ckpt_merge, bool lockfree_append = false)
         : checkpointPeriod(period),
           checkpointMaxItems(max_items),
           maxCheckpoints(max_ckpts),
           itemNumBasedNewCheckpoint(item_based_new_ckpt),
           keepClosedCheckpoints(keep_closed_ckpts),
-          enableChkMerge(enable_ckpt_merge) {}
+          enableChkMerge(enable_ckpt_merge),
+          lockfreeAppend(lockfree_append) {}
 
     CheckpointConfig(EventuallyPersistentEngine &e);
 
@@ -846,6 +1337,10 @@ public:
         return enableChkMerge;
     }
 
+    bool isLockfreeAppendEnabled() const {
+        return lockfreeAppend;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -887,6 +1382,9 @@ private:
     bool keepClosedCheckpoints;
     // Flag indicating if merging closed checkpoints is enabled or not.
     bool enableChkMerge;
+    // Flag indicating if active vbuckets append items to the open checkpoint
+    // without taking the checkpoint manager's lock.
+    bool lockfreeAppend;
 };
 
 #endif  // SRC_CHECKPOINT_H_
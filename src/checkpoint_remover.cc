@@ -108,6 +108,26 @@ void ClosedUnrefCheckpointRemoverTask::cursorDroppingIfNeeded(void) {
         // Get a list of active vbuckets sorted by memory usage
         // of their respective checkpoint managers.
         auto vbuckets = store->getVBuckets().getActiveVBucketsSortedByChkMgrMem();
+
+        // Releasing the values of the items every cursor has already passed
+        // doesn't disturb any stream, so try that before dropping cursors.
+        if (engine->getConfiguration().isChkExpelEnabled()) {
+            for (const auto& it: vbuckets) {
+                if (memoryCleared >= amountOfMemoryToClear) {
+                    break;
+                }
+                RCPtr<VBucket> vb = store->getVBucket(it.first);
+                if (vb) {
+                    ExpelResult expelled =
+                            vb->checkpointManager.expelUnreferencedItems();
+                    stats.itemsExpelledFromCheckpoints.fetch_add(
+                                                            expelled.items);
+                    stats.checkpointBytesExpelled.fetch_add(expelled.bytes);
+                    memoryCleared += expelled.bytes;
+                }
+            }
+        }
+
         for (const auto& it: vbuckets) {
             if (memoryCleared < amountOfMemoryToClear) {
                 uint16_t vbid = it.first;
@@ -0,0 +1,199 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-batch-read.h"
+
+#include <algorithm>
+#include <cstring>
+
+// couchstore reads (and caches) its files in blocks of this size.
+static const cs_off_t prefetchBlockSize = 4096;
+
+couchstore_error_t preadBatch(FileOpsInterface& ops,
+                              couchstore_error_info_t* errinfo,
+                              couch_file_handle handle,
+                              std::vector<ReadRequest>& reqs) {
+    BatchReadInterface* batchOps = dynamic_cast<BatchReadInterface*>(&ops);
+    if (batchOps) {
+        return batchOps->preadBatch(errinfo, handle, reqs);
+    }
+
+    for (auto& req : reqs) {
+        char* buf = static_cast<char*>(req.buf);
+        size_t done = 0;
+        req.result = 0;
+        while (done < req.nbytes) {
+            ssize_t got = ops.pread(errinfo, handle, buf + done,
+                                    req.nbytes - done, req.offset + done);
+            if (got < 0) {
+                req.result = got;
+                break;
+            } else if (got == 0) {
+                break;
+            }
+            done += got;
+            req.result = done;
+        }
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+couch_file_handle PrefetchOps::constructor(couchstore_error_info_t* errinfo) {
+    return wrapped_ops.constructor(errinfo);
+}
+
+couchstore_error_t PrefetchOps::open(couchstore_error_info_t* errinfo,
+                                     couch_file_handle* h,
+                                     const char* path,
+                                     int flags) {
+    couchstore_error_t errCode = wrapped_ops.open(errinfo, h, path, flags);
+    if (errCode == COUCHSTORE_SUCCESS) {
+        file = *h;
+        prefetched.clear();
+    }
+    return errCode;
+}
+
+couchstore_error_t PrefetchOps::close(couchstore_error_info_t* errinfo,
+                                      couch_file_handle h) {
+    if (h == file) {
+        file = nullptr;
+        prefetched.clear();
+    }
+    return wrapped_ops.close(errinfo, h);
+}
+
+ssize_t PrefetchOps::pread(couchstore_error_info_t* errinfo,
+                           couch_file_handle h,
+                           void* buf,
+                           size_t sz,
+                           cs_off_t off) {
+    if (h == file && !prefetched.empty()) {
+        auto it = prefetched.upper_bound(off);
+        if (it != prefetched.begin()) {
+            --it;
+            const std::string& data = it->second;
+            if (off + static_cast<cs_off_t>(sz) <=
+                    it->first + static_cast<cs_off_t>(data.size())) {
+                std::memcpy(buf, data.data() + (off - it->first), sz);
+                return sz;
+            }
+        }
+    }
+    return wrapped_ops.pread(errinfo, h, buf, sz, off);
+}
+
+ssize_t PrefetchOps::pwrite(couchstore_error_info_t* errinfo,
+                            couch_file_handle h,
+                            const void* buf,
+                            size_t sz,
+                            cs_off_t off) {
+    if (h == file) {
+        prefetched.clear();
+    }
+    return wrapped_ops.pwrite(errinfo, h, buf, sz, off);
+}
+
+cs_off_t PrefetchOps::goto_eof(couchstore_error_info_t* errinfo,
+                               couch_file_handle h) {
+    return wrapped_ops.goto_eof(errinfo, h);
+}
+
+couchstore_error_t PrefetchOps::sync(couchstore_error_info_t* errinfo,
+                                     couch_file_handle h) {
+    return wrapped_ops.sync(errinfo, h);
+}
+
+couchstore_error_t PrefetchOps::advise(couchstore_error_info_t* errinfo,
+                                       couch_file_handle h,
+                                       cs_off_t offs,
+                                       cs_off_t len,
+                                       couchstore_file_advice_t adv) {
+    return wrapped_ops.advise(errinfo, h, offs, len, adv);
+}
+
+void PrefetchOps::destructor(couch_file_handle h) {
+    if (h == file) {
+        file = nullptr;
+        prefetched.clear();
+    }
+    wrapped_ops.destructor(h);
+}
+
+void PrefetchOps::prefetch(std::vector<std::pair<cs_off_t, size_t>> extents) {
+    if (file == nullptr || extents.empty()) {
+        return;
+    }
+
+    // Widen the extents to whole blocks and merge those which then overlap
+    // or touch, so every block is read at most once.
+    for (auto& extent : extents) {
+        cs_off_t start = extent.first - (extent.first % prefetchBlockSize);
+        cs_off_t end = extent.first + extent.second;
+        end += (prefetchBlockSize - end % prefetchBlockSize) %
+               prefetchBlockSize;
+        extent = std::make_pair(start, static_cast<size_t>(end - start));
+    }
+    std::sort(extents.begin(), extents.end());
+
+    std::vector<std::pair<cs_off_t, size_t>> merged;
+    for (const auto& extent : extents) {
+        if (!merged.empty() &&
+            extent.first <= merged.back().first +
+                            static_cast<cs_off_t>(merged.back().second)) {
+            cs_off_t end = std::max(
+                    merged.back().first +
+                            static_cast<cs_off_t>(merged.back().second),
+                    extent.first + static_cast<cs_off_t>(extent.second));
+            merged.back().second = end - merged.back().first;
+        } else {
+            merged.push_back(extent);
+        }
+    }
+
+    std::vector<std::string> buffers;
+    std::vector<ReadRequest> reqs;
+    buffers.reserve(merged.size());
+    reqs.reserve(merged.size());
+    for (const auto& extent : merged) {
+        buffers.emplace_back(extent.second, '\0');
+        reqs.emplace_back(extent.first, &buffers.back()[0], extent.second);
+    }
+
+    couchstore_error_info_t errinfo;
+    if (preadBatch(wrapped_ops, &errinfo, file, reqs) != COUCHSTORE_SUCCESS) {
+        return;
+    }
+
+    prefetched.clear();
+    for (size_t ii = 0; ii < reqs.size(); ++ii) {
+        if (reqs[ii].result > 0) {
+            buffers[ii].resize(reqs[ii].result);
+            prefetched[reqs[ii].offset].swap(buffers[ii]);
+        }
+    }
+}
+
+size_t PrefetchOps::getPrefetchedBytes() const {
+    size_t bytes = 0;
+    for (const auto& entry : prefetched) {
+        bytes += entry.second.size();
+    }
+    return bytes;
+}
@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_COUCH_KVSTORE_COUCH_BATCH_READ_H_
+#define SRC_COUCH_KVSTORE_COUCH_BATCH_READ_H_ 1
+
+#include "config.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libcouchstore/couch_db.h>
+
+/**
+ * A single read of a batch: nbytes at offset into buf. result is set to the
+ * number of bytes read (short only at the end of the file), or to a
+ * (negative) couchstore_error_t.
+ */
+struct ReadRequest {
+    ReadRequest(cs_off_t off, void* b, size_t n)
+        : offset(off), buf(b), nbytes(n), result(0) {}
+
+    cs_off_t offset;
+    void* buf;
+    size_t nbytes;
+    ssize_t result;
+};
+
+/**
+ * Implemented by the FileOpsInterface implementations which can issue
+ * several reads of a file at once.
+ */
+class BatchReadInterface {
+public:
+    virtual ~BatchReadInterface() {}
+
+    /**
+     * Perform all the given reads of the file, completing in any order.
+     *
+     * @return COUCHSTORE_SUCCESS if every read was attempted; the results
+     *         of the individual reads are in the requests
+     */
+    virtual couchstore_error_t preadBatch(couchstore_error_info_t* errinfo,
+                                          couch_file_handle handle,
+                                          std::vector<ReadRequest>& reqs) = 0;
+};
+
+/**
+ * Perform the reads through ops, concurrently if it implements
+ * BatchReadInterface and one at a time otherwise.
+ */
+couchstore_error_t preadBatch(FileOpsInterface& ops,
+                              couchstore_error_info_t* errinfo,
+                              couch_file_handle handle,
+                              std::vector<ReadRequest>& reqs);
+
+/**
+ * FileOpsInterface implementation for reading a single file, which can
+ * read the parts of it about to be needed ahead of time in one batch and
+ * then serve couchstore's reads falling within them from memory.
+ *
+ * Used by CouchKVStore::getMulti() to read the bodies of all the documents
+ * of a background fetch concurrently, once their positions are known,
+ * rather than one after another.
+ */
+class PrefetchOps : public FileOpsInterface {
+public:
+    explicit PrefetchOps(FileOpsInterface& ops)
+        : wrapped_ops(ops), file(nullptr) {}
+
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override;
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle, const char* path,
+                            int oflag) override;
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override;
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle, void* buf, size_t nbytes,
+                  cs_off_t offset) override;
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle, const void* buf,
+                   size_t nbytes, cs_off_t offset) override;
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override;
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override;
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle, cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override;
+    void destructor(couch_file_handle handle) override;
+
+    /**
+     * Read the given (offset, length) extents of the open file, widened to
+     * whole blocks, in a single batch. Failed reads are left for couchstore
+     * to retry (and report) itself.
+     */
+    void prefetch(std::vector<std::pair<cs_off_t, size_t>> extents);
+
+    /**
+     * Number of bytes held in memory.
+     */
+    size_t getPrefetchedBytes() const;
+
+private:
+    FileOpsInterface& wrapped_ops;
+    // The open file, nullptr if none
+    couch_file_handle file;
+    // Prefetched data, keyed by offset; the ranges don't overlap
+    std::map<cs_off_t, std::string> prefetched;
+};
+
+#endif  // SRC_COUCH_KVSTORE_COUCH_BATCH_READ_H_
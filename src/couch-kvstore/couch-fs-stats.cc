@@ -19,13 +19,27 @@
 
 #include "common.h"
 #include "couch-kvstore/couch-fs-stats.h"
+#include "couch-kvstore/couch-uring-ops.h"
+#include "threadlocal.h"
 #include <platform/histogram.h>
 
+// The calling thread's innermost SyncTimeCounter, if any
+static ThreadLocal<SyncTimeCounter*> currentSyncTimeCounter;
+
 std::unique_ptr<FileOpsInterface> getCouchstoreStatsOps(
     FileStats& stats, FileOpsInterface& base_ops) {
     return std::unique_ptr<FileOpsInterface>(new StatsOps(stats, base_ops));
 }
 
+SyncTimeCounter::SyncTimeCounter()
+    : elapsed(0), outer(currentSyncTimeCounter.get()) {
+    currentSyncTimeCounter.set(this);
+}
+
+SyncTimeCounter::~SyncTimeCounter() {
+    currentSyncTimeCounter.set(outer);
+}
+
 StatsOps::StatFile::StatFile(FileOpsInterface* _orig_ops,
                              couch_file_handle _orig_handle,
                              cs_off_t _last_offs)
@@ -101,8 +115,28 @@ cs_off_t StatsOps::goto_eof(couchstore_error_info_t* errinfo,
 couchstore_error_t StatsOps::sync(couchstore_error_info_t* errinfo,
                                   couch_file_handle h) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
-    BlockTimer bt(&stats.syncTimeHisto);
-    return sf->orig_ops->sync(errinfo, sf->orig_handle);
+    // Writes still outstanding are waited for (and timed) first, so the
+    // sync time is that of the sync alone.
+    WriteDrainInterface* drainOps =
+            dynamic_cast<WriteDrainInterface*>(sf->orig_ops);
+    if (drainOps) {
+        BlockTimer bt(&stats.writeDrainTimeHisto);
+        couchstore_error_t result = drainOps->drainWrites(errinfo,
+                                                          sf->orig_handle);
+        if (result != COUCHSTORE_SUCCESS) {
+            return result;
+        }
+    }
+    hrtime_t start = gethrtime();
+    couchstore_error_t result = sf->orig_ops->sync(errinfo, sf->orig_handle);
+    hrtime_t elapsed = (gethrtime() - start) / 1000;
+    stats.syncTimeHisto.add(elapsed);
+    stats.totalSyncTime += elapsed;
+    SyncTimeCounter* counter = currentSyncTimeCounter.get();
+    if (counter) {
+        counter->elapsed += elapsed;
+    }
+    return result;
 }
 
 couchstore_error_t StatsOps::advise(couchstore_error_info_t* errinfo,
@@ -120,3 +154,21 @@ void StatsOps::destructor(couch_file_handle h) {
     delete sf;
 }
 
+couchstore_error_t StatsOps::preadBatch(couchstore_error_info_t* errinfo,
+                                        couch_file_handle h,
+                                        std::vector<ReadRequest>& reqs) {
+    StatFile* sf = reinterpret_cast<StatFile*>(h);
+    for (const auto& req : reqs) {
+        stats.readSizeHisto.add(req.nbytes);
+    }
+    // The reads are concurrent, so the batch counts as a single one.
+    BlockTimer bt(&stats.readTimeHisto);
+    couchstore_error_t errCode = ::preadBatch(*sf->orig_ops, errinfo,
+                                              sf->orig_handle, reqs);
+    for (const auto& req : reqs) {
+        if (req.result > 0) {
+            stats.totalBytesRead += req.result;
+        }
+    }
+    return errCode;
+}
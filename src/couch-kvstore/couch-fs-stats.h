@@ -25,6 +25,7 @@
 
 #include <libcouchstore/couch_db.h>
 #include <platform/histogram.h>
+#include "couch-kvstore/couch-batch-read.h"
 #include "kvstore.h"
 
 /**
@@ -34,11 +35,34 @@
 std::unique_ptr<FileOpsInterface> getCouchstoreStatsOps(
     FileStats& stats, FileOpsInterface& base_ops);
 
+/**
+ * Counts the time (in microseconds) the creating thread spends in syncs
+ * through StatsOps while the object exists - e.g. the syncs of a commit,
+ * apart from any other thread's issued meanwhile. Counters may be nested;
+ * only the innermost counts.
+ */
+class SyncTimeCounter {
+public:
+    SyncTimeCounter();
+
+    ~SyncTimeCounter();
+
+    size_t get() const {
+        return elapsed;
+    }
+
+private:
+    friend class StatsOps;
+
+    size_t elapsed;
+    SyncTimeCounter* outer;
+};
+
 /**
  * FileOpsInterface implementation which records various statistics
  * about OS-level file operations performed by Couchstore.
  */
-class StatsOps : public FileOpsInterface {
+class StatsOps : public FileOpsInterface, public BatchReadInterface {
 public:
     StatsOps(FileStats& _stats, FileOpsInterface& ops)
         : stats(_stats),
@@ -66,6 +90,10 @@ public:
                               couchstore_file_advice_t advice) override;
     void destructor(couch_file_handle handle) override;
 
+    couchstore_error_t preadBatch(couchstore_error_info_t* errinfo,
+                                  couch_file_handle handle,
+                                  std::vector<ReadRequest>& reqs) override;
+
 protected:
     FileStats& stats;
     FileOpsInterface& wrapped_ops;
@@ -0,0 +1,156 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-group-commit-ops.h"
+
+#include <algorithm>
+
+couch_file_handle GroupCommitOps::constructor(
+        couchstore_error_info_t* errinfo) {
+    GroupFile* gf = new GroupFile(wrapped_ops.constructor(errinfo));
+    return reinterpret_cast<couch_file_handle>(gf);
+}
+
+couchstore_error_t GroupCommitOps::open(couchstore_error_info_t* errinfo,
+                                        couch_file_handle* h,
+                                        const char* path,
+                                        int flags) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(*h);
+    return wrapped_ops.open(errinfo, &gf->orig_handle, path, flags);
+}
+
+couchstore_error_t GroupCommitOps::close(couchstore_error_info_t* errinfo,
+                                         couch_file_handle h) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    // Whatever is still held back belongs to a commit which won't complete.
+    removePending(gf);
+    return wrapped_ops.close(errinfo, gf->orig_handle);
+}
+
+ssize_t GroupCommitOps::pread(couchstore_error_info_t* errinfo,
+                              couch_file_handle h,
+                              void* buf,
+                              size_t sz,
+                              cs_off_t off) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    return wrapped_ops.pread(errinfo, gf->orig_handle, buf, sz, off);
+}
+
+ssize_t GroupCommitOps::pwrite(couchstore_error_info_t* errinfo,
+                               couch_file_handle h,
+                               const void* buf,
+                               size_t sz,
+                               cs_off_t off) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    if (gf->syncsHeld > 0) {
+        gf->heldWrites.emplace_back(off,
+                                    std::string(static_cast<const char*>(buf),
+                                                sz));
+        return sz;
+    }
+    return wrapped_ops.pwrite(errinfo, gf->orig_handle, buf, sz, off);
+}
+
+cs_off_t GroupCommitOps::goto_eof(couchstore_error_info_t* errinfo,
+                                  couch_file_handle h) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    return wrapped_ops.goto_eof(errinfo, gf->orig_handle);
+}
+
+couchstore_error_t GroupCommitOps::sync(couchstore_error_info_t* errinfo,
+                                        couch_file_handle h) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    if (gf->syncsHeld++ == 0) {
+        pending.push_back(gf);
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t GroupCommitOps::advise(couchstore_error_info_t* errinfo,
+                                          couch_file_handle h,
+                                          cs_off_t offs,
+                                          cs_off_t len,
+                                          couchstore_file_advice_t adv) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    return wrapped_ops.advise(errinfo, gf->orig_handle, offs, len, adv);
+}
+
+void GroupCommitOps::destructor(couch_file_handle h) {
+    GroupFile* gf = reinterpret_cast<GroupFile*>(h);
+    removePending(gf);
+    wrapped_ops.destructor(gf->orig_handle);
+    delete gf;
+}
+
+couchstore_error_t GroupCommitOps::syncGroup(
+        couchstore_error_info_t* errinfo) {
+    std::vector<GroupFile*> group;
+    group.swap(pending);
+
+    couchstore_error_t errCode = COUCHSTORE_SUCCESS;
+    // Make the data of every file durable before any new header is written
+    for (GroupFile* gf : group) {
+        if (errCode == COUCHSTORE_SUCCESS) {
+            errCode = wrapped_ops.sync(errinfo, gf->orig_handle);
+        }
+    }
+
+    for (GroupFile* gf : group) {
+        for (const auto& write : gf->heldWrites) {
+            if (errCode != COUCHSTORE_SUCCESS) {
+                break;
+            }
+            const char* buf = write.second.data();
+            size_t remaining = write.second.size();
+            cs_off_t off = write.first;
+            while (remaining > 0) {
+                ssize_t written = wrapped_ops.pwrite(errinfo, gf->orig_handle,
+                                                     buf, remaining, off);
+                if (written <= 0) {
+                    errCode = written < 0 ?
+                            static_cast<couchstore_error_t>(written) :
+                            COUCHSTORE_ERROR_WRITE;
+                    break;
+                }
+                buf += written;
+                remaining -= written;
+                off += written;
+            }
+        }
+        gf->heldWrites.clear();
+        gf->syncsHeld = 0;
+    }
+
+    for (GroupFile* gf : group) {
+        if (errCode == COUCHSTORE_SUCCESS) {
+            errCode = wrapped_ops.sync(errinfo, gf->orig_handle);
+        }
+    }
+
+    return errCode;
+}
+
+void GroupCommitOps::removePending(GroupFile* gf) {
+    auto it = std::find(pending.begin(), pending.end(), gf);
+    if (it != pending.end()) {
+        pending.erase(it);
+    }
+    gf->heldWrites.clear();
+    gf->syncsHeld = 0;
+}
@@ -0,0 +1,103 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_COUCH_KVSTORE_COUCH_GROUP_COMMIT_OPS_H_
+#define SRC_COUCH_KVSTORE_COUCH_GROUP_COMMIT_OPS_H_ 1
+
+#include "config.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libcouchstore/couch_db.h>
+
+/**
+ * FileOpsInterface implementation which lets the couchstore_commit()s of
+ * several files share their syncs (group commit).
+ *
+ * couchstore_commit() syncs the file, writes the new header and syncs it
+ * again, so the header never becomes durable before the data it refers to.
+ * For a file opened through this object the first sync is held back, as are
+ * the writes following it (i.e. the header) and the second sync. Once every
+ * file of the group has been committed syncGroup() syncs all of them, then
+ * writes their headers and syncs them all again, preserving that ordering
+ * with two rounds of back-to-back syncs rather than two syncs per file.
+ *
+ * A file must be committed at most once per group and must not be read
+ * (or closed, which abandons its commit) before syncGroup(). Only one
+ * thread may use the object at a time.
+ */
+class GroupCommitOps : public FileOpsInterface {
+public:
+    explicit GroupCommitOps(FileOpsInterface& ops)
+        : wrapped_ops(ops) {}
+
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override;
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle, const char* path,
+                            int oflag) override;
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override;
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle, void* buf, size_t nbytes,
+                  cs_off_t offset) override;
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle, const void* buf,
+                   size_t nbytes, cs_off_t offset) override;
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override;
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override;
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle, cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override;
+    void destructor(couch_file_handle handle) override;
+
+    /**
+     * Make the commits of every file with held back syncs durable. On error
+     * none of them can be assumed to be.
+     */
+    couchstore_error_t syncGroup(couchstore_error_info_t* errinfo);
+
+    /**
+     * Number of files whose commit awaits syncGroup().
+     */
+    size_t getNumPendingFiles() const {
+        return pending.size();
+    }
+
+protected:
+    struct GroupFile {
+        explicit GroupFile(couch_file_handle _orig_handle)
+            : orig_handle(_orig_handle), syncsHeld(0) {}
+
+        couch_file_handle orig_handle;
+        // Syncs held back since the last syncGroup()
+        size_t syncsHeld;
+        // Writes following the first held back sync, in issue order
+        std::vector<std::pair<cs_off_t, std::string>> heldWrites;
+    };
+
+    void removePending(GroupFile* gf);
+
+    FileOpsInterface& wrapped_ops;
+    std::vector<GroupFile*> pending;
+};
+
+#endif  // SRC_COUCH_KVSTORE_COUCH_GROUP_COMMIT_OPS_H_
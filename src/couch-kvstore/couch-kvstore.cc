@@ -140,15 +140,52 @@ static std::string couchkvstore_strerrno(Db *db, couchstore_error_t err) {
             err == COUCHSTORE_ERROR_FILE_CLOSE) ? getStrError(db) : "none";
 }
 
+/**
+ * A copy of a DocInfo, which outlives the couchstore callback it was
+ * passed to.
+ */
+class DocInfoCopy {
+public:
+    explicit DocInfoCopy(const DocInfo &from)
+        : info(from),
+          id(from.id.buf, from.id.size),
+          revMeta(from.rev_meta.buf, from.rev_meta.size) {
+        info.id.buf = const_cast<char *>(id.data());
+        info.rev_meta.buf = const_cast<char *>(revMeta.data());
+    }
+
+    DocInfo info;
+
+private:
+    std::string id;
+    std::string revMeta;
+
+    DISALLOW_COPY_AND_ASSIGN(DocInfoCopy);
+};
+
 struct GetMultiCbCtx {
     GetMultiCbCtx(CouchKVStore &c, uint16_t v, vb_bgfetch_queue_t &f) :
-        cks(c), vbId(v), fetches(f) {}
+        cks(c), vbId(v), fetches(f), deferFetch(false) {}
 
     CouchKVStore &cks;
     uint16_t vbId;
     vb_bgfetch_queue_t &fetches;
+    // If set the documents found are only collected in deferred, to be
+    // fetched once all of them have been found.
+    bool deferFetch;
+    std::vector<std::unique_ptr<DocInfoCopy>> deferred;
 };
 
+// The number of bytes of the file a document body of the given size
+// occupies from its position on: it's preceded by its length and checksum,
+// and (as is everything in the file) interrupted by a marker byte at every
+// block boundary.
+static size_t docBodyExtent(size_t size) {
+    const size_t blockSize = 4096;
+    size_t chunk = size + 8;
+    return chunk + chunk / (blockSize - 1) + 1;
+}
+
 struct StatResponseCtx {
 public:
     StatResponseCtx(std::map<std::pair<uint16_t, uint16_t>, vbucket_state> &sm,
@@ -255,14 +292,13 @@ CouchKVStore::CouchKVStore(KVStoreConfig &config, FileOpsInterface& ops,
     : KVStore(config, read_only),
       dbname(config.getDBName()),
       intransaction(false),
+      lastCommitSyncTime(0),
       scanCounter(0),
       logger(config.getLogger()),
       base_ops(ops)
 {
     createDataDir(dbname);
-    statCollectingFileOps = getCouchstoreStatsOps(st.fsStats, base_ops);
-    statCollectingFileOpsCompaction = getCouchstoreStatsOps(
-        st.fsStatsCompaction, base_ops);
+    createFileOps();
 
     // init db file map with default revision number, 1
     numDbFiles = configuration.getMaxVBuckets();
@@ -286,13 +322,27 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom)
       dbFileRevMap(copyFrom.dbFileRevMap),
       numDbFiles(copyFrom.numDbFiles),
       intransaction(false),
+      lastCommitSyncTime(0),
       logger(copyFrom.logger),
       base_ops(copyFrom.base_ops)
 {
     createDataDir(dbname);
-    statCollectingFileOps = getCouchstoreStatsOps(st.fsStats, base_ops);
+    createFileOps();
+}
+
+void CouchKVStore::createFileOps() {
+    FileOpsInterface* ops = &base_ops;
+    // io_uring only takes the place of couchstore's default (POSIX) file
+    // ops; any others are used as given.
+    if (configuration.getIoUring() &&
+        &base_ops == couchstore_get_default_file_ops()) {
+        uringOps.reset(new UringFileOps(base_ops));
+        ops = uringOps.get();
+    }
+    statCollectingFileOps = getCouchstoreStatsOps(st.fsStats, *ops);
     statCollectingFileOpsCompaction = getCouchstoreStatsOps(
-        st.fsStatsCompaction, base_ops);
+        st.fsStatsCompaction, *ops);
+    groupCommitOps.reset(new GroupCommitOps(*statCollectingFileOps));
 }
 
 void CouchKVStore::initialize() {
@@ -474,9 +524,17 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
     int numItems = itms.size();
     uint64_t fileRev = dbFileRevMap[vb];
 
+    // With io_uring the document bodies are all read at once, after
+    // couchstore has found where they are, rather than one by one.
+    std::unique_ptr<PrefetchOps> prefetchOps;
+    if (uringOps && uringOps->isEnabled() && itms.size() > 1) {
+        prefetchOps.reset(new PrefetchOps(*statCollectingFileOps));
+    }
+
     Db *db = NULL;
     couchstore_error_t errCode = openDB(vb, fileRev, &db,
-                                        COUCHSTORE_OPEN_FLAG_RDONLY);
+                                        COUCHSTORE_OPEN_FLAG_RDONLY,
+                                        nullptr, false, prefetchOps.get());
     if (errCode != COUCHSTORE_SUCCESS) {
         logger.log(EXTENSION_LOG_WARNING,
                    "Failed to open database for data fetch, "
@@ -504,10 +562,40 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
         ++idx;
     }
 
+    // The documents are found in key order; their bodies are then read in
+    // the order they are in the file, rather than seeking back and forth.
     GetMultiCbCtx ctx(*this, vb, itms);
+    ctx.deferFetch = itms.size() > 1;
 
     errCode = couchstore_docinfos_by_id(db, ids, itms.size(),
                                         0, getMultiCbC, &ctx);
+    if (errCode == COUCHSTORE_SUCCESS && ctx.deferFetch) {
+        std::sort(ctx.deferred.begin(), ctx.deferred.end(),
+                  [](const std::unique_ptr<DocInfoCopy>& a,
+                     const std::unique_ptr<DocInfoCopy>& b) {
+                      return a->info.bp < b->info.bp;
+                  });
+
+        if (prefetchOps) {
+            std::vector<std::pair<cs_off_t, size_t>> extents;
+            for (const auto& copy : ctx.deferred) {
+                const DocInfo& docinfo = copy->info;
+                auto qitr = itms.find(std::string(docinfo.id.buf,
+                                                  docinfo.id.size));
+                if (qitr != itms.end() && !qitr->second.isMetaOnly &&
+                    docinfo.bp != 0 && docinfo.size > 0) {
+                    extents.emplace_back(docinfo.bp,
+                                         docBodyExtent(docinfo.size));
+                }
+            }
+            prefetchOps->prefetch(extents);
+        }
+
+        ctx.deferFetch = false;
+        for (auto& copy : ctx.deferred) {
+            getMultiCb(db, &copy->info, &ctx);
+        }
+    }
     if (errCode != COUCHSTORE_SUCCESS) {
         st.numGetFailure += numItems;
         for (itr = itms.begin(); itr != itms.end(); ++itr) {
@@ -724,6 +812,13 @@ static int edit_docinfo_hook(DocInfo **info, const sized_buf *item) {
     return 1;
 }
 
+static void notifyPurged(compaction_ctx* ctx, const DocInfo* info) {
+    if (ctx->purgedItemCallback) {
+        std::string key((const char *)info->id.buf, info->id.size);
+        ctx->purgedItemCallback->callback(ctx->db_file_id, key);
+    }
+}
+
 static int time_purge_hook(Db* d, DocInfo* info, void* ctx_p) {
     compaction_ctx* ctx = (compaction_ctx*) ctx_p;
     DbInfo infoDb;
@@ -753,6 +848,7 @@ static int time_purge_hook(Db* d, DocInfo* info, void* ctx_p) {
                     if (max_purge_seq < info->db_seq) {
                         ctx->max_purged_seq[vbid] = info->db_seq; // track max_purged_seq
                     }
+                    notifyPurged(ctx, info);
                     return COUCHSTORE_COMPACT_DROP_ITEM;      // ...unconditionally
                 }
                 if (exptime < ctx->purge_before_ts &&
@@ -761,6 +857,7 @@ static int time_purge_hook(Db* d, DocInfo* info, void* ctx_p) {
                     if (max_purge_seq < info->db_seq) {
                         ctx->max_purged_seq[vbid] = info->db_seq;
                     }
+                    notifyPurged(ctx, info);
                     return COUCHSTORE_COMPACT_DROP_ITEM;
                 }
             }
@@ -1042,9 +1139,13 @@ bool CouchKVStore::commit() {
     }
 
     if (intransaction) {
+        // Snapshots of vbucket states may sync the same store's files on
+        // other threads meanwhile; only this commit's syncs are counted.
+        SyncTimeCounter syncTime;
         if (commit2couchstore()) {
             intransaction = false;
         }
+        lastCommitSyncTime = syncTime.get();
     }
 
     return !intransaction;
@@ -1065,6 +1166,12 @@ bool CouchKVStore::getStat(const char* name, size_t& value)  {
     } else if (strcmp("io_compaction_write_bytes", name) == 0) {
         value = st.fsStatsCompaction.totalBytesWritten;
         return true;
+    } else if (strcmp("io_total_sync_time", name) == 0) {
+        value = st.fsStats.totalSyncTime;
+        return true;
+    } else if (strcmp("io_commit_sync_time", name) == 0) {
+        value = lastCommitSyncTime;
+        return true;
     }
 
     return false;
@@ -1705,15 +1812,9 @@ bool CouchKVStore::commit2couchstore() {
         return success;
     }
 
-    Doc **docs = new Doc *[pendingCommitCnt];
-    DocInfo **docinfos = new DocInfo *[pendingCommitCnt];
-
-    if (pendingReqsQ[0] == nullptr) {
-        throw std::logic_error("CouchKVStore::commit2couchstore: "
-                        "pendingReqsQ[0] is NULL");
-    }
-    uint16_t vbucket2flush = pendingReqsQ[0]->getVBucketId();
-    uint64_t fileRev = pendingReqsQ[0]->getRevNum();
+    // A transaction may span the flushes of several vbuckets, whose requests
+    // are queued one vbucket after another.
+    std::vector<CommitBatch> batches;
     for (size_t i = 0; i < pendingCommitCnt; ++i) {
         CouchRequest *req = pendingReqsQ[i];
         if (req == nullptr) {
@@ -1721,40 +1822,62 @@ bool CouchKVStore::commit2couchstore() {
                                        "pendingReqsQ["
                                        + std::to_string(i) + "] is NULL");
         }
-        docs[i] = (Doc *)req->getDbDoc();
-        docinfos[i] = req->getDbDocInfo();
-        if (vbucket2flush != req->getVBucketId()) {
-            throw std::logic_error(
-                    "CouchKVStore::commit2couchstore: "
-                    "mismatch between vbucket2flush (which is "
-                    + std::to_string(vbucket2flush) + ") and pendingReqsQ["
-                    + std::to_string(i) + "] (which is "
-                    + std::to_string(req->getVBucketId()) + ")");
+        if (batches.empty() || batches.back().vbid != req->getVBucketId()) {
+            batches.emplace_back(req->getVBucketId(), req->getRevNum());
         }
+        batches.back().reqs.push_back(req);
     }
 
-    kvstats_ctx kvctx;
-    kvctx.vbucket = vbucket2flush;
-    // flush all
-    couchstore_error_t errCode = saveDocs(vbucket2flush, fileRev, docs,
-                                          docinfos, pendingCommitCnt,
-                                          kvctx);
-    if (errCode) {
-        success = false;
-        logger.log(EXTENSION_LOG_WARNING,
-                   "Commit failed, cannot save CouchDB docs "
-                   "for vbucket = %d rev = %" PRIu64, vbucket2flush, fileRev);
+    // Each vbucket's file can only be committed once per group.
+    std::vector<CommitBatch *> group;
+    std::vector<bool> inGroup(numDbFiles, false);
+    for (auto& batch : batches) {
+        if (inGroup[batch.vbid]) {
+            success = commitGroup(group) && success;
+            group.clear();
+            inGroup.assign(numDbFiles, false);
+        }
+        inGroup[batch.vbid] = true;
+        group.push_back(&batch);
     }
-
-    commitCallback(pendingReqsQ, kvctx, errCode);
+    success = commitGroup(group) && success;
 
     // clean up
     for (size_t i = 0; i < pendingCommitCnt; ++i) {
         delete pendingReqsQ[i];
     }
     pendingReqsQ.clear();
-    delete [] docs;
-    delete [] docinfos;
+    return success;
+}
+
+bool CouchKVStore::commitGroup(std::vector<CommitBatch *> &group) {
+    if (group.size() == 1) {
+        CommitBatch *batch = group.front();
+        std::vector<Doc *> docs;
+        std::vector<DocInfo *> docinfos;
+        for (auto req : batch->reqs) {
+            docs.push_back((Doc *)req->getDbDoc());
+            docinfos.push_back(req->getDbDocInfo());
+        }
+        batch->errCode = saveDocs(batch->vbid, batch->fileRev, docs.data(),
+                                  docinfos.data(), docs.size(),
+                                  batch->kvctx);
+    } else {
+        saveDocsGroup(group);
+    }
+
+    // Only acknowledged once the whole group is durable
+    bool success = true;
+    for (auto batch : group) {
+        if (batch->errCode) {
+            success = false;
+            logger.log(EXTENSION_LOG_WARNING,
+                       "Commit failed, cannot save CouchDB docs "
+                       "for vbucket = %d rev = %" PRIu64, batch->vbid,
+                       batch->fileRev);
+        }
+        commitCallback(batch->reqs, batch->kvctx, batch->errCode);
+    }
     return success;
 }
 
@@ -1782,7 +1905,6 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev,
                                           size_t docCount, kvstats_ctx &kvctx) {
     couchstore_error_t errCode;
     uint64_t fileRev = rev;
-    DbInfo info;
     if (rev == 0) {
         throw std::invalid_argument("CouchKVStore::saveDocs: rev must be non-zero");
     }
@@ -1797,90 +1919,172 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev,
                    uint64_t(docCount));
         return errCode;
     } else {
-        vbucket_state *state = cachedVBStates[vbid];
-        if (state == nullptr) {
-            throw std::logic_error(
-                    "CouchKVStore::saveDocs: cachedVBStates[" +
-                    std::to_string(vbid) + "] is NULL");
-        }
-
         uint64_t maxDBSeqno = 0;
-        sized_buf *ids = new sized_buf[docCount];
-        for (size_t idx = 0; idx < docCount; idx++) {
-            ids[idx] = docinfos[idx]->id;
-            maxDBSeqno = std::max(maxDBSeqno, docinfos[idx]->db_seq);
-            std::string key(ids[idx].buf, ids[idx].size);
-            kvctx.keyStats[key] = std::make_pair(false,
-                    !docinfos[idx]->deleted);
-        }
-        couchstore_docinfos_by_id(db, ids, (unsigned) docCount, 0,
-                readDocInfos, &kvctx);
-        delete[] ids;
-
-        hrtime_t cs_begin = gethrtime();
-        uint64_t flags = COMPRESS_DOC_BODIES | COUCHSTORE_SEQUENCE_AS_IS;
-        errCode = couchstore_save_documents(db, docs, docinfos,
-                (unsigned) docCount, flags);
-        st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
-        if (errCode != COUCHSTORE_SUCCESS) {
-            logger.log(EXTENSION_LOG_WARNING,
-                       "Failed to save docs to database, "
-                       "numDocs = %" PRIu64 " error=%s [%s]\n",
-                       uint64_t(docCount), couchstore_strerror(errCode),
-                       couchkvstore_strerrno(db, errCode).c_str());
-            closeDatabaseHandle(db);
-            return errCode;
+        errCode = writeDocs(db, vbid, docs, docinfos, docCount, kvctx,
+                            maxDBSeqno);
+        if (errCode == COUCHSTORE_SUCCESS) {
+            updateDbInfo(db, vbid, maxDBSeqno);
         }
+        closeDatabaseHandle(db);
+    }
 
-        errCode = saveVBState(db, *state);
-        if (errCode != COUCHSTORE_SUCCESS) {
-            logger.log(EXTENSION_LOG_WARNING, "Failed to save local docs to "
-                       "database, error=%s [%s]", couchstore_strerror(errCode),
-                       couchkvstore_strerrno(db, errCode).c_str());
-            closeDatabaseHandle(db);
-            return errCode;
+    /* update stat */
+    if(errCode == COUCHSTORE_SUCCESS) {
+        st.docsCommitted = docCount;
+    }
+
+    return errCode;
+}
+
+void CouchKVStore::saveDocsGroup(std::vector<CommitBatch *> &group) {
+    size_t docCount = 0;
+    for (auto batch : group) {
+        if (batch->fileRev == 0) {
+            throw std::invalid_argument("CouchKVStore::saveDocsGroup: rev "
+                                        "must be non-zero");
         }
 
-        cs_begin = gethrtime();
-        errCode = couchstore_commit(db);
-        st.commitHisto.add((gethrtime() - cs_begin) / 1000);
-        if (errCode) {
+        uint64_t newFileRev;
+        batch->errCode = openDB(batch->vbid, batch->fileRev, &batch->db, 0,
+                                &newFileRev, false, groupCommitOps.get());
+        if (batch->errCode != COUCHSTORE_SUCCESS) {
             logger.log(EXTENSION_LOG_WARNING,
-                       "couchstore_commit failed, error=%s [%s]",
-                       couchstore_strerror(errCode),
-                       couchkvstore_strerrno(db, errCode).c_str());
-            closeDatabaseHandle(db);
-            return errCode;
+                       "Failed to open database, vbucketId = %d "
+                       "fileRev = %" PRIu64 " numDocs = %" PRIu64,
+                       batch->vbid, batch->fileRev,
+                       uint64_t(batch->reqs.size()));
+            batch->db = nullptr;
+            continue;
         }
 
-        st.batchSize.add(docCount);
+        std::vector<Doc *> docs;
+        std::vector<DocInfo *> docinfos;
+        for (auto req : batch->reqs) {
+            docs.push_back((Doc *)req->getDbDoc());
+            docinfos.push_back(req->getDbDocInfo());
+        }
+        batch->errCode = writeDocs(batch->db, batch->vbid, docs.data(),
+                                   docinfos.data(), docs.size(),
+                                   batch->kvctx, batch->maxDBSeqno);
+        if (batch->errCode != COUCHSTORE_SUCCESS) {
+            // Closing the file abandons its held back commit
+            closeDatabaseHandle(batch->db);
+            batch->db = nullptr;
+        }
+    }
 
-        // retrieve storage system stats for file fragmentation computation
-        couchstore_db_info(db, &info);
-        cachedSpaceUsed[vbid] = info.space_used;
-        cachedFileSize[vbid] = info.file_size;
-        cachedDeleteCount[vbid] = info.deleted_count;
-        cachedDocCount[vbid] = info.doc_count;
+    // None of the commits above is durable until their syncs are issued.
+    couchstore_error_info_t errinfo;
+    hrtime_t cs_begin = gethrtime();
+    couchstore_error_t errCode = groupCommitOps->syncGroup(&errinfo);
+    st.groupSyncHisto.add((gethrtime() - cs_begin) / 1000);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        logger.log(EXTENSION_LOG_WARNING,
+                   "Failed to sync the group commit of %" PRIu64 " vbuckets, "
+                   "error=%s", uint64_t(group.size()),
+                   couchstore_strerror(errCode));
+    }
 
-        if (maxDBSeqno != info.last_sequence) {
-            logger.log(EXTENSION_LOG_WARNING, "Seqno in db header (%" PRIu64 ")"
-                       " is not matched with what was persisted (%" PRIu64 ")"
-                       " for vbucket %d",
-                       info.last_sequence, maxDBSeqno, vbid);
+    for (auto batch : group) {
+        if (batch->db == nullptr) {
+            continue;
         }
-        state->highSeqno = info.last_sequence;
-
-        closeDatabaseHandle(db);
+        if (errCode == COUCHSTORE_SUCCESS) {
+            updateDbInfo(batch->db, batch->vbid, batch->maxDBSeqno);
+            docCount += batch->reqs.size();
+        } else {
+            batch->errCode = errCode;
+        }
+        closeDatabaseHandle(batch->db);
+        batch->db = nullptr;
     }
 
     /* update stat */
-    if(errCode == COUCHSTORE_SUCCESS) {
+    if (docCount > 0) {
         st.docsCommitted = docCount;
     }
+}
 
+couchstore_error_t CouchKVStore::writeDocs(Db *db, uint16_t vbid, Doc **docs,
+                                           DocInfo **docinfos,
+                                           size_t docCount,
+                                           kvstats_ctx &kvctx,
+                                           uint64_t &maxDBSeqno) {
+    couchstore_error_t errCode;
+    vbucket_state *state = cachedVBStates[vbid];
+    if (state == nullptr) {
+        throw std::logic_error(
+                "CouchKVStore::writeDocs: cachedVBStates[" +
+                std::to_string(vbid) + "] is NULL");
+    }
+
+    sized_buf *ids = new sized_buf[docCount];
+    for (size_t idx = 0; idx < docCount; idx++) {
+        ids[idx] = docinfos[idx]->id;
+        maxDBSeqno = std::max(maxDBSeqno, docinfos[idx]->db_seq);
+        std::string key(ids[idx].buf, ids[idx].size);
+        kvctx.keyStats[key] = std::make_pair(false,
+                !docinfos[idx]->deleted);
+    }
+    couchstore_docinfos_by_id(db, ids, (unsigned) docCount, 0,
+            readDocInfos, &kvctx);
+    delete[] ids;
+
+    hrtime_t cs_begin = gethrtime();
+    uint64_t flags = COMPRESS_DOC_BODIES | COUCHSTORE_SEQUENCE_AS_IS;
+    errCode = couchstore_save_documents(db, docs, docinfos,
+            (unsigned) docCount, flags);
+    st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        logger.log(EXTENSION_LOG_WARNING,
+                   "Failed to save docs to database, "
+                   "numDocs = %" PRIu64 " error=%s [%s]\n",
+                   uint64_t(docCount), couchstore_strerror(errCode),
+                   couchkvstore_strerrno(db, errCode).c_str());
+        return errCode;
+    }
+
+    errCode = saveVBState(db, *state);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        logger.log(EXTENSION_LOG_WARNING, "Failed to save local docs to "
+                   "database, error=%s [%s]", couchstore_strerror(errCode),
+                   couchkvstore_strerrno(db, errCode).c_str());
+        return errCode;
+    }
+
+    cs_begin = gethrtime();
+    errCode = couchstore_commit(db);
+    st.commitHisto.add((gethrtime() - cs_begin) / 1000);
+    if (errCode) {
+        logger.log(EXTENSION_LOG_WARNING,
+                   "couchstore_commit failed, error=%s [%s]",
+                   couchstore_strerror(errCode),
+                   couchkvstore_strerrno(db, errCode).c_str());
+        return errCode;
+    }
+
+    st.batchSize.add(docCount);
     return errCode;
 }
 
+void CouchKVStore::updateDbInfo(Db *db, uint16_t vbid, uint64_t maxDBSeqno) {
+    // retrieve storage system stats for file fragmentation computation
+    DbInfo info;
+    couchstore_db_info(db, &info);
+    cachedSpaceUsed[vbid] = info.space_used;
+    cachedFileSize[vbid] = info.file_size;
+    cachedDeleteCount[vbid] = info.deleted_count;
+    cachedDocCount[vbid] = info.doc_count;
+
+    if (maxDBSeqno != info.last_sequence) {
+        logger.log(EXTENSION_LOG_WARNING, "Seqno in db header (%" PRIu64 ")"
+                   " is not matched with what was persisted (%" PRIu64 ")"
+                   " for vbucket %d",
+                   info.last_sequence, maxDBSeqno, vbid);
+    }
+    cachedVBStates[vbid]->highSeqno = info.last_sequence;
+}
+
 void CouchKVStore::remVBucketFromDbFileMap(uint16_t vbucketId) {
     if (vbucketId >= numDbFiles) {
         logger.log(EXTENSION_LOG_WARNING,
@@ -2111,8 +2315,13 @@ int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx) {
                 "be non-NULL");
     }
 
-    std::string keyStr(docinfo->id.buf, docinfo->id.size);
     GetMultiCbCtx *cbCtx = static_cast<GetMultiCbCtx *>(ctx);
+    if (cbCtx->deferFetch) {
+        cbCtx->deferred.emplace_back(new DocInfoCopy(*docinfo));
+        return 0;
+    }
+
+    std::string keyStr(docinfo->id.buf, docinfo->id.size);
     KVStoreStats& st = cbCtx->cks.getKVStoreStat();
 
     vb_bgfetch_queue_t::iterator qitr = cbCtx->fetches.find(keyStr);
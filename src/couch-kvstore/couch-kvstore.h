@@ -28,8 +28,11 @@
 #include <vector>
 
 #include "configuration.h"
+#include "couch-kvstore/couch-batch-read.h"
 #include "couch-kvstore/couch-fs-stats.h"
+#include "couch-kvstore/couch-group-commit-ops.h"
 #include "couch-kvstore/couch-kvstore-metadata.h"
+#include "couch-kvstore/couch-uring-ops.h"
 #include <platform/histogram.h>
 #include <platform/strerror.h>
 #include "logger.h"
@@ -433,6 +436,40 @@ protected:
     void close();
     bool commit2couchstore();
 
+    /**
+     * The requests of one vbucket in a transaction, which are saved and
+     * committed to its file together.
+     */
+    struct CommitBatch {
+        CommitBatch(uint16_t vb, uint64_t rev)
+            : vbid(vb), fileRev(rev), db(nullptr),
+              errCode(COUCHSTORE_SUCCESS), maxDBSeqno(0) {
+            kvctx.vbucket = vb;
+        }
+
+        uint16_t vbid;
+        uint64_t fileRev;
+        std::vector<CouchRequest *> reqs;
+        kvstats_ctx kvctx;
+        Db *db;
+        couchstore_error_t errCode;
+        uint64_t maxDBSeqno;
+    };
+
+    /**
+     * Commit the given batches, which are of distinct vbuckets, and run the
+     * callbacks of their requests once they're all durable.
+     *
+     * @return false if any of them couldn't be committed
+     */
+    bool commitGroup(std::vector<CommitBatch *> &group);
+
+    /**
+     * Save the documents of several vbuckets, sharing the syncs of their
+     * commits (see GroupCommitOps). Sets the errCode of each batch.
+     */
+    void saveDocsGroup(std::vector<CommitBatch *> &group);
+
     uint64_t checkNewRevNum(std::string &dbname, bool newFile = false);
     void populateFileNameMap(std::vector<std::string> &filenames,
                              std::vector<uint16_t> *vbids);
@@ -447,6 +484,20 @@ protected:
     couchstore_error_t saveDocs(uint16_t vbid, uint64_t rev, Doc **docs,
                                 DocInfo **docinfos, size_t docCount,
                                 kvstats_ctx &kvctx);
+
+    /**
+     * Save the given documents and the cached vbucket state to the open
+     * database and commit it.
+     */
+    couchstore_error_t writeDocs(Db *db, uint16_t vbid, Doc **docs,
+                                 DocInfo **docinfos, size_t docCount,
+                                 kvstats_ctx &kvctx, uint64_t &maxDBSeqno);
+
+    /**
+     * Refresh the cached file stats and persisted high seqno of the given
+     * vbucket from its (committed) database.
+     */
+    void updateDbInfo(Db *db, uint16_t vbid, uint64_t maxDBSeqno);
     void commitCallback(std::vector<CouchRequest *> &committedReqs,
                         kvstats_ctx &kvctx,
                         couchstore_error_t errCode);
@@ -454,6 +505,12 @@ protected:
     void setDocsCommitted(uint16_t docs);
     void closeDatabaseHandle(Db *db);
 
+    /**
+     * Create the chain of FileOpsInterface implementations the files are
+     * accessed through, on top of base_ops.
+     */
+    void createFileOps();
+
     /**
      * Unlink selected couch file, which will be removed by the OS,
      * once all its references close.
@@ -482,6 +539,15 @@ protected:
     uint16_t numDbFiles;
     std::vector<CouchRequest *> pendingReqsQ;
     bool intransaction;
+    // Time (us) spent in the syncs of the last commit, by the committing
+    // thread only (see io_commit_sync_time)
+    size_t lastCommitSyncTime;
+
+    /**
+     * FileOpsInterface implementation performing the file I/O through
+     * io_uring, wrapping base_ops; nullptr if not configured.
+     */
+    std::unique_ptr<UringFileOps> uringOps;
 
     /**
      * FileOpsInterface implementation for couchstore which tracks
@@ -499,6 +565,13 @@ protected:
      */
     std::unique_ptr<FileOpsInterface> statCollectingFileOpsCompaction;
 
+    /**
+     * FileOpsInterface implementation wrapping statCollectingFileOps, through
+     * which the files of a transaction spanning several vbuckets are
+     * committed, so they share their syncs.
+     */
+    std::unique_ptr<GroupCommitOps> groupCommitOps;
+
     /* deleted docs in each file, indexed by vBucket. RelaxedAtomic
        to allow stats access witout lock */
     std::vector<Couchbase::RelaxedAtomic<size_t>> cachedDeleteCount;
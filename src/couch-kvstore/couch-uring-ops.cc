@@ -0,0 +1,702 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-uring-ops.h"
+
+#ifdef HAVE_LIBURING
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <mutex>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <unistd.h>
+
+#include "utility.h"
+
+namespace {
+
+// Largest write gathered from a file's contiguous pwrite()s
+const size_t maxWriteSize = 1024 * 1024;
+
+ssize_t preadFully(int fd, char* buf, size_t nbytes, cs_off_t offset) {
+    size_t done = 0;
+    while (done < nbytes) {
+        ssize_t got = ::pread(fd, buf + done, nbytes - done, offset + done);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        } else if (got == 0) {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+ssize_t pwriteFully(int fd, const char* buf, size_t nbytes,
+                    cs_off_t offset) {
+    size_t done = 0;
+    while (done < nbytes) {
+        ssize_t written = ::pwrite(fd, buf + done, nbytes - done,
+                                   offset + done);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += written;
+    }
+    return done;
+}
+
+}
+
+struct UringFileOps::File {
+    File() : fd(-1), numQueued(0), bufferOffset(0), ioError(0) {}
+
+    /**
+     * Record the failure of a write which has already been returned from
+     * pwrite(), to be reported by the file's next call.
+     */
+    void setWriteError(int error, cs_off_t offset, size_t nbytes) {
+        LOG(EXTENSION_LOG_WARNING, "UringFileOps: write of %" PRIu64
+            " bytes at offset %" PRId64 " failed: %s",
+            uint64_t(nbytes), int64_t(offset), strerror(error));
+        if (ioError == 0) {
+            ioError = error;
+        }
+    }
+
+    /**
+     * Report (and clear) the error of a write already returned from.
+     */
+    couchstore_error_t takeError(couchstore_error_info_t* errinfo) {
+        if (ioError == 0) {
+            return COUCHSTORE_SUCCESS;
+        }
+        errinfo->error = ioError;
+        ioError = 0;
+        return COUCHSTORE_ERROR_WRITE;
+    }
+
+    int fd;
+    // Number of the file's operations queued to the ring
+    size_t numQueued;
+    // Contiguous writes not yet queued, starting at bufferOffset
+    std::vector<char> buffer;
+    cs_off_t bufferOffset;
+    // First error of the writes already returned from, not yet reported
+    int ioError;
+};
+
+/**
+ * The ring shared by the files, along with the operations queued to it.
+ * Everything but creating it is done with mutex held, as the operations
+ * completed by one file's call may be another file's.
+ */
+struct UringFileOps::Ring {
+    /**
+     * An operation queued to the ring. Its address is the ring entry's
+     * user data.
+     */
+    struct PendingIO {
+        enum class Type { Write, Read };
+
+        PendingIO(Type t, File* f, cs_off_t off)
+            : type(t), file(f), offset(off), read(nullptr) {}
+
+        Type type;
+        File* file;
+        cs_off_t offset;
+        // Write: the data, as couchstore reuses its buffers straight away
+        std::vector<char> data;
+        // Read: the request being served
+        ReadRequest* read;
+        // Position in the list of queued operations
+        std::list<PendingIO>::iterator self;
+    };
+
+    explicit Ring(unsigned int d)
+        : ready(io_uring_queue_init(d, &ring, 0) == 0),
+          created(ready), depth(d), numUnsubmitted(0) {}
+
+    ~Ring() {
+        if (created) {
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    /**
+     * Add a write to the file's gathered writes, queueing them first if
+     * the write doesn't follow on from them (or they're big enough).
+     */
+    void write(File& f, const char* buf, size_t nbytes, cs_off_t offset) {
+        if (!f.buffer.empty() &&
+            (offset != f.bufferOffset +
+                       static_cast<cs_off_t>(f.buffer.size()) ||
+             f.buffer.size() + nbytes > maxWriteSize)) {
+            queueWrite(f);
+        }
+        if (f.buffer.empty()) {
+            f.bufferOffset = offset;
+        }
+        f.buffer.insert(f.buffer.end(), buf, buf + nbytes);
+    }
+
+    /**
+     * Queue the file's gathered writes to the ring, or perform them right
+     * away should it have broken.
+     */
+    void queueWrite(File& f) {
+        if (f.buffer.empty()) {
+            return;
+        }
+        io_uring_sqe* sqe = ready ? getSqe() : nullptr;
+        if (sqe == nullptr) {
+            if (pwriteFully(f.fd, f.buffer.data(), f.buffer.size(),
+                            f.bufferOffset) < 0) {
+                f.setWriteError(errno, f.bufferOffset, f.buffer.size());
+            }
+            f.buffer.clear();
+            return;
+        }
+        PendingIO& io = track(PendingIO::Type::Write, f, f.bufferOffset);
+        io.data.swap(f.buffer);
+        io_uring_prep_write(sqe, f.fd, io.data.data(), io.data.size(),
+                            io.offset);
+        io_uring_sqe_set_data(sqe, &io);
+        ++numUnsubmitted;
+    }
+
+    /**
+     * Queue the reads to the ring (performing them right away should it
+     * have broken) and wait for them.
+     */
+    void read(File& f, std::vector<ReadRequest>& reqs) {
+        for (auto& req : reqs) {
+            io_uring_sqe* sqe = ready ? getSqe() : nullptr;
+            if (sqe == nullptr) {
+                readNow(f, req);
+                continue;
+            }
+            PendingIO& io = track(PendingIO::Type::Read, f, req.offset);
+            io.read = &req;
+            io_uring_prep_read(sqe, f.fd, req.buf, req.nbytes, req.offset);
+            io_uring_sqe_set_data(sqe, &io);
+            ++numUnsubmitted;
+        }
+        complete(f);
+    }
+
+    /**
+     * Wait for all of the file's operations, gathered writes included.
+     */
+    void complete(File& f) {
+        queueWrite(f);
+        if (f.numQueued == 0 || !submit()) {
+            return;
+        }
+        while (f.numQueued > 0 && completeOne()) {
+        }
+    }
+
+    bool overlapsWrite(const File& f, cs_off_t offset, size_t nbytes) const {
+        if (!f.buffer.empty() &&
+            offset < f.bufferOffset + static_cast<cs_off_t>(f.buffer.size()) &&
+            f.bufferOffset < offset + static_cast<cs_off_t>(nbytes)) {
+            return true;
+        }
+        if (f.numQueued == 0) {
+            return false;
+        }
+        for (const auto& io : queued) {
+            if (io.file == &f && io.type == PendingIO::Type::Write &&
+                offset < io.offset + static_cast<cs_off_t>(io.data.size()) &&
+                io.offset < offset + static_cast<cs_off_t>(nbytes)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Get a free entry of the ring, first waiting for an operation to
+     * complete if depth of them are queued.
+     *
+     * @return nullptr if the ring broke meanwhile
+     */
+    io_uring_sqe* getSqe() {
+        while (queued.size() >= depth) {
+            if (!submit() || !completeOne()) {
+                return nullptr;
+            }
+        }
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        while (sqe == nullptr) {
+            if (!submit()) {
+                return nullptr;
+            }
+            sqe = io_uring_get_sqe(&ring);
+        }
+        return sqe;
+    }
+
+    PendingIO& track(PendingIO::Type type, File& f, cs_off_t offset) {
+        queued.emplace_back(type, &f, offset);
+        PendingIO& io = queued.back();
+        io.self = std::prev(queued.end());
+        ++f.numQueued;
+        return io;
+    }
+
+    /**
+     * Submit the entries queued since the last submission.
+     *
+     * @return false if the ring broke
+     */
+    bool submit() {
+        if (numUnsubmitted == 0) {
+            return ready;
+        }
+        int ret;
+        do {
+            ret = io_uring_submit(&ring);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            breakRing();
+            return false;
+        }
+        numUnsubmitted = 0;
+        return true;
+    }
+
+    /**
+     * Wait for a submitted operation to complete.
+     *
+     * @return false if the ring broke
+     */
+    bool completeOne() {
+        io_uring_cqe* cqe;
+        int ret;
+        do {
+            ret = io_uring_wait_cqe(&ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            breakRing();
+            return false;
+        }
+
+        PendingIO* io = static_cast<PendingIO*>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        File& f = *io->file;
+        switch (io->type) {
+        case PendingIO::Type::Write:
+            if (res < 0) {
+                f.setWriteError(-res, io->offset, io->data.size());
+            } else if (static_cast<size_t>(res) < io->data.size()) {
+                // Short write; finish it here.
+                if (pwriteFully(f.fd, io->data.data() + res,
+                                io->data.size() - res,
+                                io->offset + res) < 0) {
+                    f.setWriteError(errno, io->offset, io->data.size());
+                }
+            }
+            break;
+        case PendingIO::Type::Read:
+        {
+            ReadRequest* req = io->read;
+            if (res < 0) {
+                req->result = COUCHSTORE_ERROR_READ;
+                break;
+            }
+            size_t got = res;
+            if (got > 0 && got < req->nbytes) {
+                // Short read; read the rest (if not at the end) here.
+                ssize_t more = preadFully(f.fd,
+                                          static_cast<char*>(req->buf) + got,
+                                          req->nbytes - got,
+                                          req->offset + got);
+                if (more > 0) {
+                    got += more;
+                }
+            }
+            req->result = got;
+            break;
+        }
+        }
+        --f.numQueued;
+        queued.erase(io->self);
+        return true;
+    }
+
+    /**
+     * Stop using the ring, which failed to submit or reap operations, and
+     * perform the queued ones (whose outcome is unknown) synchronously;
+     * redoing a read or write is harmless. The I/O is synchronous from now
+     * on.
+     */
+    void breakRing() {
+        ready = false;
+        for (auto& io : queued) {
+            File& f = *io.file;
+            switch (io.type) {
+            case PendingIO::Type::Write:
+                if (pwriteFully(f.fd, io.data.data(), io.data.size(),
+                                io.offset) < 0) {
+                    f.setWriteError(errno, io.offset, io.data.size());
+                }
+                break;
+            case PendingIO::Type::Read:
+                readNow(f, *io.read);
+                break;
+            }
+            f.numQueued = 0;
+        }
+        queued.clear();
+        numUnsubmitted = 0;
+    }
+
+    static void readNow(File& f, ReadRequest& req) {
+        req.result = preadFully(f.fd, static_cast<char*>(req.buf),
+                                req.nbytes, req.offset);
+        if (req.result < 0) {
+            req.result = COUCHSTORE_ERROR_READ;
+        }
+    }
+
+    std::mutex mutex;
+    // False if the ring couldn't be created, or has broken since
+    bool ready;
+    const bool created;
+    io_uring ring;
+    const unsigned int depth;
+    std::list<PendingIO> queued;
+    // Number of the queued entries not yet submitted
+    size_t numUnsubmitted;
+};
+
+UringFileOps::UringFileOps(FileOpsInterface& fallback,
+                           unsigned int depth)
+    : fallback_ops(fallback),
+      enabled(isAvailable()),
+      ring(enabled ? new Ring(depth) : nullptr) {
+}
+
+UringFileOps::~UringFileOps() {
+}
+
+bool UringFileOps::isAvailable() {
+    static const bool available = []() {
+        io_uring ring;
+        if (io_uring_queue_init(2, &ring, 0) != 0) {
+            return false;
+        }
+        io_uring_queue_exit(&ring);
+        return true;
+    }();
+    return available;
+}
+
+couch_file_handle UringFileOps::constructor(couchstore_error_info_t* errinfo) {
+    if (!enabled) {
+        return fallback_ops.constructor(errinfo);
+    }
+    return reinterpret_cast<couch_file_handle>(new File);
+}
+
+couchstore_error_t UringFileOps::open(couchstore_error_info_t* errinfo,
+                                      couch_file_handle* h,
+                                      const char* path,
+                                      int flags) {
+    if (!enabled) {
+        return fallback_ops.open(errinfo, h, path, flags);
+    }
+    File* f = reinterpret_cast<File*>(*h);
+    int fd;
+    do {
+        fd = ::open(path, flags, 0666);
+    } while (fd == -1 && errno == EINTR);
+
+    if (fd == -1) {
+        errinfo->error = errno;
+        return errno == ENOENT ? COUCHSTORE_ERROR_NO_SUCH_FILE :
+                                 COUCHSTORE_ERROR_OPEN_FILE;
+    }
+    f->fd = fd;
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t UringFileOps::close(couchstore_error_info_t* errinfo,
+                                       couch_file_handle h) {
+    if (!enabled) {
+        return fallback_ops.close(errinfo, h);
+    }
+    File* f = reinterpret_cast<File*>(h);
+    couchstore_error_t errCode;
+    {
+        std::lock_guard<std::mutex> lh(ring->mutex);
+        ring->complete(*f);
+        errCode = f->takeError(errinfo);
+    }
+    if (f->fd != -1) {
+        if (::close(f->fd) == -1 && errCode == COUCHSTORE_SUCCESS) {
+            errinfo->error = errno;
+            errCode = COUCHSTORE_ERROR_FILE_CLOSE;
+        }
+        f->fd = -1;
+    }
+    return errCode;
+}
+
+ssize_t UringFileOps::pread(couchstore_error_info_t* errinfo,
+                            couch_file_handle h,
+                            void* buf,
+                            size_t sz,
+                            cs_off_t off) {
+    if (!enabled) {
+        return fallback_ops.pread(errinfo, h, buf, sz, off);
+    }
+    File* f = reinterpret_cast<File*>(h);
+    {
+        std::lock_guard<std::mutex> lh(ring->mutex);
+        if (ring->overlapsWrite(*f, off, sz)) {
+            ring->complete(*f);
+        }
+    }
+    ssize_t got = preadFully(f->fd, static_cast<char*>(buf), sz, off);
+    if (got < 0) {
+        errinfo->error = errno;
+        return COUCHSTORE_ERROR_READ;
+    }
+    return got;
+}
+
+ssize_t UringFileOps::pwrite(couchstore_error_info_t* errinfo,
+                             couch_file_handle h,
+                             const void* buf,
+                             size_t sz,
+                             cs_off_t off) {
+    if (!enabled) {
+        return fallback_ops.pwrite(errinfo, h, buf, sz, off);
+    }
+    File* f = reinterpret_cast<File*>(h);
+    std::lock_guard<std::mutex> lh(ring->mutex);
+    couchstore_error_t errCode = f->takeError(errinfo);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        // An earlier write failed (and was logged); fail this one rather
+        // than carry on building on it.
+        return errCode;
+    }
+    ring->write(*f, static_cast<const char*>(buf), sz, off);
+    return sz;
+}
+
+cs_off_t UringFileOps::goto_eof(couchstore_error_info_t* errinfo,
+                                couch_file_handle h) {
+    if (!enabled) {
+        return fallback_ops.goto_eof(errinfo, h);
+    }
+    File* f = reinterpret_cast<File*>(h);
+    {
+        // The outstanding writes may extend the file.
+        std::lock_guard<std::mutex> lh(ring->mutex);
+        ring->complete(*f);
+    }
+    cs_off_t rv = ::lseek(f->fd, 0, SEEK_END);
+    if (rv < 0) {
+        errinfo->error = errno;
+        return COUCHSTORE_ERROR_READ;
+    }
+    return rv;
+}
+
+couchstore_error_t UringFileOps::sync(couchstore_error_info_t* errinfo,
+                                      couch_file_handle h) {
+    if (!enabled) {
+        return fallback_ops.sync(errinfo, h);
+    }
+    couchstore_error_t errCode = drainWrites(errinfo, h);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        return errCode;
+    }
+    File* f = reinterpret_cast<File*>(h);
+    int ret;
+    do {
+        ret = ::fdatasync(f->fd);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        errinfo->error = errno;
+        return COUCHSTORE_ERROR_WRITE;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t UringFileOps::drainWrites(couchstore_error_info_t* errinfo,
+                                             couch_file_handle h) {
+    if (!enabled) {
+        return COUCHSTORE_SUCCESS;
+    }
+    File* f = reinterpret_cast<File*>(h);
+    std::lock_guard<std::mutex> lh(ring->mutex);
+    ring->complete(*f);
+    return f->takeError(errinfo);
+}
+
+couchstore_error_t UringFileOps::advise(couchstore_error_info_t* errinfo,
+                                        couch_file_handle h,
+                                        cs_off_t offs,
+                                        cs_off_t len,
+                                        couchstore_file_advice_t adv) {
+    if (!enabled) {
+        return fallback_ops.advise(errinfo, h, offs, len, adv);
+    }
+    File* f = reinterpret_cast<File*>(h);
+    // couchstore's advice values are the POSIX ones; it's only a hint, so
+    // (like couchstore's own ops) failing to give it isn't an error.
+    ::posix_fadvise(f->fd, offs, len, static_cast<int>(adv));
+    return COUCHSTORE_SUCCESS;
+}
+
+void UringFileOps::destructor(couch_file_handle h) {
+    if (!enabled) {
+        fallback_ops.destructor(h);
+        return;
+    }
+    File* f = reinterpret_cast<File*>(h);
+    {
+        // Queued operations refer to the file.
+        std::lock_guard<std::mutex> lh(ring->mutex);
+        ring->complete(*f);
+    }
+    if (f->fd != -1) {
+        ::close(f->fd);
+    }
+    delete f;
+}
+
+couchstore_error_t UringFileOps::preadBatch(couchstore_error_info_t* errinfo,
+                                            couch_file_handle h,
+                                            std::vector<ReadRequest>& reqs) {
+    if (!enabled) {
+        return ::preadBatch(fallback_ops, errinfo, h, reqs);
+    }
+    File* f = reinterpret_cast<File*>(h);
+    std::lock_guard<std::mutex> lh(ring->mutex);
+    for (const auto& req : reqs) {
+        if (ring->overlapsWrite(*f, req.offset, req.nbytes)) {
+            ring->complete(*f);
+            break;
+        }
+    }
+    ring->read(*f, reqs);
+    return COUCHSTORE_SUCCESS;
+}
+
+#else
+
+struct UringFileOps::Ring {};
+
+UringFileOps::UringFileOps(FileOpsInterface& fallback,
+                           unsigned int depth)
+    : fallback_ops(fallback),
+      enabled(false) {
+}
+
+UringFileOps::~UringFileOps() {
+}
+
+bool UringFileOps::isAvailable() {
+    return false;
+}
+
+couch_file_handle UringFileOps::constructor(couchstore_error_info_t* errinfo) {
+    return fallback_ops.constructor(errinfo);
+}
+
+couchstore_error_t UringFileOps::open(couchstore_error_info_t* errinfo,
+                                      couch_file_handle* h,
+                                      const char* path,
+                                      int flags) {
+    return fallback_ops.open(errinfo, h, path, flags);
+}
+
+couchstore_error_t UringFileOps::close(couchstore_error_info_t* errinfo,
+                                       couch_file_handle h) {
+    return fallback_ops.close(errinfo, h);
+}
+
+ssize_t UringFileOps::pread(couchstore_error_info_t* errinfo,
+                            couch_file_handle h,
+                            void* buf,
+                            size_t sz,
+                            cs_off_t off) {
+    return fallback_ops.pread(errinfo, h, buf, sz, off);
+}
+
+ssize_t UringFileOps::pwrite(couchstore_error_info_t* errinfo,
+                             couch_file_handle h,
+                             const void* buf,
+                             size_t sz,
+                             cs_off_t off) {
+    return fallback_ops.pwrite(errinfo, h, buf, sz, off);
+}
+
+cs_off_t UringFileOps::goto_eof(couchstore_error_info_t* errinfo,
+                                couch_file_handle h) {
+    return fallback_ops.goto_eof(errinfo, h);
+}
+
+couchstore_error_t UringFileOps::sync(couchstore_error_info_t* errinfo,
+                                      couch_file_handle h) {
+    return fallback_ops.sync(errinfo, h);
+}
+
+couchstore_error_t UringFileOps::drainWrites(couchstore_error_info_t* errinfo,
+                                             couch_file_handle h) {
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t UringFileOps::advise(couchstore_error_info_t* errinfo,
+                                        couch_file_handle h,
+                                        cs_off_t offs,
+                                        cs_off_t len,
+                                        couchstore_file_advice_t adv) {
+    return fallback_ops.advise(errinfo, h, offs, len, adv);
+}
+
+void UringFileOps::destructor(couch_file_handle h) {
+    fallback_ops.destructor(h);
+}
+
+couchstore_error_t UringFileOps::preadBatch(couchstore_error_info_t* errinfo,
+                                            couch_file_handle h,
+                                            std::vector<ReadRequest>& reqs) {
+    return ::preadBatch(fallback_ops, errinfo, h, reqs);
+}
+
+#endif
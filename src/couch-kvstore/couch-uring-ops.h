@@ -0,0 +1,126 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_COUCH_KVSTORE_COUCH_URING_OPS_H_
+#define SRC_COUCH_KVSTORE_COUCH_URING_OPS_H_ 1
+
+#include "config.h"
+
+#include <memory>
+#include <vector>
+
+#include <libcouchstore/couch_db.h>
+
+#include "couch-kvstore/couch-batch-read.h"
+
+/**
+ * Implemented by the FileOpsInterface implementations whose writes may
+ * still be outstanding once pwrite() has returned.
+ */
+class WriteDrainInterface {
+public:
+    virtual ~WriteDrainInterface() {}
+
+    /**
+     * Wait for the file's outstanding writes to complete (without syncing
+     * them), so the cost of a following sync can be told from theirs.
+     *
+     * @return the error of an outstanding write, if any
+     */
+    virtual couchstore_error_t drainWrites(couchstore_error_info_t* errinfo,
+                                           couch_file_handle handle) = 0;
+};
+
+/**
+ * FileOpsInterface implementation performing couchstore's file I/O through
+ * io_uring (on Linux, when built with liburing).
+ *
+ * All the files opened through the object (i.e. a store's) share a single
+ * ring. A file's writes - couchstore mostly appends - are gathered into
+ * writes of up to 1MiB which are queued to the ring, and only submitted,
+ * all together, once the file is synced (or closed, read where written or
+ * looked for its end) or the ring is full; the sync waits for them, then
+ * syncs the file. A write which fails is logged with its offset and size,
+ * and its error returned by the file's next pwrite, sync or close. Batched
+ * reads (preadBatch) are all in flight at once.
+ *
+ * Should the ring not be created the I/O is simply synchronous, as it also
+ * becomes should the ring fail later (the operations then queued are redone
+ * synchronously). Where io_uring is not available at all every call is
+ * passed to the fallback ops (couchstore's default ones) as is.
+ */
+class UringFileOps : public FileOpsInterface, public BatchReadInterface,
+                     public WriteDrainInterface {
+public:
+    explicit UringFileOps(FileOpsInterface& fallback,
+                          unsigned int queueDepth = 64);
+
+    ~UringFileOps();
+
+    /**
+     * Whether io_uring can be used by this process.
+     */
+    static bool isAvailable();
+
+    /**
+     * Whether the files are read and written through io_uring rather than
+     * the fallback ops.
+     */
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override;
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle, const char* path,
+                            int oflag) override;
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override;
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle, void* buf, size_t nbytes,
+                  cs_off_t offset) override;
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle, const void* buf,
+                   size_t nbytes, cs_off_t offset) override;
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override;
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override;
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle, cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override;
+    void destructor(couch_file_handle handle) override;
+
+    couchstore_error_t preadBatch(couchstore_error_info_t* errinfo,
+                                  couch_file_handle handle,
+                                  std::vector<ReadRequest>& reqs) override;
+
+    couchstore_error_t drainWrites(couchstore_error_info_t* errinfo,
+                                   couch_file_handle handle) override;
+
+private:
+    struct File;
+    struct Ring;
+
+    FileOpsInterface& fallback_ops;
+    const bool enabled;
+    // Shared by all the files; nullptr if not enabled
+    std::unique_ptr<Ring> ring;
+};
+
+#endif  // SRC_COUCH_KVSTORE_COUCH_URING_OPS_H_
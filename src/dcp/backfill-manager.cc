@@ -17,6 +17,9 @@
 
 #include <phosphor/phosphor.h>
 #include "config.h"
+
+#include <algorithm>
+
 #include "ep_engine.h"
 #include "connmap.h"
 #include "dcp/backfill-manager.h"
@@ -62,7 +65,7 @@ bool BackfillManagerTask::run() {
         return false;
     }
 
-    backfill_status_t status = manager->backfill();
+    backfill_status_t status = manager->backfill(getId());
     if (status == backfill_finished) {
         return false;
     } else if (status == backfill_snooze) {
@@ -83,14 +86,17 @@ std::string BackfillManagerTask::getDescription() {
 }
 
 BackfillManager::BackfillManager(EventuallyPersistentEngine* e)
-    : engine(e), managerTask(NULL) {
+    : engine(e), numRunning(0) {
 
     Configuration& config = e->getConfiguration();
 
-    scanBuffer.bytesRead = 0;
-    scanBuffer.itemsRead = 0;
-    scanBuffer.maxBytes = config.getDcpScanByteLimit();
-    scanBuffer.maxItems = config.getDcpScanItemLimit();
+    size_t numShards = e->getEpStore()->getVBuckets().getNumShards();
+    maxRunning = std::min(config.getDcpBackfillShardConcurrency(), numShards);
+    busyShards.assign(numShards, false);
+
+    scanBuffers.assign(numShards, ScanBuffer{0, 0});
+    scanMaxBytes = config.getDcpScanByteLimit();
+    scanMaxItems = config.getDcpScanItemLimit();
 
     buffer.bytesRead = 0;
     buffer.maxBytes = config.getDcpBackfillByteLimit();
@@ -105,15 +111,16 @@ void BackfillManager::addStats(connection_t conn, ADD_STAT add_stat,
     conn->addStat("backfill_buffer_max_bytes", buffer.maxBytes, add_stat, c);
     conn->addStat("backfill_buffer_full", buffer.full, add_stat, c);
     conn->addStat("backfill_num_active", activeBackfills.size(), add_stat, c);
+    conn->addStat("backfill_num_running", numRunning, add_stat, c);
     conn->addStat("backfill_num_snoozing", snoozingBackfills.size(), add_stat, c);
     conn->addStat("backfill_num_pending", pendingBackfills.size(), add_stat, c);
 }
 
 BackfillManager::~BackfillManager() {
-    if (managerTask) {
-        managerTask->cancel();
-        managerTask.reset();
+    for (auto& task : managerTasks) {
+        task->cancel();
     }
+    managerTasks.clear();
 
     while (!activeBackfills.empty()) {
         DCPBackfill* backfill = activeBackfills.front();
@@ -148,41 +155,49 @@ void BackfillManager::schedule(stream_t stream, uint64_t start, uint64_t end) {
         pendingBackfills.push_back(new DCPBackfill(engine, stream, start, end));
     }
 
-    if (managerTask && !managerTask->isdead()) {
-        ExecutorPool::get()->wake(managerTask->getId());
-        return;
+    // Another task only helps if it would have a shard to backfill
+    if (managerTasks.size() < maxRunning && hasIdleShardBackfill_UNLOCKED()) {
+        addTask_UNLOCKED();
+    } else {
+        wakeUpTasks_UNLOCKED();
     }
-
-    managerTask.reset(new BackfillManagerTask(engine, shared_from_this()));
-    ExecutorPool::get()->schedule(managerTask, AUXIO_TASK_IDX);
 }
 
-bool BackfillManager::bytesRead(uint32_t bytes) {
+bool BackfillManager::bytesRead(uint16_t vbid, uint32_t bytes,
+                                bool scanLimited) {
+    size_t shard = getShardId(vbid);
     LockHolder lh(lock);
-    if (scanBuffer.itemsRead >= scanBuffer.maxItems) {
-        return false;
-    }
+    ScanBuffer& scanBuffer = scanBuffers[shard];
+    if (scanLimited) {
+        if (scanBuffer.itemsRead >= scanMaxItems) {
+            return false;
+        }
 
-    // Always allow an item to be backfilled if the scan buffer is empty,
-    // otherwise check to see if there is room for the item.
-    if (scanBuffer.bytesRead + bytes <= scanBuffer.maxBytes ||
-        scanBuffer.bytesRead == 0) {
-        scanBuffer.bytesRead += bytes;
-    } else {
-        /* Subsequent items for this backfill will be read in next run */
-        return false;
+        // Always allow an item to be backfilled if the scan buffer is
+        // empty, otherwise check to see if there is room for the item.
+        if (scanBuffer.bytesRead + bytes <= scanMaxBytes ||
+            scanBuffer.bytesRead == 0) {
+            scanBuffer.bytesRead += bytes;
+        } else {
+            /* Subsequent items for this backfill will be read in next run */
+            return false;
+        }
     }
 
     if (buffer.bytesRead == 0 || buffer.bytesRead + bytes <= buffer.maxBytes) {
         buffer.bytesRead += bytes;
     } else {
-        scanBuffer.bytesRead -= bytes;
+        if (scanLimited) {
+            scanBuffer.bytesRead -= bytes;
+        }
         buffer.full = true;
         buffer.nextReadSize = bytes;
         return false;
     }
 
-    scanBuffer.itemsRead++;
+    if (scanLimited) {
+        scanBuffer.itemsRead++;
+    }
 
     return true;
 }
@@ -203,19 +218,17 @@ void BackfillManager::bytesSent(uint32_t bytes) {
         if (canFitNext && enoughCleared) {
             buffer.nextReadSize = 0;
             buffer.full = false;
-            if (managerTask) {
-                ExecutorPool::get()->wake(managerTask->getId());
-            }
+            wakeUpTasks_UNLOCKED();
         }
     }
 }
 
-backfill_status_t BackfillManager::backfill() {
+backfill_status_t BackfillManager::backfill(size_t taskId) {
     LockHolder lh(lock);
 
     if (activeBackfills.empty() && snoozingBackfills.empty()
         && pendingBackfills.empty()) {
-        managerTask.reset();
+        removeTask_UNLOCKED(taskId);
         return backfill_finished;
     }
 
@@ -258,15 +271,39 @@ backfill_status_t BackfillManager::backfill() {
         return reschedule ? backfill_success : backfill_snooze;
     }
 
-    DCPBackfill* backfill = activeBackfills.front();
-    activeBackfills.pop_front();
+    // Run the first backfill of a shard no other task is backfilling
+    std::list<DCPBackfill*>::iterator next = activeBackfills.begin();
+    while (next != activeBackfills.end() &&
+           busyShards[getShardId((*next)->getVBucketId())]) {
+        ++next;
+    }
+    if (next == activeBackfills.end()) {
+        if (managerTasks.size() > 1) {
+            // There are more tasks than shards to backfill
+            removeTask_UNLOCKED(taskId);
+            return backfill_finished;
+        }
+        return backfill_snooze;
+    }
+
+    DCPBackfill* backfill = *next;
+    activeBackfills.erase(next);
+    size_t shard = getShardId(backfill->getVBucketId());
+    busyShards[shard] = true;
+    scanBuffers[shard] = ScanBuffer{0, 0};
+    ++numRunning;
+
+    if (managerTasks.size() < maxRunning && hasIdleShardBackfill_UNLOCKED()) {
+        addTask_UNLOCKED();
+    }
 
     lh.unlock();
     backfill_status_t status = backfill->run();
     lh.lock();
 
-    scanBuffer.bytesRead = 0;
-    scanBuffer.itemsRead = 0;
+    busyShards[shard] = false;
+    scanBuffers[shard] = ScanBuffer{0, 0};
+    --numRunning;
 
     if (status == backfill_success) {
         activeBackfills.push_back(backfill);
@@ -317,9 +354,39 @@ void BackfillManager::moveToActiveQueue() {
     }
 }
 
+size_t BackfillManager::getShardId(uint16_t vbid) {
+    return engine->getEpStore()->getVBuckets().getShardByVbId(vbid)->getId();
+}
+
+bool BackfillManager::hasIdleShardBackfill_UNLOCKED() {
+    auto onIdleShard = [this](DCPBackfill* bf) {
+        return !busyShards[getShardId(bf->getVBucketId())];
+    };
+    return std::any_of(activeBackfills.begin(), activeBackfills.end(),
+                       onIdleShard) ||
+           std::any_of(pendingBackfills.begin(), pendingBackfills.end(),
+                       onIdleShard);
+}
+
+void BackfillManager::addTask_UNLOCKED() {
+    ExTask task = new BackfillManagerTask(engine, shared_from_this());
+    managerTasks.push_back(task);
+    ExecutorPool::get()->schedule(task, AUXIO_TASK_IDX);
+}
+
+void BackfillManager::removeTask_UNLOCKED(size_t taskId) {
+    managerTasks.remove_if([taskId](const ExTask& task) {
+        return task->getId() == taskId;
+    });
+}
+
+void BackfillManager::wakeUpTasks_UNLOCKED() {
+    for (auto& task : managerTasks) {
+        ExecutorPool::get()->wake(task->getId());
+    }
+}
+
 void BackfillManager::wakeUpTask() {
     LockHolder lh(lock);
-    if (managerTask) {
-        ExecutorPool::get()->wake(managerTask->getId());
-    }
+    wakeUpTasks_UNLOCKED();
 }
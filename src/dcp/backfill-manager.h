@@ -36,16 +36,27 @@
  * sufficiently drained (by sending to the client), backfilling can be
  * resumed.
  *
+ * Backfills of vbuckets on different shards (which have their own files
+ * and reader threads) are run at the same time, by up to
+ * dcp_backfill_shard_concurrency BackfillManagerTasks; there is never more
+ * than one backfill of a shard running, and the scan limits apply to each
+ * shard.
+ *
  * Significant configuration parameters affecting backfill:
  * - dcp_scan_byte_limit
  * - dcp_scan_item_limit
  * - dcp_backfill_byte_limit
+ * - dcp_backfill_shard_concurrency
  */
 
 #ifndef SRC_DCP_BACKFILL_MANAGER_H_
 #define SRC_DCP_BACKFILL_MANAGER_H_ 1
 
 #include "config.h"
+
+#include <list>
+#include <vector>
+
 #include "connmap.h"
 #include "dcp/backfill.h"
 #include "dcp/producer.h"
@@ -63,13 +74,21 @@ public:
 
     void schedule(stream_t stream, uint64_t start, uint64_t end);
 
-    bool bytesRead(uint32_t bytes);
+    /**
+     * Account for an item read by a backfill of vbucket vbid.
+     *
+     * @param scanLimited whether the item counts towards the limits of the
+     *        shard's current scan; it doesn't when read by the backfill of
+     *        another connection sharing the scan (see SharedBackfillScan)
+     * @return false if the item doesn't fit in the buffers
+     */
+    bool bytesRead(uint16_t vbid, uint32_t bytes, bool scanLimited = true);
 
     void bytesSent(uint32_t bytes);
 
-    // Called by the managerTask to acutally perform backfilling & manage
+    // Called by the managerTasks to acutally perform backfilling & manage
     // backfills between the different queues.
-    backfill_status_t backfill();
+    backfill_status_t backfill(size_t taskId);
 
     void wakeUpTask();
 
@@ -77,6 +96,18 @@ private:
 
     void moveToActiveQueue();
 
+    size_t getShardId(uint16_t vbid);
+
+    //! Whether an active or pending backfill is of a shard no task is
+    //! backfilling
+    bool hasIdleShardBackfill_UNLOCKED();
+
+    void addTask_UNLOCKED();
+
+    void removeTask_UNLOCKED(size_t taskId);
+
+    void wakeUpTasks_UNLOCKED();
+
     std::mutex lock;
     std::list<DCPBackfill*> activeBackfills;
     std::list<std::pair<rel_time_t, DCPBackfill*> > snoozingBackfills;
@@ -84,15 +115,22 @@ private:
     //!   threshold we use waitingBackfills
     std::list<DCPBackfill*> pendingBackfills;
     EventuallyPersistentEngine* engine;
-    ExTask managerTask;
-
-    //! The scan buffer is for the current stream being backfilled
-    struct {
+    std::list<ExTask> managerTasks;
+    //! Max number of managerTasks, and so of backfills run at once
+    size_t maxRunning;
+    //! Whether a backfill of each shard is being run
+    std::vector<bool> busyShards;
+    size_t numRunning;
+
+    //! The scan buffer is for the current stream being backfilled, one
+    //! per shard
+    struct ScanBuffer {
         uint32_t bytesRead;
         uint32_t itemsRead;
-        uint32_t maxBytes;
-        uint32_t maxItems;
-    } scanBuffer;
+    };
+    std::vector<ScanBuffer> scanBuffers;
+    uint32_t scanMaxBytes;
+    uint32_t scanMaxItems;
 
     //! The buffer is the total bytes used by all backfills for this connection
     struct {
@@ -17,8 +17,11 @@
 
 #include "config.h"
 
+#include <algorithm>
+
 #include "ep_engine.h"
 #include "dcp/backfill.h"
+#include "dcp/dcpconnmap.h"
 #include "dcp/stream.h"
 
 static std::string backfillStateToString(backfill_state_t state) {
@@ -38,7 +41,8 @@ static std::string backfillStateToString(backfill_state_t state) {
 
 CacheCallback::CacheCallback(EventuallyPersistentEngine* e, stream_t &s)
     : engine_(e),
-      stream_(s) {
+      stream_(s),
+      scanLimited(true) {
     if (stream_.get() == nullptr) {
         throw std::invalid_argument("CacheCallback(): stream is NULL");
     }
@@ -77,7 +81,7 @@ void CacheCallback::callback(CacheLookup &lookup) {
             return;
         }
         lh.unlock();
-        if (!as->backfillReceived(it, BACKFILL_FROM_MEMORY)) {
+        if (!as->backfillReceived(it, BACKFILL_FROM_MEMORY, scanLimited)) {
             setStatus(ENGINE_ENOMEM); // Pause the backfill
         } else {
             setStatus(ENGINE_KEY_EEXISTS);
@@ -112,10 +116,297 @@ void DiskCallback::callback(GetValue &val) {
     }
 }
 
+SharedBackfillScan::Subscription::Subscription(EventuallyPersistentEngine* e,
+                                               stream_t& s, uint64_t start)
+    : stream(s), startSeqno(start), lastSeqno(0), cacheCallback(e, s),
+      detached(false), splitOff(false) {
+}
+
+class SharedBackfillScan::FanOutCacheCallback : public Callback<CacheLookup> {
+public:
+    FanOutCacheCallback(SharedBackfillScan& s) : scan(s) {}
+
+    void callback(CacheLookup& lookup) {
+        scan.cacheLookup(lookup, *this);
+    }
+
+private:
+    SharedBackfillScan& scan;
+};
+
+class SharedBackfillScan::FanOutDiskCallback : public Callback<GetValue> {
+public:
+    FanOutDiskCallback(SharedBackfillScan& s) : scan(s) {}
+
+    void callback(GetValue& val) {
+        scan.diskItem(val, *this);
+    }
+
+private:
+    SharedBackfillScan& scan;
+};
+
+SharedBackfillScan::SharedBackfillScan(EventuallyPersistentEngine* e,
+                                       uint16_t vb, ValueFilter filter,
+                                       uint64_t snapEnd)
+    : engine(e), vbid(vb), valFilter(filter), snapshotEnd(snapEnd),
+      scanCtx(nullptr), opened(false), status(Status::MORE),
+      driver(nullptr) {
+}
+
+SharedBackfillScan::~SharedBackfillScan() {
+    if (scanCtx) {
+        engine->getEpStore()->getROUnderlying(vbid)->destroyScanContext(
+                                                                    scanCtx);
+    }
+}
+
+std::shared_ptr<SharedBackfillScan::Subscription> SharedBackfillScan::attach(
+                            stream_t& stream, uint64_t start, uint64_t end) {
+    std::lock_guard<std::mutex> lh(lock);
+    if (status != Status::MORE) {
+        return nullptr;
+    }
+
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    if (opened) {
+        if (start < scanCtx->startSeqno || start <= scanCtx->lastReadSeqno ||
+            end > scanCtx->maxSeqno) {
+            return nullptr;
+        }
+        as->incrBackfillRemaining(scanCtx->documentCount);
+        as->markDiskSnapshot(start, scanCtx->maxSeqno);
+    }
+
+    pruneSubscriptions();
+
+    std::shared_ptr<Subscription> sub =
+                            std::make_shared<Subscription>(engine, stream,
+                                                           start);
+    subscriptions.push_back(sub);
+    return sub;
+}
+
+SharedBackfillScan::Status SharedBackfillScan::run(
+                                            const Subscription& caller) {
+    std::lock_guard<std::mutex> lh(lock);
+    pruneSubscriptions();
+
+    if (status != Status::MORE) {
+        return status;
+    }
+
+    if (caller.isSplitOff()) {
+        // Split off by another backfill since checking; its next run
+        // carries on without this scan.
+        return Status::MORE;
+    }
+
+    if (!opened) {
+        opened = true;
+        if (subscriptions.empty()) {
+            status = Status::DONE;
+            return status;
+        }
+
+        uint64_t start = subscriptions.front()->startSeqno;
+        for (const auto& sub : subscriptions) {
+            start = std::min(start, sub->startSeqno);
+        }
+
+        std::shared_ptr<Callback<GetValue> > cb(new FanOutDiskCallback(*this));
+        std::shared_ptr<Callback<CacheLookup> > cl(
+                                            new FanOutCacheCallback(*this));
+        KVStore* kvstore = engine->getEpStore()->getROUnderlying(vbid);
+        scanCtx = kvstore->initScanContext(cb, cl, vbid, start,
+                                           DocumentFilter::ALL_ITEMS,
+                                           valFilter);
+        if (!scanCtx) {
+            status = Status::OPEN_FAILED;
+            return status;
+        }
+
+        if (snapshotEnd != 0) {
+            // Carrying on a snapshot already marked (and counted) on the
+            // stream.
+            return Status::MORE;
+        }
+        for (const auto& sub : subscriptions) {
+            ActiveStream* as = static_cast<ActiveStream*>(sub->stream.get());
+            as->incrBackfillRemaining(scanCtx->documentCount);
+            as->markDiskSnapshot(sub->startSeqno, scanCtx->maxSeqno);
+        }
+        return Status::MORE;
+    }
+
+    driver = &caller;
+    KVStore* kvstore = engine->getEpStore()->getROUnderlying(vbid);
+    scan_error_t error = kvstore->scan(scanCtx);
+    driver = nullptr;
+    if (error == scan_again) {
+        return Status::MORE;
+    }
+
+    status = Status::DONE;
+    return status;
+}
+
+uint64_t SharedBackfillScan::getSnapshotEnd() {
+    std::lock_guard<std::mutex> lh(lock);
+    if (snapshotEnd != 0) {
+        return snapshotEnd;
+    }
+    return scanCtx ? scanCtx->maxSeqno : 0;
+}
+
+bool SharedBackfillScan::beyondSnapshot(uint64_t seqno) const {
+    return snapshotEnd != 0 && seqno > snapshotEnd;
+}
+
+void SharedBackfillScan::pruneSubscriptions() {
+    subscriptions.erase(
+            std::remove_if(subscriptions.begin(), subscriptions.end(),
+                           [](const std::shared_ptr<Subscription>& sub) {
+                               return sub->detached.load() ||
+                                      sub->splitOff.load();
+                           }),
+            subscriptions.end());
+}
+
+bool SharedBackfillScan::refused(Subscription& sub, uint64_t seqno) {
+    if (&sub == driver) {
+        return true;
+    }
+
+    sub.splitOff.store(true);
+    ActiveStream* as = static_cast<ActiveStream*>(sub.stream.get());
+    as->getLogger().log(EXTENSION_LOG_NOTICE,
+        "(vb %d) Backfill split off a shared disk scan at seqno %" PRIu64
+        " as its stream's buffer is full", vbid, seqno);
+    return false;
+}
+
+void SharedBackfillScan::cacheLookup(CacheLookup& lookup,
+                                     Callback<CacheLookup>& result) {
+    uint64_t seqno = lookup.getBySeqno();
+    bool needDisk = false;
+    for (const auto& sub : subscriptions) {
+        if (sub->detached.load() || sub->splitOff.load() ||
+            seqno < sub->startSeqno || seqno <= sub->lastSeqno ||
+            beyondSnapshot(seqno)) {
+            continue;
+        }
+
+        sub->cacheCallback.setScanLimited(sub.get() == driver);
+        sub->cacheCallback.callback(lookup);
+        int status = sub->cacheCallback.getStatus();
+        if (status == ENGINE_KEY_EEXISTS) {
+            sub->lastSeqno = seqno;
+        } else if (status == ENGINE_ENOMEM) {
+            if (refused(*sub, seqno)) {
+                // Pause the scan; the streams which have taken the item
+                // already won't be given it again.
+                result.setStatus(ENGINE_ENOMEM);
+                return;
+            }
+        } else {
+            needDisk = true;
+        }
+    }
+
+    result.setStatus(needDisk ? ENGINE_SUCCESS : ENGINE_KEY_EEXISTS);
+}
+
+void SharedBackfillScan::diskItem(GetValue& val, Callback<GetValue>& result) {
+    if (val.getValue() == nullptr) {
+        throw std::invalid_argument("SharedBackfillScan::diskItem: "
+                                    "val is NULL");
+    }
+
+    std::unique_ptr<Item> itm(val.getValue());
+    uint64_t seqno = itm->getBySeqno();
+
+    std::vector<Subscription*> wanting;
+    for (const auto& sub : subscriptions) {
+        if (!sub->detached.load() && !sub->splitOff.load() &&
+            seqno >= sub->startSeqno && seqno > sub->lastSeqno &&
+            !beyondSnapshot(seqno)) {
+            wanting.push_back(sub.get());
+        }
+    }
+
+    // Every stream gets its own Item, all of them sharing the value; the
+    // last one gets the one read.
+    for (size_t ii = 0; ii < wanting.size(); ++ii) {
+        Subscription* sub = wanting[ii];
+        Item* copy = (ii + 1 == wanting.size()) ? itm.release()
+                                                : new Item(*itm);
+        ActiveStream* as = static_cast<ActiveStream*>(sub->stream.get());
+        if (as->backfillReceived(copy, BACKFILL_FROM_DISK,
+                                 sub == driver)) {
+            sub->lastSeqno = seqno;
+        } else if (refused(*sub, seqno)) {
+            result.setStatus(ENGINE_ENOMEM); // Pause the scan
+            return;
+        }
+    }
+
+    result.setStatus(ENGINE_SUCCESS);
+}
+
+std::shared_ptr<SharedBackfillScan> SharedBackfillScanMap::attach(
+                    EventuallyPersistentEngine* e, stream_t& stream,
+                    uint64_t start, uint64_t end, ValueFilter filter,
+                    bool share,
+                    std::shared_ptr<SharedBackfillScan::Subscription>&
+                            subscription) {
+    uint16_t vb = stream->getVBucket();
+    if (share) {
+        std::vector<std::shared_ptr<SharedBackfillScan>> candidates;
+        {
+            std::lock_guard<std::mutex> lh(lock);
+            auto range = scans.equal_range(vb);
+            for (auto it = range.first; it != range.second;) {
+                std::shared_ptr<SharedBackfillScan> scan = it->second.lock();
+                if (!scan) {
+                    it = scans.erase(it);
+                    continue;
+                }
+                ++it;
+                if (scan->getValueFilter() == filter) {
+                    candidates.push_back(scan);
+                }
+            }
+        }
+
+        // Attaching waits for a running scan to finish its batch, so is
+        // done without the map locked.
+        for (const auto& scan : candidates) {
+            subscription = scan->attach(stream, start, end);
+            if (subscription) {
+                ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+                as->getLogger().log(EXTENSION_LOG_NOTICE,
+                    "(vb %d) Backfill (%" PRIu64 " to %" PRIu64 ") joined a "
+                    "shared disk scan", vb, start, end);
+                return scan;
+            }
+        }
+    }
+
+    std::shared_ptr<SharedBackfillScan> scan =
+                        std::make_shared<SharedBackfillScan>(e, vb, filter);
+    subscription = scan->attach(stream, start, end);
+    if (share) {
+        std::lock_guard<std::mutex> lh(lock);
+        scans.insert(std::make_pair(vb, std::weak_ptr<SharedBackfillScan>(scan)));
+    }
+    return scan;
+}
+
 DCPBackfill::DCPBackfill(EventuallyPersistentEngine* e, stream_t s,
                          uint64_t start_seqno, uint64_t end_seqno)
     : engine(e), stream(s),startSeqno(start_seqno), endSeqno(end_seqno),
-      scanCtx(NULL), state(backfill_state_init) {
+      state(backfill_state_init) {
     if (stream->getType() != STREAM_ACTIVE) {
         throw std::invalid_argument("DCPBackfill(): stream->getType() "
                 "(which is " + std::to_string(stream->getType()) +
@@ -170,7 +461,6 @@ backfill_status_t DCPBackfill::create() {
         return backfill_snooze;
     }
 
-    KVStore* kvstore = engine->getEpStore()->getROUnderlying(vbid);
     ValueFilter valFilter = ValueFilter::VALUES_DECOMPRESSED;
     if (as->isSendMutationKeyOnlyEnabled()) {
         valFilter = ValueFilter::KEYS_ONLY;
@@ -180,45 +470,59 @@ backfill_status_t DCPBackfill::create() {
         }
     }
 
-    std::shared_ptr<Callback<GetValue> > cb(new DiskCallback(stream));
-    std::shared_ptr<Callback<CacheLookup> > cl(new CacheCallback(engine, stream));
-    scanCtx = kvstore->initScanContext(cb, cl, vbid, startSeqno,
-                                       DocumentFilter::ALL_ITEMS, valFilter);
+    bool share = engine->getConfiguration().isDcpBackfillSharedScans();
+    sharedScan = engine->getDcpConnMap().getBackfillScans().attach(
+                        engine, stream, startSeqno, endSeqno, valFilter,
+                        share, subscription);
+    transitionState(backfill_state_scanning);
 
-    if (scanCtx) {
-        as->incrBackfillRemaining(scanCtx->documentCount);
-        as->markDiskSnapshot(startSeqno, scanCtx->maxSeqno);
-        transitionState(backfill_state_scanning);
-    } else {
-        transitionState(backfill_state_done);
-    }
-
-    return backfill_success;
+    // Open the scan (or, having joined one, carry on with it) right away
+    return scan();
 }
 
 backfill_status_t DCPBackfill::scan() {
-    uint16_t vbid = stream->getVBucket();
-
     if (!(stream->isActive())) {
         return complete(true);
     }
 
-    KVStore* kvstore = engine->getEpStore()->getROUnderlying(vbid);
-    scan_error_t error = kvstore->scan(scanCtx);
-
-    if (error == scan_again) {
-        return backfill_success;
+    if (subscription->isSplitOff()) {
+        // The shared scan went on without the stream; carry on from the
+        // first item it didn't take with a scan of its own, within the
+        // disk snapshot already sent to the stream.
+        uint64_t resumeSeqno = subscription->getResumeSeqno();
+        uint64_t snapshotEnd = sharedScan->getSnapshotEnd();
+        ValueFilter valFilter = sharedScan->getValueFilter();
+        subscription->detach();
+        sharedScan = std::make_shared<SharedBackfillScan>(
+                            engine, stream->getVBucket(), valFilter,
+                            snapshotEnd);
+        subscription = sharedScan->attach(stream, resumeSeqno, endSeqno);
     }
 
-    transitionState(backfill_state_completing);
+    switch (sharedScan->run(*subscription)) {
+        case SharedBackfillScan::Status::MORE:
+            return backfill_success;
+        case SharedBackfillScan::Status::DONE:
+            transitionState(backfill_state_completing);
+            return backfill_success;
+        case SharedBackfillScan::Status::OPEN_FAILED:
+            subscription->detach();
+            subscription.reset();
+            sharedScan.reset();
+            transitionState(backfill_state_done);
+            return backfill_success;
+    }
 
-    return backfill_success;
+    throw std::logic_error("DCPBackfill::scan: Invalid shared scan status");
 }
 
 backfill_status_t DCPBackfill::complete(bool cancelled) {
     uint16_t vbid = stream->getVBucket();
-    KVStore* kvstore = engine->getEpStore()->getROUnderlying(vbid);
-    kvstore->destroyScanContext(scanCtx);
+    if (subscription) {
+        subscription->detach();
+        subscription.reset();
+    }
+    sharedScan.reset();
 
     ActiveStream* as = static_cast<ActiveStream*>(stream.get());
     as->completeBackfill();
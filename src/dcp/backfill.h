@@ -20,8 +20,15 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "callbacks.h"
 #include "dcp/stream.h"
+#include "kvstore.h"
 
 class EventuallyPersistentEngine;
 class ScanContext;
@@ -45,9 +52,18 @@ public:
 
     void callback(CacheLookup &lookup);
 
+    /**
+     * Set whether the items found count towards the limits of the
+     * connection's current disk scan (see BackfillManager::bytesRead()).
+     */
+    void setScanLimited(bool limited) {
+        scanLimited = limited;
+    }
+
 private:
     EventuallyPersistentEngine* engine_;
     stream_t stream_;
+    bool scanLimited;
 };
 
 class DiskCallback : public Callback<GetValue> {
@@ -60,6 +76,186 @@ private:
     stream_t stream_;
 };
 
+/**
+ * A scan of a vbucket's disk snapshot which feeds the backfills of all the
+ * streams (of any connections) attached to it, so that streams backfilling
+ * overlapping seqno ranges of the vbucket at the same time - replicas and
+ * indexers after a restart or failover, say - read the file once.
+ *
+ * The scan starts at the lowest start seqno of the streams attached before
+ * it is opened; a stream may also join while it is under way, as long as
+ * the scan hasn't read past the stream's start seqno yet. Each stream only
+ * gets the items from its own start seqno on.
+ *
+ * The scan is driven by the DCPBackfill of every attached stream, one at a
+ * time, and is destroyed with the last of them. Only the items given to the
+ * driving stream count towards the scan limits of its connection. Should
+ * the driving stream's backfill buffer be full the scan pauses, and is
+ * resumed from the item it stopped at by the next run of any of the
+ * backfills; the streams which had already taken that item don't get it
+ * again. A stream whose buffer is full while another drives is split off
+ * instead, so as not to hold the others up: its backfill carries on from
+ * the first item it didn't take with a scan of its own, which no other
+ * stream joins. That scan carries on the disk snapshot already marked on
+ * the stream, up to its end seqno, rather than starting a new one.
+ */
+class SharedBackfillScan {
+public:
+    /**
+     * A stream's attachment to the scan.
+     */
+    class Subscription {
+    public:
+        Subscription(EventuallyPersistentEngine* e, stream_t& s,
+                     uint64_t start);
+
+        /**
+         * Stop feeding the stream. Safe to call with any lock held.
+         */
+        void detach() {
+            detached.store(true);
+        }
+
+        /**
+         * Whether the scan has gone on without the stream, as it couldn't
+         * take an item while another stream's backfill drove the scan.
+         */
+        bool isSplitOff() const {
+            return splitOff.load();
+        }
+
+        /**
+         * The seqno the stream's backfill is to carry on from once split
+         * off the scan.
+         */
+        uint64_t getResumeSeqno() const {
+            return std::max(startSeqno, lastSeqno + 1);
+        }
+
+    private:
+        friend class SharedBackfillScan;
+
+        stream_t stream;
+        uint64_t startSeqno;
+        // Last seqno given to the stream, from memory or disk
+        uint64_t lastSeqno;
+        CacheCallback cacheCallback;
+        std::atomic<bool> detached;
+        std::atomic<bool> splitOff;
+    };
+
+    enum class Status {
+        //! There is more to read
+        MORE,
+        //! The whole snapshot has been read (or reading it failed)
+        DONE,
+        //! The snapshot couldn't be opened
+        OPEN_FAILED
+    };
+
+    /**
+     * @param snapEnd if non-zero, the scan carries on a disk snapshot
+     *        already marked on its stream and ending at this seqno: it
+     *        marks no snapshot of its own and stops at snapEnd
+     */
+    SharedBackfillScan(EventuallyPersistentEngine* e, uint16_t vb,
+                       ValueFilter filter, uint64_t snapEnd = 0);
+
+    ~SharedBackfillScan();
+
+    uint16_t getVBucketId() const {
+        return vbid;
+    }
+
+    ValueFilter getValueFilter() const {
+        return valFilter;
+    }
+
+    /**
+     * The end seqno of the disk snapshot the scan reads (0 until it is
+     * opened).
+     */
+    uint64_t getSnapshotEnd();
+
+    /**
+     * Attach a stream wanting the seqnos from start to end.
+     *
+     * @return the stream's subscription, or nullptr if it can't join (the
+     *         scan has read past start, or its snapshot ends before end)
+     */
+    std::shared_ptr<Subscription> attach(stream_t& stream, uint64_t start,
+                                         uint64_t end);
+
+    /**
+     * Open the scan if that's still to be done, or read the next part of
+     * it otherwise, feeding the attached streams.
+     *
+     * @param caller the subscription of the stream whose backfill is
+     *        driving the scan
+     */
+    Status run(const Subscription& caller);
+
+private:
+    class FanOutCacheCallback;
+    class FanOutDiskCallback;
+
+    void cacheLookup(CacheLookup& lookup, Callback<CacheLookup>& result);
+
+    void diskItem(GetValue& val, Callback<GetValue>& result);
+
+    /**
+     * Handle sub's stream refusing an item: split it off unless it's the
+     * driving stream.
+     *
+     * @return true if the scan is to pause
+     */
+    bool refused(Subscription& sub, uint64_t seqno);
+
+    //! Whether seqno is past the end of the snapshot being carried on
+    bool beyondSnapshot(uint64_t seqno) const;
+
+    void pruneSubscriptions();
+
+    EventuallyPersistentEngine* engine;
+    const uint16_t vbid;
+    const ValueFilter valFilter;
+    // End of the snapshot carried on for a split-off stream, or 0
+    const uint64_t snapshotEnd;
+
+    std::mutex lock;
+    std::vector<std::shared_ptr<Subscription>> subscriptions;
+    ScanContext* scanCtx;
+    bool opened;
+    Status status;
+    // The subscription of the stream whose backfill is running the scan
+    const Subscription* driver;
+};
+
+/**
+ * The SharedBackfillScans of the engine's vbuckets which streams may still
+ * join (see DcpConnMap::getBackfillScans()).
+ */
+class SharedBackfillScanMap {
+public:
+    /**
+     * Get a scan of vbucket vb, with the value filter the stream needs,
+     * to backfill the stream from start to end: an existing one if sharing
+     * is enabled and the stream can join it, or a new one otherwise.
+     *
+     * @param [out] subscription the stream's attachment to the scan
+     */
+    std::shared_ptr<SharedBackfillScan> attach(
+                        EventuallyPersistentEngine* e, stream_t& stream,
+                        uint64_t start, uint64_t end, ValueFilter filter,
+                        bool share,
+                        std::shared_ptr<SharedBackfillScan::Subscription>&
+                                subscription);
+
+private:
+    std::mutex lock;
+    std::multimap<uint16_t, std::weak_ptr<SharedBackfillScan>> scans;
+};
+
 class DCPBackfill {
 public:
     DCPBackfill(EventuallyPersistentEngine* e, stream_t s,
@@ -91,7 +287,8 @@ private:
     stream_t                    stream;
     uint64_t                    startSeqno;
     uint64_t                    endSeqno;
-    ScanContext*                scanCtx;
+    std::shared_ptr<SharedBackfillScan> sharedScan;
+    std::shared_ptr<SharedBackfillScan::Subscription> subscription;
     backfill_state_t            state;
     std::mutex                       lock;
 };
@@ -24,9 +24,10 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
 #include <mutex>
-#include <queue>
 #include <unordered_set>
+#include <utility>
 
 #include "locks.h"
 
@@ -50,7 +51,7 @@ class PassiveStream;
 typedef RCPtr<PassiveStream> passive_stream_t;
 
 /**
- * DcpReadyQueue is a std::queue wrapper for managing a
+ * DcpReadyQueue is a std::deque wrapper for managing a
  * queue of vbuckets that are ready for a DCP producer/consumer to process.
  * The queue does not allow duplicates and the push_unique method enforces
  * this. The interface is generally customised for the needs of:
@@ -58,8 +59,10 @@ typedef RCPtr<PassiveStream> passive_stream_t;
  *   DCPProducer threads are accessing this data.
  * - processBufferedItems by the processer task of the consumer
  *
- * Internally a std::queue and std::set track the contents and the std::set
- * enables a fast exists method which is used by front-end threads.
+ * Internally a std::deque and std::set track the contents and the std::set
+ * enables a fast exists method which is used by front-end threads. The
+ * deque also records when each vbucket was queued, so the producer can
+ * account for how long its streams wait to be served.
  */
 class DcpReadyQueue {
 public:
@@ -73,10 +76,20 @@ public:
      * empty. frontValue is set to the front of the queue.
      */
     bool popFront(uint16_t &frontValue) {
+        hrtime_t queuedAt;
+        return popFront(frontValue, queuedAt);
+    }
+
+    /**
+     * As popFront(frontValue), also setting queuedAt to the time the
+     * vbucket was queued.
+     */
+    bool popFront(uint16_t &frontValue, hrtime_t &queuedAt) {
         LockHolder lh(lock);
         if (!readyQueue.empty()) {
-            frontValue = readyQueue.front();
-            readyQueue.pop();
+            frontValue = readyQueue.front().first;
+            queuedAt = readyQueue.front().second;
+            readyQueue.pop_front();
             queuedValues.erase(frontValue);
             return true;
         }
@@ -90,8 +103,8 @@ public:
     void pop() {
         LockHolder lh(lock);
         if (!readyQueue.empty()) {
-            queuedValues.erase(readyQueue.front());
-            readyQueue.pop();
+            queuedValues.erase(readyQueue.front().first);
+            readyQueue.pop_front();
         }
     }
 
@@ -102,7 +115,22 @@ public:
     bool pushUnique(uint16_t vbucket) {
         LockHolder lh(lock);
         if (queuedValues.count(vbucket) == 0) {
-            readyQueue.push(vbucket);
+            readyQueue.emplace_back(vbucket, gethrtime());
+            queuedValues.insert(vbucket);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Push the vbucket to the front of the queue, to be popped next, only
+     * if it's not already in the queue.
+     * Return true if the vbucket was added to the queue.
+     */
+    bool pushFrontUnique(uint16_t vbucket) {
+        LockHolder lh(lock);
+        if (queuedValues.count(vbucket) == 0) {
+            readyQueue.emplace_front(vbucket, gethrtime());
             queuedValues.insert(vbucket);
             return true;
         }
@@ -125,8 +153,9 @@ public:
 private:
     std::mutex lock;
 
-    /* a queue of vbuckets that are ready for producing */
-    std::queue<uint16_t> readyQueue;
+    /* a queue of vbuckets that are ready for producing, and when each was
+       queued */
+    std::deque<std::pair<uint16_t, hrtime_t>> readyQueue;
 
     /**
      * maintain a std::unordered_set of values that are in the readyQueue.
@@ -40,6 +40,14 @@ DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     updateMaxActiveSnoozingBackfills(engine.getEpStats().getMaxDataSize());
     minCompressionRatioForProducer.store(
                     engine.getConfiguration().getDcpMinCompressionRatio());
+    producerStepBatchItems.store(
+                    engine.getConfiguration().getDcpProducerStepBatchItems());
+    producerStepBatchBytes.store(
+                    engine.getConfiguration().getDcpProducerStepBatchBytes());
+    producerSchedQuantum.store(
+                    engine.getConfiguration().getDcpProducerSchedQuantum());
+    takeoverStreamWeight.store(
+                    engine.getConfiguration().getDcpTakeoverStreamWeight());
 
     // Note: these allocations are deleted by ~Configuration
     engine.getConfiguration().
@@ -48,6 +56,18 @@ DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     engine.getConfiguration().
         addValueChangedListener("dcp_consumer_process_buffered_messages_batch_size",
                                 new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_producer_step_batch_items",
+                                new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_producer_step_batch_bytes",
+                                new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_producer_sched_quantum",
+                                new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_takeover_stream_weight",
+                                new DcpConfigChangeListener(*this));
 }
 
 DcpConsumer *DcpConnMap::newConsumer(const void* cookie,
@@ -441,6 +461,14 @@ void DcpConnMap::DcpConfigChangeListener::sizeValueChanged(const std::string &ke
         myConnMap.consumerYieldConfigChanged(value);
     } else if (key == "dcp_consumer_process_buffered_messages_batch_size") {
         myConnMap.consumerBatchSizeConfigChanged(value);
+    } else if (key == "dcp_producer_step_batch_items") {
+        myConnMap.producerStepBatchItems.store(value);
+    } else if (key == "dcp_producer_step_batch_bytes") {
+        myConnMap.producerStepBatchBytes.store(value);
+    } else if (key == "dcp_producer_sched_quantum") {
+        myConnMap.producerSchedQuantum.store(value);
+    } else if (key == "dcp_takeover_stream_weight") {
+        myConnMap.takeoverStreamWeight.store(value);
     }
 }
 
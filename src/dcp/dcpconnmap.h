@@ -29,6 +29,7 @@
 #include "syncobject.h"
 #include "atomicqueue.h"
 #include "connmap.h"
+#include "dcp/backfill.h"
 #include "dcp/consumer.h"
 #include "dcp/producer.h"
 
@@ -120,6 +121,31 @@ public:
 
     float getMinCompressionRatio();
 
+    /* Maximum number of messages, and of bytes, a producer sends in one
+     * step call */
+    size_t getProducerStepBatchItems() {
+        return producerStepBatchItems.load(std::memory_order_relaxed);
+    }
+
+    size_t getProducerStepBatchBytes() {
+        return producerStepBatchBytes.load(std::memory_order_relaxed);
+    }
+
+    /* Bytes a producer's stream of weight 1 sends per turn */
+    size_t getProducerSchedQuantum() {
+        return producerSchedQuantum.load(std::memory_order_relaxed);
+    }
+
+    /* Scheduling weight given to new takeover streams */
+    size_t getTakeoverStreamWeight() {
+        return takeoverStreamWeight.load(std::memory_order_relaxed);
+    }
+
+    /* Disk scans which the backfills of new streams may join */
+    SharedBackfillScanMap& getBackfillScans() {
+        return backfillScans;
+    }
+
 protected:
     /*
      * deadConnections is protected (as opposed to private) because
@@ -161,6 +187,13 @@ protected:
 
     std::atomic<float> minCompressionRatioForProducer;
 
+    std::atomic<size_t> producerStepBatchItems;
+    std::atomic<size_t> producerStepBatchBytes;
+    std::atomic<size_t> producerSchedQuantum;
+    std::atomic<size_t> takeoverStreamWeight;
+
+    SharedBackfillScanMap backfillScans;
+
     /* Total memory used by all DCP consumer buffers */
     std::atomic<size_t> aggrDcpConsumerBufferSize;
 
@@ -15,6 +15,7 @@
  *   limitations under the License.
  */
 
+#include <algorithm>
 #include <vector>
 
 #include "dcp/producer.h"
@@ -31,6 +32,9 @@
 
 const std::chrono::seconds DcpProducer::defaultDcpNoopTxInterval(20);
 
+// Number of free responses each producer keeps for reuse.
+static const size_t maxFreeResponses = 1024;
+
 DcpProducer::BufferLog::State DcpProducer::BufferLog::getState_UNLOCKED() {
     if (isEnabled_UNLOCKED()) {
         if (isFull_UNLOCKED()) {
@@ -115,6 +119,7 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine &e, const void *cookie,
                          const std::string &name, bool isNotifier)
     : Producer(e, cookie, name), rejectResp(NULL),
       notifyOnly(isNotifier), lastSendTime(ep_current_time()), log(*this),
+      responsePool(new DcpResponsePool(maxFreeResponses)),
       itemsSent(0), totalBytesSent(0) {
     setSupportAck(true);
     setReserved(true);
@@ -135,6 +140,7 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine &e, const void *cookie,
 
     engine_.setDCPPriority(getCookie(), CONN_PRIORITY_MED);
     priority.assign("medium");
+    priorityWeight = mediumPriorityWeight;
 
     // The consumer assigns opaques starting at 0 so lets have the producer
     //start using opaques at 10M to prevent any opaque conflicts.
@@ -177,6 +183,7 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine &e, const void *cookie,
 DcpProducer::~DcpProducer() {
     backfillMgr.reset();
     delete rejectResp;
+    responsePool->release();
 
     ExecutorPool::get()->cancel(checkpointCreatorTask->getId());
 }
@@ -323,6 +330,11 @@ ENGINE_ERROR_CODE DcpProducer::streamRequest(uint32_t flags,
                              snap_start_seqno, snap_end_seqno);
     }
 
+    if (flags & DCP_ADD_STREAM_FLAG_TAKEOVER) {
+        s->setSchedWeight(
+                engine_.getDcpConnMap().getTakeoverStreamWeight());
+    }
+
     {
         ReaderLockHolder rlh(vb->getStateLock());
         if (vb->getState() == vbucket_state_dead) {
@@ -383,17 +395,46 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
         return ret;
     }
 
-    DcpResponse *resp;
-    if (rejectResp) {
-        resp = rejectResp;
-        rejectResp = NULL;
-    } else {
-        resp = getNextItem();
-        if (!resp) {
-            return ENGINE_SUCCESS;
+    // Send up to a batch of messages; memcached ships them all at once
+    // when we return.
+    DcpConnMap& connMap = engine_.getDcpConnMap();
+    const size_t batchItems = connMap.getProducerStepBatchItems();
+    const size_t batchBytes = connMap.getProducerStepBatchBytes();
+    size_t sent = 0;
+    size_t sentBytes = 0;
+    do {
+        DcpResponse *resp;
+        if (rejectResp) {
+            resp = rejectResp;
+            rejectResp = NULL;
+        } else {
+            resp = getNextItem();
+            if (!resp) {
+                break;
+            }
         }
-    }
 
+        const uint32_t respSize = resp->getMessageSize();
+        ret = sendResponse(producers, resp);
+        if (ret != ENGINE_SUCCESS) {
+            // A message stashed for retry is sent by the next step, after
+            // those sent already.
+            if (sent > 0 && rejectResp) {
+                break;
+            }
+            return ret;
+        }
+        ++sent;
+        sentBytes += respSize;
+    } while (sent < batchItems && sentBytes < batchBytes);
+
+    return (sent > 0) ? ENGINE_WANT_MORE : ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE DcpProducer::sendResponse(
+                                    struct dcp_message_producers* producers,
+                                    DcpResponse* resp) {
+    ENGINE_ERROR_CODE ret;
     Item* itmCpy = NULL;
     if (resp->getEvent() == DCP_MUTATION) {
         try {
@@ -421,10 +462,32 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
              * to snappy-compress the document before transmitting.
              * Compression will obviously be done only if the datatype
              * indicates that the value isn't compressed already.
+             * The value is compressed once per item, rather than once per
+             * stream sending it; see Item::getCompressedValue().
              */
+            MutationResponse* m = static_cast<MutationResponse*>(resp);
+            float minRatio = engine_.getDcpConnMap().getMinCompressionRatio();
             uint32_t sizeBefore = itmCpy->getNBytes();
-            if (!itmCpy->compressValue(
-                            engine_.getDcpConnMap().getMinCompressionRatio())) {
+            bool compressed = true;
+            if (m->getPayloadType() == KEY_VALUE) {
+                value_t value;
+                size_t memAdded, memFreed;
+                compressed = m->getItem()->getCompressedValue(minRatio, value,
+                                                              memAdded,
+                                                              memFreed);
+                itmCpy->setValue(value);
+                // A backfilled item isn't held by any checkpoint.
+                if (memAdded != memFreed && !m->isBackfilled()) {
+                    RCPtr<VBucket> vb = engine_.getVBucket(m->getVBucket());
+                    if (vb) {
+                        vb->checkpointManager.chargeCompressedValue(
+                                m->getItem(), memAdded, memFreed);
+                    }
+                }
+            } else {
+                compressed = itmCpy->compressValue(minRatio);
+            }
+            if (!compressed) {
                 LOG(EXTENSION_LOG_WARNING,
                     "%s Failed to snappy compress an uncompressed value!",
                     logHeader());
@@ -528,7 +591,7 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
     }
 
     lastSendTime = ep_current_time();
-    return (ret == ENGINE_SUCCESS) ? ENGINE_WANT_MORE : ret;
+    return ret;
 }
 
 ENGINE_ERROR_CODE DcpProducer::bufferAcknowledgement(uint32_t opaque,
@@ -597,14 +660,17 @@ ENGINE_ERROR_CODE DcpProducer::control(uint32_t opaque, const void* key,
         if (valueStr == "high") {
             engine_.setDCPPriority(getCookie(), CONN_PRIORITY_HIGH);
             priority.assign("high");
+            priorityWeight = highPriorityWeight;
             return ENGINE_SUCCESS;
         } else if (valueStr == "medium") {
             engine_.setDCPPriority(getCookie(), CONN_PRIORITY_MED);
             priority.assign("medium");
+            priorityWeight = mediumPriorityWeight;
             return ENGINE_SUCCESS;
         } else if (valueStr == "low") {
             engine_.setDCPPriority(getCookie(), CONN_PRIORITY_LOW);
             priority.assign("low");
+            priorityWeight = lowPriorityWeight;
             return ENGINE_SUCCESS;
         }
     }
@@ -708,8 +774,10 @@ void DcpProducer::notifyBackfillManager() {
     backfillMgr->wakeUpTask();
 }
 
-bool DcpProducer::recordBackfillManagerBytesRead(uint32_t bytes) {
-    return backfillMgr->bytesRead(bytes);
+bool DcpProducer::recordBackfillManagerBytesRead(uint16_t vbucket,
+                                                 uint32_t bytes,
+                                                 bool scanLimited) {
+    return backfillMgr->bytesRead(vbucket, bytes, scanLimited);
 }
 
 void DcpProducer::recordBackfillManagerBytesSent(uint32_t bytes) {
@@ -740,6 +808,9 @@ void DcpProducer::addStats(ADD_STAT add_stat, const void *c) {
     addStat("cursor_dropping",
             supportsCursorDropping ? "ELIGIBLE" : "NOT_ELIGIBLE",
             add_stat, c);
+    addStat("response_pool_used", responsePool->getNumAllocated(), add_stat,
+            c);
+    addStat("response_pool_free", responsePool->getNumFree(), add_stat, c);
 
     // Possible that the producer has had its streams closed and hence doesn't
     // have a backfill manager anymore.
@@ -868,13 +939,21 @@ const char* DcpProducer::getType() const {
 }
 
 DcpResponse* DcpProducer::getNextItem() {
+    // The ready streams are served deficit round robin: each turn a stream
+    // gets a quantum of bytes proportional to its weight (and to the
+    // connection's priority), and keeps the front of the ready queue until
+    // it has sent them, so a stream with a lot to send (a backfill, say)
+    // can't starve the others, and a takeover stream gets a bigger share.
+    const int64_t quantum = engine_.getDcpConnMap().getProducerSchedQuantum() *
+                            priorityWeight.load();
     do {
         setPaused(false);
 
         uint16_t vbucket = 0;
-        while (ready.popFront(vbucket)) {
+        hrtime_t queuedAt = 0;
+        while (ready.popFront(vbucket, queuedAt)) {
             if (log.pauseIfFull()) {
-                ready.pushUnique(vbucket);
+                ready.pushFrontUnique(vbucket);
                 return NULL;
             }
 
@@ -887,10 +966,26 @@ DcpResponse* DcpProducer::getNextItem() {
                 }
             }
 
+            const int64_t streamQuantum = quantum * stream->getSchedWeight();
+            int64_t deficit = stream->getSchedDeficit();
+            if (deficit <= 0) {
+                // A new turn. A stream which overran its last one by more
+                // than this turn's quantum sits it out.
+                deficit += streamQuantum;
+                if (deficit <= 0) {
+                    stream->setSchedDeficit(deficit);
+                    stream->recordSchedTurn(gethrtime() - queuedAt, 0);
+                    ready.pushUnique(vbucket);
+                    continue;
+                }
+            }
+
             op = stream->next();
 
             if (!op) {
-                // stream is empty, try another vbucket.
+                // stream is empty, try another vbucket; an idle stream
+                // doesn't keep what was left of its turn.
+                stream->setSchedDeficit(0);
                 continue;
             }
 
@@ -908,14 +1003,25 @@ DcpResponse* DcpProducer::getNextItem() {
                     abort();
             }
 
-            ready.pushUnique(vbucket);
+            const uint32_t msgBytes = op->getMessageSize();
+            stream->recordSchedTurn(gethrtime() - queuedAt, msgBytes);
+            // Charge the message to the stream's turn, keeping a big
+            // message from costing it more than one turn.
+            deficit = std::max(deficit - static_cast<int64_t>(msgBytes),
+                               -streamQuantum);
+            stream->setSchedDeficit(deficit);
+            if (deficit > 0) {
+                ready.pushFrontUnique(vbucket);
+            } else {
+                ready.pushUnique(vbucket);
+            }
 
             if (op->getEvent() == DCP_MUTATION || op->getEvent() == DCP_DELETION ||
                 op->getEvent() == DCP_EXPIRATION) {
                 itemsSent++;
             }
 
-            totalBytesSent.fetch_add(op->getMessageSize());
+            totalBytesSent.fetch_add(msgBytes);
 
             return op;
         }
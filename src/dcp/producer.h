@@ -26,6 +26,7 @@
 
 class BackfillManager;
 class DcpResponse;
+class DcpResponsePool;
 
 class DcpProducer : public Producer {
 public:
@@ -106,7 +107,8 @@ public:
     void notifyStreamReady(uint16_t vbucket, bool schedule);
 
     void notifyBackfillManager();
-    bool recordBackfillManagerBytesRead(uint32_t bytes);
+    bool recordBackfillManagerBytesRead(uint16_t vbucket, uint32_t bytes,
+                                        bool scanLimited = true);
     void recordBackfillManagerBytesSent(uint32_t bytes);
     void scheduleBackfillManager(stream_t s, uint64_t start, uint64_t end);
 
@@ -118,6 +120,14 @@ public:
         return enableValueCompression;
     }
 
+    /**
+     * Get the pool the streams of this producer allocate the responses
+     * they send most often (mutations and snapshot markers) from.
+     */
+    DcpResponsePool& getResponsePool() {
+        return *responsePool;
+    }
+
     void notifyPaused(bool schedule);
 
     class BufferLog {
@@ -236,6 +246,14 @@ protected:
      */
     ENGINE_ERROR_CODE maybeSendNoop(struct dcp_message_producers* producers);
 
+    /**
+     * Send the given response through the producers callbacks. Takes
+     * ownership of it: it's deleted once sent, or stashed in rejectResp
+     * to be sent again if it can't be sent yet.
+     */
+    ENGINE_ERROR_CODE sendResponse(struct dcp_message_producers* producers,
+                                   DcpResponse* resp);
+
     struct {
         rel_time_t sendTime;
         uint32_t opaque;
@@ -256,6 +274,13 @@ private:
 
     std::string priority;
 
+    // Scales the scheduling quantum of the connection's streams by its
+    // priority (see getNextItem())
+    std::atomic<uint32_t> priorityWeight;
+    static const uint32_t lowPriorityWeight = 1;
+    static const uint32_t mediumPriorityWeight = 2;
+    static const uint32_t highPriorityWeight = 4;
+
     DcpResponse *rejectResp; // stash response for retry if E2BIG was hit
 
     bool notifyOnly;
@@ -273,6 +298,10 @@ private:
     // weak_ptr) to this.
     std::shared_ptr<BackfillManager> backfillMgr;
 
+    // Released (rather than deleted) by the destructor, as responses
+    // allocated from it may still be queued.
+    DcpResponsePool* responsePool;
+
     DcpReadyQueue ready;
 
     // Map of vbid -> stream. Map itself is atomic (thread-safe).
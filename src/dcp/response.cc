@@ -35,3 +35,120 @@ const uint32_t SetVBucketState::baseMsgBytes = 25;
 const uint32_t SnapshotMarker::baseMsgBytes = 44;
 const uint32_t MutationResponse::mutationBaseMsgBytes = 55;
 const uint32_t MutationResponse::deletionBaseMsgBytes = 42;
+
+static_assert(sizeof(MutationResponse) <= DcpResponsePool::slotSize,
+              "MutationResponse doesn't fit a DcpResponsePool slot");
+static_assert(sizeof(SnapshotMarker) <= DcpResponsePool::slotSize,
+              "SnapshotMarker doesn't fit a DcpResponsePool slot");
+
+DcpResponsePool::DcpResponsePool(size_t max)
+    : freeList(nullptr), numFree(0), numAllocated(0), maxFree(max),
+      released(false) {
+}
+
+DcpResponsePool::~DcpResponsePool() {
+    while (freeList) {
+        FreeSlot* slot = freeList;
+        freeList = slot->next;
+        ::operator delete(slot);
+    }
+}
+
+void* DcpResponsePool::allocate(size_t size) {
+    if (size > slotSize) {
+        return allocateUnpooled(size);
+    }
+
+    Header* header = nullptr;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        if (freeList) {
+            header = reinterpret_cast<Header*>(freeList);
+            freeList = freeList->next;
+            --numFree;
+        }
+        ++numAllocated;
+    }
+    if (!header) {
+        try {
+            header = static_cast<Header*>(
+                    ::operator new(sizeof(Header) + slotSize));
+        } catch (const std::bad_alloc&) {
+            std::lock_guard<std::mutex> lh(mutex);
+            --numAllocated;
+            throw;
+        }
+    }
+    header->pool = this;
+    return header + 1;
+}
+
+void* DcpResponsePool::allocateUnpooled(size_t size) {
+    Header* header = static_cast<Header*>(
+            ::operator new(sizeof(Header) + size));
+    header->pool = nullptr;
+    return header + 1;
+}
+
+void DcpResponsePool::deallocate(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    Header* header = static_cast<Header*>(ptr) - 1;
+    if (header->pool) {
+        header->pool->free(header);
+    } else {
+        ::operator delete(header);
+    }
+}
+
+void DcpResponsePool::free(Header* header) {
+    bool destroy = false;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        --numAllocated;
+        if (!released && numFree < maxFree) {
+            FreeSlot* slot = reinterpret_cast<FreeSlot*>(header);
+            slot->next = freeList;
+            freeList = slot;
+            ++numFree;
+            return;
+        }
+        destroy = released && numAllocated == 0;
+    }
+    ::operator delete(header);
+    if (destroy) {
+        delete this;
+    }
+}
+
+void DcpResponsePool::release() {
+    FreeSlot* slots;
+    bool destroy;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        released = true;
+        slots = freeList;
+        freeList = nullptr;
+        numFree = 0;
+        destroy = numAllocated == 0;
+    }
+    while (slots) {
+        FreeSlot* slot = slots;
+        slots = slot->next;
+        ::operator delete(slot);
+    }
+    if (destroy) {
+        delete this;
+    }
+}
+
+size_t DcpResponsePool::getNumFree() {
+    std::lock_guard<std::mutex> lh(mutex);
+    return numFree;
+}
+
+size_t DcpResponsePool::getNumAllocated() {
+    std::lock_guard<std::mutex> lh(mutex);
+    return numAllocated;
+}
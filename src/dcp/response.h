@@ -20,6 +20,9 @@
 
 #include "config.h"
 
+#include <cstddef>
+#include <mutex>
+
 #include "ext_meta_parser.h"
 #include "item.h"
 
@@ -48,6 +51,81 @@ typedef enum {
     KEY_ONLY
 } MutationPayload;
 
+/**
+ * Pool of memory for the DcpResponses of a producer's streams.
+ *
+ * A response is allocated and freed for every item streamed; with the pool
+ * the memory is recycled through an intrusive free list instead, after the
+ * first responses. Responses larger than slotSize are allocated from the
+ * heap as usual.
+ *
+ * The pool is owned by a DcpProducer, but lives until the last response
+ * allocated from it is freed: see release().
+ */
+class DcpResponsePool {
+public:
+    //! Size of the largest response recycled through the pool.
+    static const size_t slotSize = 64;
+
+    /**
+     * @param maxFree maximum number of free slots kept for reuse
+     */
+    explicit DcpResponsePool(size_t maxFree);
+
+    /**
+     * Allocate memory for a response of the given size, from the pool if
+     * it fits.
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Allocate memory for a response from the heap.
+     */
+    static void* allocateUnpooled(size_t size);
+
+    /**
+     * Free memory returned by either allocate function.
+     */
+    static void deallocate(void* ptr);
+
+    /**
+     * Release the owner's reference: frees the memory held for reuse, and
+     * the pool itself as soon as no response allocated from it remains.
+     */
+    void release();
+
+    //! Number of free slots held for reuse.
+    size_t getNumFree();
+
+    //! Number of slots allocated from the pool and not yet freed.
+    size_t getNumAllocated();
+
+private:
+    // Every allocation is preceded by a header recording the pool it came
+    // from (or nullptr), sized to keep the response suitably aligned.
+    struct alignas(alignof(std::max_align_t)) Header {
+        DcpResponsePool* pool;
+    };
+
+    // A free slot
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    ~DcpResponsePool();
+
+    void free(Header* header);
+
+    std::mutex mutex;
+    FreeSlot* freeList;
+    size_t numFree;
+    size_t numAllocated;
+    const size_t maxFree;
+    bool released;
+
+    DISALLOW_COPY_AND_ASSIGN(DcpResponsePool);
+};
+
 class DcpResponse {
 public:
     DcpResponse(dcp_event_t event, uint32_t opaque)
@@ -55,6 +133,27 @@ public:
 
     virtual ~DcpResponse() {}
 
+    static void* operator new(size_t size) {
+        return DcpResponsePool::allocateUnpooled(size);
+    }
+
+    /**
+     * Allocate a response from the given pool, as in
+     * new (pool) MutationResponse(...).
+     */
+    static void* operator new(size_t size, DcpResponsePool& pool) {
+        return pool.allocate(size);
+    }
+
+    static void operator delete(void* ptr) {
+        DcpResponsePool::deallocate(ptr);
+    }
+
+    // Used if the constructor of a pool allocated response throws
+    static void operator delete(void* ptr, DcpResponsePool&) {
+        DcpResponsePool::deallocate(ptr);
+    }
+
     uint32_t getOpaque() {
         return opaque_;
     }
@@ -306,9 +405,11 @@ class MutationResponse : public DcpResponse {
 public:
     MutationResponse(queued_item item, uint32_t opaque,
                      ExtendedMetaData *e = NULL,
-                     MutationPayload mutationPayloadType = KEY_VALUE)
+                     MutationPayload mutationPayloadType = KEY_VALUE,
+                     bool backfilled = false)
         : DcpResponse(item->isDeleted() ? DCP_DELETION : DCP_MUTATION, opaque),
-          item_(item), emd(e), payloadType(mutationPayloadType) {}
+          item_(item), emd(e), payloadType(mutationPayloadType),
+          backfilled_(backfilled) {}
 
     ~MutationResponse() {
         if (emd) {
@@ -365,6 +466,18 @@ public:
         return emd;
     }
 
+    MutationPayload getPayloadType() const {
+        return payloadType;
+    }
+
+    /**
+     * True if the item was read by a backfill, rather than from a
+     * checkpoint.
+     */
+    bool isBackfilled() const {
+        return backfilled_;
+    }
+
     static const uint32_t mutationBaseMsgBytes;
     static const uint32_t deletionBaseMsgBytes;
 
@@ -372,6 +485,7 @@ private:
     queued_item item_;
     ExtendedMetaData *emd;
     MutationPayload payloadType;
+    bool backfilled_;
 };
 
 #endif  // SRC_DCP_RESPONSE_H_
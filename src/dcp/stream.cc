@@ -54,7 +54,8 @@ Stream::Stream(const std::string &name, uint32_t flags, uint32_t opaque,
       snap_start_seqno_(snap_start_seqno),
       snap_end_seqno_(snap_end_seqno),
       state_(STREAM_PENDING), itemsReady(false),
-      readyQ_non_meta_items(0),
+      readyQ_non_meta_items(0), schedWeight(1), schedDeficit(0),
+      schedServedBytes(0), schedWaitTime(0),
       readyQueueMemory(0) {
 }
 
@@ -210,6 +211,8 @@ ActiveStream::ActiveStream(EventuallyPersistentEngine* e, dcp_producer_t p,
 
     takeoverStart = 0;
     takeoverSendMaxTime = engine->getConfiguration().getDcpTakeoverMaxTime();
+    cursorBatchItems = engine->getConfiguration().getDcpCursorBatchItems();
+    cursorBatchBytes = engine->getConfiguration().getDcpCursorBatchBytes();
 
     if (start_seqno_ >= end_seqno_) {
         /* streamMutex lock needs to be acquired because endStream
@@ -312,8 +315,9 @@ void ActiveStream::markDiskSnapshot(uint64_t startSeqno, uint64_t endSeqno) {
     producer->getLogger().log(EXTENSION_LOG_NOTICE,
         "(vb %" PRIu16 ") Sending disk snapshot with start seqno %" PRIu64
         " and end seqno %" PRIu64, vb_, startSeqno, endSeqno);
-    pushToReadyQ(new SnapshotMarker(opaque_, vb_, startSeqno, endSeqno,
-                                    MARKER_FLAG_DISK));
+    pushToReadyQ(new (producer->getResponsePool())
+                 SnapshotMarker(opaque_, vb_, startSeqno, endSeqno,
+                                MARKER_FLAG_DISK));
     lastSentSnapEndSeqno.store(endSeqno, std::memory_order_relaxed);
 
     if (!vb) {
@@ -334,13 +338,15 @@ void ActiveStream::markDiskSnapshot(uint64_t startSeqno, uint64_t endSeqno) {
     }
 }
 
-bool ActiveStream::backfillReceived(Item* itm, backfill_source_t backfill_source) {
+bool ActiveStream::backfillReceived(Item* itm, backfill_source_t backfill_source,
+                                    bool scanLimited) {
     if (nullptr == itm) {
         return false;
     }
     LockHolder lh(streamMutex);
     if (state_ == STREAM_BACKFILLING) {
-        if (!producer->recordBackfillManagerBytesRead(itm->size())) {
+        if (!producer->recordBackfillManagerBytesRead(vb_, itm->size(),
+                                                      scanLimited)) {
             delete itm;
             return false;
         }
@@ -348,9 +354,11 @@ bool ActiveStream::backfillReceived(Item* itm, backfill_source_t backfill_source
         bufferedBackfill.bytes.fetch_add(itm->size());
         bufferedBackfill.items++;
 
-        pushToReadyQ(new MutationResponse(itm, opaque_,
+        pushToReadyQ(new (producer->getResponsePool())
+                     MutationResponse(itm, opaque_,
                           prepareExtendedMetaData(itm->getVBucketId(),
-                                                  itm->getConflictResMode())));
+                                                  itm->getConflictResMode()),
+                          KEY_VALUE, true));
 
         lastReadSeqno.store(itm->getBySeqno());
         lh.unlock();
@@ -596,6 +604,15 @@ void ActiveStream::addStats(ADD_STAT add_stat, const void *c) {
         checked_snprintf(buffer, bsize, "%s:stream_%d_backfill_buffer_items",
                          name_.c_str(), vb_);
         add_casted_stat(buffer, bufferedBackfill.items, add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_sched_weight",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, schedWeight.load(), add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_sched_served_bytes",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, schedServedBytes.load(), add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_sched_wait_time",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, schedWaitTime.load(), add_stat, c);
 
         if ((state_ == STREAM_TAKEOVER_SEND) && takeoverStart != 0) {
             checked_snprintf(buffer, bsize, "%s:stream_%d_takeover_since",
@@ -773,7 +790,8 @@ void ActiveStream::getOutstandingItems(RCPtr<VBucket> &vb,
     chkptItemsExtractionInProgress.store(true);
 
     hrtime_t _begin_ = gethrtime();
-    vb->checkpointManager.getAllItemsForCursor(name_, items);
+    vb->checkpointManager.getItemsForCursor(name_, items, cursorBatchItems,
+                                            cursorBatchBytes);
     engine->getEpStats().dcpCursorsGetItemsHisto.add(
                                             (gethrtime() - _begin_) / 1000);
 
@@ -799,7 +817,8 @@ void ActiveStream::processItems(std::vector<queued_item>& items) {
                 curChkSeqno = qi->getBySeqno();
                 lastReadSeqnoUnSnapshotted = qi->getBySeqno();
 
-                mutations.push_back(new MutationResponse(qi, opaque_,
+                mutations.push_back(new (producer->getResponsePool())
+                            MutationResponse(qi, opaque_,
                             prepareExtendedMetaData(qi->getVBucketId(),
                                                     qi->getConflictResMode()),
                             isSendMutationKeyOnlyEnabled() ? KEY_ONLY :
@@ -876,8 +895,8 @@ void ActiveStream::snapshot(std::deque<MutationResponse*>& items, bool mark) {
             snapStart = std::min(snap_start_seqno_, snapStart);
             firstMarkerSent = true;
         }
-        pushToReadyQ(new SnapshotMarker(opaque_, vb_, snapStart, snapEnd,
-                                        flags));
+        pushToReadyQ(new (producer->getResponsePool())
+                     SnapshotMarker(opaque_, vb_, snapStart, snapEnd, flags));
         lastSentSnapEndSeqno.store(snapEnd, std::memory_order_relaxed);
     }
 
@@ -1580,7 +1599,30 @@ ENGINE_ERROR_CODE PassiveStream::messageReceived(std::unique_ptr<DcpResponse> dc
 
 process_items_error_t PassiveStream::processBufferedMessages(uint32_t& processed_bytes,
                                                              size_t batchSize) {
+    RCPtr<VBucket> vb = engine->getVBucket(vb_);
     std::unique_lock<std::mutex> lh(buffer.bufMutex);
+
+    // Prefetch the hash buckets of the batch's keys up front, so their cache
+    // misses overlap instead of each message stalling on its own.
+    if (vb) {
+        size_t prefetched = 0;
+        for (const auto& message : buffer.messages) {
+            if (prefetched++ == batchSize) {
+                break;
+            }
+            switch (message->getEvent()) {
+                case DCP_MUTATION:
+                case DCP_DELETION:
+                case DCP_EXPIRATION:
+                    vb->ht.prefetch(static_cast<MutationResponse*>(
+                            message.get())->getItem()->getKey());
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
     uint32_t count = 0;
     uint32_t message_bytes = 0;
     uint32_t total_bytes_processed = 0;
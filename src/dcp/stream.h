@@ -25,11 +25,11 @@
 #include "dcp/dcp-types.h"
 #include "dcp/producer.h"
 #include "response.h"
+#include "ringbuffer.h"
 #include "vbucket.h"
 
 #include <atomic>
 #include <climits>
-#include <queue>
 
 class EventuallyPersistentEngine;
 class MutationResponse;
@@ -138,6 +138,40 @@ public:
         clear_UNLOCKED();
     }
 
+    /**
+     * The stream's share of its producer's bandwidth, relative to its other
+     * streams (see DcpProducer::getNextItem()).
+     */
+    uint32_t getSchedWeight() const {
+        return schedWeight;
+    }
+
+    void setSchedWeight(uint32_t weight) {
+        schedWeight = weight;
+    }
+
+    /**
+     * Bytes the stream may still send in its current turn; only used by
+     * the producer while stepping.
+     */
+    int64_t getSchedDeficit() const {
+        return schedDeficit;
+    }
+
+    void setSchedDeficit(int64_t deficit) {
+        schedDeficit = deficit;
+    }
+
+    /**
+     * Account for a turn of the stream: waitTime (ns) spent in the
+     * producer's ready queue before it, and a message of msgBytes sent in
+     * it (if any).
+     */
+    void recordSchedTurn(hrtime_t waitTime, uint32_t msgBytes) {
+        schedWaitTime.fetch_add(waitTime / 1000, std::memory_order_relaxed);
+        schedServedBytes.fetch_add(msgBytes, std::memory_order_relaxed);
+    }
+
 protected:
 
     const char* stateName(stream_state_t st) const;
@@ -166,13 +200,20 @@ protected:
 
     std::atomic<bool> itemsReady;
     std::mutex streamMutex;
-    std::queue<DcpResponse*> readyQ;
+    RingQueue<DcpResponse*> readyQ;
 
     // Number of items in the readyQ that are not meta items. Used for
     // calculating getItemsRemaining(). Atomic so it can be safely read by
     // getItemsRemaining() without acquiring streamMutex.
     std::atomic<size_t> readyQ_non_meta_items;
 
+    // Deficit round robin state; see DcpProducer::getNextItem().
+    std::atomic<uint32_t> schedWeight;
+    int64_t schedDeficit;
+    // Bytes sent, and total time (us) spent waiting to be served
+    std::atomic<uint64_t> schedServedBytes;
+    std::atomic<uint64_t> schedWaitTime;
+
     const static uint64_t dcpMaxSeqno;
 
 private:
@@ -219,7 +260,16 @@ public:
 
     void markDiskSnapshot(uint64_t startSeqno, uint64_t endSeqno);
 
-    bool backfillReceived(Item* itm, backfill_source_t backfill_source);
+    /**
+     * Queue an item read by the stream's backfill.
+     *
+     * @param scanLimited whether the item counts towards the limits of the
+     *        connection's current disk scan (see BackfillManager::bytesRead())
+     * @return false if the connection's backfill buffers are full; the item
+     *         is then deleted
+     */
+    bool backfillReceived(Item* itm, backfill_source_t backfill_source,
+                          bool scanLimited = true);
 
     void completeBackfill();
 
@@ -356,6 +406,12 @@ private:
     std::atomic<rel_time_t> takeoverStart;
     size_t takeoverSendMaxTime;
 
+    /* Approximate limits on the items (and their bytes) taken from the
+       checkpoint cursor at a time; the rest are taken once these have been
+       sent */
+    size_t cursorBatchItems;
+    size_t cursorBatchBytes;
+
     /* Enum indicating whether the stream mutations should contain key only or
        both key and value */
     MutationPayload payloadType;
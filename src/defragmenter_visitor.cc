@@ -94,8 +94,16 @@ bool DefragmentVisitor::visit(StoredValue& v) {
     // supports, so it can be successfully reallocated to a run with other
     // objects of the same size.
     if (value_len > 0 && value_len <= max_size_class) {
-        // If sufficiently old reallocate, otherwise increment it's age.
-        if (v.getValue()->getAge() >= age_threshold) {
+        if (SlabArena::getSlotSize(v.getValue().get()) != 0) {
+            // Slab allocated values are compacted a slab at a time: move
+            // the values out of sparsely used slabs (so those slabs can be
+            // released), regardless of their age.
+            if (SlabArena::isInSparseSlab(v.getValue().get())) {
+                v.reallocate();
+                defrag_count++;
+            }
+        } else if (v.getValue()->getAge() >= age_threshold) {
+            // If sufficiently old reallocate, otherwise increment it's age.
             v.reallocate();
             defrag_count++;
         } else {
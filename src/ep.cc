@@ -23,9 +23,12 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -133,6 +136,8 @@ public:
             store.getEPEngine().getReplicationThrottle().setQueueCap(value);
         } else if (key.compare("replication_throttle_cap_pcnt") == 0) {
             store.getEPEngine().getReplicationThrottle().setCapPercent(value);
+        } else if (key.compare("flusher_max_batch_delay") == 0) {
+            store.getFlushController().setMaxDelay(value);
         } else {
             LOG(EXTENSION_LOG_WARNING,
                 "Failed to change value for unknown variable, %s\n",
@@ -155,6 +160,8 @@ public:
             } else {
                 store.disableExpiryPager();
             }
+        } else if (key.compare("flusher_adaptive_batching") == 0) {
+            store.getFlushController().setEnabled(value);
         }
     }
 
@@ -183,6 +190,12 @@ public:
     void callback(uint16_t& vbucketId, std::string& key, bool& isDeleted) {
         RCPtr<VBucket> vb = store.getVBucket(vbucketId);
         if (vb) {
+            if (!isRebuilding(vbucketId, vb)) {
+                // The vbucket's (counting) filter is kept up to date as
+                // compaction drops items; see PurgedItemCallback.
+                return;
+            }
+
             /* Check if a temporary filter has been initialized. If not,
              * initialize it. If initialization fails, throw an exception
              * to the caller and let the caller deal with it.
@@ -227,9 +240,45 @@ public:
         }
     }
 
+    /**
+     * True if this compaction is rebuilding the given vbucket's filter. This
+     * is decided once per compaction, as a filter only partly rebuilt would
+     * be missing keys.
+     */
+    bool isRebuilding(uint16_t vbucketId, RCPtr<VBucket> &vb) {
+        auto it = rebuilding.find(vbucketId);
+        if (it == rebuilding.end()) {
+            it = rebuilding.emplace(vbucketId,
+                                    vb->isFilterRebuildNeeded()).first;
+        }
+        return it->second;
+    }
+
 private:
     bool initTempFilter(uint16_t vbucketId);
     EventuallyPersistentStore& store;
+    std::unordered_map<uint16_t, bool> rebuilding;
+};
+
+/**
+ * Callback class used by the compactor to remove the deleted items it drops
+ * from the vbucket's bloom filter (if it supports removal).
+ */
+class PurgedItemCallback : public Callback<uint16_t&, std::string&> {
+public:
+    PurgedItemCallback(EventuallyPersistentStore& eps)
+        : store(eps) {
+    }
+
+    void callback(uint16_t& vbucketId, std::string& key) {
+        RCPtr<VBucket> vb = store.getVBucket(vbucketId);
+        if (vb) {
+            vb->removeFromFilter(key);
+        }
+    }
+
+private:
+    EventuallyPersistentStore& store;
 };
 
 bool BloomFilterCallback::initTempFilter(uint16_t vbucketId) {
@@ -288,7 +337,8 @@ bool BloomFilterCallback::initTempFilter(uint16_t vbucketId) {
         estimated_count = initial_estimation;
     }
 
-    vb->initTempFilter(estimated_count, config.getBfilterFpProb());
+    vb->initTempFilter(estimated_count, config.getBfilterFpProb(),
+                       BloomFilter::toType(config.getBfilterType()));
 
     return true;
 }
@@ -371,7 +421,9 @@ EventuallyPersistentStore::EventuallyPersistentStore(
     bgFetchQueue(0),
     diskFlushAll(false), bgFetchDelay(0),
     backfillMemoryThreshold(0.95),
-    statsSnapshotTaskId(0), lastTransTimePerItem(0)
+    statsSnapshotTaskId(0), lastTransTimePerItem(0),
+    flushController(theEngine.getConfiguration(), theEngine.getEpStats(),
+                    theEngine.getConfiguration().getMaxNumShards())
 {
     cachedResidentRatio.activeRatio.store(0);
     cachedResidentRatio.replicaRatio.store(0);
@@ -444,6 +496,11 @@ EventuallyPersistentStore::EventuallyPersistentStore(
     config.addValueChangedListener("replication_throttle_cap_pcnt",
                                    new EPStoreValueChangeListener(*this));
 
+    config.addValueChangedListener("flusher_adaptive_batching",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("flusher_max_batch_delay",
+                                   new EPStoreValueChangeListener(*this));
+
     setBGFetchDelay(config.getBgFetchDelay());
     config.addValueChangedListener("bg_fetch_delay",
                                    new EPStoreValueChangeListener(*this));
@@ -600,12 +657,12 @@ const Flusher* EventuallyPersistentStore::getFlusher(uint16_t shardId) {
     return vbMap.shards[shardId]->getFlusher();
 }
 
-uint16_t EventuallyPersistentStore::getCommitInterval(uint16_t shardId) {
+size_t EventuallyPersistentStore::getCommitInterval(uint16_t shardId) {
     Flusher *flusher = vbMap.shards[shardId]->getFlusher();
     return flusher->getCommitInterval();
 }
 
-uint16_t EventuallyPersistentStore::decrCommitInterval(uint16_t shardId) {
+size_t EventuallyPersistentStore::decrCommitInterval(uint16_t shardId) {
     Flusher *flusher = vbMap.shards[shardId]->getFlusher();
     return flusher->decrCommitInterval();
 }
@@ -865,6 +922,20 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::addTempItemForBgFetch(
                                                         bool metadataOnly,
                                                         bool isReplication) {
 
+    ENGINE_ERROR_CODE ec = unlocked_addTempItemForBgFetch(bucket_num, key, vb,
+                                                          isReplication);
+    if (ec == ENGINE_EWOULDBLOCK) {
+        lock.unlock();
+        bgFetch(key, vb->getId(), cookie, metadataOnly);
+    }
+    return ec;
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::unlocked_addTempItemForBgFetch(
+                                                        int bucket_num,
+                                                        const std::string &key,
+                                                        RCPtr<VBucket> &vb,
+                                                        bool isReplication) {
     add_type_t rv = vb->ht.unlocked_addTempItem(bucket_num, key,
                                                 eviction_policy,
                                                 isReplication);
@@ -878,8 +949,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::addTempItemForBgFetch(
             // Since the hashtable bucket is locked, we shouldn't get here
             abort();
         case ADD_BG_FETCH:
-            lock.unlock();
-            bgFetch(key, vb->getId(), cookie, metadataOnly);
+            break;
     }
     return ENGINE_EWOULDBLOCK;
 }
@@ -1447,7 +1517,8 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::setVBucketState(uint16_t vbid,
             // Initialize bloom filters upon vbucket creation during
             // bucket creation and rebalance
             newvb->createFilter(config.getBfilterKeyCount(),
-                                config.getBfilterFpProb());
+                                config.getBfilterFpProb(),
+                                BloomFilter::toType(config.getBfilterType()));
         }
         const std::string& timeSyncConfig = config.getTimeSynchronization();
         newvb->setTimeSyncConfig(VBucket::convertStrToTimeSyncConfig(timeSyncConfig));
@@ -1660,9 +1731,13 @@ uint16_t EventuallyPersistentStore::getDBFileId(const protocol_binary_request_co
 }
 
 void EventuallyPersistentStore::compactInternal(compaction_ctx *ctx) {
-    BloomFilterCBPtr filter(new BloomFilterCallback(*this));
+    std::shared_ptr<BloomFilterCallback> filter(
+            new BloomFilterCallback(*this));
     ctx->bloomFilterCallback = filter;
 
+    PurgedItemCBPtr purged(new PurgedItemCallback(*this));
+    ctx->purgedItemCallback = purged;
+
     ExpiredItemsCBPtr expiry(new ExpiredItemsCallback(*this));
     ctx->expiryCallback = expiry;
 
@@ -1683,8 +1758,12 @@ void EventuallyPersistentStore::compactInternal(compaction_ctx *ctx) {
         }
 
         if (config.isBfilterEnabled() && result) {
-            vb->swapFilter();
+            if (filter->isRebuilding(vbid, vb)) {
+                vb->swapFilter();
+            }
         } else {
+            // Also drops a counting filter which had items removed by a
+            // compaction which then failed.
             vb->clearFilter();
         }
         vb->setPurgeSeqno(it.second);
@@ -1925,7 +2004,8 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
 void EventuallyPersistentStore::bgFetch(const std::string &key,
                                         uint16_t vbucket,
                                         const void *cookie,
-                                        bool isMeta) {
+                                        bool isMeta,
+                                        bool notifyBgFetcher) {
     if (multiBGFetchEnabled()) {
         RCPtr<VBucket> vb = getVBucket(vbucket);
         if (!vb) {
@@ -1941,7 +2021,9 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
                                                                 isMeta);
         size_t bgfetch_size = vb->queueBGFetchItem(key, fetchThis,
                                                    myShard->getBgFetcher());
-        myShard->getBgFetcher()->notifyBGEvent();
+        if (notifyBgFetcher) {
+            myShard->getBgFetcher()->notifyBGEvent();
+        }
         LOG(EXTENSION_LOG_DEBUG, "Queued a background fetch, now at %" PRIu64,
             uint64_t(bgfetch_size));
     } else {
@@ -1957,42 +2039,38 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
     }
 }
 
-GetValue EventuallyPersistentStore::getInternal(const std::string &key,
-                                                uint16_t vbucket,
+ENGINE_ERROR_CODE EventuallyPersistentStore::checkStateForGet(
+                                                RCPtr<VBucket> &vb,
                                                 const void *cookie,
                                                 vbucket_state_t allowedState,
                                                 get_options_t options) {
+    if (!(options & HONOR_STATES)) {
+        return ENGINE_SUCCESS;
+    }
 
     vbucket_state_t disallowedState = (allowedState == vbucket_state_active) ?
         vbucket_state_replica : vbucket_state_active;
-    RCPtr<VBucket> vb = getVBucket(vbucket);
-    if (!vb) {
-        ++stats.numNotMyVBuckets;
-        return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
-    }
-
-    const bool honorStates = (options & HONOR_STATES);
-
-    ReaderLockHolder rlh(vb->getStateLock());
-    if (honorStates) {
-        vbucket_state_t vbState = vb->getState();
-        if (vbState == vbucket_state_dead) {
-            ++stats.numNotMyVBuckets;
-            return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
-        } else if (vbState == disallowedState) {
-            ++stats.numNotMyVBuckets;
-            return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
-        } else if (vbState == vbucket_state_pending) {
-            if (vb->addPendingOp(cookie)) {
-                return GetValue(NULL, ENGINE_EWOULDBLOCK);
-            }
+    vbucket_state_t vbState = vb->getState();
+    if (vbState == vbucket_state_dead) {
+        return ENGINE_NOT_MY_VBUCKET;
+    } else if (vbState == disallowedState) {
+        return ENGINE_NOT_MY_VBUCKET;
+    } else if (vbState == vbucket_state_pending) {
+        if (vb->addPendingOp(cookie)) {
+            return ENGINE_EWOULDBLOCK;
         }
     }
+    return ENGINE_SUCCESS;
+}
 
-    const bool trackReference = (options & TRACK_REFERENCE);
+GetValue EventuallyPersistentStore::unlocked_get(RCPtr<VBucket> &vb,
+                                                 const std::string &key,
+                                                 int bucket_num,
+                                                 get_options_t options,
+                                                 bool &bgFetchRequired) {
+    bgFetchRequired = false;
 
-    int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    const bool trackReference = (options & TRACK_REFERENCE);
     StoredValue *v = fetchValidValue(vb, key, bucket_num, true,
                                      trackReference);
     if (v) {
@@ -2013,9 +2091,7 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
 
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
-            if (options & QUEUE_BG_FETCH) {
-                bgFetch(key, vbucket, cookie);
-            }
+            bgFetchRequired = (options & QUEUE_BG_FETCH);
             return GetValue(NULL, ENGINE_EWOULDBLOCK, v->getBySeqno(),
                             true, v->getNRUValue());
         }
@@ -2023,7 +2099,7 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         // Should we hide (return -1) for the items' CAS?
         const bool hide_cas = (options & HIDE_LOCKED_CAS) &&
                               v->isLocked(ep_current_time());
-        GetValue rv(v->toItem(hide_cas, vbucket), ENGINE_SUCCESS,
+        GetValue rv(v->toItem(hide_cas, vb->getId()), ENGINE_SUCCESS,
                     v->getBySeqno(), false, v->getNRUValue());
         return rv;
     } else {
@@ -2035,8 +2111,8 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         if (vb->maybeKeyExistsInFilter(key)) {
             ENGINE_ERROR_CODE ec = ENGINE_EWOULDBLOCK;
             if (options & QUEUE_BG_FETCH) { // Full eviction and need a bg fetch.
-                ec = addTempItemForBgFetch(lh, bucket_num, key, vb,
-                                           cookie, false);
+                ec = unlocked_addTempItemForBgFetch(bucket_num, key, vb);
+                bgFetchRequired = (ec == ENGINE_EWOULDBLOCK);
             }
             return GetValue(NULL, ec, -1, true);
         } else {
@@ -2048,6 +2124,168 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
     }
 }
 
+GetValue EventuallyPersistentStore::getInternal(const std::string &key,
+                                                uint16_t vbucket,
+                                                const void *cookie,
+                                                vbucket_state_t allowedState,
+                                                get_options_t options) {
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    if (!vb) {
+        ++stats.numNotMyVBuckets;
+        return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
+    }
+
+    ReaderLockHolder rlh(vb->getStateLock());
+    ENGINE_ERROR_CODE ec = checkStateForGet(vb, cookie, allowedState, options);
+    if (ec != ENGINE_SUCCESS) {
+        if (ec == ENGINE_NOT_MY_VBUCKET) {
+            ++stats.numNotMyVBuckets;
+        }
+        return GetValue(NULL, ec);
+    }
+
+    // Resident items can usually be read without the hash bucket lock.
+    Item *itm = vb->ht.optimisticGet(key, vbucket,
+                                     options & TRACK_REFERENCE,
+                                     options & HIDE_LOCKED_CAS);
+    if (itm) {
+        return GetValue(itm, ENGINE_SUCCESS, itm->getBySeqno(), false,
+                        itm->getNRUValue());
+    }
+
+    int bucket_num(0);
+    bool bgFetchRequired;
+    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    GetValue rv = unlocked_get(vb, key, bucket_num, options, bgFetchRequired);
+    if (bgFetchRequired) {
+        lh.unlock();
+        bgFetch(key, vbucket, cookie);
+    }
+    return rv;
+}
+
+std::vector<GetValue> EventuallyPersistentStore::getMulti(
+                    const std::vector<std::pair<std::string, uint16_t> > &keys,
+                    const void *cookie,
+                    get_options_t options) {
+    std::vector<GetValue> results(keys.size());
+
+    // The request may wait on several vbuckets and fetches; it's notified
+    // once they have all completed.
+    class IOCompleteCoalescer {
+    public:
+        IOCompleteCoalescer(EventuallyPersistentEngine& e, const void* c)
+            : engine(e), cookie(c) {
+            if (cookie) {
+                engine.coalesceIOComplete(cookie);
+            }
+        }
+        ~IOCompleteCoalescer() {
+            if (cookie) {
+                engine.releaseIOComplete(cookie);
+            }
+        }
+    private:
+        EventuallyPersistentEngine& engine;
+        const void* cookie;
+    } coalescer(engine, cookie);
+
+    // Group the keys (by index) by vbucket, so each vbucket's state lock is
+    // taken once.
+    std::map<uint16_t, std::vector<size_t> > byVBucket;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        byVBucket[keys[i].second].push_back(i);
+    }
+
+    std::set<KVShard*> shardsToNotify;
+    for (const auto& group : byVBucket) {
+        const uint16_t vbid = group.first;
+        const std::vector<size_t>& indices = group.second;
+
+        RCPtr<VBucket> vb = getVBucket(vbid);
+        if (!vb) {
+            stats.numNotMyVBuckets += indices.size();
+            for (size_t i : indices) {
+                results[i] = GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
+            }
+            continue;
+        }
+
+        ReaderLockHolder rlh(vb->getStateLock());
+        ENGINE_ERROR_CODE ec = checkStateForGet(vb, cookie,
+                                                vbucket_state_active, options);
+        if (ec != ENGINE_SUCCESS) {
+            if (ec == ENGINE_NOT_MY_VBUCKET) {
+                stats.numNotMyVBuckets += indices.size();
+            } else if (ec == ENGINE_EWOULDBLOCK && cookie) {
+                // Added to the vbucket's pending ops
+                engine.expectIOComplete(cookie);
+            }
+            for (size_t i : indices) {
+                results[i] = GetValue(NULL, ec);
+            }
+            continue;
+        }
+
+        // Then group them by hash table lock, so each lock is taken once,
+        // prefetching their buckets on the way.
+        std::map<size_t, std::vector<std::pair<size_t, int> > > byLock;
+        for (size_t i : indices) {
+            const int h = vb->ht.hash(keys[i].first);
+            vb->ht.prefetch(h);
+            byLock[vb->ht.getLockForHash(h)].push_back(std::make_pair(i, h));
+        }
+
+        std::vector<size_t> toFetch;
+        std::vector<size_t> moved;
+        auto getOne = [&](size_t i, int bucket_num) {
+            bool bgFetchRequired;
+            results[i] = unlocked_get(vb, keys[i].first, bucket_num, options,
+                                      bgFetchRequired);
+            if (bgFetchRequired) {
+                toFetch.push_back(i);
+            }
+        };
+
+        for (const auto& stripe : byLock) {
+            LockHolder lh = vb->ht.getLockedStripe(stripe.first);
+            for (const auto& entry : stripe.second) {
+                int bucket_num;
+                if (vb->ht.getBucketInLockedStripe(entry.second, stripe.first,
+                                                   &bucket_num)) {
+                    getOne(entry.first, bucket_num);
+                } else {
+                    moved.push_back(entry.first);
+                }
+            }
+        }
+
+        // A resize moved these keys to another lock after they were grouped.
+        for (size_t i : moved) {
+            int bucket_num(0);
+            LockHolder lh = vb->ht.getLockedBucket(keys[i].first, &bucket_num);
+            getOne(i, bucket_num);
+        }
+
+        // Queue the background fetches without waking the BgFetcher, so it
+        // reads all of this request's non-resident keys in one batch.
+        for (size_t i : toFetch) {
+            if (cookie) {
+                engine.expectIOComplete(cookie);
+            }
+            bgFetch(keys[i].first, vbid, cookie, false, false);
+        }
+        if (!toFetch.empty() && multiBGFetchEnabled()) {
+            shardsToNotify.insert(vbMap.getShardByVbId(vbid));
+        }
+    }
+
+    for (KVShard *shard : shardsToNotify) {
+        shard->getBgFetcher()->notifyBGEvent();
+    }
+    return results;
+}
+
 GetValue EventuallyPersistentStore::getRandomKey() {
     VBucketMap::id_type max = vbMap.getSize();
 
@@ -2460,6 +2698,9 @@ void EventuallyPersistentStore::completeStatsVKey(const void* cookie,
                     }
                 } else if (gcb.val.getStatus() == ENGINE_KEY_ENOENT) {
                     v->setNonExistent();
+                    if (eviction_policy == FULL_EVICTION) {
+                        vb->addFilterFalsePositive();
+                    }
                 } else {
                     // underlying kvstore couldn't fetch requested data
                     // log returned error and notify TMPFAIL to client
@@ -3201,6 +3442,9 @@ void EventuallyPersistentStore::flushOneDeleteAll() {
         RCPtr<VBucket> vb = getVBucket(i);
         if (vb) {
             LockHolder lh(vb_mutexes[vb->getId()]);
+            // Not while another of the shard's flusher writers is in the
+            // middle of a transaction on the same store.
+            LockHolder tlh(vbMap.getShardByVbId(i)->getRWTransactionLock());
             getRWUnderlying(vb->getId())->reset(i);
         }
     }
@@ -3246,18 +3490,31 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
         vb->getBackfillItems(items);
 
         hrtime_t _begin_ = gethrtime();
-        snapshot_range_t range;
-        range = vb->checkpointManager.getAllItemsForCursor(cursor, items);
+        // A large backlog is flushed in several batches (see FlushController)
+        ItemsForCursor cursorItems =
+            vb->checkpointManager.getItemsForCursor(
+                                    cursor, items,
+                                    flushController.getBatchLimit(),
+                                    std::numeric_limits<size_t>::max());
+        snapshot_range_t range = cursorItems.range;
         stats.persistenceCursorGetItemsHisto.add((gethrtime() - _begin_) / 1000);
+        if (cursorItems.moreAvailable) {
+            flushController.batchLimited();
+        }
 
         if (!items.empty()) {
+            rwUnderlying->optimizeWrites(items);
+
+            // Everything up to here overlaps with the write and commit of
+            // another vbucket by the shard's other flusher writers; only one
+            // of them can have a transaction open on the shard's store.
+            LockHolder tlh(shard->getRWTransactionLock());
             while (!rwUnderlying->begin()) {
                 ++stats.beginFailed;
                 LOG(EXTENSION_LOG_WARNING, "Failed to start a transaction!!! "
                     "Retry in 1 sec ...");
                 sleep(1);
             }
-            rwUnderlying->optimizeWrites(items);
 
             Item *prev = NULL;
             uint64_t maxSeqno = 0;
@@ -3314,17 +3571,22 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
                 }
             }
 
+            // Acknowledged by the commit of the transaction
+            shard->uncommittedFlushes.emplace_back(vb, true, range);
+
             /* Perform an explicit commit to disk if the commit interval reaches zero.
              * The commit interval varies based on the underlying store. For couchstore,
-             * the commit interval is set 1, so a commit is performed on every
-             * flushVBucket call. For forestdb, in order to be more optimized for SSDs,
-             * a larger commit interval is set, so that there is a bigger batch of
-             * writes perfomed. Hence, a commit is not explicitly performed on
-             * each flushVBucket call.
+             * the commit interval is set to couchstore_group_commit_vbuckets (1 by
+             * default), so a commit is performed on every flushVBucket call unless
+             * group commit is enabled. For forestdb, in order to be more optimized
+             * for SSDs, a larger commit interval is set, so that there is a bigger
+             * batch of writes perfomed. Hence, a commit is not explicitly performed
+             * on each flushVBucket call.
              */
             if (decrCommitInterval(shard->getId()) == 0) {
                 commit(shard->getId());
             }
+            tlh.unlock();
 
             hrtime_t flush_end = gethrtime();
             uint64_t trans_time = (flush_end - flush_start) / 1000000;
@@ -3334,14 +3596,6 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
                                        static_cast<double>(items_flushed));
             stats.cumulativeFlushTime.fetch_add(trans_time);
             stats.flusher_todo.store(0);
-            if (vb->rejectQueue.empty()) {
-                vb->setPersistedSnapshot(range.start, range.end);
-                uint64_t highSeqno = rwUnderlying->getLastPersistedSeqno(vbid);
-                if (highSeqno > 0 &&
-                    highSeqno != vbMap.getPersistenceSeqno(vbid)) {
-                    vbMap.setPersistenceSeqno(vbid, highSeqno);
-                }
-            }
         }
 
         rwUnderlying->pendingTasks();
@@ -3350,17 +3604,19 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
             wakeUpCheckpointRemover();
         }
 
-        if (vb->rejectQueue.empty()) {
-            vb->checkpointManager.itemsPersisted();
-            uint64_t seqno = vbMap.getPersistenceSeqno(vbid);
-            uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
-            vb->notifyOnPersistence(engine, seqno, true);
-            vb->notifyOnPersistence(engine, chkid, false);
-            if (chkid > 0 && chkid != vbMap.getPersistenceCheckpointId(vbid)) {
-                vbMap.setPersistenceCheckpointId(vbid, chkid);
-            }
-        } else {
+        if (!vb->rejectQueue.empty() || cursorItems.moreAvailable) {
             return RETRY_FLUSH_VBUCKET;
+        } else if (items.empty()) {
+            // Nothing to write, but an earlier flush of this vbucket may
+            // still await the commit of the open transaction.
+            KVShard::UncommittedFlush flush(vb, false, range);
+            LockHolder tlh(shard->getRWTransactionLock());
+            if (shard->uncommittedFlushes.empty()) {
+                tlh.unlock();
+                acknowledgePersistence(flush);
+            } else {
+                shard->uncommittedFlushes.push_back(flush);
+            }
         }
     }
 
@@ -3372,6 +3628,7 @@ void EventuallyPersistentStore::commit(uint16_t shardId) {
     std::list<PersistenceCallback *>& pcbs = rwUnderlying->getPersistenceCbList();
     BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
     hrtime_t commit_start = gethrtime();
+    size_t items = pcbs.size();
 
     while (!rwUnderlying->commit()) {
         ++stats.commitFailed;
@@ -3380,6 +3637,14 @@ void EventuallyPersistentStore::commit(uint16_t shardId) {
         sleep(1);
     }
 
+    // The syncs of this commit alone; io_total_sync_time would include
+    // those of vbucket state snapshots made meanwhile.
+    size_t syncTime = 0;
+    bool syncTimeMeasured = rwUnderlying->getStat("io_commit_sync_time",
+                                                  syncTime);
+    flushController.recordCommit(items, (gethrtime() - commit_start) / 1000,
+                                 syncTime, syncTimeMeasured);
+
     //Update the total items in the case of full eviction
     if (getItemEvictionPolicy() == FULL_EVICTION) {
         std::unordered_set<uint16_t> vbSet;
@@ -3402,6 +3667,14 @@ void EventuallyPersistentStore::commit(uint16_t shardId) {
          pcbs.pop_front();
     }
 
+    // Everything flushed in the transaction is now durable.
+    KVShard *shard = vbMap.shards[shardId];
+    std::vector<KVShard::UncommittedFlush> flushes;
+    flushes.swap(shard->uncommittedFlushes);
+    for (const auto& flush : flushes) {
+        acknowledgePersistence(flush);
+    }
+
     ++stats.flusherCommits;
     hrtime_t commit_end = gethrtime();
     uint64_t commit_time = (commit_end - commit_start) / 1000000;
@@ -3409,6 +3682,40 @@ void EventuallyPersistentStore::commit(uint16_t shardId) {
     stats.cumulativeCommitTime.fetch_add(commit_time);
 }
 
+void EventuallyPersistentStore::acknowledgePersistence(
+                                    const KVShard::UncommittedFlush &flush) {
+    RCPtr<VBucket> vb = flush.vb;
+    uint16_t vbid = vb->getId();
+    if (vbMap.getBucket(vbid) != vb) {
+        // Deleted (and possibly recreated) since it was flushed
+        return;
+    }
+
+    if (!vb->rejectQueue.empty()) {
+        // Items failed to persist; acknowledged when they're flushed again.
+        vbMap.getShardByVbId(vbid)->notifyFlusher();
+        return;
+    }
+
+    if (flush.written) {
+        vb->setPersistedSnapshot(flush.range.start, flush.range.end);
+        uint64_t highSeqno = getRWUnderlying(vbid)->getLastPersistedSeqno(vbid);
+        if (highSeqno > 0 &&
+            highSeqno != vbMap.getPersistenceSeqno(vbid)) {
+            vbMap.setPersistenceSeqno(vbid, highSeqno);
+        }
+    }
+
+    vb->checkpointManager.itemsPersisted();
+    uint64_t seqno = vbMap.getPersistenceSeqno(vbid);
+    uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
+    vb->notifyOnPersistence(engine, seqno, true);
+    vb->notifyOnPersistence(engine, chkid, false);
+    if (chkid > 0 && chkid != vbMap.getPersistenceCheckpointId(vbid)) {
+        vbMap.setPersistenceCheckpointId(vbid, chkid);
+    }
+}
+
 PersistenceCallback*
 EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
                                             RCPtr<VBucket> &vb) {
@@ -3626,6 +3933,11 @@ void EventuallyPersistentStore::completeBGFetchForSingleItem(
         LockHolder blh = vb->ht.getLockedBucket(key, &bucket);
         StoredValue *v = fetchValidValue(vb, key, bucket, true);
         if (fetched_item.metaDataOnly) {
+            if (status == ENGINE_KEY_ENOENT &&
+                eviction_policy == FULL_EVICTION) {
+                // Only fetched as the bloom filter didn't rule the key out.
+                vb->addFilterFalsePositive();
+            }
             if ((v && v->unlocked_restoreMeta(fetchedValue, status, vb->ht))
                 || ENGINE_KEY_ENOENT == status) {
                 /* If ENGINE_KEY_ENOENT is the status from storage and the temp
@@ -3683,6 +3995,7 @@ void EventuallyPersistentStore::completeBGFetchForSingleItem(
                 } else if (status == ENGINE_KEY_ENOENT) {
                     v->setNonExistent();
                     if (eviction_policy == FULL_EVICTION) {
+                        vb->addFilterFalsePositive();
                         // For the full eviction, we should notify
                         // ENGINE_SUCCESS to the memcached worker thread,
                         // so that the worker thread can visit the
@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include "executorpool.h"
+#include "flush_controller.h"
 #include "stored-value.h"
 #include "task_type.h"
 #include "vbucket.h"
@@ -261,6 +262,27 @@ public:
                            options);
     }
 
+    /**
+     * Retrieve several values at once.
+     *
+     * Keys are grouped by vbucket and then by hash table lock, so each
+     * vbucket state lock and each hash table lock is acquired once per
+     * call rather than once per key. The background fetches for all of the
+     * non-resident keys are queued before the BgFetcher is woken, so they
+     * are read from disk in a single batch (see KVStore::getMulti). The
+     * cookie is notified once, when the last of those fetches completes.
+     *
+     * @param keys    the keys to fetch, each with the vbucket it lives in
+     * @param cookie  the connection cookie
+     * @param options options specified for retrieval (as for get())
+     *
+     * @return a GetValue for each key, in the same order as keys
+     */
+    std::vector<GetValue> getMulti(
+                    const std::vector<std::pair<std::string, uint16_t> > &keys,
+                    const void *cookie,
+                    get_options_t options);
+
     GetValue getRandomKey(void);
 
     /**
@@ -455,11 +477,14 @@ public:
      * @param cookie the cookie of the requestor
      * @param type whether the fetch is for a non-resident value or metadata of
      *             a (possibly) deleted item
+     * @param notifyBgFetcher false to leave waking the BgFetcher to the
+     *                        caller, when queueing several fetches at once
      */
     void bgFetch(const std::string &key,
                  uint16_t vbucket,
                  const void *cookie,
-                 bool isMeta = false);
+                 bool isMeta = false,
+                 bool notifyBgFetcher = true);
 
     /**
      * Complete a background fetch of a non resident value or metadata.
@@ -744,6 +769,10 @@ public:
         return lastTransTimePerItem.load();
     }
 
+    FlushController &getFlushController() {
+        return flushController;
+    }
+
     bool isFlushAllScheduled() {
         return diskFlushAll.load();
     }
@@ -832,6 +861,13 @@ public:
 
     void commit(uint16_t shardId);
 
+    /**
+     * Acknowledge the persistence of a flush (updating the persisted
+     * snapshot, seqno and checkpoint id and notifying those waiting for
+     * them) once the transaction it was flushed in is committed.
+     */
+    void acknowledgePersistence(const KVShard::UncommittedFlush &flush);
+
     void addKVStoreStats(ADD_STAT add_stat, const void* cookie);
 
     void addKVStoreTimingStats(ADD_STAT add_stat, const void* cookie);
@@ -1029,14 +1065,45 @@ protected:
                          vbucket_state_t allowedState,
                          get_options_t options = TRACK_REFERENCE);
 
+    /**
+     * Check whether a get may be served by the given vbucket (if the options
+     * ask for the vbucket state to be honored). The vbucket's state lock
+     * must be held.
+     *
+     * @return ENGINE_SUCCESS, ENGINE_NOT_MY_VBUCKET, or ENGINE_EWOULDBLOCK
+     *         if the request has been queued until a pending vbucket
+     *         becomes active
+     */
+    ENGINE_ERROR_CODE checkStateForGet(RCPtr<VBucket> &vb, const void *cookie,
+                                       vbucket_state_t allowedState,
+                                       get_options_t options);
+
+    /**
+     * Look up a key for a get; the lock for the key's hash bucket must be
+     * held. Rather than queueing any background fetch needed (with the lock
+     * held), sets bgFetchRequired and leaves it to the caller.
+     */
+    GetValue unlocked_get(RCPtr<VBucket> &vb, const std::string &key,
+                          int bucket_num, get_options_t options,
+                          bool &bgFetchRequired);
+
     ENGINE_ERROR_CODE addTempItemForBgFetch(LockHolder &lock, int bucket_num,
                                             const std::string &key, RCPtr<VBucket> &vb,
                                             const void *cookie, bool metadataOnly,
                                             bool isReplication = false);
 
-    uint16_t getCommitInterval(uint16_t shardId);
+    /**
+     * Add the temporary item for a background fetch, without queueing the
+     * fetch. Returns ENGINE_EWOULDBLOCK if the fetch should be queued.
+     */
+    ENGINE_ERROR_CODE unlocked_addTempItemForBgFetch(int bucket_num,
+                                                     const std::string &key,
+                                                     RCPtr<VBucket> &vb,
+                                                     bool isReplication = false);
+
+    size_t getCommitInterval(uint16_t shardId);
 
-    uint16_t decrCommitInterval(uint16_t shardId);
+    size_t decrCommitInterval(uint16_t shardId);
 
     friend class Warmup;
     friend class Flusher;
@@ -1102,6 +1169,7 @@ protected:
     } cachedResidentRatio;
     size_t statsSnapshotTaskId;
     std::atomic<size_t> lastTransTimePerItem;
+    FlushController flushController;
     item_eviction_policy_t eviction_policy;
 
     std::mutex compactionLock;
@@ -592,6 +592,25 @@ extern "C" {
                 checkNumeric(valz);
                 validate(v, size_t(1), std::numeric_limits<size_t>::max());
                 e->getConfiguration().setDcpConsumerProcessBufferedMessagesBatchSize(v);
+            } else if (strcmp(keyz, "dcp_producer_step_batch_items") == 0) {
+                size_t v = atoi(valz);
+                checkNumeric(valz);
+                validate(v, size_t(1), size_t(10000));
+                e->getConfiguration().setDcpProducerStepBatchItems(v);
+            } else if (strcmp(keyz, "dcp_producer_step_batch_bytes") == 0) {
+                size_t v = atoi(valz);
+                checkNumeric(valz);
+                e->getConfiguration().setDcpProducerStepBatchBytes(v);
+            } else if (strcmp(keyz, "dcp_producer_sched_quantum") == 0) {
+                size_t v = atoi(valz);
+                checkNumeric(valz);
+                validate(v, size_t(1), std::numeric_limits<size_t>::max());
+                e->getConfiguration().setDcpProducerSchedQuantum(v);
+            } else if (strcmp(keyz, "dcp_takeover_stream_weight") == 0) {
+                size_t v = atoi(valz);
+                checkNumeric(valz);
+                validate(v, size_t(1), size_t(1024));
+                e->getConfiguration().setDcpTakeoverStreamWeight(v);
             } else {
                 msg = "Unknown config param";
                 rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -1334,6 +1353,14 @@ extern "C" {
                 }
                 return h->getRandomKey(cookie, response);
             }
+        case PROTOCOL_BINARY_CMD_EP_GET_MULTI:
+            {
+                if (request->request.extlen != 0 ||
+                    request->request.keylen != 0) {
+                    return ENGINE_EINVAL;
+                }
+                return h->handleGetMulti(cookie, request, response);
+            }
         case PROTOCOL_BINARY_CMD_GET_KEYS:
             {
                 return h->getAllKeys(cookie,
@@ -1955,7 +1982,8 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(
                                     GET_SERVER_API get_server_api) :
     clusterConfig(), epstore(NULL), workload(NULL),
     workloadPriority(NO_BUCKET_PRIORITY),
-    replicationThrottle(NULL), getServerApiFunc(get_server_api),
+    replicationThrottle(NULL), numCoalescedIOCompletes(0),
+    getServerApiFunc(get_server_api),
     dcpConnMap_(NULL),
     dcpFlowControlManager_(NULL),
     tapConnMap(NULL) ,
@@ -2093,6 +2121,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    HashTable::setDefaultBucketLayout(
+            HashTable::toBucketLayout(configuration.getHtBucketLayout()));
+    if (configuration.isSlabAllocatorEnabled()) {
+        slabArena.reset(new SlabArena());
+    }
+    if (configuration.isHtLockfreeReads()) {
+        epochManager.reset(new EpochManager());
+    }
     StoredValue::setMutationMemoryThreshold(
                                       configuration.getMutationMemThreshold());
 
@@ -3170,6 +3206,24 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.cumulativeFlushTime, add_stat, cookie);
     add_casted_stat("ep_flush_all", epstore->isFlushAllScheduled(), add_stat,
                     cookie);
+
+    FlushController &flushController = epstore->getFlushController();
+    add_casted_stat("ep_flush_target_batch",
+                    flushController.getTargetBatch(), add_stat, cookie);
+    add_casted_stat("ep_flush_batch_limit",
+                    flushController.getBatchLimit(), add_stat, cookie);
+    add_casted_stat("ep_flush_sync_cost",
+                    flushController.getSyncCost(), add_stat, cookie);
+    add_casted_stat("ep_flush_item_cost",
+                    flushController.getItemCost(), add_stat, cookie);
+    add_casted_stat("ep_flush_inflow_rate",
+                    flushController.getInflowRate(), add_stat, cookie);
+    add_casted_stat("ep_flush_queue_growth_rate",
+                    flushController.getQueueGrowthRate(), add_stat, cookie);
+    add_casted_stat("ep_flushes_deferred",
+                    flushController.getFlushesDeferred(), add_stat, cookie);
+    add_casted_stat("ep_flush_batches_limited",
+                    flushController.getBatchesLimited(), add_stat, cookie);
     add_casted_stat("curr_items", activeCountVisitor.getNumItems(), add_stat,
                     cookie);
     add_casted_stat("curr_temp_items", activeCountVisitor.getNumTempItems(),
@@ -3411,6 +3465,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_storedval_overhead", "unknown", add_stat, cookie);
 #endif
     add_casted_stat("ep_storedval_num", stats.numStoredVal, add_stat, cookie);
+    if (slabArena) {
+        add_casted_stat("ep_slab_num", slabArena->getNumSlabs(),
+                        add_stat, cookie);
+        add_casted_stat("ep_slab_size", slabArena->getSlabBytes(),
+                        add_stat, cookie);
+        add_casted_stat("ep_slab_used_size", slabArena->getUsedBytes(),
+                        add_stat, cookie);
+    }
     add_casted_stat("ep_overhead", stats.memOverhead, add_stat, cookie);
     add_casted_stat("ep_item_num", stats.numItem, add_stat, cookie);
     add_casted_stat("ep_total_cache_size",
@@ -3622,6 +3684,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.cursorDroppingUThreshold, add_stat, cookie);
     add_casted_stat("ep_cursors_dropped",
                     epstats.cursorsDropped, add_stat, cookie);
+    add_casted_stat("ep_items_expelled_from_checkpoints",
+                    epstats.itemsExpelledFromCheckpoints, add_stat, cookie);
+    add_casted_stat("ep_checkpoint_bytes_expelled",
+                    epstats.checkpointBytesExpelled, add_stat, cookie);
 
 
     // Note: These are also reported per-shard in 'kvstore' stats, however
@@ -3688,6 +3754,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
     add_casted_stat("ep_storedval_overhead", "unknown", add_stat, cookie);
 #endif
     add_casted_stat("ep_storedval_num", stats.numStoredVal, add_stat, cookie);
+    if (slabArena) {
+        add_casted_stat("ep_slab_num", slabArena->getNumSlabs(),
+                        add_stat, cookie);
+        add_casted_stat("ep_slab_size", slabArena->getSlabBytes(),
+                        add_stat, cookie);
+        add_casted_stat("ep_slab_used_size", slabArena->getUsedBytes(),
+                        add_stat, cookie);
+    }
     add_casted_stat("ep_item_num", stats.numItem, add_stat, cookie);
 
     std::map<std::string, size_t> alloc_stats;
@@ -4354,6 +4428,7 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
 
     // Regular commands
     add_casted_stat("get_cmd", stats.getCmdHisto, add_stat, cookie);
+    add_casted_stat("get_multi_cmd", stats.getMultiCmdHisto, add_stat, cookie);
     add_casted_stat("store_cmd", stats.storeCmdHisto, add_stat, cookie);
     add_casted_stat("arith_cmd", stats.arithCmdHisto, add_stat, cookie);
     add_casted_stat("get_stats_cmd", stats.getStatsCmdHisto, add_stat, cookie);
@@ -4371,6 +4446,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     // Misc
     add_casted_stat("notify_io", stats.notifyIOHisto, add_stat, cookie);
     add_casted_stat("batch_read", stats.getMultiHisto, add_stat, cookie);
+    add_casted_stat("bg_fetch_queue_wait", stats.bgFetchQueueWaitHisto,
+                    add_stat, cookie);
+    add_casted_stat("bg_fetch_disk", stats.bgFetchDiskHisto, add_stat, cookie);
 
     // Disk stats
     add_casted_stat("disk_insert", stats.diskInsertHisto, add_stat, cookie);
@@ -5163,8 +5241,10 @@ EventuallyPersistentEngine::handleCheckpointCmds(const void *cookie,
                 if (!es) {
                     vb->addHighPriorityVBEntry(chk_id, cookie, false);
                     storeEngineSpecific(cookie, this);
-                    // Wake up the flusher if it is idle.
+                    // Wake up the flusher if it is idle (or deferring).
                     getEpStore()->wakeUpFlusher();
+                    getEpStore()->getVBuckets().getShardByVbId(vbucket)->
+                        getFlusher()->wake();
                     return ENGINE_EWOULDBLOCK;
                 } else {
                     storeEngineSpecific(cookie, NULL);
@@ -5220,6 +5300,9 @@ EventuallyPersistentEngine::handleSeqnoCmds(const void *cookie,
             if (seqno > persisted_seqno) {
                 vb->addHighPriorityVBEntry(seqno, cookie, true);
                 storeEngineSpecific(cookie, this);
+                // The flusher may be deferring to gather a larger batch.
+                epstore->getVBuckets().getShardByVbId(vbucket)->
+                    getFlusher()->wake();
                 return ENGINE_EWOULDBLOCK;
             }
         } else {
@@ -6227,6 +6310,148 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getRandomKey(const void *cookie,
     return ret;
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::handleGetMulti(
+                                    const void *cookie,
+                                    protocol_binary_request_header *request,
+                                    ADD_RESPONSE response) {
+    const uint8_t* body = request->bytes + sizeof(request->bytes);
+    const uint32_t bodylen = ntohl(request->request.bodylen);
+
+    std::vector<std::pair<std::string, uint16_t> > keys;
+    for (uint32_t offset = 0; offset < bodylen;) {
+        uint16_t vbucket;
+        uint16_t keylen;
+        if (bodylen - offset < sizeof(vbucket) + sizeof(keylen)) {
+            return ENGINE_EINVAL;
+        }
+        memcpy(&vbucket, body + offset, sizeof(vbucket));
+        memcpy(&keylen, body + offset + sizeof(vbucket), sizeof(keylen));
+        offset += sizeof(vbucket) + sizeof(keylen);
+        keylen = ntohs(keylen);
+        if (keylen == 0 || bodylen - offset < keylen) {
+            return ENGINE_EINVAL;
+        }
+        keys.emplace_back(std::string(reinterpret_cast<const char*>(body) +
+                                      offset, keylen),
+                          ntohs(vbucket));
+        offset += keylen;
+    }
+
+    const get_options_t options = static_cast<get_options_t>(QUEUE_BG_FETCH |
+                                                             HONOR_STATES |
+                                                             TRACK_REFERENCE |
+                                                             DELETE_TEMP |
+                                                             HIDE_LOCKED_CAS |
+                                                             TRACK_STATISTICS);
+    std::vector<GetValue> results(getMulti(cookie, keys, options));
+
+    // Any key still to be read (or vbucket still pending) means the whole
+    // request is retried once it's been notified, as for a single get.
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+    for (const auto& gv : results) {
+        ENGINE_ERROR_CODE status = gv.getStatus();
+        if (status != ENGINE_SUCCESS && status != ENGINE_KEY_ENOENT &&
+            status != ENGINE_NOT_MY_VBUCKET && ret == ENGINE_SUCCESS) {
+            ret = status;
+        }
+    }
+
+    for (size_t ii = 0; ii < results.size(); ++ii) {
+        std::unique_ptr<Item> it(results[ii].getValue());
+        if (ret != ENGINE_SUCCESS) {
+            continue;
+        }
+
+        const std::string& key = keys[ii].first;
+        if (it) {
+            uint32_t flags = it->getFlags();
+            ret = sendResponse(response, key.data(), key.size(),
+                               &flags, sizeof(flags),
+                               it->getData(), it->getNBytes(),
+                               it->getDataType(),
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                               it->getCas(), cookie);
+        } else {
+            uint16_t status = (results[ii].getStatus() == ENGINE_NOT_MY_VBUCKET)
+                              ? PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET
+                              : PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+            ret = sendResponse(response, key.data(), key.size(), NULL, 0,
+                               NULL, 0, PROTOCOL_BINARY_RAW_BYTES, status, 0,
+                               cookie);
+        }
+    }
+
+    return ret;
+}
+
+void EventuallyPersistentEngine::coalesceIOComplete(const void* cookie) {
+    std::lock_guard<std::mutex> lh(coalescedIOCompleteMutex);
+    coalescedIOCompletes[cookie] = CoalescedIOComplete{0, false, false,
+                                                       ENGINE_SUCCESS};
+    numCoalescedIOCompletes.store(coalescedIOCompletes.size());
+}
+
+void EventuallyPersistentEngine::expectIOComplete(const void* cookie) {
+    std::lock_guard<std::mutex> lh(coalescedIOCompleteMutex);
+    auto it = coalescedIOCompletes.find(cookie);
+    if (it == coalescedIOCompletes.end()) {
+        throw std::logic_error("EventuallyPersistentEngine::"
+                               "expectIOComplete: cookie is not coalescing "
+                               "its notifications");
+    }
+    ++it->second.outstanding;
+}
+
+void EventuallyPersistentEngine::releaseIOComplete(const void* cookie) {
+    std::unique_lock<std::mutex> lh(coalescedIOCompleteMutex);
+    auto it = coalescedIOCompletes.find(cookie);
+    if (it == coalescedIOCompletes.end()) {
+        return;
+    }
+    it->second.released = true;
+    if (it->second.outstanding > 0) {
+        return;
+    }
+
+    // Everything has completed already
+    const bool notify = it->second.notified;
+    const ENGINE_ERROR_CODE status = it->second.status;
+    coalescedIOCompletes.erase(it);
+    numCoalescedIOCompletes.store(coalescedIOCompletes.size());
+    lh.unlock();
+    if (notify) {
+        notifyIOComplete(cookie, status);
+    }
+}
+
+bool EventuallyPersistentEngine::deferIOComplete(const void* cookie,
+                                                 ENGINE_ERROR_CODE& status) {
+    if (numCoalescedIOCompletes.load() == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lh(coalescedIOCompleteMutex);
+    auto it = coalescedIOCompletes.find(cookie);
+    if (it == coalescedIOCompletes.end()) {
+        return false;
+    }
+
+    CoalescedIOComplete& coalesced = it->second;
+    --coalesced.outstanding;
+    if (coalesced.status == ENGINE_SUCCESS) {
+        coalesced.status = status;
+    }
+    if (!coalesced.released || coalesced.outstanding > 0) {
+        coalesced.notified = true;
+        return true;
+    }
+
+    status = coalesced.status;
+    coalescedIOCompletes.erase(it);
+    numCoalescedIOCompletes.store(coalescedIOCompletes.size());
+    return false;
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::getAdjustedTime(
                              const void *cookie,
                              protocol_binary_request_get_adjusted_time *request,
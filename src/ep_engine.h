@@ -21,12 +21,15 @@
 #include "config.h"
 
 #include "ep.h"
+#include "epoch_manager.h"
+#include "slab_allocator.h"
 #include "tapconnection.h"
 #include "taskable.h"
 #include "vbucket.h"
 
 #include <memcached/engine.h>
 
+#include <memory>
 #include <string>
 
 class StoredValue;
@@ -59,6 +62,14 @@ typedef void (*NOTIFY_IO_COMPLETE_T)(const void *cookie,
 class EventuallyPersistentEngine;
 class TapConnMap;
 
+/**
+ * Engine-private opcode fetching several keys at once (see
+ * EventuallyPersistentEngine::handleGetMulti). The body is a sequence of
+ * (vbucket, key length, key) entries, the vbucket and key length in network
+ * byte order; a response is sent for each key, in order.
+ */
+static const uint8_t PROTOCOL_BINARY_CMD_EP_GET_MULTI = 0xe0;
+
 /**
     To allow Engines to run tasks.
 **/
@@ -310,6 +321,37 @@ public:
         return ret;
     }
 
+    /**
+     * Retrieve several keys at once; see EventuallyPersistentStore::getMulti.
+     * Each result holds either the item (owned by the caller) or the status
+     * get() would have returned for that key.
+     */
+    std::vector<GetValue> getMulti(
+                    const void* cookie,
+                    const std::vector<std::pair<std::string, uint16_t> >& keys,
+                    get_options_t options)
+    {
+        BlockTimer timer(&stats.getMultiCmdHisto);
+        std::vector<GetValue> results(epstore->getMulti(keys, cookie,
+                                                        options));
+
+        for (auto& gv : results) {
+            ENGINE_ERROR_CODE ret = gv.getStatus();
+            if (ret == ENGINE_SUCCESS) {
+                if (options & TRACK_STATISTICS) {
+                    ++stats.numOpsGet;
+                }
+            } else if (ret == ENGINE_KEY_ENOENT ||
+                       ret == ENGINE_NOT_MY_VBUCKET) {
+                if (isDegradedMode()) {
+                    gv.setStatus(ENGINE_TMPFAIL);
+                }
+            }
+        }
+
+        return results;
+    }
+
     const std::string& getName() const {
         return name;
     }
@@ -532,6 +574,10 @@ public:
                        protocol_binary_request_set_drift_counter_state *request,
                        ADD_RESPONSE response);
 
+    ENGINE_ERROR_CODE handleGetMulti(const void* cookie,
+                                     protocol_binary_request_header *request,
+                                     ADD_RESPONSE response);
+
     /**
      * Visit the objects and add them to the tap/dcp connecitons queue.
      * @todo this code should honor the backfill time!
@@ -547,7 +593,7 @@ public:
     void notifyIOComplete(const void *cookie, ENGINE_ERROR_CODE status) {
         if (cookie == NULL) {
             LOG(EXTENSION_LOG_WARNING, "Tried to signal a NULL cookie!");
-        } else {
+        } else if (!deferIOComplete(cookie, status)) {
             BlockTimer bt(&stats.notifyIOHisto);
             EventuallyPersistentEngine *epe = ObjectRegistry::onSwitchThread(NULL, true);
             serverApi->cookie->notify_io_complete(cookie, status);
@@ -610,13 +656,38 @@ public:
 
     template <typename T>
     void notifyIOComplete(T cookies, ENGINE_ERROR_CODE status) {
-        EventuallyPersistentEngine *epe = ObjectRegistry::onSwitchThread(NULL, true);
-        std::for_each(cookies.begin(), cookies.end(),
-                      std::bind2nd(std::ptr_fun((NOTIFY_IO_COMPLETE_T)serverApi->cookie->notify_io_complete),
-                                   status));
-        ObjectRegistry::onSwitchThread(epe);
+        for (const void* cookie : cookies) {
+            ENGINE_ERROR_CODE cookieStatus = status;
+            if (!deferIOComplete(cookie, cookieStatus)) {
+                EventuallyPersistentEngine *epe =
+                        ObjectRegistry::onSwitchThread(NULL, true);
+                serverApi->cookie->notify_io_complete(cookie, cookieStatus);
+                ObjectRegistry::onSwitchThread(epe);
+            }
+        }
     }
 
+    /**
+     * Coalesce the notifications of a request which may wait on several
+     * operations (the background fetches of a multi-get, say) into one.
+     * Notifications for cookie are held back from now on; once
+     * releaseIOComplete(cookie) has been called and a notification has
+     * arrived for each expectIOComplete(cookie), a single one is sent,
+     * with the first failure status if there was one.
+     */
+    void coalesceIOComplete(const void* cookie);
+
+    /**
+     * Announce one more notification to come for a coalescing cookie.
+     */
+    void expectIOComplete(const void* cookie);
+
+    /**
+     * Stop expecting notifications for a coalescing cookie; called once
+     * every operation has been started.
+     */
+    void releaseIOComplete(const void* cookie);
+
     void handleDisconnect(const void *cookie);
     void handleDeleteBucket(const void *cookie);
 
@@ -712,6 +783,22 @@ public:
         return stats;
     }
 
+    /**
+     * Get the slab arena StoredValues and small Blobs are allocated from,
+     * or NULL if slab allocation is disabled.
+     */
+    SlabArena* getSlabArena() {
+        return slabArena.get();
+    }
+
+    /**
+     * Get the epoch manager deferring frees for lock-free hash table reads,
+     * or NULL if they are disabled.
+     */
+    EpochManager* getEpochManager() {
+        return epochManager.get();
+    }
+
     EventuallyPersistentStore* getEpStore() { return epstore; }
 
     TapConnMap &getTapConnMap() { return *tapConnMap; }
@@ -1003,6 +1090,28 @@ protected:
     // server.
     void initializeEngineCallbacks();
 
+    /**
+     * Account for a notification of cookie, if it is coalescing them (see
+     * coalesceIOComplete).
+     *
+     * @param status the notification's status; set to the one to send if
+     *        this is the last of the coalesced notifications
+     * @return true if the notification is to be held back
+     */
+    bool deferIOComplete(const void* cookie, ENGINE_ERROR_CODE& status);
+
+    //! Notifications being coalesced for a cookie
+    struct CoalescedIOComplete {
+        //! Expected notifications still to arrive (negative if some
+        //! arrived before they were announced)
+        int outstanding;
+        //! Whether releaseIOComplete has been called
+        bool released;
+        //! Whether any notification has been held back
+        bool notified;
+        ENGINE_ERROR_CODE status;
+    };
+
     SERVER_HANDLE_V1 *serverApi;
     EventuallyPersistentStore *epstore;
     WorkLoadPolicy *workload;
@@ -1012,6 +1121,9 @@ protected:
     std::map<const void*, Item*> lookups;
     std::unordered_map<const void*, ENGINE_ERROR_CODE> allKeysLookups;
     std::mutex lookupMutex;
+    std::unordered_map<const void*, CoalescedIOComplete> coalescedIOCompletes;
+    std::atomic<size_t> numCoalescedIOCompletes;
+    std::mutex coalescedIOCompleteMutex;
     GET_SERVER_API getServerApiFunc;
     union {
         engine_info info;
@@ -1029,6 +1141,9 @@ protected:
     size_t getlMaxTimeout;
     size_t maxFailoverEntries;
     EPStats stats;
+    std::unique_ptr<SlabArena> slabArena;
+    // Destroyed before slabArena, as it may still hold slab memory.
+    std::unique_ptr<EpochManager> epochManager;
     Configuration configuration;
     std::atomic<bool> trafficEnabled;
 
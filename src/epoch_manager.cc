@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "epoch_manager.h"
+
+#include <functional>
+#include <thread>
+
+namespace {
+
+// Slots tried by a reader before giving up on pinning.
+const size_t maxSlotProbes = 8;
+
+}
+
+EpochManager::Guard::Guard(EpochManager &manager) : slot(NULL) {
+    // Announcing an epoch which has since moved on is harmless: it holds
+    // the epoch back until this guard is released, and only objects
+    // retired (i.e. unlinked) before the read started are then freed.
+    const uint64_t e = manager.epoch.load();
+    const size_t start = getThreadIndex();
+    for (size_t i = 0; i < maxSlotProbes; ++i) {
+        std::atomic<uint64_t> &s = manager.slots[(start + i) % numSlots].epoch;
+        uint64_t expected = 0;
+        if (s.compare_exchange_strong(expected, e)) {
+            slot = &s;
+            return;
+        }
+    }
+}
+
+EpochManager::Guard::~Guard() {
+    if (slot) {
+        slot->store(0, std::memory_order_release);
+    }
+}
+
+EpochManager::EpochManager() : epoch(1), numRetired(0) {
+}
+
+EpochManager::~EpochManager() {
+    for (RetireList &list : retireLists) {
+        deleteRetired(list.items);
+    }
+}
+
+size_t EpochManager::getThreadIndex() {
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+void EpochManager::retire(void *ptr, Deleter deleter) {
+    RetireList &list = retireLists[getThreadIndex() % numRetireLists];
+    std::vector<Retired> freeable;
+    {
+        std::lock_guard<std::mutex> lh(list.mutex);
+        Retired r = { ptr, deleter, epoch.load() };
+        list.items.push_back(r);
+        numRetired++;
+        if (++list.sinceReclaim < reclaimInterval) {
+            return;
+        }
+        list.sinceReclaim = 0;
+        tryAdvance();
+        collectReclaimable(list, freeable);
+    }
+    // Deleters run without the list locked, as they may take other locks.
+    deleteRetired(freeable);
+}
+
+void EpochManager::reclaim() {
+    tryAdvance();
+    for (RetireList &list : retireLists) {
+        std::vector<Retired> freeable;
+        {
+            std::lock_guard<std::mutex> lh(list.mutex);
+            collectReclaimable(list, freeable);
+        }
+        deleteRetired(freeable);
+    }
+}
+
+void EpochManager::tryAdvance() {
+    uint64_t e = epoch.load();
+    for (const Slot &s : slots) {
+        const uint64_t pinned = s.epoch.load();
+        if (pinned != 0 && pinned != e) {
+            return;
+        }
+    }
+    epoch.compare_exchange_strong(e, e + 1);
+}
+
+void EpochManager::collectReclaimable(RetireList &list,
+                                      std::vector<Retired> &freeable) {
+    // A reader may have pinned the epoch before an object was retired (and
+    // still be looking at it) until the epoch has advanced twice.
+    const uint64_t e = epoch.load();
+    size_t kept = 0;
+    for (size_t i = 0; i < list.items.size(); ++i) {
+        const Retired &r = list.items[i];
+        if (r.epoch + 2 <= e) {
+            freeable.push_back(r);
+        } else {
+            list.items[kept++] = r;
+        }
+    }
+    list.items.resize(kept);
+}
+
+void EpochManager::deleteRetired(const std::vector<Retired> &items) {
+    for (const Retired &r : items) {
+        r.deleter(r.ptr);
+    }
+    numRetired.fetch_sub(items.size());
+}
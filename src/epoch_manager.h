@@ -0,0 +1,159 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_EPOCH_MANAGER_H_
+#define SRC_EPOCH_MANAGER_H_ 1
+
+#include "config.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "utility.h"
+
+/**
+ * Epoch-based reclamation of memory which may still be read by threads that
+ * don't hold the lock guarding it (see HashTable::optimisticGet()).
+ *
+ * A reader pins the current (global) epoch for the duration of its read with
+ * a Guard. A writer unlinks an object under the usual lock and then retires
+ * it rather than freeing it; the object is tagged with the epoch at the time
+ * of retirement. The epoch can only be advanced once every pinned reader has
+ * observed the current one, so once the epoch is two past an object's tag no
+ * reader can still hold a pointer to it and it is freed.
+ *
+ * Retired objects are kept in a few mutex-guarded lists (chosen by thread)
+ * so concurrent writers rarely contend; every reclaimInterval retirements
+ * to a list the epoch is advanced if possible and that list's reclaimable
+ * objects are freed.
+ */
+class EpochManager {
+public:
+    //! Frees a retired object.
+    typedef void (*Deleter)(void *ptr);
+
+    //! Maximum number of readers which can be pinned at once.
+    static const size_t numSlots = 128;
+    static const size_t numRetireLists = 16;
+    //! Retirements to a list between attempts to free its objects.
+    static const size_t reclaimInterval = 64;
+
+    /**
+     * Pins the current epoch for the lifetime of the Guard, so no object
+     * retired from now on is freed until it is destroyed.
+     *
+     * Pinning fails (rather than blocks) if too many readers are already
+     * pinned; the reader must then fall back to taking the lock.
+     */
+    class Guard {
+    public:
+        explicit Guard(EpochManager &manager);
+        ~Guard();
+
+        bool isPinned() const {
+            return slot != NULL;
+        }
+
+    private:
+        std::atomic<uint64_t> *slot;
+
+        DISALLOW_COPY_AND_ASSIGN(Guard);
+    };
+
+    EpochManager();
+
+    /**
+     * Frees every object still retired; no reader may be pinned.
+     */
+    ~EpochManager();
+
+    /**
+     * Free the given object with the given deleter once no pinned reader can
+     * still be accessing it. It must already be unreachable for new readers.
+     */
+    void retire(void *ptr, Deleter deleter);
+
+    /**
+     * Advance the epoch if possible and free whatever can now be freed.
+     * (This is also done periodically by retire(), which only drains the
+     * caller's list; the hash table resizer task and completed resizes
+     * call this so that lists no longer retired to are drained too.)
+     */
+    void reclaim();
+
+    //! Number of objects retired but not yet freed.
+    size_t getNumRetired() const {
+        return numRetired.load();
+    }
+
+    uint64_t getEpoch() const {
+        return epoch.load();
+    }
+
+private:
+    struct Retired {
+        void    *ptr;
+        Deleter  deleter;
+        uint64_t epoch;
+    };
+
+    struct RetireList {
+        RetireList() : sinceReclaim(0) {}
+
+        std::mutex            mutex;
+        std::vector<Retired>  items;
+        size_t                sinceReclaim;
+    };
+
+    /**
+     * A reader's pinned epoch, or 0 if free. Padded to a cache line so
+     * readers on different slots don't contend.
+     */
+    struct Slot {
+        Slot() : epoch(0) {}
+
+        std::atomic<uint64_t> epoch;
+        char                  padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    static size_t getThreadIndex();
+
+    /**
+     * Advance the epoch, provided every pinned reader has observed the
+     * current one.
+     */
+    void tryAdvance();
+
+    /**
+     * Move the objects in the given (locked) list which can be freed into
+     * freeable.
+     */
+    void collectReclaimable(RetireList &list, std::vector<Retired> &freeable);
+
+    void deleteRetired(const std::vector<Retired> &items);
+
+    //! Current epoch; starts at 1 as 0 marks a free slot.
+    std::atomic<uint64_t> epoch;
+    std::atomic<size_t>   numRetired;
+    Slot                  slots[numSlots];
+    RetireList            retireLists[numRetireLists];
+
+    DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+#endif  // SRC_EPOCH_MANAGER_H_
@@ -0,0 +1,145 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "configuration.h"
+#include "flush_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const size_t FlushController::syncCostRatio = 4;
+const double FlushController::maxFlushTime = 0.5;
+const double FlushController::smoothing = 0.2;
+
+namespace {
+
+// Minimum interval (in seconds) over which the queue's rates are measured
+const double minSampleInterval = 0.1;
+
+}
+
+FlushController::FlushController(Configuration &config, EPStats &s,
+                                 size_t shards) :
+    stats(s),
+    numShards(std::max(shards, size_t(1))),
+    enabled(config.isFlusherAdaptiveBatching()),
+    maxDelay(config.getFlusherMaxBatchDelay()),
+    costsSampled(false),
+    ratesSampled(false),
+    smoothedSyncCost(0),
+    smoothedItemCost(0),
+    lastSampleTime(gethrtime()),
+    lastQueueSize(0),
+    itemsSinceSample(0),
+    targetBatch(0),
+    batchLimit(std::numeric_limits<size_t>::max()),
+    syncCost(0),
+    itemCost(0),
+    inflowRate(0),
+    queueGrowthRate(0),
+    flushesDeferred(0),
+    batchesLimited(0)
+{}
+
+double FlushController::smooth(double current, double sample, bool first) {
+    return first ? sample : current + smoothing * (sample - current);
+}
+
+void FlushController::recordCommit(size_t items, hrtime_t commitTime,
+                                   hrtime_t syncTime, bool syncTimeMeasured) {
+    std::lock_guard<std::mutex> lh(mutex);
+
+    if (items > 0 && syncTimeMeasured) {
+        syncTime = std::min(syncTime, commitTime);
+        double perItem = static_cast<double>(commitTime - syncTime) * 1000 /
+                         items;
+        smoothedSyncCost = smooth(smoothedSyncCost, syncTime, !costsSampled);
+        smoothedItemCost = smooth(smoothedItemCost, perItem, !costsSampled);
+        costsSampled = true;
+
+        syncCost = static_cast<size_t>(smoothedSyncCost);
+        itemCost = static_cast<size_t>(smoothedItemCost);
+
+        // The smallest batch whose variable cost is syncCostRatio times the
+        // commit's fixed cost, and the largest one written in maxFlushTime.
+        double itemNs = std::max(smoothedItemCost, 1.0);
+        double target = std::ceil(syncCostRatio * smoothedSyncCost * 1000 /
+                                  itemNs);
+        double limit = maxFlushTime * 1e9 / itemNs;
+        targetBatch = static_cast<size_t>(std::max(target, 1.0));
+        batchLimit = static_cast<size_t>(std::max(limit, target));
+    }
+
+    itemsSinceSample += items;
+    hrtime_t now = gethrtime();
+    double interval = static_cast<double>(now - lastSampleTime) / 1e9;
+    if (interval < minSampleInterval) {
+        return;
+    }
+
+    size_t queueSize = stats.diskQueueSize.load();
+    double growth = (static_cast<double>(queueSize) -
+                     static_cast<double>(lastQueueSize)) / interval;
+    // Whatever was flushed was queued too.
+    double inflow = std::max(growth + itemsSinceSample / interval, 0.0);
+    double smoothedGrowth = smooth(queueGrowthRate.load(), growth,
+                                   !ratesSampled);
+    double smoothedInflow = smooth(inflowRate.load(), inflow,
+                                   !ratesSampled);
+    ratesSampled = true;
+    queueGrowthRate = static_cast<int64_t>(smoothedGrowth);
+    inflowRate = static_cast<size_t>(smoothedInflow);
+
+    lastSampleTime = now;
+    lastQueueSize = queueSize;
+    itemsSinceSample = 0;
+}
+
+double FlushController::getFlushDelay() {
+    size_t target = targetBatch;
+    if (!enabled || maxDelay == 0 || target == 0) {
+        return 0;
+    }
+
+    // Queued items cost memory; don't hold them back once it's short.
+    if (stats.getTotalMemoryUsed() >= stats.mem_low_wat.load()) {
+        return 0;
+    }
+
+    size_t queued = stats.diskQueueSize.load() / numShards;
+    double rate = static_cast<double>(inflowRate) / numShards;
+    if (queued >= target || rate <= 0) {
+        // Either a full batch is ready or waiting won't fill it.
+        return 0;
+    }
+
+    // Waiting longer than a commit's syncs take costs more latency than
+    // the syncs saved.
+    double delay = (target - queued) / rate;
+    delay = std::min(delay, static_cast<double>(syncCost) / 1e6);
+    return std::min(delay, static_cast<double>(maxDelay) / 1000);
+}
+
+size_t FlushController::getBatchLimit() const {
+    if (!enabled) {
+        return std::numeric_limits<size_t>::max();
+    }
+    return batchLimit;
+}
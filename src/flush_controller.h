@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_FLUSH_CONTROLLER_H_
+#define SRC_FLUSH_CONTROLLER_H_ 1
+
+#include "config.h"
+
+#include <mutex>
+
+#include <platform/platform.h>
+#include <relaxed_atomic.h>
+
+#include "stats.h"
+#include "utility.h"
+
+class Configuration;
+
+/**
+ * Feedback controller choosing the size and timing of the flushers' batches
+ * from the measured cost of their commits and the rate items are queued for
+ * persistence at.
+ *
+ * A commit costs a fixed part, dominated by its file syncs, plus a part
+ * proportional to the number of items written. The target batch is the
+ * smallest one whose fixed part is at most 1/syncCostRatio of the variable
+ * part; flushing a shard is deferred (for at most the configured maximum
+ * delay) until enough items are queued to fill it, unless memory is short
+ * or someone waits for persistence. A single vbucket flush is limited to
+ * the items which can be written within maxFlushTime (but never fewer than
+ * the target), so a large backlog is flushed in several commits.
+ *
+ * The costs are smoothed (exponentially weighted) over the commits of all
+ * shards, which share the disk.
+ */
+class FlushController {
+public:
+    // Fixed cost of a commit allowed per unit of its variable cost.
+    static const size_t syncCostRatio;
+    // Time (in seconds) writing a single vbucket's batch may take.
+    static const double maxFlushTime;
+    // Weight of the latest sample in the smoothed costs and rates.
+    static const double smoothing;
+
+    FlushController(Configuration &config, EPStats &s, size_t shards);
+
+    /**
+     * Account for a commit of the given number of items (if any) which
+     * took commitTime, of which syncTime (if measured) was spent in syncs.
+     * Times are in microseconds.
+     */
+    void recordCommit(size_t items, hrtime_t commitTime, hrtime_t syncTime,
+                      bool syncTimeMeasured);
+
+    /**
+     * How long (in seconds) a shard should wait for more items before
+     * flushing; 0 to flush now.
+     */
+    double getFlushDelay();
+
+    /**
+     * Number of items a single vbucket flush should be limited to.
+     */
+    size_t getBatchLimit() const;
+
+    void flushDeferred() { ++flushesDeferred; }
+    void batchLimited() { ++batchesLimited; }
+
+    void setEnabled(bool to) { enabled = to; }
+    void setMaxDelay(size_t ms) { maxDelay = ms; }
+
+    bool isEnabled() const { return enabled; }
+    size_t getTargetBatch() const { return targetBatch; }
+    // Smoothed fixed cost of a commit, in microseconds
+    size_t getSyncCost() const { return syncCost; }
+    // Smoothed cost of writing an item, in nanoseconds
+    size_t getItemCost() const { return itemCost; }
+    // Smoothed rate (items/s) items are queued for persistence at
+    size_t getInflowRate() const { return inflowRate; }
+    // Smoothed rate (items/s) the disk write queue grows (or shrinks) at
+    int64_t getQueueGrowthRate() const { return queueGrowthRate; }
+    size_t getFlushesDeferred() const { return flushesDeferred; }
+    size_t getBatchesLimited() const { return batchesLimited; }
+
+private:
+    static double smooth(double current, double sample, bool first);
+
+    EPStats &stats;
+    const size_t numShards;
+
+    Couchbase::RelaxedAtomic<bool> enabled;
+    // Maximum time (ms) to defer a flush for
+    Couchbase::RelaxedAtomic<size_t> maxDelay;
+
+    // Guards the sampling state below
+    std::mutex mutex;
+    bool costsSampled;
+    bool ratesSampled;
+    double smoothedSyncCost;
+    double smoothedItemCost;
+    hrtime_t lastSampleTime;
+    size_t lastQueueSize;
+    size_t itemsSinceSample;
+
+    Couchbase::RelaxedAtomic<size_t> targetBatch;
+    Couchbase::RelaxedAtomic<size_t> batchLimit;
+    Couchbase::RelaxedAtomic<size_t> syncCost;
+    Couchbase::RelaxedAtomic<size_t> itemCost;
+    Couchbase::RelaxedAtomic<size_t> inflowRate;
+    Couchbase::RelaxedAtomic<int64_t> queueGrowthRate;
+    Couchbase::RelaxedAtomic<size_t> flushesDeferred;
+    Couchbase::RelaxedAtomic<size_t> batchesLimited;
+
+    DISALLOW_COPY_AND_ASSIGN(FlushController);
+};
+
+#endif  // SRC_FLUSH_CONTROLLER_H_
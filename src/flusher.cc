@@ -127,6 +127,7 @@ enum flusher_state Flusher::state() const {
 void Flusher::initialize() {
     LOG(EXTENSION_LOG_DEBUG, "Initializing flusher");
     transition_state(running);
+    scheduleWriters();
 }
 
 void Flusher::schedule_UNLOCKED() {
@@ -138,6 +139,18 @@ void Flusher::schedule_UNLOCKED() {
     iom->schedule(task, WRITER_TASK_IDX);
 }
 
+void Flusher::scheduleWriters() {
+    LockHolder lh(taskMutex);
+    ExecutorPool* iom = ExecutorPool::get();
+    for (size_t ii = writerTaskIds.size() + 1; ii < numWriters; ++ii) {
+        ExTask task = new FlusherTask(ObjectRegistry::getCurrentEngine(),
+                                      this,
+                                      shard->getId());
+        writerTaskIds.push_back(task->getId());
+        iom->schedule(task, WRITER_TASK_IDX);
+    }
+}
+
 void Flusher::start() {
     LockHolder lh(taskMutex);
     if (taskId) {
@@ -146,6 +159,7 @@ void Flusher::start() {
             uint64_t(taskId.load()), stateName());
         return;
     }
+    writerTaskIds.clear();
     schedule_UNLOCKED();
 }
 
@@ -154,9 +168,21 @@ void Flusher::wake(void) {
     if (taskId > 0) {
         ExecutorPool::get()->wake(taskId);
     }
+    if (numWriters == 1) {
+        // No other writers; don't take taskMutex on every wake
+        return;
+    }
+    LockHolder lh(taskMutex);
+    for (auto id : writerTaskIds) {
+        ExecutorPool::get()->wake(id);
+    }
 }
 
 bool Flusher::step(GlobalTask *task) {
+    if (task->getId() != taskId && _state != initializing) {
+        return writerStep(task);
+    }
+
     flusher_state current_state = _state.load();
 
     switch (current_state) {
@@ -173,6 +199,11 @@ bool Flusher::step(GlobalTask *task) {
     case paused:
     case pausing:
         if (_state == pausing) {
+            // Only paused once no other writer is flushing.
+            if (busyWriters.load() > 0) {
+                task->snooze(WRITER_POLL_TIME);
+                return true;
+            }
             transition_state(paused);
         }
         // Indefinitely put task to sleep..
@@ -180,27 +211,33 @@ bool Flusher::step(GlobalTask *task) {
         return true;
 
     case running:
-        flushVB();
+    {
+        double delay = flushVB(true);
         if (_state == running) {
-            double tosleep = computeMinSleepTime();
+            double tosleep = delay > 0 ? delay : computeMinSleepTime();
             if (tosleep > 0) {
-                store->commit(shard->getId());
-                resetCommitInterval();
+                commit();
                 task->snooze(tosleep);
             }
         }
         return true;
+    }
 
     case stopping:
+        completeFlush();
+        if (busyWriters.load() > 0) {
+            // The other writers stop once they've finished their current
+            // vbucket, which they may have requeued.
+            task->snooze(WRITER_POLL_TIME);
+            return true;
+        }
         {
             std::stringstream ss;
             ss << "Shutting down flusher (Write of all dirty items)"
                << std::endl;
             LOG(EXTENSION_LOG_DEBUG, "%s", ss.str().c_str());
         }
-        completeFlush();
-        store->commit(shard->getId());
-        resetCommitInterval();
+        commit();
         LOG(EXTENSION_LOG_DEBUG, "Flusher stopped");
         transition_state(stopped);
         return false;
@@ -215,12 +252,53 @@ bool Flusher::step(GlobalTask *task) {
                                std::to_string(current_state));
 }
 
+bool Flusher::writerStep(GlobalTask *task) {
+    switch (_state.load()) {
+    case running:
+        // Counted as busy before checking the state again, so the flusher
+        // can't be paused (or stopped) while this writer is flushing.
+        ++busyWriters;
+        {
+            double delay = 0;
+            if (_state == running) {
+                delay = flushVB(false);
+            }
+            if (delay > 0) {
+                task->snooze(delay);
+            } else if (canSnooze()) {
+                task->snooze(INT_MAX);
+            }
+        }
+        --busyWriters;
+        return true;
+
+    case initializing:
+    case pausing:
+    case paused:
+        task->snooze(INT_MAX);
+        return true;
+
+    case stopping:
+    case stopped:
+        return false;
+    }
+
+    throw std::logic_error("Flusher::writerStep: Invalid state " +
+                               std::to_string(_state.load()));
+}
+
 void Flusher::completeFlush() {
     while(!canSnooze()) {
-        flushVB();
+        flushVB(true);
     }
 }
 
+void Flusher::commit() {
+    LockHolder lh(shard->getRWTransactionLock());
+    store->commit(shard->getId());
+    resetCommitInterval();
+}
+
 double Flusher::computeMinSleepTime() {
     if (!canSnooze() || shard->highPriorityCount.load() > 0) {
         minSleepTime = DEFAULT_MIN_SLEEP_TIME;
@@ -230,7 +308,7 @@ double Flusher::computeMinSleepTime() {
     return std::min(minSleepTime, DEFAULT_MAX_SLEEP_TIME);
 }
 
-uint16_t Flusher::decrCommitInterval(void) {
+size_t Flusher::decrCommitInterval(void) {
     --currCommitInterval;
     //When the current commit interval hits zero, then reset the
     //current commit interval to the initial value
@@ -242,22 +320,66 @@ uint16_t Flusher::decrCommitInterval(void) {
     return currCommitInterval;
 }
 
-void Flusher::flushVB(void) {
-    if (store->diskFlushAll && shard->getId() != EP_PRIMARY_SHARD) {
-        // another shard is doing disk flush
+double Flusher::computeFlushDelay_UNLOCKED() {
+    if (_state != running || shard->highPriorityCount.load() > 0) {
+        // Someone is waiting for persistence.
+        deferUntil = 0;
+        return 0;
+    }
+
+    FlushController &controller = store->getFlushController();
+    hrtime_t now = gethrtime();
+    if (deferUntil == 0) {
+        double delay = controller.getFlushDelay();
+        if (delay > 0) {
+            deferUntil = now + static_cast<hrtime_t>(delay * 1e9);
+            controller.flushDeferred();
+        }
+        return delay;
+    }
+
+    if (now >= deferUntil || controller.getFlushDelay() == 0) {
+        // Waited long enough, or the batch filled up meanwhile.
+        deferUntil = 0;
+        return 0;
+    }
+    return static_cast<double>(deferUntil - now) / 1e9;
+}
+
+double Flusher::flushVB(bool primary) {
+    if (store->diskFlushAll &&
+        (shard->getId() != EP_PRIMARY_SHARD || !primary)) {
+        // another shard (or the primary shard's first writer) is doing disk
+        // flush
         bool inverse = false;
         pendingMutation.compare_exchange_strong(inverse, true);
-        return;
+        return 0;
     }
 
+    uint16_t vbid;
+    bool highPriority;
+    LockHolder lh(queueMutex);
     if (lpVbs.empty()) {
         if (hpVbs.empty()) {
             doHighPriority = false;
+            if (pendingMutation.load() && !store->diskFlushAll) {
+                // Let the pending mutations accumulate into a batch worth
+                // committing.
+                double delay = computeFlushDelay_UNLOCKED();
+                if (delay > 0) {
+                    return delay;
+                }
+            }
         }
         bool inverse = true;
         if (pendingMutation.compare_exchange_strong(inverse, false)) {
             for (auto vbid : shard->getVBucketsSortedByState()) {
-                lpVbs.push(vbid);
+                if (flushing.count(vbid)) {
+                    // Queued once the writer flushing it has finished.
+                    flushAgain.insert(std::make_pair(vbid, false));
+                } else {
+                    lpVbs.push(vbid);
+                }
             }
         }
     }
@@ -266,7 +388,11 @@ void Flusher::flushVB(void) {
         for (auto vbid : shard->getVBuckets()) {
             RCPtr<VBucket> vb = store->getVBucket(vbid);
             if (vb && vb->getHighPriorityChkSize() > 0) {
-                hpVbs.push(vbid);
+                if (flushing.count(vbid)) {
+                    flushAgain[vbid] = true;
+                } else {
+                    hpVbs.push(vbid);
+                }
             }
         }
         numHighPriority = hpVbs.size();
@@ -277,21 +403,58 @@ void Flusher::flushVB(void) {
 
     if (hpVbs.empty() && lpVbs.empty()) {
         LOG(EXTENSION_LOG_INFO, "Trying to flush but no vbucket exist");
-        return;
-    } else if (!hpVbs.empty()) {
-        uint16_t vbid = hpVbs.front();
-        hpVbs.pop();
-        if (store->flushVBucket(vbid) == RETRY_FLUSH_VBUCKET) {
-            hpVbs.push(vbid);
+        return 0;
+    }
+
+    // Take the next vbucket which no other writer is flushing (one queued
+    // before another writer took it is flushed again once that writer has
+    // finished, rather than retried meanwhile).
+    bool found = false;
+    while (!found && !(hpVbs.empty() && lpVbs.empty())) {
+        if (!hpVbs.empty()) {
+            highPriority = true;
+            vbid = hpVbs.front();
+            hpVbs.pop();
+        } else {
+            if (doHighPriority && --numHighPriority == 0) {
+                doHighPriority = false;
+            }
+            highPriority = false;
+            vbid = lpVbs.front();
+            lpVbs.pop();
         }
-    } else {
-        if (doHighPriority && --numHighPriority == 0) {
-            doHighPriority = false;
+        if (flushing.count(vbid)) {
+            flushAgain[vbid] = flushAgain[vbid] || highPriority;
+        } else {
+            found = true;
         }
-        uint16_t vbid = lpVbs.front();
-        lpVbs.pop();
-        if (store->flushVBucket(vbid) == RETRY_FLUSH_VBUCKET) {
+    }
+    if (!found) {
+        return 0;
+    }
+    flushing.insert(vbid);
+    // Other writers can pick the next vbucket while this one is flushed.
+    lh.unlock();
+
+    const int rv = store->flushVBucket(vbid);
+
+    lh.lock();
+    flushing.erase(vbid);
+    auto again = flushAgain.find(vbid);
+    if (again != flushAgain.end() || rv == RETRY_FLUSH_VBUCKET) {
+        if (highPriority ||
+            (again != flushAgain.end() && again->second)) {
+            hpVbs.push(vbid);
+        } else {
             lpVbs.push(vbid);
         }
+        if (again != flushAgain.end()) {
+            flushAgain.erase(again);
+        }
+    }
+    if (rv == RETRY_FLUSH_VBUCKET && hpVbs.size() + lpVbs.size() == 1) {
+        // Nothing else to flush meanwhile; don't spin on the vbucket.
+        return RETRY_FLUSH_DELAY;
     }
+    return 0;
 }
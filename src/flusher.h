@@ -23,7 +23,9 @@
 #include <list>
 #include <map>
 #include <queue>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "ep.h"
 #include "executorthread.h"
@@ -45,20 +47,34 @@ class Flusher;
 
 const double DEFAULT_MIN_SLEEP_TIME = MIN_SLEEP_TIME;
 const double DEFAULT_MAX_SLEEP_TIME = 10.0;
+// How often the flusher polls for its other writers to become idle
+const double WRITER_POLL_TIME = 0.01;
+// How long a writer waits to retry a vbucket which couldn't be flushed (its
+// lock being held, say) when there's no other vbucket to flush
+const double RETRY_FLUSH_DELAY = 0.001;
 
 class KVShard;
 
 /**
  * Manage persistence of data for an EventuallyPersistentStore.
+ *
+ * A flusher may run more than one writer task for its shard. Each writer
+ * flushes a different vbucket; a writer gathers the dirty items of its
+ * vbucket while another writer is writing and committing (the shard's
+ * KVStore only runs one transaction at a time), so gathering is pipelined
+ * with the disk writes. The first task drives the flusher's state, the
+ * others only flush while it is running.
  */
 class Flusher {
 public:
 
-    Flusher(EventuallyPersistentStore *st, KVShard *k, uint16_t commitInt) :
-        store(st), _state(initializing), taskId(0), minSleepTime(0.1),
+    Flusher(EventuallyPersistentStore *st, KVShard *k, size_t commitInt,
+            size_t writers = 1) :
+        store(st), _state(initializing), taskId(0), numWriters(writers),
+        busyWriters(0), minSleepTime(0.1),
         initCommitInterval(commitInt), currCommitInterval(commitInt),
         forceShutdownReceived(false), doHighPriority(false), numHighPriority(0),
-        pendingMutation(false), shard(k) { }
+        pendingMutation(false), deferUntil(0), shard(k) { }
 
     ~Flusher() {
         if (_state != stopped) {
@@ -90,11 +106,11 @@ public:
     }
     void setTaskId(size_t newId) { taskId = newId; }
 
-    uint16_t getCommitInterval(void) {
+    size_t getCommitInterval(void) {
         return currCommitInterval;
     }
 
-    uint16_t decrCommitInterval(void);
+    size_t decrCommitInterval(void);
 
     void resetCommitInterval(void) {
         currCommitInterval = initCommitInterval;
@@ -102,15 +118,32 @@ public:
 
 private:
     bool transition_state(enum flusher_state to);
-    void flushVB();
+    /**
+     * Flush the next vbucket of the shard (if it isn't deferred).
+     *
+     * @return how long (in seconds) to wait before flushing again: the flush
+     *         was deferred, or its vbucket (the only one queued) has to be
+     *         retried; 0 otherwise.
+     */
+    double flushVB(bool primary);
+    double computeFlushDelay_UNLOCKED();
     void completeFlush();
     void initialize();
     void schedule_UNLOCKED();
+    void scheduleWriters();
     double computeMinSleepTime();
+    void commit();
+
+    /**
+     * Step of one of the writer tasks other than the first, which flushes
+     * while the flusher is running and sleeps otherwise.
+     */
+    bool writerStep(GlobalTask *task);
 
     const char * stateName(enum flusher_state st) const;
 
     bool canSnooze(void) {
+        LockHolder lh(queueMutex);
         return lpVbs.empty() && hpVbs.empty() && !pendingMutation.load();
     }
 
@@ -121,17 +154,32 @@ private:
     // different threads.
     std::mutex                        taskMutex;
     std::atomic<size_t>      taskId;
+    // Tasks of the writers other than the first
+    std::vector<size_t>      writerTaskIds;
+    const size_t             numWriters;
+    // Number of the other writers currently flushing a vbucket
+    std::atomic<size_t>      busyWriters;
 
     double                   minSleepTime;
-    uint16_t                 initCommitInterval;
-    uint16_t                 currCommitInterval;
+    size_t                   initCommitInterval;
+    size_t                   currCommitInterval;
     rel_time_t               flushStart;
     std::atomic<bool> forceShutdownReceived;
+    // Guards the vbucket queues, which the writers share
+    std::mutex queueMutex;
     std::queue<uint16_t> hpVbs;
     std::queue<uint16_t> lpVbs;
+    // Vbuckets being flushed by a writer
+    std::set<uint16_t> flushing;
+    // Vbuckets taken from the queues while being flushed, to be queued again
+    // (at high priority if the value is true) once that flush is done
+    std::map<uint16_t, bool> flushAgain;
     bool doHighPriority;
     size_t numHighPriority;
     std::atomic<bool> pendingMutation;
+    // Time until which refilling the vbucket queues is deferred, 0 if it
+    // isn't (guarded by queueMutex)
+    hrtime_t deferUntil;
 
     KVShard *shard;
 
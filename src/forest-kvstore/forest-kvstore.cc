@@ -1684,6 +1684,9 @@ fdb_compact_decision ForestKVStore::compaction_cb(fdb_file_handle* fhandle,
                     comp_ctx->max_purged_seq[vbid] = doc->seqnum;
                 }
 
+                if (comp_ctx->purgedItemCallback) {
+                    comp_ctx->purgedItemCallback->callback(vbid, key);
+                }
                 return FDB_CS_DROP_DOC;
             }
 
@@ -1694,6 +1697,9 @@ fdb_compact_decision ForestKVStore::compaction_cb(fdb_file_handle* fhandle,
                     comp_ctx->max_purged_seq[vbid] = doc->seqnum;
                 }
 
+                if (comp_ctx->purgedItemCallback) {
+                    comp_ctx->purgedItemCallback->callback(vbid, key);
+                }
                 return FDB_CS_DROP_DOC;
             }
         }
@@ -17,6 +17,7 @@
 
 #include "hash_table.h"
 
+#include <algorithm>
 #include <cstring>
 
 #ifndef DEFAULT_HT_SIZE
@@ -25,6 +26,8 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+HashTable::BucketLayout HashTable::defaultBucketLayout =
+        HashTable::BucketLayout::Chained;
 
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3079, 6143, 12289, 24571, 49157,
@@ -39,7 +42,120 @@ std::ostream& operator<<(std::ostream& os, const HashTable::Position& pos) {
     return os;
 }
 
+bool HashTable::BucketArray::allocate(size_t n, BucketLayout layout) {
+    if (layout == BucketLayout::Chained) {
+        chains = static_cast<StoredValue**>(calloc(n, sizeof(StoredValue*)));
+        return chains != NULL;
+    }
+
+    // Tagged buckets are aligned to a cache line, so a lookup which doesn't
+    // overflow into the chain only touches one line.
+    void *mem = NULL;
+    size_t bytes = n * sizeof(TaggedBucket);
+#ifdef _MSC_VER
+    mem = _aligned_malloc(bytes, sizeof(TaggedBucket));
+#else
+    if (posix_memalign(&mem, sizeof(TaggedBucket), bytes) != 0) {
+        mem = NULL;
+    }
+#endif
+    if (mem == NULL) {
+        return false;
+    }
+    std::memset(mem, 0, bytes);
+    tagged = static_cast<TaggedBucket*>(mem);
+    return true;
+}
+
+static void freeChains(void *mem) {
+    free(mem);
+}
+
+static void freeTagged(void *mem) {
+#ifdef _MSC_VER
+    _aligned_free(mem);
+#else
+    free(mem);
+#endif
+}
+
+void HashTable::BucketArray::release() {
+    freeChains(chains);
+    chains = NULL;
+    freeTagged(tagged);
+    tagged = NULL;
+}
+
+void HashTable::BucketArray::retire(EpochManager *epochs) {
+    if (epochs == NULL) {
+        release();
+        return;
+    }
+    if (chains) {
+        epochs->retire(chains, freeChains);
+        chains = NULL;
+    }
+    if (tagged) {
+        epochs->retire(tagged, freeTagged);
+        tagged = NULL;
+    }
+}
+
+bool HashTable::BucketArray::remove(size_t bucket, StoredValue *v) {
+    StoredValue **head;
+    if (tagged) {
+        TaggedBucket &b = tagged[bucket];
+        for (size_t i = 0; i < TaggedBucket::numSlots; ++i) {
+            if (b.tags[i] != 0 && b.slots[i] == v) {
+                // Never leave a stale pointer in an empty slot; see find().
+                b.tags[i] = 0;
+                b.slots[i] = NULL;
+                return true;
+            }
+        }
+        head = &b.chain;
+    } else {
+        head = &chains[bucket];
+    }
+
+    for (; *head; head = &(*head)->next) {
+        if (*head == v) {
+            *head = v->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+StoredValue* HashTable::BucketArray::pop(size_t bucket) {
+    StoredValue **head;
+    if (tagged) {
+        TaggedBucket &b = tagged[bucket];
+        for (size_t i = 0; i < TaggedBucket::numSlots; ++i) {
+            if (b.tags[i] != 0) {
+                StoredValue *v = b.slots[i];
+                b.tags[i] = 0;
+                b.slots[i] = NULL;
+                return v;
+            }
+        }
+        head = &b.chain;
+    } else {
+        head = &chains[bucket];
+    }
+
+    StoredValue *v = *head;
+    if (v) {
+        *head = v->next;
+    }
+    return v;
+}
+
 HashTable::HashTable(EPStats &st, size_t s, size_t l)
+    : HashTable(st, s, l, defaultBucketLayout) {
+}
+
+HashTable::HashTable(EPStats &st, size_t s, size_t l, BucketLayout bl)
     : maxDeletedRevSeqno(0),
       numTotalItems(0),
       numNonResidentItems(0),
@@ -56,8 +172,21 @@ HashTable::HashTable(EPStats &st, size_t s, size_t l)
 {
     size = HashTable::getNumBuckets(s);
     n_locks = HashTable::getNumLocks(l);
-    values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
+    layout = bl;
+    if (!values.allocate(size, layout)) {
+        throw std::bad_alloc();
+    }
+    epochs = ObjectRegistry::getEpochManager();
+    bucketsView.store(NULL);
+    publishBuckets();
     mutexes = new std::mutex[n_locks];
+    lockSeqs = new std::atomic<uint64_t>[n_locks];
+    for (size_t i = 0; i < n_locks; ++i) {
+        lockSeqs[i].store(0);
+    }
+    oldSize = 0;
+    resizeLock = 0;
+    resizeBucket = 0;
     activeState = true;
 }
 
@@ -72,8 +201,29 @@ HashTable::~HashTable() {
 #endif
     }
     delete []mutexes;
-    free(values);
-    values = NULL;
+    delete []lockSeqs;
+    values.release();
+    oldValues.release();
+    delete bucketsView.load();
+}
+
+void HashTable::publishBuckets() {
+    bucketsAddr.store(reinterpret_cast<uintptr_t>(values.data()));
+    const BucketsView *old = bucketsView.exchange(
+            new BucketsView{values.data(), size.load()});
+    if (old == NULL) {
+        return;
+    }
+    if (epochs) {
+        // optimisticGet() may still be reading through the old view.
+        epochs->retire(const_cast<BucketsView*>(old), deleteBucketsView);
+    } else {
+        delete old;
+    }
+}
+
+void HashTable::deleteBucketsView(void *ptr) {
+    delete static_cast<BucketsView*>(ptr);
 }
 
 HashTableStatVisitor HashTable::clear(bool deactivate) {
@@ -86,15 +236,19 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
                     "non-active object");
         }
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    MultiLockHolder mlh(mutexes, n_locks, lockSequences());
     if (deactivate) {
         setActiveState(false);
     }
     for (int i = 0; i < (int)size; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
+        while (StoredValue *v = values.pop(i)) {
+            rv.visit(v);
+            delete v;
+        }
+    }
+    for (size_t i = 0; oldValues.isAllocated() && i < oldSize; i++) {
+        while (StoredValue *v = oldValues.pop(i)) {
             rv.visit(v);
-            values[i] = v->next;
             delete v;
         }
     }
@@ -125,6 +279,10 @@ static bool isCurrently(size_t size, ssize_t a, ssize_t b) {
 }
 
 void HashTable::resize() {
+    resize(getPreferredSize());
+}
+
+size_t HashTable::getPreferredSize() {
     size_t ni = getNumInMemoryItems();
     int i(0);
     size_t new_size(0);
@@ -150,7 +308,7 @@ void HashTable::resize() {
         new_size = nearest(ni, prime_size_table[i-1], prime_size_table[i]);
     }
 
-    resize(new_size);
+    return new_size;
 }
 
 void HashTable::resize(size_t newSize) {
@@ -165,12 +323,14 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
+    std::lock_guard<std::mutex> rlh(resizeMutex);
+
     // Don't resize to the same size, either.
-    if (newSize == size) {
+    if (newSize == size && !oldValues.isAllocated()) {
         return;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
+    MultiLockHolder mlh(mutexes, n_locks, lockSequences());
     if (visitors.load() > 0) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
@@ -179,11 +339,24 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
+    // Complete any incremental resize which is in progress.
+    if (oldValues.isAllocated()) {
+        for (size_t i = 0; i < oldSize; i++) {
+            unlocked_migrateBucket(i);
+        }
+        stats.memOverhead.fetch_sub(memorySize());
+        oldValues.retire(epochs);
+        oldSize = 0;
+        stats.memOverhead.fetch_add(memorySize());
+        if (newSize == size) {
+            return;
+        }
+    }
+
     // Get a place for the new items.
-    StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
-                                                        sizeof(StoredValue*)));
+    BucketArray newValues;
     // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
+    if (!newValues.allocate(newSize, layout)) {
         return;
     }
 
@@ -191,27 +364,142 @@ void HashTable::resize(size_t newSize) {
     ++numResizes;
 
     // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
+    size_t prevSize = size;
     size.store(newSize);
 
     // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
-
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(),
-                                                  v->getKeyLen()));
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
+    for (size_t i = 0; i < prevSize; i++) {
+        while (StoredValue *v = values.pop(i)) {
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            newValues.insert(getBucketForHash(h), v, getTagForHash(h));
         }
     }
 
-    // values still points to the old (now empty) table.
-    free(values);
+    // values still refers to the old (now empty) table.
+    values.retire(epochs);
+    values = newValues;
+    publishBuckets();
+
+    stats.memOverhead.fetch_add(memorySize());
+    mlh.unlock();
+    // Free the old table now rather than when the retire list next fills.
+    reclaimRetired();
+}
+
+bool HashTable::startIncrementalResize() {
+    return startIncrementalResize(getPreferredSize());
+}
+
+bool HashTable::startIncrementalResize(size_t newSize) {
+    if (!isActive()) {
+        throw std::logic_error("HashTable::startIncrementalResize: Cannot "
+                "call on a non-active object");
+    }
+
+    if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> rlh(resizeMutex);
+    if (oldValues.isAllocated()) {
+        return true;
+    }
+    if (newSize == size) {
+        return false;
+    }
+
+    if (newSize < n_locks || size < n_locks) {
+        // Items would change lock when moving between the old and new
+        // bucket arrays; fall back to resizing in one go (the table is
+        // small anyway).
+        rlh.unlock();
+        resize(newSize);
+        return false;
+    }
+
+    // Allocate before taking the bucket locks.
+    BucketArray newValues;
+    if (!newValues.allocate(newSize, layout)) {
+        return false;
+    }
+
+    MultiLockHolder mlh(mutexes, n_locks, lockSequences());
+    if (visitors.load() > 0) {
+        // As per resize(); try again on the next attempt.
+        newValues.release();
+        return false;
+    }
+
+    stats.memOverhead.fetch_sub(memorySize());
+    ++numResizes;
+
+    oldValues = values;
+    oldSize = size.load();
+    resizeLock = 0;
+    resizeBucket = 0;
     values = newValues;
+    size.store(newSize);
+    publishBuckets();
 
     stats.memOverhead.fetch_add(memorySize());
+    return true;
+}
+
+bool HashTable::continueIncrementalResize(size_t maxBuckets) {
+    std::lock_guard<std::mutex> rlh(resizeMutex);
+    if (!oldValues.isAllocated()) {
+        return true;
+    }
+
+    // Walk the old buckets lock by lock, so that each chunk of work only
+    // needs to hold a single lock.
+    size_t migrated = 0;
+    while (migrated < maxBuckets && resizeLock < n_locks) {
+        LockHolder lh(mutexes[resizeLock], lockSequence(resizeLock));
+        if (visitors.load() > 0) {
+            // Moving items under a visitor could make it skip (or re-visit)
+            // them; leave it for the next attempt.
+            return false;
+        }
+        for (; migrated < maxBuckets && resizeBucket < oldSize;
+             resizeBucket += n_locks, ++migrated) {
+            unlocked_migrateBucket(resizeBucket);
+        }
+        if (resizeBucket >= oldSize) {
+            ++resizeLock;
+            resizeBucket = resizeLock;
+        }
+    }
+
+    if (resizeLock < n_locks) {
+        return false;
+    }
+
+    // All items have been moved; release the old bucket array.
+    MultiLockHolder mlh(mutexes, n_locks, lockSequences());
+    if (visitors.load() > 0) {
+        return false;
+    }
+    stats.memOverhead.fetch_sub(memorySize());
+    oldValues.retire(epochs);
+    oldSize = 0;
+    stats.memOverhead.fetch_add(memorySize());
+    mlh.unlock();
+    reclaimRetired();
+    return true;
+}
+
+void HashTable::reclaimRetired() {
+    if (epochs) {
+        epochs->reclaim();
+    }
+}
+
+void HashTable::unlocked_migrateBucket(size_t oldBucket) {
+    while (StoredValue *v = oldValues.pop(oldBucket)) {
+        int h = hash(v->getKeyBytes(), v->getKeyLen());
+        values.insert(getBucketForHash(h), v, getTagForHash(h));
+    }
 }
 
 StoredValue* HashTable::find(const std::string &key, bool trackReference) {
@@ -224,6 +512,64 @@ StoredValue* HashTable::find(const std::string &key, bool trackReference) {
     return unlocked_find(key, bucket_num, false, trackReference);
 }
 
+Item* HashTable::optimisticGet(const std::string &key, uint16_t vbucket,
+                               bool trackReference, bool hideLockedCas) {
+    if (epochs == NULL || !isActive()) {
+        return NULL;
+    }
+    // Nothing read below (including memory unlinked by a racing writer) is
+    // freed until the guard is released.
+    EpochManager::Guard guard(*epochs);
+    if (!guard.isPinned()) {
+        return NULL;
+    }
+
+    const int h = hash(key);
+    // The key's lock while the table has at least n_locks buckets (see
+    // getBucketForHash()); any resize changing that holds every lock, so
+    // is caught by the sequence check.
+    const size_t lock = static_cast<unsigned int>(h) % n_locks;
+    for (int attempt = 0; attempt < maxOptimisticReadAttempts; ++attempt) {
+        const uint64_t seq = lockSeqs[lock].load(std::memory_order_acquire);
+        if (seq & 1) {
+            // A writer holds the lock.
+            continue;
+        }
+
+        // The array and the size it was allocated with are loaded as one;
+        // size and bucketsAddr are updated separately by resize().
+        const BucketsView *view =
+                bucketsView.load(std::memory_order_acquire);
+        if (view->size < n_locks ||
+            oldSize.load(std::memory_order_relaxed)) {
+            return NULL;
+        }
+        const BucketArray buckets(view->addr, layout);
+        StoredValue *v = buckets.find(getBucketForHash(h, view->size), key,
+                                      getTagForHash(h));
+
+        Item *itm = NULL;
+        if (v && !v->isDeleted() && !v->isTempItem() &&
+            !v->isExpired(ep_real_time()) &&
+            !(hideLockedCas && v->lock_expiry != 0) &&
+            !(trackReference && v->nru > MIN_NRU_VALUE)) {
+            // The value may be released by a writer at any moment, so only
+            // take a reference if it is still live.
+            value_t val = value_t::acquireIfLive(v->getValue().get());
+            if (val) {
+                itm = v->toItem(false, vbucket, val);
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (lockSeqs[lock].load(std::memory_order_relaxed) == seq) {
+            return itm;
+        }
+        delete itm;
+    }
+    return NULL;
+}
+
 Item* HashTable::getRandomKey(long rnd) {
     /* Try to locate a partition */
     size_t start = rnd % size;
@@ -327,8 +673,8 @@ mutation_type_t HashTable::unlocked_set(StoredValue*& v, Item& itm,
         rv = NOT_FOUND;
     } else {
         int bucket_num = getBucketForHash(hash(itm.getKey()));
-        v = valFact(itm, values[bucket_num], *this);
-        values[bucket_num] = v;
+        v = valFact(itm, NULL, *this);
+        unlocked_insert(bucket_num, v);
         ++numItems;
         ++numTotalItems;
 
@@ -359,16 +705,96 @@ mutation_type_t HashTable::insert(Item &itm, item_eviction_policy_t policy,
 
     int bucket_num(0);
     LockHolder lh = getLockedBucket(itm.getKey(), &bucket_num);
+    return unlocked_insert(itm, bucket_num, policy, eject, partial);
+}
+
+void HashTable::insertBatch(const std::vector<Item*> &items,
+                            item_eviction_policy_t policy, bool eject,
+                            bool partial,
+                            std::vector<mutation_type_t> &results) {
+    if (!isActive()) {
+        throw std::logic_error("HashTable::insertBatch: Cannot call on a "
+                "non-active object");
+    }
+
+    struct Probe {
+        size_t lock;
+        size_t index;
+        int    hash;
+        int    bucket;
+    };
+
+    results.assign(items.size(), NOT_FOUND);
+    std::vector<Probe> probes;
+    probes.reserve(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!StoredValue::hasAvailableSpace(stats, *items[i])) {
+            results[i] = NOMEM;
+            continue;
+        }
+        const int h = hash(items[i]->getKey());
+        probes.push_back({getLockForHash(h), i, h, -1});
+    }
+    std::stable_sort(probes.begin(), probes.end(),
+                     [](const Probe &a, const Probe &b) {
+                         return a.lock < b.lock;
+                     });
+
+    std::vector<size_t> moved;
+    auto group = probes.begin();
+    while (group != probes.end()) {
+        const size_t lock = group->lock;
+        auto end = group;
+        while (end != probes.end() && end->lock == lock) {
+            ++end;
+        }
+
+        LockHolder lh(mutexes[lock], lockSequence(lock));
+        for (auto p = group; p != end; ++p) {
+            if (getBucketInLockedStripe(p->hash, lock, &p->bucket)) {
+                values.prefetchBucket(p->bucket);
+            } else {
+                // Moved to another lock by a resize; insert it on its own.
+                p->bucket = -1;
+                moved.push_back(p->index);
+            }
+        }
+        for (auto p = group; p != end; ++p) {
+            if (p->bucket >= 0) {
+                values.prefetchItem(p->bucket, getTagForHash(p->hash));
+            }
+        }
+        for (auto p = group; p != end; ++p) {
+            if (p->bucket >= 0) {
+                results[p->index] = unlocked_insert(*items[p->index],
+                                                    p->bucket, policy, eject,
+                                                    partial);
+            }
+        }
+        group = end;
+    }
+
+    for (size_t i : moved) {
+        int bucket_num(0);
+        LockHolder lh = getLockedBucket(items[i]->getKey(), &bucket_num);
+        results[i] = unlocked_insert(*items[i], bucket_num, policy, eject,
+                                     partial);
+    }
+}
+
+mutation_type_t HashTable::unlocked_insert(Item &itm, int bucket_num,
+                                           item_eviction_policy_t policy,
+                                           bool eject, bool partial) {
     StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true, false);
 
     if (v == NULL) {
-        v = valFact(itm, values[bucket_num], *this);
+        v = valFact(itm, NULL, *this);
         v->markClean();
         if (partial) {
             v->markNotResident();
             ++numNonResidentItems;
         }
-        values[bucket_num] = v;
+        unlocked_insert(bucket_num, v);
         ++numItems;
         v->setNewCacheItem(false);
     } else {
@@ -472,8 +898,8 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
                     return ADD_TMP_AND_BG_FETCH;
                 }
             }
-            v = valFact(itm, values[bucket_num], *this, isDirty);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this, isDirty);
+            unlocked_insert(bucket_num, v);
 
             if (v->isTempItem()) {
                 ++numTempItems;
@@ -614,78 +1040,61 @@ mutation_type_t HashTable::unlocked_softDelete(StoredValue *v,
 
 StoredValue* HashTable::unlocked_find(const std::string &key, int bucket_num,
                                       bool wantsDeleted, bool trackReference) {
-    StoredValue *v = values[bucket_num];
-    while (v) {
-        if (v->hasKey(key)) {
-            if (trackReference && !v->isDeleted()) {
-                v->referenced();
-            }
-            if (wantsDeleted || !v->isDeleted()) {
-                return v;
-            } else {
-                return NULL;
-            }
+    uint8_t tag = getTag(key.data(), key.length());
+    StoredValue *v = values.find(bucket_num, key, tag);
+    if (v == NULL && oldValues.isAllocated()) {
+        // Item may not have been migrated by the incremental resize yet.
+        v = oldValues.find(unlocked_getOldBucket(key.data(), key.length()),
+                           key, tag);
+    }
+
+    if (v) {
+        if (trackReference && !v->isDeleted()) {
+            v->referenced();
+        }
+        if (wantsDeleted || !v->isDeleted()) {
+            return v;
         }
-        v = v->next;
     }
     return NULL;
 }
 
+void HashTable::unlocked_remove(StoredValue *v) {
+    int h = hash(v->getKeyBytes(), v->getKeyLen());
+    if (!values.remove(getBucketForHash(h), v)) {
+        if (!oldValues.isAllocated() ||
+            !oldValues.remove(getBucketForHash(h, oldSize), v)) {
+            throw std::logic_error("HashTable::unlocked_remove: StoredValue "
+                    "not found in its hash bucket");
+        }
+    }
+}
+
 bool HashTable::unlocked_del(const std::string &key, int bucket_num) {
     if (!isActive()) {
         throw std::logic_error("HashTable::unlocked_del: Cannot call on a "
                 "non-active object");
     }
-    StoredValue *v = values[bucket_num];
 
-    // Special case empty bucket.
+    StoredValue *v = unlocked_find(key, bucket_num, true, false);
     if (!v) {
         return false;
     }
-
-    // Special case the first one
-    if (v->hasKey(key)) {
-        if (!v->isDeleted() && v->isLocked(ep_current_time())) {
-            return false;
-        }
-
-        values[bucket_num] = v->next;
-        StoredValue::reduceCacheSize(*this, v->size());
-        StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
-        if (v->isTempItem()) {
-            --numTempItems;
-        } else {
-            decrNumItems();
-            decrNumTotalItems();
-        }
-        delete v;
-        return true;
+    if (!v->isDeleted() && v->isLocked(ep_current_time())) {
+        return false;
     }
 
-    while (v->next) {
-        if (v->next->hasKey(key)) {
-            StoredValue *tmp = v->next;
-            if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
-                return false;
-            }
-
-            v->next = v->next->next;
-            StoredValue::reduceCacheSize(*this, tmp->size());
-            StoredValue::reduceMetaDataSize(*this, stats, tmp->metaDataSize());
-            if (tmp->isTempItem()) {
-                --numTempItems;
-            } else {
-                decrNumItems();
-                decrNumTotalItems();
-            }
-            delete tmp;
-            return true;
-        } else {
-            v = v->next;
-        }
+    unlocked_remove(v);
+    StoredValue::reduceCacheSize(*this, v->size());
+    StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
+    if (v->isTempItem()) {
+        --numTempItems;
+    } else {
+        decrNumItems();
+        decrNumTotalItems();
     }
-
-    return false;
+    delete v;
+    return true;
 }
 
 void HashTable::visit(HashTableVisitor &visitor) {
@@ -696,7 +1105,7 @@ void HashTable::visit(HashTableVisitor &visitor) {
     // Acquire one (any) of the mutexes before incrementing {visitors}, this
     // prevents any race between this visitor and the HashTable resizer.
     // See comments in pauseResumeVisit() for further details.
-    LockHolder lh(mutexes[0]);
+    LockHolder lh(mutexes[0], lockSequence(0));
     VisitorTracker vt(&visitors);
     lh.unlock();
 
@@ -707,29 +1116,39 @@ void HashTable::visit(HashTableVisitor &visitor) {
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             // (re)acquire mutex on each HashBucket, to minimise any impact
             // on front-end threads.
-            LockHolder lh(mutexes[l]);
-
-            StoredValue *v = values[i];
-            if (v) {
-                // TODO: Perf: This check seems costly - do we think it's still
-                // worth keeping?
-                auto hashbucket = getBucketForHash(hash(v->getKeyBytes(),
-                                                        v->getKeyLen()));
-                if (i != hashbucket) {
-                    throw std::logic_error("HashTable::visit: inconsistency "
-                            "between StoredValue's calculated hashbucket "
-                            "(which is " + std::to_string(hashbucket) +
-                            ") and bucket is is located in (which is " +
-                            std::to_string(i) + ")");
+            LockHolder lh(mutexes[l], lockSequence(l));
+
+            bool checked = false;
+            values.forEach(i, [&](StoredValue *v) {
+                if (!checked) {
+                    // TODO: Perf: This check seems costly - do we think it's
+                    // still worth keeping?
+                    checked = true;
+                    auto hashbucket = getBucketForHash(hash(v->getKeyBytes(),
+                                                            v->getKeyLen()));
+                    if (i != hashbucket) {
+                        throw std::logic_error("HashTable::visit: "
+                                "inconsistency between StoredValue's "
+                                "calculated hashbucket (which is " +
+                                std::to_string(hashbucket) +
+                                ") and bucket is is located in (which is " +
+                                std::to_string(i) + ")");
+                    }
                 }
-            }
-            while (v) {
-                StoredValue *tmp = v->next;
                 visitor.visit(v);
-                v = tmp;
-            }
+                return true;
+            });
             ++visited;
         }
+        // Items not yet migrated by an incremental resize.
+        for (int i = l; oldValues.isAllocated() && i < static_cast<int>(oldSize);
+             i += n_locks) {
+            LockHolder lh(mutexes[l], lockSequence(l));
+            oldValues.forEach(i, [&visitor](StoredValue *v) {
+                visitor.visit(v);
+                return true;
+            });
+        }
         lh.unlock();
         aborted = !visitor.shouldContinue();
     }
@@ -743,32 +1162,45 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     VisitorTracker vt(&visitors);
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
+        LockHolder lh(mutexes[l], lockSequence(l));
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             size_t depth = 0;
-            StoredValue *p = values[i];
-            if (p) {
-                // TODO: Perf: This check seems costly - do we think it's still
-                // worth keeping?
-                auto hashbucket = getBucketForHash(hash(p->getKeyBytes(),
-                                                        p->getKeyLen()));
-                if (i != hashbucket) {
-                    throw std::logic_error("HashTable::visit: inconsistency "
-                            "between StoredValue's calculated hashbucket "
-                            "(which is " + std::to_string(hashbucket) +
-                            ") and bucket it is located in (which is " +
-                            std::to_string(i) + ")");
-                }
-            }
             size_t mem(0);
-            while (p) {
+            bool checked = false;
+            values.forEach(i, [&](StoredValue *p) {
+                if (!checked) {
+                    // TODO: Perf: This check seems costly - do we think it's
+                    // still worth keeping?
+                    checked = true;
+                    auto hashbucket = getBucketForHash(hash(p->getKeyBytes(),
+                                                            p->getKeyLen()));
+                    if (i != hashbucket) {
+                        throw std::logic_error("HashTable::visit: "
+                                "inconsistency between StoredValue's "
+                                "calculated hashbucket (which is " +
+                                std::to_string(hashbucket) +
+                                ") and bucket it is located in (which is " +
+                                std::to_string(i) + ")");
+                    }
+                }
                 depth++;
                 mem += p->size();
-                p = p->next;
-            }
+                return true;
+            });
             visitor.visit(i, depth, mem);
             ++visited;
         }
+        for (int i = l; oldValues.isAllocated() && i < static_cast<int>(oldSize);
+             i += n_locks) {
+            size_t depth = 0;
+            size_t mem(0);
+            oldValues.forEach(i, [&](StoredValue *p) {
+                depth++;
+                mem += p->size();
+                return true;
+            });
+            visitor.visit(i, depth, mem);
+        }
     }
 }
 
@@ -793,7 +1225,7 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
     // inside the inner for() loop. To prevent this race, we explicitly acquire
     // (any) mutex, increment {visitors} and then release the mutex. This
     //avoids the race as if visitors >0 then Resizer will not attempt to resize.
-    LockHolder lh(mutexes[0]);
+    LockHolder lh(mutexes[0], lockSequence(0));
     VisitorTracker vt(&visitors);
     lh.unlock();
 
@@ -801,6 +1233,10 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
     size_t lock = (start_pos.lock < n_locks) ? start_pos.lock : 0;
     size_t hash_bucket = 0;
 
+    // While an incremental resize is in progress the old bucket array is
+    // visited alongside the new one, and may be the larger of the two.
+    const size_t limit = std::max(size.load(), oldSize.load());
+
     for (; isActive() && !paused && lock < n_locks; lock++) {
 
         // If the bucket position is *this* lock, then start from the
@@ -808,28 +1244,31 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
         hash_bucket = lock;
         if (start_pos.lock == lock &&
             start_pos.ht_size == size &&
-            start_pos.hash_bucket < size) {
+            start_pos.hash_bucket < limit) {
             hash_bucket = start_pos.hash_bucket;
         }
 
         // Iterate across all values in the hash buckets owned by this lock.
         // Note: we don't record how far into the bucket linked-list we
         // pause at; so any restart will begin from the next bucket.
-        for (; !paused && hash_bucket < size; hash_bucket += n_locks) {
-            LockHolder lh(mutexes[lock]);
-
-            StoredValue *v = values[hash_bucket];
-            while (!paused && v) {
-                StoredValue *tmp = v->next;
-                paused = !visitor.visit(*v);
-                v = tmp;
+        for (; !paused && hash_bucket < limit; hash_bucket += n_locks) {
+            LockHolder lh(mutexes[lock], lockSequence(lock));
+
+            auto visitOne = [&visitor](StoredValue *v) {
+                return visitor.visit(*v);
+            };
+            if (hash_bucket < size) {
+                paused = !values.forEach(hash_bucket, visitOne);
+            }
+            if (!paused && oldValues.isAllocated() && hash_bucket < oldSize) {
+                paused = !oldValues.forEach(hash_bucket, visitOne);
             }
         }
 
         // If the visitor paused us before we visited all hash buckets owned
         // by this lock, we don't want to skip the remaining hash buckets, so
         // stop the outer for loop from advancing to the next lock.
-        if (paused && hash_bucket < size) {
+        if (paused && hash_bucket < limit) {
             break;
         }
 
@@ -870,6 +1309,20 @@ void HashTable::setDefaultNumLocks(size_t to) {
     }
 }
 
+void HashTable::setDefaultBucketLayout(BucketLayout to) {
+    defaultBucketLayout = to;
+}
+
+HashTable::BucketLayout HashTable::toBucketLayout(const std::string &name) {
+    if (name == "chained") {
+        return BucketLayout::Chained;
+    } else if (name == "tagged") {
+        return BucketLayout::Tagged;
+    }
+    throw std::invalid_argument("HashTable::toBucketLayout: unknown bucket "
+            "layout '" + name + "'");
+}
+
 bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                                    item_eviction_policy_t policy) {
     if (vptr == nullptr) {
@@ -894,26 +1347,13 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                                             vptr->metaDataSize());
             StoredValue::reduceCacheSize(*this, vptr->size());
 
-            int bucket_num = getBucketForHash(hash(vptr->getKey()));
-            StoredValue *v = values[bucket_num];
             // Remove the item from the hash table.
-            if (v == vptr) {
-                values[bucket_num] = v->next;
-            } else {
-                while (v->next) {
-                    if (v->next == vptr) {
-                        v->next = v->next->next;
-                        break;
-                    } else {
-                        v = v->next;
-                    }
-                }
-            }
+            unlocked_remove(vptr);
 
             if (vptr->isResident()) {
                 ++stats.numValueEjects;
             }
-            if (!vptr->isResident() && !v->isTempItem()) {
+            if (!vptr->isResident() && !vptr->isTempItem()) {
                 decrNumNonResidentItems(); // Decrement because the item is
                                            // fully evicted.
             }
@@ -933,14 +1373,19 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
 
 Item *HashTable::getRandomKeyFromSlot(int slot) {
     LockHolder lh = getLockedBucket(slot);
-    StoredValue *v = values[slot];
-
-    while (v) {
+    Item *itm = NULL;
+    auto pick = [&itm](StoredValue *v) {
         if (!v->isTempItem() && !v->isDeleted() && v->isResident()) {
-            return v->toItem(false, 0);
+            itm = v->toItem(false, 0);
+            return false;
         }
-        v = v->next;
-    }
+        return true;
+    };
 
-    return NULL;
+    // The old bucket with the same index is guarded by the same lock.
+    if (values.forEach(slot, pick) && oldValues.isAllocated() &&
+        static_cast<size_t>(slot) < oldSize) {
+        oldValues.forEach(slot, pick);
+    }
+    return itm;
 }
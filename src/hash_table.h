@@ -19,8 +19,13 @@
 
 #include "config.h"
 
+#include "epoch_manager.h"
 #include "stored-value.h"
 
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#endif
+
 class HashTableStatVisitor;
 class HashTableVisitor;
 class HashTableDepthVisitor;
@@ -48,6 +53,9 @@ class PauseResumeHashTableVisitor;
  * HashTable has no direct knowledge of the item now, it /does/ track the total
  * number of items which exist but are not resident (see numNonResidentItems).
  * This is full eviction.
+ *
+ * If the engine has an EpochManager (ht_lockfree_reads), gets of resident
+ * items can also be served without taking any lock; see optimisticGet().
  */
 class HashTable {
 public:
@@ -92,7 +100,22 @@ public:
     };
 
     /**
-     * Create a HashTable.
+     * Layout of the hash buckets.
+     *
+     * Chained: each bucket is the head of a linked list of StoredValues,
+     *          so finding an item costs a cache miss per item in the chain.
+     * Tagged: each bucket is a single cache line holding a few StoredValue
+     *         pointers, each with a one-byte tag taken from its key's hash,
+     *         so non-matching items are skipped without being dereferenced
+     *         (see TaggedBucket). Uses 8 times the memory per bucket.
+     */
+    enum class BucketLayout {
+        Chained,
+        Tagged
+    };
+
+    /**
+     * Create a HashTable with the default bucket layout.
      *
      * @param st the global stats reference
      * @param s the number of hash table buckets
@@ -100,14 +123,29 @@ public:
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0);
 
+    /**
+     * Create a HashTable.
+     *
+     * @param st the global stats reference
+     * @param s the number of hash table buckets
+     * @param l the number of locks in the hash table
+     * @param layout the layout of the hash buckets
+     */
+    HashTable(EPStats &st, size_t s, size_t l, BucketLayout layout);
+
     ~HashTable();
 
     size_t memorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(std::mutex));
+            + ((size + oldSize) * getBucketSize())
+            + (n_locks * (sizeof(std::mutex) + sizeof(std::atomic<uint64_t>)));
     }
 
+    /**
+     * Get the layout of this hash table's buckets.
+     */
+    BucketLayout getBucketLayout() const { return layout; }
+
     /**
      * Get the number of hash table buckets this hash table has.
      */
@@ -214,9 +252,51 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * All hash table locks are held while every item is rehashed; any
+     * in-progress incremental resize is completed first.
      */
     void resize(size_t to);
 
+    /**
+     * Begin an incremental resize to a size which fits the current data.
+     *
+     * @return true if an incremental resize is now in progress
+     */
+    bool startIncrementalResize();
+
+    /**
+     * Begin an incremental resize to the specified size.
+     *
+     * The new bucket array is installed alongside the old one; items are
+     * then moved across by continueIncrementalResize() while the old and new
+     * arrays are both searched by lookups. If the old or new size is smaller
+     * than the number of locks, a regular (blocking) resize is performed
+     * instead.
+     *
+     * @param to the number of hash buckets to resize to
+     * @return true if an incremental resize is now in progress
+     */
+    bool startIncrementalResize(size_t to);
+
+    /**
+     * Move up to the given number of hash buckets from the old bucket array
+     * to the new one. Only one lock is held at a time, and for no more than
+     * maxBuckets chains.
+     *
+     * @param maxBuckets the maximum number of old hash buckets to migrate
+     * @return true if the resize has completed (or none was in progress)
+     */
+    bool continueIncrementalResize(size_t maxBuckets);
+
+    /**
+     * True if an incremental resize is in progress.
+     */
+    bool isResizing() {
+        std::lock_guard<std::mutex> lh(resizeMutex);
+        return oldValues.isAllocated();
+    }
+
     /**
      * Find the item with the given key.
      *
@@ -225,6 +305,32 @@ public:
      */
     StoredValue *find(const std::string &key, bool trackReference=true);
 
+    /**
+     * Get a copy of the given key's item without taking its bucket lock.
+     *
+     * The bucket is read optimistically: each lock has a sequence counter
+     * which writers make odd while they hold the lock, and the read is only
+     * trusted if the counter was even and unchanged across it (otherwise it
+     * is retried a few times). Items and values unlinked by a concurrent
+     * writer stay readable as their frees are deferred by the EpochManager.
+     *
+     * Only the common case is answered: a live, resident, unexpired item.
+     * NULL is returned for anything else (or if lock-free reads are
+     * disabled, the table is being resized, or writers kept interfering), in
+     * which case the caller must fall back to looking up the key under the
+     * lock. Hence nothing is ever modified: if trackReference is set, items
+     * not already marked as referenced are left to the locked path, as are
+     * items which may be locked if hideLockedCas is set.
+     *
+     * @param key the key to find
+     * @param vbucket the vbucket id to give the returned item
+     * @param trackReference true if the get should reference the item
+     * @param hideLockedCas true if a locked item's CAS must be hidden
+     * @return a new Item owned by the caller, or NULL
+     */
+    Item* optimisticGet(const std::string &key, uint16_t vbucket,
+                        bool trackReference, bool hideLockedCas);
+
     /**
      * Find a resident item
      *
@@ -285,6 +391,25 @@ public:
     mutation_type_t insert(Item &itm, item_eviction_policy_t policy,
                            bool eject, bool partial);
 
+    /**
+     * Insert a batch of items, as insert() does for each of them.
+     *
+     * All of the keys are hashed up front and grouped by lock, so each lock
+     * is acquired once per batch. Within a lock's group the buckets, and
+     * then the items each probe will examine first, are prefetched before
+     * any key is resolved, so the cache misses of the batch overlap rather
+     * than being taken one key at a time.
+     *
+     * @param items the Items to insert
+     * @param policy item eviction policy
+     * @param eject true if we should eject the values immediately
+     * @param partial are these complete items, or just keys and meta-data
+     * @param results receives the result for each item (as from insert())
+     */
+    void insertBatch(const std::vector<Item*> &items,
+                     item_eviction_policy_t policy, bool eject, bool partial,
+                     std::vector<mutation_type_t> &results);
+
     /**
      * Add an item to the hash table iff it doesn't already exist.
      *
@@ -404,6 +529,24 @@ public:
         return hash(s.data(), s.length());
     }
 
+    /**
+     * Hint that the given key is about to be looked up, prefetching its
+     * bucket. Takes no lock, so callers with a batch of keys can prefetch
+     * all of them before locking and probing the first.
+     */
+    void prefetch(const std::string &key) {
+        prefetch(hash(key));
+    }
+
+    /**
+     * As prefetch(key), for the key with the given hash.
+     */
+    void prefetch(int h) {
+        const uintptr_t addr = bucketsAddr.load(std::memory_order_relaxed) +
+                               getBucketForHash(h) * getBucketSize();
+        prefetchForRead(reinterpret_cast<const void*>(addr));
+    }
+
     /**
      * Get a lock holder holding a lock for the given bucket
      *
@@ -411,7 +554,8 @@ public:
      * @return a locked LockHolder
      */
     inline LockHolder getLockedBucket(int bucket) {
-        LockHolder rv(mutexes[mutexForBucket(bucket)]);
+        const size_t lock = mutexForBucket(bucket);
+        LockHolder rv(mutexes[lock], lockSequence(lock));
         return rv;
     }
 
@@ -430,7 +574,8 @@ public:
                         "Cannot call on a non-active object");
             }
             *bucket = getBucketForHash(h);
-            LockHolder rv(mutexes[mutexForBucket(*bucket)]);
+            const size_t lock = mutexForBucket(*bucket);
+            LockHolder rv(mutexes[lock], lockSequence(lock));
             if (*bucket == getBucketForHash(h)) {
                 return rv;
             }
@@ -462,6 +607,46 @@ public:
         return getLockedBucket(hash(s.data(), s.size()), bucket);
     }
 
+    /**
+     * Get the index of the lock currently guarding the bucket for the given
+     * hash. Until that lock is held a resize may change the mapping; see
+     * getBucketInLockedStripe().
+     *
+     * @param h the input hash
+     * @return the lock index, to be passed to getLockedStripe()
+     */
+    inline size_t getLockForHash(int h) {
+        return mutexForBucket(getBucketForHash(h));
+    }
+
+    /**
+     * Get a lock holder holding the given lock, allowing the buckets of
+     * several keys guarded by the same lock to be accessed while acquiring
+     * it only once.
+     *
+     * @param lock the lock index (from getLockForHash())
+     * @return a locked LockHolder
+     */
+    inline LockHolder getLockedStripe(size_t lock) {
+        LockHolder rv(mutexes[lock], lockSequence(lock));
+        return rv;
+    }
+
+    /**
+     * Get the bucket for the given hash, provided it is guarded by the
+     * given lock (which must be held).
+     *
+     * @param h the input hash
+     * @param lock the lock index held by the caller
+     * @param bucket output parameter to receive the bucket
+     * @return false if a resize has moved the hash to another lock's bucket,
+     *         in which case the key must be locked by getLockedBucket()
+     */
+    inline bool getBucketInLockedStripe(int h, size_t lock, int *bucket) {
+        *bucket = getBucketForHash(h);
+        return mutexForBucket(*bucket) == lock;
+    }
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -549,6 +734,16 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Set the default bucket layout.
+     */
+    static void setDefaultBucketLayout(BucketLayout);
+
+    /**
+     * Parse a bucket layout name ("chained" or "tagged").
+     */
+    static BucketLayout toBucketLayout(const std::string &name);
+
     /**
      * Get the max deleted revision seqno seen so far.
      */
@@ -598,13 +793,318 @@ public:
 private:
     friend class StoredValue;
 
+    /**
+     * A hash bucket in the tagged layout, occupying exactly one cache line.
+     *
+     * Up to numSlots items are held inline, each alongside a non-zero tag
+     * taken from its key's hash (a tag of 0 marks an empty slot). Items
+     * which do not fit inline overflow into a chain linked through
+     * StoredValue::next, as in the chained layout.
+     */
+    struct TaggedBucket {
+        static const size_t numSlots = 6;
+
+        uint8_t      tags[numSlots];
+        uint8_t      padding[2];
+        StoredValue *slots[numSlots];
+        StoredValue *chain;
+    };
+    static_assert(sizeof(TaggedBucket) == 64,
+                  "TaggedBucket should occupy exactly one cache line");
+
+    /**
+     * An array of hash buckets in either layout. The lock for a bucket must
+     * be held while accessing it, other than by find() from optimisticGet().
+     * Writers therefore publish items (and clear tagged slots) in an order
+     * such that a racing find() sees either the old or the new contents of
+     * a bucket, never a partially initialised item or a stale pointer.
+     */
+    class BucketArray {
+    public:
+        BucketArray() : chains(NULL), tagged(NULL) {}
+
+        /**
+         * View of the buckets at the given address (from data()).
+         */
+        BucketArray(const void *mem, BucketLayout layout)
+            : chains(NULL), tagged(NULL) {
+            if (layout == BucketLayout::Tagged) {
+                tagged = static_cast<TaggedBucket*>(const_cast<void*>(mem));
+            } else {
+                chains = static_cast<StoredValue**>(const_cast<void*>(mem));
+            }
+        }
+
+        /**
+         * Allocate the given number of empty buckets.
+         *
+         * @return false if the memory could not be allocated
+         */
+        bool allocate(size_t n, BucketLayout layout);
+
+        /**
+         * Free the buckets. Any items still in them are *not* freed.
+         */
+        void release();
+
+        /**
+         * As release(), but if epochs is non-NULL the memory is retired to
+         * it rather than freed, as lock-free readers may still be using it.
+         */
+        void retire(EpochManager *epochs);
+
+        bool isAllocated() const {
+            return chains != NULL || tagged != NULL;
+        }
+
+        //! Start of the bucket memory.
+        const void* data() const {
+            if (tagged) {
+                return tagged;
+            }
+            return chains;
+        }
+
+        /**
+         * Prefetch a bucket.
+         */
+        void prefetchBucket(size_t bucket) const {
+            if (tagged) {
+                prefetchForRead(&tagged[bucket]);
+            } else {
+                prefetchForRead(&chains[bucket]);
+            }
+        }
+
+        /**
+         * Prefetch the first item a find() of the given tag in a bucket
+         * would examine, if any.
+         */
+        void prefetchItem(size_t bucket, uint8_t tag) const {
+            const StoredValue *v;
+            if (tagged) {
+                const TaggedBucket &b = tagged[bucket];
+                v = b.chain;
+                for (size_t i = 0; i < TaggedBucket::numSlots; ++i) {
+                    if (b.tags[i] == tag) {
+                        v = b.slots[i];
+                        break;
+                    }
+                }
+            } else {
+                v = chains[bucket];
+            }
+            if (v) {
+                prefetchForRead(v);
+            }
+        }
+
+        /**
+         * Find the item with the given key (and tag) in a bucket.
+         */
+        StoredValue* find(size_t bucket, const std::string &key,
+                          uint8_t tag) const {
+            StoredValue *v;
+            if (tagged) {
+                const TaggedBucket &b = tagged[bucket];
+                for (size_t i = 0; i < TaggedBucket::numSlots; ++i) {
+                    if (b.tags[i] == tag) {
+                        // NULL if the slot is being filled or emptied.
+                        StoredValue *s = b.slots[i];
+                        if (s && s->hasKey(key)) {
+                            return s;
+                        }
+                    }
+                }
+                v = b.chain;
+            } else {
+                v = chains[bucket];
+            }
+            while (v && !v->hasKey(key)) {
+                v = v->next;
+            }
+            return v;
+        }
+
+        /**
+         * Add an item (which must not already be present) to a bucket.
+         */
+        void insert(size_t bucket, StoredValue *v, uint8_t tag) {
+            if (tagged) {
+                TaggedBucket &b = tagged[bucket];
+                for (size_t i = 0; i < TaggedBucket::numSlots; ++i) {
+                    if (b.tags[i] == 0) {
+                        v->next = NULL;
+                        std::atomic_thread_fence(std::memory_order_release);
+                        b.slots[i] = v;
+                        b.tags[i] = tag;
+                        return;
+                    }
+                }
+                v->next = b.chain;
+                std::atomic_thread_fence(std::memory_order_release);
+                b.chain = v;
+            } else {
+                v->next = chains[bucket];
+                std::atomic_thread_fence(std::memory_order_release);
+                chains[bucket] = v;
+            }
+        }
+
+        /**
+         * Remove the given item from a bucket.
+         *
+         * @return true if the item was found (and removed)
+         */
+        bool remove(size_t bucket, StoredValue *v);
+
+        /**
+         * Remove any one item from a bucket.
+         *
+         * @return the item removed, or NULL if the bucket is empty
+         */
+        StoredValue* pop(size_t bucket);
+
+        /**
+         * Call f(v) for each item in a bucket, until f returns false.
+         * f may remove (and delete) the item it is passed.
+         *
+         * @return false if f stopped the iteration
+         */
+        template <typename F>
+        bool forEach(size_t bucket, F f) const {
+            StoredValue *v;
+            if (tagged) {
+                const TaggedBucket &b = tagged[bucket];
+                for (size_t i = 0; i < TaggedBucket::numSlots; ++i) {
+                    if (b.tags[i] != 0 && !f(b.slots[i])) {
+                        return false;
+                    }
+                }
+                v = b.chain;
+            } else {
+                v = chains[bucket];
+            }
+            while (v) {
+                StoredValue *tmp = v->next;
+                if (!f(v)) {
+                    return false;
+                }
+                v = tmp;
+            }
+            return true;
+        }
+
+    private:
+        StoredValue  **chains;
+        TaggedBucket  *tagged;
+    };
+
     inline bool isActive() const { return activeState; }
     inline void setActiveState(bool newv) { activeState = newv; }
 
+    static void prefetchForRead(const void *addr) {
+#if defined(__GNUC__)
+        __builtin_prefetch(addr);
+#elif defined(_MSC_VER)
+        _mm_prefetch(static_cast<const char*>(addr), _MM_HINT_T0);
+#endif
+    }
+
+    /**
+     * Publish the address of the (new) bucket array to prefetch(), and it
+     * together with its size to optimisticGet(); called with every lock
+     * held whenever values is replaced.
+     */
+    void publishBuckets();
+
+    //! Deleter for a BucketsView retired to the epoch manager.
+    static void deleteBucketsView(void *ptr);
+
+    //! Free whatever has been retired and is no longer visible to readers.
+    void reclaimRetired();
+
+    size_t getBucketSize() const {
+        return layout == BucketLayout::Tagged ? sizeof(TaggedBucket)
+                                              : sizeof(StoredValue*);
+    }
+
+    /**
+     * Tag to store alongside an item with the given hash in the tagged
+     * layout; never 0.
+     */
+    static uint8_t getTagForHash(int h) {
+        uint8_t tag = static_cast<unsigned int>(h) >> 24;
+        return tag == 0 ? 1 : tag;
+    }
+
+    /**
+     * Tag for the given key; only calculated for the tagged layout.
+     */
+    uint8_t getTag(const char *key, size_t nkey) {
+        if (layout != BucketLayout::Tagged) {
+            return 0;
+        }
+        return getTagForHash(hash(key, nkey));
+    }
+
+    /**
+     * Add a newly created item to the given bucket.
+     */
+    void unlocked_insert(int bucket_num, StoredValue *v) {
+        values.insert(bucket_num, v,
+                      getTag(v->getKeyBytes(), v->getKeyLen()));
+    }
+
+    /**
+     * Implementation of insert() once the bucket is locked.
+     */
+    mutation_type_t unlocked_insert(Item &itm, int bucket_num,
+                                    item_eviction_policy_t policy,
+                                    bool eject, bool partial);
+
+    /**
+     * Sequence counter to bump when the given lock is taken, or NULL if
+     * lock-free reads are disabled.
+     */
+    std::atomic<uint64_t>* lockSequence(size_t lock) {
+        return epochs ? &lockSeqs[lock] : NULL;
+    }
+
+    std::atomic<uint64_t>* lockSequences() {
+        return epochs ? lockSeqs : NULL;
+    }
+
+    //! Attempts at an optimistic read before giving up on it.
+    static const int maxOptimisticReadAttempts = 4;
+
     std::atomic<size_t> size;
     size_t               n_locks;
-    StoredValue        **values;
+    BucketLayout         layout;
+    BucketArray          values;
+    //! Address of values' buckets, read by prefetch() without any lock.
+    std::atomic<uintptr_t> bucketsAddr;
+    //! A bucket array and its size, swapped as one so that optimisticGet()
+    //! never indexes an array with the size of another.
+    struct BucketsView {
+        const void *addr;
+        size_t size;
+    };
+    std::atomic<const BucketsView*> bucketsView;
     std::mutex               *mutexes;
+    //! Per lock sequence counters (see optimisticGet()).
+    std::atomic<uint64_t>    *lockSeqs;
+    //! Defers frees for optimisticGet(); NULL if it is disabled.
+    EpochManager             *epochs;
+    //! Serialises resizers; acquired before any of the bucket mutexes.
+    std::mutex           resizeMutex;
+    //! Buckets being migrated from by an incremental resize (if allocated).
+    BucketArray          oldValues;
+    //! Number of buckets in oldValues (0 if no resize in progress).
+    std::atomic<size_t>  oldSize;
+    //! Next lock / old bucket to be migrated by an incremental resize.
+    size_t               resizeLock;
+    size_t               resizeBucket;
     EPStats&             stats;
     StoredValueFactory   valFact;
     std::atomic<size_t>       visitors;
@@ -615,11 +1115,56 @@ private:
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
+    static BucketLayout           defaultBucketLayout;
 
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        return getBucketForHash(h, size);
     }
 
+    /**
+     * Map a hash onto a bucket of a table with the given number of buckets.
+     *
+     * Provided the table has at least n_locks buckets, a hash always maps to
+     * a bucket guarded by the same lock (h mod n_locks) whatever the size of
+     * the table. This allows an incremental resize to move a chain between
+     * the old and new bucket arrays while holding a single lock.
+     */
+    int getBucketForHash(int h, size_t tableSize) {
+        if (tableSize < n_locks) {
+            return abs(h % static_cast<int>(tableSize));
+        }
+        size_t uh = static_cast<unsigned int>(h);
+        size_t lock = uh % n_locks;
+        size_t rows = (tableSize - lock + n_locks - 1) / n_locks;
+        return static_cast<int>(lock + n_locks * ((uh / n_locks) % rows));
+    }
+
+    /**
+     * Get the bucket in the old bucket array which holds (or would hold) the
+     * given key. Must only be called while an incremental resize is in
+     * progress, with the key's bucket lock held.
+     */
+    size_t unlocked_getOldBucket(const char *key, size_t nkey) {
+        return getBucketForHash(hash(key, nkey), oldSize);
+    }
+
+    /**
+     * Move every item in the given old bucket into the new bucket array.
+     * The lock for the bucket must be held.
+     */
+    void unlocked_migrateBucket(size_t oldBucket);
+
+    /**
+     * Remove the given item from whichever bucket array holds it; the item
+     * must be present.
+     */
+    void unlocked_remove(StoredValue *v);
+
+    /**
+     * Size to resize to in order to fit the current data.
+     */
+    size_t getPreferredSize();
+
     inline size_t mutexForBucket(size_t bucket_num) {
         if (!isActive()) {
             throw std::logic_error("HashTable::mutexForBucket: Cannot call on a "
@@ -23,7 +23,12 @@
 
 #include <phosphor/phosphor.h>
 
+#include "ep_engine.h"
+
 static const double FREQUENCY(60.0);
+// Pause between the steps of an incremental resize, so that a resize held
+// up by a visitor doesn't keep an executor thread busy.
+static const double RESIZE_STEP_INTERVAL(0.01);
 
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
@@ -42,6 +47,33 @@ public:
 
 bool HashtableResizerTask::run(void) {
     TRACE_EVENT0("ep-engine/task", "HashtableResizerTask");
+    Configuration &config = store->getEPEngine().getConfiguration();
+
+    // Free memory retired by lock-free hash table readers (old bucket
+    // arrays, unlinked items) which a quiet thread's retire list would
+    // otherwise hold on to until it fills.
+    EpochManager *epochs = store->getEPEngine().getEpochManager();
+    if (epochs) {
+        epochs->reclaim();
+    }
+
+    if (config.isHtResizeIncremental()) {
+        // Move a bounded number of hash buckets per vbucket, and come back
+        // shortly while any resize is still in progress.
+        bool resizing = false;
+        const size_t batchSize = config.getHtResizeBatchSize();
+        for (auto vbid : store->getVBuckets().getBuckets()) {
+            RCPtr<VBucket> vb = store->getVBucket(vbid);
+            if (vb && vb->ht.startIncrementalResize()) {
+                if (!vb->ht.continueIncrementalResize(batchSize)) {
+                    resizing = true;
+                }
+            }
+        }
+        snooze(resizing ? RESIZE_STEP_INTERVAL : FREQUENCY);
+        return true;
+    }
+
     std::shared_ptr<ResizingVisitor> pv(new ResizingVisitor);
     store->visit(pv, "Hashtable resizer", NONIO_TASK_IDX,
             TaskId::HashtableResizerVisitorTask);
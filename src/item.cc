@@ -23,6 +23,87 @@
 std::atomic<uint64_t> Item::casCounter(1);
 const uint32_t Item::metaDataSize(2*sizeof(uint32_t) + 2*sizeof(uint64_t) + 2);
 
+bool Item::getCompressedValue(float minCompressionRatio, value_t& compressed,
+                              size_t& memAdded, size_t& memFreed) {
+    memAdded = 0;
+    memFreed = 0;
+    CompressedValueCache* cache = compressedCache.load();
+    if (cache) {
+        SpinLockHolder lh(&cache->lock);
+        if (cache->value.get() && cache->ratio == minCompressionRatio) {
+            compressed = cache->value;
+            return true;
+        }
+    }
+
+    compressed = value;
+    uint8_t datatype = getDataType();
+    if (value.get() && (datatype == PROTOCOL_BINARY_RAW_BYTES ||
+                        datatype == PROTOCOL_BINARY_DATATYPE_JSON)) {
+        // Compress outside the lock; should another stream race us to it,
+        // whichever Blob is cached first is the one everyone sends.
+        snap_buf output;
+        if (doSnappyCompress(getData(), getNBytes(), output) != SNAP_SUCCESS) {
+            return false;
+        }
+        if (output.len <= minCompressionRatio * getNBytes()) {
+            compressed.reset(Blob::New(output.buf.get(), output.len,
+                                       (uint8_t *)(getExtMeta()),
+                                       getExtMetaLen()));
+            compressed->setDataType(
+                    (datatype == PROTOCOL_BINARY_RAW_BYTES)
+                    ? PROTOCOL_BINARY_DATATYPE_COMPRESSED
+                    : PROTOCOL_BINARY_DATATYPE_COMPRESSED_JSON);
+        }
+    }
+
+    cache = getCompressedValueCache();
+    SpinLockHolder lh(&cache->lock);
+    if (cache->value.get() && cache->ratio == minCompressionRatio) {
+        compressed = cache->value;
+    } else {
+        // First compression, or one for a different ratio than the cached
+        // value was compressed for.
+        memFreed = getCompressedValMemSize_UNLOCKED(*cache);
+        cache->value = compressed;
+        cache->ratio = minCompressionRatio;
+        memAdded = getCompressedValMemSize_UNLOCKED(*cache);
+    }
+    return true;
+}
+
+size_t Item::getCompressedValMemSize() {
+    CompressedValueCache* cache = compressedCache.load();
+    if (!cache) {
+        return 0;
+    }
+    SpinLockHolder lh(&cache->lock);
+    return getCompressedValMemSize_UNLOCKED(*cache);
+}
+
+Item::CompressedValueCache* Item::getCompressedValueCache() {
+    CompressedValueCache* cache = compressedCache.load();
+    if (!cache) {
+        CompressedValueCache* created = new CompressedValueCache();
+        if (compressedCache.compare_exchange_strong(cache, created)) {
+            cache = created;
+        } else {
+            // Another stream installed one first; cache now points to it.
+            delete created;
+        }
+    }
+    return cache;
+}
+
+size_t Item::getCompressedValMemSize_UNLOCKED(
+        const CompressedValueCache& cache) const {
+    // A value which wasn't worth compressing is cached as itself.
+    if (cache.value.get() && cache.value.get() != value.get()) {
+        return cache.value->getSize();
+    }
+    return 0;
+}
+
 /**
  * Append another item to this item
  *
@@ -32,6 +32,7 @@
 #include "ep_time.h"
 #include "locks.h"
 #include "objectregistry.h"
+#include "slab_allocator.h"
 #include "stats.h"
 
 enum queue_operation {
@@ -71,7 +72,7 @@ public:
     static Blob* New(const char *start, const size_t len, uint8_t *ext_meta,
                      uint8_t ext_len) {
         size_t total_len = len + sizeof(Blob) + FLEX_DATA_OFFSET + ext_len;
-        Blob *t = new (::operator new(total_len)) Blob(start, len, ext_meta,
+        Blob *t = new (ObjectRegistry::allocate(total_len)) Blob(start, len, ext_meta,
                                                        ext_len);
         return t;
     }
@@ -88,7 +89,7 @@ public:
      */
     static Blob* New(const size_t len, uint8_t *ext_meta, uint8_t ext_len) {
         size_t total_len = len + sizeof(Blob) + FLEX_DATA_OFFSET + ext_len;
-        Blob *t = new (::operator new(total_len)) Blob(NULL, len, ext_meta,
+        Blob *t = new (ObjectRegistry::allocate(total_len)) Blob(NULL, len, ext_meta,
                                                        ext_len);
         return t;
     }
@@ -104,7 +105,7 @@ public:
      */
     static Blob* New(const size_t len, uint8_t ext_len) {
         size_t total_len = len + sizeof(Blob) + FLEX_DATA_OFFSET + ext_len;
-        Blob *t = new (::operator new(total_len)) Blob(len, ext_len);
+        Blob *t = new (ObjectRegistry::allocate(total_len)) Blob(len, ext_len);
         return t;
     }
 
@@ -112,7 +113,7 @@ public:
      * Creates an exact copy of the specified Blob.
      */
     static Blob* Copy(const Blob& other) {
-        Blob *t = new (::operator new(other.getSize())) Blob(other);
+        Blob *t = new (ObjectRegistry::allocate(other.getSize())) Blob(other);
         return t;
     }
 
@@ -212,8 +213,9 @@ public:
 
     // This is necessary for making C++ happy when I'm doing a
     // placement new on fairly "normal" c++ heap allocations, just
-    // with variable-sized objects.
-    void operator delete(void* p) { ::operator delete(p); }
+    // with variable-sized objects. (The memory may be a slab slot; see
+    // ObjectRegistry::allocate()).
+    void operator delete(void* p) { ObjectRegistry::deallocate(p); }
 
     ~Blob() {
         ObjectRegistry::onDeleteBlob(this);
@@ -336,7 +338,8 @@ public:
         vbucketId(vbid),
         op(queue_op_set),
         nru(nru_value),
-        conflictResMode(conflict_res_value)
+        conflictResMode(conflict_res_value),
+        compressedCache(nullptr)
     {
         if (bySeqno == 0) {
             throw std::invalid_argument("Item(): bySeqno must be non-zero");
@@ -367,7 +370,8 @@ public:
         vbucketId(vbid),
         op(queue_op_set),
         nru(nru_value),
-        conflictResMode(conflict_res_value)
+        conflictResMode(conflict_res_value),
+        compressedCache(nullptr)
     {
         if (bySeqno == 0) {
             throw std::invalid_argument("Item(): bySeqno must be non-zero");
@@ -387,7 +391,8 @@ public:
        vbucketId(vb),
        op(static_cast<uint16_t>(o)),
        nru(nru_value),
-       conflictResMode(conflict_res_value)
+       conflictResMode(conflict_res_value),
+       compressedCache(nullptr)
     {
        if (bySeqno < 0) {
            throw std::invalid_argument("Item(): bySeqno must be non-negative");
@@ -405,7 +410,8 @@ public:
         vbucketId(other.vbucketId),
         op(other.op),
         nru(other.nru),
-        conflictResMode(other.conflictResMode)
+        conflictResMode(other.conflictResMode),
+        compressedCache(nullptr)
     {
         if (copyKeyOnly) {
             setData(nullptr, 0, nullptr, 0);
@@ -416,6 +422,7 @@ public:
     }
 
     ~Item() {
+        delete compressedCache.load();
         ObjectRegistry::onDeleteItem(this);
     }
 
@@ -448,6 +455,44 @@ public:
         return true;
     }
 
+    /**
+     * Get this item's value snappy compressed, as compressValue() would
+     * leave it, without changing the item itself.
+     *
+     * The compressed Blob is kept on the item, so every DCP stream sending
+     * a (checkpoint) item shares the one compressed on its first send for
+     * the same minCompressionRatio; a different ratio replaces it. If
+     * compressing doesn't achieve minCompressionRatio, or the value is
+     * already compressed, the value itself is returned (and remembered).
+     *
+     * The memory of the kept Blob isn't part of size(); the caller is told
+     * how it changed, to charge it to the checkpoint holding the item.
+     *
+     * @param minCompressionRatio as for compressValue()
+     * @param [out] compressed the value to send
+     * @param [out] memAdded memory newly held for the kept Blob
+     * @param [out] memFreed memory held for the Blob it replaced
+     * @return false if compression failed; compressed is then the value
+     */
+    bool getCompressedValue(float minCompressionRatio, value_t& compressed,
+                            size_t& memAdded, size_t& memFreed);
+
+    /**
+     * Memory held for the Blob kept by getCompressedValue(), if it is not
+     * the value itself.
+     */
+    size_t getCompressedValMemSize();
+
+    /**
+     * Drop the item's value (and the compressed one kept), leaving its key
+     * and metadata as a copyKeyOnly copy would. Only for an item nothing
+     * else refers to.
+     */
+    void releaseValue() {
+        setData(nullptr, 0, nullptr, 0);
+        delete compressedCache.exchange(nullptr);
+    }
+
     /* Snappy uncompress value and update datatype */
     bool decompressValue() {
         uint8_t datatype = getDataType();
@@ -692,6 +737,25 @@ private:
 
     ItemMetaData metaData;
     value_t value;
+    /**
+     * The value as sent to compressing DCP streams, kept by
+     * getCompressedValue(). Only items which get compressed pay for it.
+     */
+    struct CompressedValueCache {
+        CompressedValueCache() : ratio(0) {}
+
+        value_t value;
+        // The minimum compression ratio value was compressed for
+        float ratio;
+        SpinLock lock;
+    };
+
+    // The cache, installing it if this is the first compression
+    CompressedValueCache* getCompressedValueCache();
+
+    size_t getCompressedValMemSize_UNLOCKED(
+            const CompressedValueCache& cache) const;
+
     std::string key;
     int64_t bySeqno;
     uint32_t queuedTime;
@@ -699,6 +763,8 @@ private:
     uint8_t op;
     uint8_t nru  : 2;
     uint8_t conflictResMode : 2;
+    // Null until getCompressedValue() is first called
+    std::atomic<CompressedValueCache*> compressedCache;
 
     static std::atomic<uint64_t> casCounter;
     static const uint32_t metaDataSize;
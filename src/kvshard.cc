@@ -37,19 +37,32 @@ KVShard::KVShard(uint16_t id, EventuallyPersistentStore &store) :
     vbuckets = new RCPtr<VBucket>[maxVbuckets];
 
     std::string backend = kvConfig.getBackend();
-    uint16_t commitInterval = 1;
+    size_t commitInterval = 1;
+    size_t flusherWriters = config.getFlusherWritersPerShard();
+    size_t bgFetchers = config.getBgFetchersPerShard();
 
     if (backend.compare("couchdb") == 0) {
         rwUnderlying = KVStoreFactory::create(kvConfig, false);
         roUnderlying = KVStoreFactory::create(kvConfig, true);
+        commitInterval = config.getCouchstoreGroupCommitVbuckets();
+        if (commitInterval > 1) {
+            // As for forestdb, a (group) commit spans the flushes of
+            // several vbuckets.
+            flusherWriters = 1;
+        }
     } else if (backend.compare("forestdb") == 0) {
         rwUnderlying = KVStoreFactory::create(kvConfig);
         roUnderlying = rwUnderlying;
         commitInterval = config.getMaxVbuckets()/config.getMaxNumShards();
+        // A transaction spans the flushes of several vbuckets, so they
+        // can't be interleaved.
+        flusherWriters = 1;
+        // Nor are reads of the store concurrent with each other.
+        bgFetchers = 1;
     }
 
-    flusher = new Flusher(&store, this, commitInterval);
-    bgFetcher = new BgFetcher(&store, this, stats);
+    flusher = new Flusher(&store, this, commitInterval, flusherWriters);
+    bgFetcher = new BgFetcher(&store, this, stats, bgFetchers);
 }
 
 KVShard::~KVShard() {
@@ -21,6 +21,8 @@
 #include "config.h"
 
 #include <atomic>
+#include <mutex>
+#include <vector>
 #include "utility.h"
 
 /**
@@ -65,6 +67,12 @@ public:
     KVStore *getRWUnderlying() { return rwUnderlying; }
     KVStore *getROUnderlying() { return roUnderlying; }
 
+    /**
+     * Lock to be held from beginning a transaction on the read write store
+     * until it is committed, as the shard's flusher writers share it.
+     */
+    std::mutex &getRWTransactionLock() { return rwTransactionLock; }
+
     Flusher *getFlusher();
     BgFetcher *getBgFetcher();
 
@@ -135,6 +143,7 @@ private:
 
     KVStore    *rwUnderlying;
     KVStore    *roUnderlying;
+    std::mutex  rwTransactionLock;
 
     Flusher    *flusher;
     BgFetcher  *bgFetcher;
@@ -150,6 +159,24 @@ private:
 public:
     std::atomic<size_t> highPriorityCount;
 
+    /**
+     * A flush of a vbucket in the open transaction on the read write store,
+     * whose persistence is only acknowledged once that is committed.
+     */
+    struct UncommittedFlush {
+        UncommittedFlush(const RCPtr<VBucket> &v, bool w,
+                         const snapshot_range_t &r)
+            : vb(v), written(w), range(r) {}
+
+        RCPtr<VBucket> vb;
+        // Whether any items were written (up to the snapshot range)
+        bool written;
+        snapshot_range_t range;
+    };
+
+    // Flushes awaiting the commit, guarded by the rw transaction lock
+    std::vector<UncommittedFlush> uncommittedFlushes;
+
     DISALLOW_COPY_AND_ASSIGN(KVShard);
 };
 
@@ -39,7 +39,7 @@ KVStoreConfig::KVStoreConfig(Configuration& config, uint16_t shardid)
                     config.getDbname(),
                     config.getBackend(),
                     shardid) {
-
+    setIoUring(config.isCouchstoreIoUring());
 }
 
 KVStoreConfig::KVStoreConfig(uint16_t _maxVBuckets,
@@ -53,7 +53,8 @@ KVStoreConfig::KVStoreConfig(uint16_t _maxVBuckets,
       backend(_backend),
       shardId(_shardId),
       logger(&global_logger),
-      buffered(true) {
+      buffered(true),
+      ioUring(false) {
 
 }
 
@@ -67,6 +68,11 @@ KVStoreConfig& KVStoreConfig::setBuffered(bool _buffered) {
     return *this;
 }
 
+KVStoreConfig& KVStoreConfig::setIoUring(bool _ioUring) {
+    ioUring = _ioUring;
+    return *this;
+}
+
 KVStore *KVStoreFactory::create(KVStoreConfig &config, bool read_only) {
     KVStore *ret = NULL;
     std::string backend = config.getBackend();
@@ -282,6 +288,7 @@ void KVStore::addTimingStats(ADD_STAT add_stat, const void *c) {
     addStat(prefix, "snapshot",    st.snapshotHisto,    add_stat, c);
     addStat(prefix, "delete",      st.delTimeHisto,     add_stat, c);
     addStat(prefix, "save_documents", st.saveDocsHisto, add_stat, c);
+    addStat(prefix, "group_sync",  st.groupSyncHisto,   add_stat, c);
     addStat(prefix, "writeTime",   st.writeTimeHisto,   add_stat, c);
     addStat(prefix, "writeSize",   st.writeSizeHisto,   add_stat, c);
     addStat(prefix, "bulkSize",    st.batchSize,        add_stat, c);
@@ -289,6 +296,8 @@ void KVStore::addTimingStats(ADD_STAT add_stat, const void *c) {
     //file ops stats
     addStat(prefix, "fsReadTime",  st.fsStats.readTimeHisto,  add_stat, c);
     addStat(prefix, "fsWriteTime", st.fsStats.writeTimeHisto, add_stat, c);
+    addStat(prefix, "fsWriteDrainTime", st.fsStats.writeDrainTimeHisto,
+            add_stat, c);
     addStat(prefix, "fsSyncTime",  st.fsStats.syncTimeHisto,  add_stat, c);
     addStat(prefix, "fsReadSize",  st.fsStats.readSizeHisto,  add_stat, c);
     addStat(prefix, "fsWriteSize", st.fsStats.writeSizeHisto, add_stat, c);
@@ -91,6 +91,7 @@ typedef uint16_t DBFileId;
 
 typedef std::shared_ptr<Callback<uint16_t&, std::string&, bool&> > BloomFilterCBPtr;
 typedef std::shared_ptr<Callback<uint16_t&, std::string&, uint64_t&, time_t&> > ExpiredItemsCBPtr;
+typedef std::shared_ptr<Callback<uint16_t&, std::string&> > PurgedItemCBPtr;
 
 typedef struct {
     uint64_t purge_before_ts;
@@ -103,6 +104,8 @@ typedef struct {
     uint32_t curr_time;
     BloomFilterCBPtr bloomFilterCallback;
     ExpiredItemsCBPtr expiryCallback;
+    // Called for each deleted item dropped by the compaction.
+    PurgedItemCBPtr purgedItemCallback;
 } compaction_ctx;
 
 /**
@@ -290,7 +293,8 @@ public:
         readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
         writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
         totalBytesRead(0),
-        totalBytesWritten(0) { }
+        totalBytesWritten(0),
+        totalSyncTime(0) { }
 
     //Read time length
     Histogram<hrtime_t> readTimeHisto;
@@ -302,6 +306,8 @@ public:
     Histogram<hrtime_t> writeTimeHisto;
     //Write size
     Histogram<size_t> writeSizeHisto;
+    //Time spent waiting for outstanding writes before a sync
+    Histogram<hrtime_t> writeDrainTimeHisto;
     //Time spent in sync
     Histogram<hrtime_t> syncTimeHisto;
 
@@ -309,6 +315,8 @@ public:
     std::atomic<size_t> totalBytesRead;
     // Total bytes written to disk.
     std::atomic<size_t> totalBytesWritten;
+    // Total time (in microseconds) spent in sync.
+    std::atomic<size_t> totalSyncTime;
 
     void reset() {
         readTimeHisto.reset();
@@ -316,9 +324,11 @@ public:
         readSizeHisto.reset();
         writeTimeHisto.reset();
         writeSizeHisto.reset();
+        writeDrainTimeHisto.reset();
         syncTimeHisto.reset();
         totalBytesRead = 0;
         totalBytesWritten = 0;
+        totalSyncTime = 0;
     }
 };
 
@@ -371,6 +381,7 @@ public:
         snapshotHisto.reset();
         commitHisto.reset();
         saveDocsHisto.reset();
+        groupSyncHisto.reset();
         batchSize.reset();
         fsStats.reset();
     }
@@ -419,6 +430,8 @@ public:
     Histogram<hrtime_t> compactHisto;
     // Time spent in saving documents to disk
     Histogram<hrtime_t> saveDocsHisto;
+    // Time spent syncing the files of a group commit of several vbuckets
+    Histogram<hrtime_t> groupSyncHisto;
     // Batch size while saving documents
     Histogram<size_t> batchSize;
     //Time spent in vbucket snapshot
@@ -572,6 +585,16 @@ public:
         return buffered;
     }
 
+    /**
+     * Indicates whether file I/O should go through io_uring, where it is
+     * available (otherwise it makes no difference).
+     *
+     * Only recognised by CouchKVStore
+     */
+    bool getIoUring() {
+        return ioUring;
+    }
+
     /**
      * Used to override the default logger object
      */
@@ -584,6 +607,13 @@ public:
      */
     KVStoreConfig& setBuffered(bool _buffered);
 
+    /**
+     * Used to enable (or disable) file I/O through io_uring.
+     *
+     * Only recognised by CouchKVStore
+     */
+    KVStoreConfig& setIoUring(bool _ioUring);
+
 private:
     uint16_t maxVBuckets;
     uint16_t maxShards;
@@ -592,6 +622,7 @@ private:
     uint16_t shardId;
     Logger* logger;
     bool buffered;
+    bool ioUring;
 };
 
 class IORequest {
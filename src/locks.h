@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <functional>
 #include <mutex>
 #include <iostream>
@@ -43,7 +44,8 @@ public:
     /**
      * Acquire the lock in the given mutex.
      */
-    LockHolder(std::mutex &m, bool tryLock = false) : mutex(m), locked(false) {
+    LockHolder(std::mutex &m, bool tryLock = false)
+        : mutex(m), sequence(NULL), locked(false) {
         if (tryLock) {
             trylock();
         } else {
@@ -51,11 +53,26 @@ public:
         }
     }
 
+    /**
+     * Acquire the lock in the given mutex, which guards data that is also
+     * read optimistically (without the mutex) by validating the given
+     * sequence counter. The counter is made odd while the lock is held and
+     * even again before it is released (see seqlockBegin()).
+     *
+     * @param m the mutex to lock
+     * @param seq the mutex's sequence counter, or NULL if it has none
+     */
+    LockHolder(std::mutex &m, std::atomic<uint64_t> *seq)
+        : mutex(m), sequence(seq), locked(false) {
+        lock();
+    }
+
     /**
      * Copy constructor hands this lock to the new copy and then
      * consider it released locally (i.e. renders unlock() a noop).
      */
-    LockHolder(const LockHolder& from) : mutex(from.mutex), locked(true) {
+    LockHolder(const LockHolder& from)
+        : mutex(from.mutex), sequence(from.sequence), locked(true) {
         const_cast<LockHolder*>(&from)->locked = false;
     }
 
@@ -72,6 +89,7 @@ public:
     void lock() {
         mutex.lock();
         locked = true;
+        seqlockBegin(sequence);
     }
 
     /**
@@ -79,6 +97,9 @@ public:
      */
     bool trylock() {
         locked = mutex.try_lock();
+        if (locked) {
+            seqlockBegin(sequence);
+        }
         return locked;
     }
 
@@ -95,12 +116,38 @@ public:
     void unlock() {
         if (locked) {
             locked = false;
+            seqlockEnd(sequence);
             mutex.unlock();
         }
     }
 
+    /**
+     * Mark the start of a write to data guarded by a sequence counter; the
+     * counter's mutex must be held. An optimistic reader reads the counter
+     * before and after reading the data, and only trusts what it read if the
+     * counter was even and unchanged.
+     */
+    static void seqlockBegin(std::atomic<uint64_t> *seq) {
+        if (seq) {
+            seq->store(seq->load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+    }
+
+    /**
+     * Mark the end of a write started by seqlockBegin().
+     */
+    static void seqlockEnd(std::atomic<uint64_t> *seq) {
+        if (seq) {
+            seq->store(seq->load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+        }
+    }
+
 private:
     std::mutex &mutex;
+    std::atomic<uint64_t> *sequence;
     bool locked;
 
     void operator=(const LockHolder&);
@@ -119,8 +166,12 @@ public:
      *
      * @param m beginning of an array of locks
      * @param n the number of locks to lock
+     * @param seqs beginning of an array of the locks' sequence counters (see
+     *             LockHolder::seqlockBegin()), or NULL if they have none
      */
-    MultiLockHolder(std::mutex *m, size_t n) : mutexes(m),
+    MultiLockHolder(std::mutex *m, size_t n,
+                    std::atomic<uint64_t> *seqs = NULL) : mutexes(m),
+                                          sequences(seqs),
                                           locked(new bool[n]),
                                           n_locks(n) {
         std::fill_n(locked, n_locks, false);
@@ -144,6 +195,7 @@ public:
             }
             mutexes[i].lock();
             locked[i] = true;
+            LockHolder::seqlockBegin(sequence(i));
         }
     }
 
@@ -154,13 +206,19 @@ public:
         for (size_t i = 0; i < n_locks; i++) {
             if (locked[i]) {
                 locked[i] = false;
+                LockHolder::seqlockEnd(sequence(i));
                 mutexes[i].unlock();
             }
         }
     }
 
 private:
+    std::atomic<uint64_t>* sequence(size_t i) {
+        return sequences ? &sequences[i] : NULL;
+    }
+
     std::mutex  *mutexes;
+    std::atomic<uint64_t> *sequences;
     bool   *locked;
     size_t  n_locks;
 
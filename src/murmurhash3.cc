@@ -343,3 +343,282 @@ void MurmurHash3_x64_128 ( const void * key, const int len,
 }
 
 //-----------------------------------------------------------------------------
+// Batched MurmurHash3_x64_128 over consecutive seeds.
+//
+// Every seed shares the mixed blocks of the key (k1, k2); only the state
+// (h1, h2) is per seed, so the state of several seeds is held in the 64-bit
+// lanes of a vector. 64-bit multiplies (only needed by fmix64) are built
+// from 32x32->64 bit multiplies, which SSE2 and AVX2 both have.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MURMURHASH3_HAVE_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include <string.h>
+
+static const uint64_t x64_c1 = BIG_CONSTANT(0x87c37b91114253d5);
+static const uint64_t x64_c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+static const uint64_t fmix_c1 = BIG_CONSTANT(0xff51afd7ed558ccd);
+static const uint64_t fmix_c2 = BIG_CONSTANT(0xc4ceb9fe1a85ec53);
+
+FORCE_INLINE void mixBlock64 ( uint64_t & k1, uint64_t & k2 )
+{
+    k1 *= x64_c1; k1  = ROTL64(k1,31); k1 *= x64_c2;
+    k2 *= x64_c2; k2  = ROTL64(k2,33); k2 *= x64_c1;
+}
+
+/**
+ * The mixed k1 and k2 of the (up to 15 byte) tail of a key. Mixing zero
+ * gives zero, so they can be applied whatever the length of the tail.
+ * (Little-endian only, as is the SIMD code which uses it.)
+ */
+FORCE_INLINE void mixTail64 ( const uint8_t * tail, int len,
+                              uint64_t & k1, uint64_t & k2 )
+{
+    uint64_t buf[2] = { 0, 0 };
+    if (len > 0) {
+        memcpy(buf, tail, len);
+    }
+    k1 = buf[0];
+    k2 = buf[1];
+    mixBlock64(k1, k2);
+}
+
+static void seeds_scalar ( const void * key, int len, uint32_t firstSeed,
+                           int n, uint64_t * out )
+{
+    for (int i = 0; i < n; i++) {
+        MurmurHash3_x64_128(key, len, firstSeed + i, &out[i]);
+    }
+}
+
+#ifdef MURMURHASH3_HAVE_SIMD
+
+//----------
+// SSE2; two seeds at a time.
+
+template <int r>
+FORCE_INLINE __m128i rotl64_sse2 ( __m128i x )
+{
+    return _mm_or_si128(_mm_slli_epi64(x, r), _mm_srli_epi64(x, 64 - r));
+}
+
+FORCE_INLINE __m128i mul64_sse2 ( __m128i a, uint64_t c )
+{
+    const __m128i clo = _mm_set1_epi64x(c & 0xffffffff);
+    const __m128i chi = _mm_set1_epi64x(c >> 32);
+    const __m128i cross = _mm_add_epi64(
+            _mm_mul_epu32(_mm_srli_epi64(a, 32), clo), _mm_mul_epu32(a, chi));
+    return _mm_add_epi64(_mm_mul_epu32(a, clo), _mm_slli_epi64(cross, 32));
+}
+
+FORCE_INLINE __m128i fmix64_sse2 ( __m128i k )
+{
+    k = _mm_xor_si128(k, _mm_srli_epi64(k, 33));
+    k = mul64_sse2(k, fmix_c1);
+    k = _mm_xor_si128(k, _mm_srli_epi64(k, 33));
+    k = mul64_sse2(k, fmix_c2);
+    return _mm_xor_si128(k, _mm_srli_epi64(k, 33));
+}
+
+static void seeds_sse2 ( const void * key, int len, uint32_t firstSeed,
+                         int n, uint64_t * out )
+{
+    const uint8_t * data = (const uint8_t*)key;
+    const int nblocks = len / 16;
+    const uint64_t * blocks = (const uint64_t *)(data);
+
+    uint64_t t1, t2;
+    mixTail64(data + nblocks*16, len & 15, t1, t2);
+
+    for (int s = 0; s < n; s += 2) {
+        __m128i h1 = _mm_set_epi64x((uint32_t)(firstSeed + s + 1),
+                                    (uint32_t)(firstSeed + s));
+        __m128i h2 = h1;
+
+        for (int i = 0; i < nblocks; i++) {
+            uint64_t k1 = getblock64(blocks,i*2+0);
+            uint64_t k2 = getblock64(blocks,i*2+1);
+            mixBlock64(k1, k2);
+
+            h1 = _mm_xor_si128(h1, _mm_set1_epi64x(k1));
+            h1 = _mm_add_epi64(rotl64_sse2<27>(h1), h2);
+            h1 = _mm_add_epi64(_mm_add_epi64(_mm_slli_epi64(h1, 2), h1),
+                               _mm_set1_epi64x(0x52dce729));
+
+            h2 = _mm_xor_si128(h2, _mm_set1_epi64x(k2));
+            h2 = _mm_add_epi64(rotl64_sse2<31>(h2), h1);
+            h2 = _mm_add_epi64(_mm_add_epi64(_mm_slli_epi64(h2, 2), h2),
+                               _mm_set1_epi64x(0x38495ab5));
+        }
+
+        const __m128i vlen = _mm_set1_epi64x(len);
+        h1 = _mm_xor_si128(h1, _mm_xor_si128(_mm_set1_epi64x(t1), vlen));
+        h2 = _mm_xor_si128(h2, _mm_xor_si128(_mm_set1_epi64x(t2), vlen));
+
+        h1 = _mm_add_epi64(h1, h2);
+        h2 = _mm_add_epi64(h2, h1);
+        h1 = fmix64_sse2(h1);
+        h2 = fmix64_sse2(h2);
+        h1 = _mm_add_epi64(h1, h2);
+
+        uint64_t result[2];
+        _mm_storeu_si128((__m128i*)result, h1);
+        out[s] = result[0];
+        if (s + 1 < n) {
+            out[s + 1] = result[1];
+        }
+    }
+}
+
+//----------
+// AVX2; four seeds at a time.
+
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+template <int r>
+AVX2_FUNCTION FORCE_INLINE __m256i rotl64_avx2 ( __m256i x )
+{
+    return _mm256_or_si256(_mm256_slli_epi64(x, r),
+                           _mm256_srli_epi64(x, 64 - r));
+}
+
+AVX2_FUNCTION FORCE_INLINE __m256i mul64_avx2 ( __m256i a, uint64_t c )
+{
+    const __m256i clo = _mm256_set1_epi64x(c & 0xffffffff);
+    const __m256i chi = _mm256_set1_epi64x(c >> 32);
+    const __m256i cross = _mm256_add_epi64(
+            _mm256_mul_epu32(_mm256_srli_epi64(a, 32), clo),
+            _mm256_mul_epu32(a, chi));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, clo),
+                            _mm256_slli_epi64(cross, 32));
+}
+
+AVX2_FUNCTION FORCE_INLINE __m256i fmix64_avx2 ( __m256i k )
+{
+    k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+    k = mul64_avx2(k, fmix_c1);
+    k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+    k = mul64_avx2(k, fmix_c2);
+    return _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+}
+
+AVX2_FUNCTION
+static void seeds_avx2 ( const void * key, int len, uint32_t firstSeed,
+                         int n, uint64_t * out )
+{
+    const uint8_t * data = (const uint8_t*)key;
+    const int nblocks = len / 16;
+    const uint64_t * blocks = (const uint64_t *)(data);
+
+    uint64_t t1, t2;
+    mixTail64(data + nblocks*16, len & 15, t1, t2);
+
+    for (int s = 0; s < n; s += 4) {
+        __m256i h1 = _mm256_set_epi64x((uint32_t)(firstSeed + s + 3),
+                                       (uint32_t)(firstSeed + s + 2),
+                                       (uint32_t)(firstSeed + s + 1),
+                                       (uint32_t)(firstSeed + s));
+        __m256i h2 = h1;
+
+        for (int i = 0; i < nblocks; i++) {
+            uint64_t k1 = getblock64(blocks,i*2+0);
+            uint64_t k2 = getblock64(blocks,i*2+1);
+            mixBlock64(k1, k2);
+
+            h1 = _mm256_xor_si256(h1, _mm256_set1_epi64x(k1));
+            h1 = _mm256_add_epi64(rotl64_avx2<27>(h1), h2);
+            h1 = _mm256_add_epi64(
+                    _mm256_add_epi64(_mm256_slli_epi64(h1, 2), h1),
+                    _mm256_set1_epi64x(0x52dce729));
+
+            h2 = _mm256_xor_si256(h2, _mm256_set1_epi64x(k2));
+            h2 = _mm256_add_epi64(rotl64_avx2<31>(h2), h1);
+            h2 = _mm256_add_epi64(
+                    _mm256_add_epi64(_mm256_slli_epi64(h2, 2), h2),
+                    _mm256_set1_epi64x(0x38495ab5));
+        }
+
+        const __m256i vlen = _mm256_set1_epi64x(len);
+        h1 = _mm256_xor_si256(h1,
+                              _mm256_xor_si256(_mm256_set1_epi64x(t1), vlen));
+        h2 = _mm256_xor_si256(h2,
+                              _mm256_xor_si256(_mm256_set1_epi64x(t2), vlen));
+
+        h1 = _mm256_add_epi64(h1, h2);
+        h2 = _mm256_add_epi64(h2, h1);
+        h1 = fmix64_avx2(h1);
+        h2 = fmix64_avx2(h2);
+        h1 = _mm256_add_epi64(h1, h2);
+
+        uint64_t result[4];
+        _mm256_storeu_si256((__m256i*)result, h1);
+        for (int i = 0; i < 4 && s + i < n; i++) {
+            out[s + i] = result[i];
+        }
+    }
+}
+
+#endif // MURMURHASH3_HAVE_SIMD
+
+static bool isSupported ( murmurhash3_kernel_t kernel )
+{
+    switch (kernel) {
+    case MURMURHASH3_SCALAR:
+        return true;
+#ifdef MURMURHASH3_HAVE_SIMD
+    case MURMURHASH3_SSE2:
+        // Part of the x86-64 baseline.
+        return true;
+    case MURMURHASH3_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+    default:
+        return false;
+#endif
+    }
+    return false;
+}
+
+murmurhash3_kernel_t MurmurHash3_getKernel ()
+{
+    // Only two lanes, and the emulated 64-bit multiplies, leave SSE2 no
+    // faster than scalar code; it is available for explicit use.
+    static const murmurhash3_kernel_t kernel =
+        isSupported(MURMURHASH3_AVX2) ? MURMURHASH3_AVX2 : MURMURHASH3_SCALAR;
+    return kernel;
+}
+
+bool MurmurHash3_x64_128_seeds_using ( murmurhash3_kernel_t kernel,
+                                       const void * key, int len,
+                                       uint32_t firstSeed, int n,
+                                       uint64_t * out )
+{
+    if (!isSupported(kernel)) {
+        return false;
+    }
+    switch (kernel) {
+#ifdef MURMURHASH3_HAVE_SIMD
+    case MURMURHASH3_AVX2:
+        seeds_avx2(key, len, firstSeed, n, out);
+        return true;
+    case MURMURHASH3_SSE2:
+        seeds_sse2(key, len, firstSeed, n, out);
+        return true;
+#endif
+    default:
+        seeds_scalar(key, len, firstSeed, n, out);
+        return true;
+    }
+}
+
+void MurmurHash3_x64_128_seeds ( const void * key, int len,
+                                 uint32_t firstSeed, int n, uint64_t * out )
+{
+    MurmurHash3_x64_128_seeds_using(MurmurHash3_getKernel(), key, len,
+                                    firstSeed, n, out);
+}
+
+//-----------------------------------------------------------------------------
@@ -25,6 +25,43 @@ void MurmurHash3_x86_128 (const void * key, int len, uint32_t seed,
 void MurmurHash3_x64_128 (const void * key, int len, uint32_t seed,
                           void * out);
 
+//-----------------------------------------------------------------------------
+// Batched hashing of one key with consecutive seeds (as a bloom filter needs).
+//
+// Only the initial state of MurmurHash3_x64_128 depends on the seed, so each
+// block of the key is mixed once and applied to the state of every seed,
+// which is held in the lanes of SIMD registers. The kernel is picked at
+// runtime from what the CPU supports.
+
+enum murmurhash3_kernel_t {
+    MURMURHASH3_SCALAR,
+    MURMURHASH3_SSE2,
+    MURMURHASH3_AVX2
+};
+
+/**
+ * Equivalent to calling MurmurHash3_x64_128 (64-bit output) with each of
+ * the seeds firstSeed .. firstSeed + n - 1, storing the results in out[0]
+ * .. out[n - 1].
+ */
+void MurmurHash3_x64_128_seeds (const void * key, int len, uint32_t firstSeed,
+                                int n, uint64_t * out);
+
+/**
+ * As MurmurHash3_x64_128_seeds, using the given kernel.
+ *
+ * @return false (and nothing is hashed) if the CPU doesn't support it
+ */
+bool MurmurHash3_x64_128_seeds_using (murmurhash3_kernel_t kernel,
+                                      const void * key, int len,
+                                      uint32_t firstSeed, int n,
+                                      uint64_t * out);
+
+/**
+ * The kernel MurmurHash3_x64_128_seeds uses on this CPU.
+ */
+murmurhash3_kernel_t MurmurHash3_getKernel ();
+
 //-----------------------------------------------------------------------------
 
 #endif // _MURMURHASH3_H_
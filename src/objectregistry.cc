@@ -21,6 +21,8 @@
 
 #include "threadlocal.h"
 #include "ep_engine.h"
+#include "epoch_manager.h"
+#include "slab_allocator.h"
 #include "stored-value.h"
 
 #if 1
@@ -72,13 +74,47 @@ void ObjectRegistry::initialize(get_allocation_size func) {
     getAllocSize = func;
 }
 
+/**
+ * Size of the allocation holding the given object (or 0 if not known). Slab
+ * slots are interior pointers, so must not be passed to the allocator.
+ */
+static size_t getObjectAllocSize(const void *ptr) {
+    size_t size = SlabArena::getSlotSize(ptr);
+    if (size == 0) {
+        size = getAllocSize(ptr);
+    }
+    return size;
+}
+
+void* ObjectRegistry::allocate(size_t size) {
+    EventuallyPersistentEngine *engine = th->get();
+    SlabArena *arena = engine ? engine->getSlabArena() : NULL;
+    if (arena) {
+        return arena->allocate(size);
+    }
+    return ::operator new(size);
+}
+
+void ObjectRegistry::deallocate(void *ptr) {
+    EpochManager *epochs = getEpochManager();
+    if (epochs && ptr) {
+        epochs->retire(ptr, SlabArena::deallocate);
+    } else {
+        SlabArena::deallocate(ptr);
+    }
+}
+
+EpochManager* ObjectRegistry::getEpochManager() {
+    EventuallyPersistentEngine *engine = th->get();
+    return engine ? engine->getEpochManager() : NULL;
+}
 
 void ObjectRegistry::onCreateBlob(const Blob *blob)
 {
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(blob);
+       size_t size = getObjectAllocSize(blob);
        if (size == 0) {
            size = blob->getSize();
        } else {
@@ -95,7 +131,7 @@ void ObjectRegistry::onDeleteBlob(const Blob *blob)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(blob);
+       size_t size = getObjectAllocSize(blob);
        if (size == 0) {
            size = blob->getSize();
        } else {
@@ -112,7 +148,7 @@ void ObjectRegistry::onCreateStoredValue(const StoredValue *sv)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(sv);
+       size_t size = getObjectAllocSize(sv);
        if (size == 0) {
            size = sv->getObjectSize();
        } else {
@@ -128,7 +164,7 @@ void ObjectRegistry::onDeleteStoredValue(const StoredValue *sv)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(sv);
+       size_t size = getObjectAllocSize(sv);
        if (size == 0) {
            size = sv->getObjectSize();
        } else {
@@ -22,6 +22,7 @@
 #include <atomic>
 
 class EventuallyPersistentEngine;
+class EpochManager;
 class Blob;
 class Item;
 class StoredValue;
@@ -35,6 +36,26 @@ class StoredValue;
 class ObjectRegistry {
 public:
     static void initialize(get_allocation_size func);
+
+    /**
+     * Allocate memory for a StoredValue or Blob; from the current engine's
+     * slab arena if it has one. Free with deallocate().
+     */
+    static void* allocate(size_t size);
+
+    /**
+     * Free memory returned by allocate(). If the current engine allows
+     * lock-free hash table reads the memory is retired to its epoch manager
+     * instead, and only freed once no reader can still be looking at it.
+     */
+    static void deallocate(void *ptr);
+
+    /**
+     * Get the current engine's epoch manager, or NULL if it doesn't allow
+     * lock-free hash table reads.
+     */
+    static EpochManager* getEpochManager();
+
     static void onCreateBlob(const Blob *blob);
     static void onDeleteBlob(const Blob *blob);
 
@@ -95,4 +95,93 @@ private:
     bool wrapped;
 };
 
+/**
+ * A RingQueue is a FIFO queue of elements of type T held in a circular
+ * array, so pushing and popping elements doesn't allocate (unlike
+ * std::queue's deque, which allocates a new block every few elements).
+ *
+ * The array doubles in size when full. Once the queue empties the array is
+ * shrunk back to its initial size if it has grown beyond maxIdleCapacity, so
+ * a burst doesn't hold on to its memory for good.
+ */
+template <typename T>
+class RingQueue {
+public:
+    static const size_t maxIdleCapacity = 1024;
+
+    /**
+     * Construct a RingQueue; initially holding the given number of elements
+     * (rounded up to a power of two) without growing.
+     */
+    explicit RingQueue(size_t initialCapacity = 16)
+        : initial(roundUp(initialCapacity)), head(0), count(0) {
+        storage.resize(initial);
+    }
+
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t capacity() const {
+        return storage.size();
+    }
+
+    T& front() {
+        return storage[head];
+    }
+
+    const T& front() const {
+        return storage[head];
+    }
+
+    void push(const T& ob) {
+        if (count == storage.size()) {
+            grow();
+        }
+        storage[(head + count) & (storage.size() - 1)] = ob;
+        ++count;
+    }
+
+    void pop() {
+        storage[head] = T();
+        head = (head + 1) & (storage.size() - 1);
+        if (--count == 0) {
+            head = 0;
+            if (storage.size() > maxIdleCapacity) {
+                std::vector<T>(initial).swap(storage);
+            }
+        }
+    }
+
+private:
+    static size_t roundUp(size_t n) {
+        size_t rv = 1;
+        while (rv < n) {
+            rv <<= 1;
+        }
+        return rv;
+    }
+
+    void grow() {
+        std::vector<T> larger(storage.size() * 2);
+        for (size_t ii = 0; ii < count; ++ii) {
+            larger[ii] = storage[(head + ii) & (storage.size() - 1)];
+        }
+        storage.swap(larger);
+        head = 0;
+    }
+
+    const size_t initial;
+    std::vector<T> storage;
+    size_t head;
+    size_t count;
+};
+
 #endif  // SRC_RINGBUFFER_H_
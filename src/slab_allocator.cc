@@ -0,0 +1,321 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "slab_allocator.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+struct SlabArena::Slab {
+    SlabArena           *arena;
+    SizeClass           *sizeClass;
+    //! Links in the size class's list of partially used slabs.
+    Slab                *prev;
+    Slab                *next;
+    //! Freed slots, linked through their first word.
+    void                *freeList;
+    //! Start of the slots which have never been allocated.
+    char                *unused;
+    size_t               slotSize;
+    size_t               numSlots;
+    //! Number of allocated slots; only modified with the size class locked.
+    std::atomic<size_t>  used;
+};
+
+namespace {
+
+// A slab is sparse (and its objects worth relocating) below 1/4 full.
+const size_t sparseSlabDivisor = 4;
+
+// Number of partially used slabs considered when choosing the fullest one to
+// allocate from next.
+const size_t maxPartialSlabsScanned = 16;
+
+/*
+ * Page map recording which slab-aligned addresses are slabs, so that
+ * deallocate() can tell slab memory from ::operator new memory without any
+ * help from the caller. Two level radix tree (like tcmalloc's), one bit per
+ * slab, covering a 48 bit address space; leaves are created on demand and
+ * never freed.
+ */
+const int slabShift = 16;
+const int leafShift = 16;
+const size_t leafBits = size_t(1) << leafShift;
+const size_t rootSize = size_t(1) << 16;
+
+static_assert(SlabArena::slabSize == size_t(1) << slabShift,
+              "slabShift must match SlabArena::slabSize");
+
+struct PageMapLeaf {
+    std::atomic<uint64_t> bits[leafBits / 64];
+};
+
+std::atomic<PageMapLeaf*> pageMap[rootSize];
+std::mutex pageMapMutex;
+
+bool setSlabAddress(uintptr_t addr, bool isSlab) {
+    const uintptr_t index = addr >> slabShift;
+    const uintptr_t root = index >> leafShift;
+    if (root >= rootSize) {
+        return false;
+    }
+
+    PageMapLeaf *leaf = pageMap[root].load();
+    if (leaf == nullptr) {
+        std::lock_guard<std::mutex> lh(pageMapMutex);
+        leaf = pageMap[root].load();
+        if (leaf == nullptr) {
+            leaf = new PageMapLeaf();
+            pageMap[root].store(leaf);
+        }
+    }
+
+    const uintptr_t bit = index & (leafBits - 1);
+    const uint64_t mask = uint64_t(1) << (bit % 64);
+    if (isSlab) {
+        leaf->bits[bit / 64].fetch_or(mask);
+    } else {
+        leaf->bits[bit / 64].fetch_and(~mask);
+    }
+    return true;
+}
+
+bool isSlabAddress(uintptr_t addr) {
+    const uintptr_t index = addr >> slabShift;
+    const uintptr_t root = index >> leafShift;
+    if (root >= rootSize) {
+        return false;
+    }
+    PageMapLeaf *leaf = pageMap[root].load();
+    if (leaf == nullptr) {
+        return false;
+    }
+    const uintptr_t bit = index & (leafBits - 1);
+    return leaf->bits[bit / 64].load() & (uint64_t(1) << (bit % 64));
+}
+
+void* allocateAligned(size_t size) {
+    void *mem = nullptr;
+#ifdef _MSC_VER
+    mem = _aligned_malloc(size, size);
+#else
+    if (posix_memalign(&mem, size, size) != 0) {
+        mem = nullptr;
+    }
+#endif
+    return mem;
+}
+
+void freeAligned(void *mem) {
+#ifdef _MSC_VER
+    _aligned_free(mem);
+#else
+    free(mem);
+#endif
+}
+
+} // anonymous namespace
+
+const size_t SlabArena::slabSize;
+const size_t SlabArena::sizeClassGranularity;
+const size_t SlabArena::maxObjectSize;
+const size_t SlabArena::numSizeClasses;
+
+SlabArena::SlabArena()
+    : numSlabs(0),
+      usedBytes(0) {
+}
+
+SlabArena::~SlabArena() {
+    for (auto& sc : sizeClasses) {
+        Slab *slab = sc.current.load();
+        if (slab != nullptr) {
+            destroySlab(slab);
+        }
+        while (sc.partial != nullptr) {
+            slab = sc.partial;
+            sc.partial = slab->next;
+            destroySlab(slab);
+        }
+    }
+}
+
+void* SlabArena::allocate(size_t size) {
+    if (size == 0 || size > maxObjectSize) {
+        return ::operator new(size);
+    }
+
+    const size_t index = (size - 1) / sizeClassGranularity;
+    const size_t slotSize = (index + 1) * sizeClassGranularity;
+    SizeClass &sc = sizeClasses[index];
+
+    std::lock_guard<std::mutex> lh(sc.mutex);
+    Slab *slab = sc.current.load();
+    if (slab == nullptr || slab->used == slab->numSlots) {
+        slab = nextSlab(sc, slotSize);
+        if (slab == nullptr) {
+            return ::operator new(size);
+        }
+    }
+
+    void *ptr;
+    if (slab->freeList != nullptr) {
+        ptr = slab->freeList;
+        slab->freeList = *static_cast<void**>(ptr);
+    } else {
+        ptr = slab->unused;
+        slab->unused += slotSize;
+    }
+    ++slab->used;
+    usedBytes.fetch_add(slotSize);
+    return ptr;
+}
+
+void SlabArena::deallocate(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    Slab *slab = getSlab(ptr);
+    if (slab == nullptr) {
+        ::operator delete(ptr);
+    } else {
+        slab->arena->free(slab, ptr);
+    }
+}
+
+SlabArena::Slab* SlabArena::getSlab(const void *ptr) {
+    const uintptr_t base = reinterpret_cast<uintptr_t>(ptr) &
+                           ~uintptr_t(slabSize - 1);
+    return isSlabAddress(base) ? reinterpret_cast<Slab*>(base) : nullptr;
+}
+
+size_t SlabArena::getSlotSize(const void *ptr) {
+    Slab *slab = getSlab(ptr);
+    return slab == nullptr ? 0 : slab->slotSize;
+}
+
+bool SlabArena::isInSparseSlab(const void *ptr) {
+    Slab *slab = getSlab(ptr);
+    if (slab == nullptr || slab == slab->sizeClass->current.load()) {
+        return false;
+    }
+    return slab->used.load() * sparseSlabDivisor < slab->numSlots;
+}
+
+SlabArena::Slab* SlabArena::createSlab(SizeClass &sc, size_t slotSize) {
+    void *mem = allocateAligned(slabSize);
+    if (mem == nullptr) {
+        return nullptr;
+    }
+    if (!setSlabAddress(reinterpret_cast<uintptr_t>(mem), true)) {
+        freeAligned(mem);
+        return nullptr;
+    }
+
+    // Slots start after the slab header, suitably aligned.
+    const size_t headerSize = (sizeof(Slab) + sizeClassGranularity - 1) &
+                              ~(sizeClassGranularity - 1);
+
+    Slab *slab = new (mem) Slab();
+    slab->arena = this;
+    slab->sizeClass = &sc;
+    slab->unused = static_cast<char*>(mem) + headerSize;
+    slab->slotSize = slotSize;
+    slab->numSlots = (slabSize - headerSize) / slotSize;
+    ++numSlabs;
+    return slab;
+}
+
+void SlabArena::destroySlab(Slab *slab) {
+    slab->~Slab();
+    setSlabAddress(reinterpret_cast<uintptr_t>(slab), false);
+    freeAligned(slab);
+    --numSlabs;
+}
+
+SlabArena::Slab* SlabArena::nextSlab(SizeClass &sc, size_t slotSize) {
+    // Carry on with the fullest partially used slab (if any), leaving the
+    // emptier ones to drain.
+    Slab *best = nullptr;
+    size_t scanned = 0;
+    for (Slab *s = sc.partial; s != nullptr && scanned < maxPartialSlabsScanned;
+         s = s->next, ++scanned) {
+        if (best == nullptr || s->used > best->used) {
+            best = s;
+        }
+    }
+
+    if (best != nullptr) {
+        if (best->prev != nullptr) {
+            best->prev->next = best->next;
+        } else {
+            sc.partial = best->next;
+        }
+        if (best->next != nullptr) {
+            best->next->prev = best->prev;
+        }
+        best->prev = best->next = nullptr;
+    } else {
+        best = createSlab(sc, slotSize);
+        if (best == nullptr) {
+            return nullptr;
+        }
+    }
+
+    // The old current slab is full, so isn't tracked until one of its
+    // objects is freed.
+    sc.current.store(best);
+    return best;
+}
+
+void SlabArena::free(Slab *slab, void *ptr) {
+    SizeClass &sc = *slab->sizeClass;
+    std::lock_guard<std::mutex> lh(sc.mutex);
+
+    *static_cast<void**>(ptr) = slab->freeList;
+    slab->freeList = ptr;
+    const bool wasFull = slab->used == slab->numSlots;
+    --slab->used;
+    usedBytes.fetch_sub(slab->slotSize);
+
+    if (slab == sc.current.load()) {
+        return;
+    }
+
+    if (wasFull) {
+        // Now has a free slot; make it available for allocation.
+        slab->prev = nullptr;
+        slab->next = sc.partial;
+        if (sc.partial != nullptr) {
+            sc.partial->prev = slab;
+        }
+        sc.partial = slab;
+    } else if (slab->used == 0) {
+        if (slab->prev != nullptr) {
+            slab->prev->next = slab->next;
+        } else {
+            sc.partial = slab->next;
+        }
+        if (slab->next != nullptr) {
+            slab->next->prev = slab->prev;
+        }
+        destroySlab(slab);
+    }
+}
@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_SLAB_ALLOCATOR_H_
+#define SRC_SLAB_ALLOCATOR_H_ 1
+
+#include "config.h"
+
+#include <atomic>
+#include <mutex>
+
+#include "utility.h"
+
+/**
+ * Arena of slabs for small, variable sized objects (StoredValues and small
+ * Blobs).
+ *
+ * Objects are grouped into size classes. Each size class carves fixed size
+ * slots out of slabs of slabSize bytes, and recycles freed slots through a
+ * per-slab free list; so most allocations and frees don't call into the
+ * underlying allocator at all, and objects of similar size are packed
+ * together rather than scattered across the heap.
+ *
+ * Fragmentation is dealt with a slab at a time rather than an object at a
+ * time: new objects are placed in the fullest slabs, and the defragmenter
+ * relocates the objects left in sparsely used slabs (see isInSparseSlab())
+ * so those slabs empty out and are returned to the underlying allocator.
+ *
+ * Requests larger than maxObjectSize are passed straight to ::operator new;
+ * deallocate() accepts memory from either source.
+ */
+class SlabArena {
+public:
+    //! Size (and alignment) of each slab.
+    static const size_t slabSize = 64 * 1024;
+    //! Difference in size between consecutive size classes.
+    static const size_t sizeClassGranularity = 16;
+    //! Largest object allocated from a slab.
+    static const size_t maxObjectSize = 512;
+    static const size_t numSizeClasses = maxObjectSize / sizeClassGranularity;
+
+    SlabArena();
+
+    /**
+     * Releases all slabs; every object allocated from the arena must have
+     * been deallocated by now.
+     */
+    ~SlabArena();
+
+    /**
+     * Allocate memory for an object of the given size.
+     *
+     * @throws std::bad_alloc if the memory could not be allocated
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Free memory returned by allocate() of any arena, or by ::operator new.
+     */
+    static void deallocate(void *ptr);
+
+    /**
+     * Get the size of the slot holding the given object, or 0 if it was not
+     * allocated from a slab.
+     */
+    static size_t getSlotSize(const void *ptr);
+
+    /**
+     * True if the given object lives in a sparsely used slab, and should be
+     * moved (re-allocated) so that the slab can be released.
+     */
+    static bool isInSparseSlab(const void *ptr);
+
+    //! Number of slabs currently allocated.
+    size_t getNumSlabs() const {
+        return numSlabs.load();
+    }
+
+    //! Memory held in slabs.
+    size_t getSlabBytes() const {
+        return numSlabs.load() * slabSize;
+    }
+
+    //! Memory held in slots which are currently allocated.
+    size_t getUsedBytes() const {
+        return usedBytes.load();
+    }
+
+private:
+    struct Slab;
+
+    struct SizeClass {
+        SizeClass() : current(nullptr), partial(nullptr) {}
+
+        std::mutex         mutex;
+        //! Slab new objects are allocated from.
+        std::atomic<Slab*> current;
+        //! Other slabs with at least one free slot.
+        Slab              *partial;
+    };
+
+    static Slab* getSlab(const void *ptr);
+    Slab* createSlab(SizeClass &sc, size_t slotSize);
+    void destroySlab(Slab *slab);
+    Slab* nextSlab(SizeClass &sc, size_t slotSize);
+    void free(Slab *slab, void *ptr);
+
+    SizeClass           sizeClasses[numSizeClasses];
+    std::atomic<size_t> numSlabs;
+    std::atomic<size_t> usedBytes;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabArena);
+};
+
+#endif  // SRC_SLAB_ALLOCATOR_H_
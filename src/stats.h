@@ -78,6 +78,8 @@ public:
         cursorDroppingLThreshold(0),
         cursorDroppingUThreshold(0),
         cursorsDropped(0),
+        itemsExpelledFromCheckpoints(0),
+        checkpointBytesExpelled(0),
         pagerRuns(0),
         expiryPagerRuns(0),
         itemsRemovedFromCheckpoints(0),
@@ -277,6 +279,10 @@ public:
 
     //! Number of cursors dropped by checkpoint remover
     std::atomic<size_t> cursorsDropped;
+    //! Number of items whose values were expelled from checkpoints
+    std::atomic<size_t> itemsExpelledFromCheckpoints;
+    //! Memory released by expelling item values from checkpoints
+    std::atomic<size_t> checkpointBytesExpelled;
 
     //! Number of times we needed to kick in the pager
     std::atomic<size_t> pagerRuns;
@@ -505,6 +511,9 @@ public:
     //! Histogram of get commands.
     Histogram<hrtime_t> getCmdHisto;
 
+    //! Histogram of multi-key get commands.
+    Histogram<hrtime_t> getMultiCmdHisto;
+
     //! Histogram of store commands.
     Histogram<hrtime_t> storeCmdHisto;
 
@@ -560,6 +569,13 @@ public:
     //! Historgram of batch reads
     Histogram<hrtime_t> getMultiHisto;
 
+    //! Histogram of the time a vbucket waits for a bg fetcher to take its
+    //! fetches
+    Histogram<hrtime_t> bgFetchQueueWaitHisto;
+
+    //! Histogram of the time each batch of bg fetches spends reading disk
+    Histogram<hrtime_t> bgFetchDiskHisto;
+
     // ! Histogram of various task wait times
     Histogram<hrtime_t> *schedulingHisto;
 
@@ -628,6 +644,7 @@ public:
         setVbucketCmdHisto.reset();
         delVbucketCmdHisto.reset();
         getCmdHisto.reset();
+        getMultiCmdHisto.reset();
         storeCmdHisto.reset();
         arithCmdHisto.reset();
         tapVbucketResetHisto.reset();
@@ -647,6 +664,8 @@ public:
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
         getMultiHisto.reset();
+        bgFetchQueueWaitHisto.reset();
+        bgFetchDiskHisto.reset();
         persistenceCursorGetItemsHisto.reset();
         dcpCursorsGetItemsHisto.reset();
     }
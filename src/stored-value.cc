@@ -170,7 +170,12 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm,
 }
 
 Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
-    Item* itm = new Item(getKey(), getFlags(), getExptime(), value,
+    return toItem(lck, vbucket, value);
+}
+
+Item* StoredValue::toItem(bool lck, uint16_t vbucket,
+                          const value_t &val) const {
+    Item* itm = new Item(getKey(), getFlags(), getExptime(), val,
                          lck ? static_cast<uint64_t>(-1) : getCas(),
                          bySeqno, vbucket, getRevSeqno());
 
@@ -34,7 +34,7 @@ class StoredValue {
 public:
 
     void operator delete(void* p) {
-        ::operator delete(p);
+        ObjectRegistry::deallocate(p);
      }
 
     uint8_t getNRUValue();
@@ -468,6 +468,17 @@ public:
      */
     Item *toItem(bool lck, uint16_t vbucket) const;
 
+    /**
+     * As toItem(), but with the given value rather than a new reference to
+     * this object's own; for readers not holding this object's lock (see
+     * HashTable::optimisticGet()).
+     *
+     * @param lck if true, the new item will return a locked CAS ID.
+     * @param vbucket the vbucket containing this item.
+     * @param val the value for the new item.
+     */
+    Item *toItem(bool lck, uint16_t vbucket, const value_t &val) const;
+
     /**
      * Generate a new Item with only key and metadata out of this object.
      * The item generated will not contain value
@@ -647,7 +658,7 @@ private:
 
         size_t len = key.length() + base;
 
-        StoredValue *t = new (::operator new(len))
+        StoredValue *t = new (ObjectRegistry::allocate(len))
                          StoredValue(itm, n, *stats, ht, setDirty);
         std::memcpy(t->keybytes, key.data(), key.length());
         return t;
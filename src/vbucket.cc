@@ -505,21 +505,24 @@ bool VBucket::isResidentRatioUnderThreshold(float threshold,
     }
 }
 
-void VBucket::createFilter(size_t key_count, double probability) {
+void VBucket::createFilter(size_t key_count, double probability,
+                           bfilter_type_t type) {
     // Create the actual bloom filter upon vbucket creation during
     // scenarios:
     //      - Bucket creation
     //      - Rebalance
     LockHolder lh(bfMutex);
     if (bFilter == nullptr && tempFilter == nullptr) {
-        bFilter = new BloomFilter(key_count, probability, BFILTER_ENABLED);
+        bFilter = new BloomFilter(key_count, probability, BFILTER_ENABLED,
+                                  type);
     } else {
         LOG(EXTENSION_LOG_WARNING, "(vb %" PRIu16 ") Bloom filter / Temp filter"
             " already exist!", id);
     }
 }
 
-void VBucket::initTempFilter(size_t key_count, double probability) {
+void VBucket::initTempFilter(size_t key_count, double probability,
+                             bfilter_type_t type) {
     // Create a temp bloom filter with status as COMPACTING,
     // if the main filter is found to exist, set its state to
     // COMPACTING as well.
@@ -527,7 +530,8 @@ void VBucket::initTempFilter(size_t key_count, double probability) {
     if (tempFilter) {
         delete tempFilter;
     }
-    tempFilter = new BloomFilter(key_count, probability, BFILTER_COMPACTING);
+    tempFilter = new BloomFilter(key_count, probability, BFILTER_COMPACTING,
+                                 type);
     if (bFilter) {
         bFilter->setStatus(BFILTER_COMPACTING);
     }
@@ -559,6 +563,27 @@ bool VBucket::maybeKeyExistsInFilter(const std::string &key) {
     }
 }
 
+void VBucket::addFilterFalsePositive() {
+    LockHolder lh(bfMutex);
+    if (bFilter) {
+        bFilter->addFalsePositive();
+    }
+}
+
+void VBucket::removeFromFilter(const std::string &key) {
+    LockHolder lh(bfMutex);
+    if (bFilter && bFilter->supportsRemoval()) {
+        bFilter->removeKey(key.c_str(), key.length());
+    }
+}
+
+bool VBucket::isFilterRebuildNeeded() {
+    LockHolder lh(bfMutex);
+    return !(bFilter && bFilter->supportsRemoval() &&
+             bFilter->getStatus() == BFILTER_ENABLED &&
+             !bFilter->isOverCapacity());
+}
+
 bool VBucket::isTempFilterAvailable() {
     LockHolder lh(bfMutex);
     if (tempFilter &&
@@ -657,6 +682,15 @@ size_t VBucket::getNumOfKeysInFilter() {
     }
 }
 
+double VBucket::getFilterFalsePositiveRate() {
+    LockHolder lh(bfMutex);
+    if (bFilter) {
+        return bFilter->getFalsePositiveRate();
+    } else {
+        return 0;
+    }
+}
+
 uint64_t VBucket::nextHLCCas() {
     int64_t adjusted_time = gethrtime();
     uint64_t final_adjusted_time = 0;
@@ -718,6 +752,8 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c,
                 add_stat, c);
         addStat("bloom_filter_size", getFilterSize(), add_stat, c);
         addStat("bloom_filter_key_count", getNumOfKeysInFilter(), add_stat, c);
+        addStat("bloom_filter_fp_rate", getFilterFalsePositiveRate(),
+                add_stat, c);
         addStat("max_cas", getMaxCas(), add_stat, c);
         addStat("drift_counter", getDriftCounter(), add_stat, c);
         addStat("time_sync", isTimeSyncEnabled() ? "enabled" : "disabled",
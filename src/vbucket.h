@@ -426,10 +426,21 @@ public:
     /**
      * BloomFilter operations for vbucket
      */
-    void createFilter(size_t key_count, double probability);
-    void initTempFilter(size_t key_count, double probability);
+    void createFilter(size_t key_count, double probability,
+                      bfilter_type_t type = BFILTER_STANDARD);
+    void initTempFilter(size_t key_count, double probability,
+                        bfilter_type_t type = BFILTER_STANDARD);
     void addToFilter(const std::string &key);
     bool maybeKeyExistsInFilter(const std::string &key);
+    // A key the filter may have contained turned out not to exist.
+    void addFilterFalsePositive();
+    // A key (known to be in the filter) no longer exists on disk.
+    void removeFromFilter(const std::string &key);
+    /**
+     * True if compaction needs to rebuild the filter (into the temp filter),
+     * rather than the filter being kept up to date by removeFromFilter().
+     */
+    bool isFilterRebuildNeeded();
     bool isTempFilterAvailable();
     void addToTempFilter(const std::string &key);
     void swapFilter();
@@ -438,6 +449,7 @@ public:
     std::string getFilterStatusString();
     size_t getFilterSize();
     size_t getNumOfKeysInFilter();
+    double getFilterFalsePositiveRate();
 
     uint64_t nextHLCCas();
 
@@ -207,109 +207,167 @@ std::ostream& operator <<(std::ostream &out, const WarmupState &state)
     return out;
 }
 
+const size_t LoadStorageKVPairCallback::batchSize;
+
+LoadStorageKVPairCallback::~LoadStorageKVPairCallback() {
+    for (Item *i : batch) {
+        delete i;
+    }
+}
+
 void LoadStorageKVPairCallback::callback(GetValue &val) {
     Item *i = val.getValue();
     bool stopLoading = false;
     if (i != NULL && !epstore.getWarmup()->isComplete()) {
-        RCPtr<VBucket> vb = vbuckets.getBucket(i->getVBucketId());
-        if (!vb) {
-            return;
+        // A batch only holds items of one vbucket and kind.
+        if (!batch.empty() &&
+            (batch.front()->getVBucketId() != i->getVBucketId() ||
+             batchPartial != val.isPartial())) {
+            stopLoading = loadBatch();
         }
-        bool succeeded(false);
-        int retry = 2;
+        batch.push_back(i);
+        batchPartial = val.isPartial();
+        val.setValue(NULL);
+
+        if (!stopLoading && batch.size() >= batchSize) {
+            stopLoading = loadBatch();
+        }
+    } else {
+        loadBatch();
+        stopLoading = true;
+        delete i;
+    }
+
+    if (stopLoading) {
+        finishLoading();
+        setStatus(ENGINE_ENOMEM);
+    } else {
+        setStatus(ENGINE_SUCCESS);
+    }
+}
+
+bool LoadStorageKVPairCallback::flush() {
+    if (loadBatch()) {
+        finishLoading();
+        return true;
+    }
+    return false;
+}
+
+bool LoadStorageKVPairCallback::loadBatch() {
+    if (batch.empty()) {
+        return false;
+    }
+
+    bool stopLoading = false;
+    RCPtr<VBucket> vb = vbuckets.getBucket(batch.front()->getVBucketId());
+    if (vb) {
         item_eviction_policy_t policy = epstore.getItemEvictionPolicy();
-        do {
+        for (Item *i : batch) {
             if (i->getCas() == static_cast<uint64_t>(-1)) {
-                if (val.isPartial()) {
+                if (batchPartial) {
                     i->setCas(0);
                 } else {
                     i->setCas(vb->nextHLCCas());
                 }
             }
+        }
 
-            switch (vb->ht.insert(*i, policy, shouldEject(), val.isPartial())) {
-            case NOMEM:
-                if (retry == 2) {
-                    if (hasPurged) {
-                        if (++stats.warmOOM == 1) {
+        std::vector<mutation_type_t> results;
+        vb->ht.insertBatch(batch, policy, shouldEject(), batchPartial,
+                           results);
+
+        for (size_t n = 0; n < batch.size(); ++n) {
+            Item *i = batch[n];
+            mutation_type_t rv = results[n];
+            int retry = 2;
+            while (true) {
+                bool succeeded(false);
+                switch (rv) {
+                case NOMEM:
+                    if (retry == 2) {
+                        if (hasPurged) {
+                            if (++stats.warmOOM == 1) {
+                                LOG(EXTENSION_LOG_WARNING,
+                                    "Warmup dataload failure: max_size too low.");
+                            }
+                        } else {
                             LOG(EXTENSION_LOG_WARNING,
-                                "Warmup dataload failure: max_size too low.");
+                                "Emergency startup purge to free space for load.");
+                            purge();
                         }
                     } else {
                         LOG(EXTENSION_LOG_WARNING,
-                            "Emergency startup purge to free space for load.");
-                        purge();
+                            "Cannot store an item after emergency purge.");
+                        ++stats.warmOOM;
                     }
-                } else {
-                    LOG(EXTENSION_LOG_WARNING,
-                        "Cannot store an item after emergency purge.");
-                    ++stats.warmOOM;
+                    break;
+                case INVALID_CAS:
+                    LOG(EXTENSION_LOG_DEBUG,
+                        "Value changed in memory before restore from disk. "
+                        "Ignored disk value for: %s.", i->getKey().c_str());
+                    ++stats.warmDups;
+                    succeeded = true;
+                    break;
+                case NOT_FOUND:
+                    succeeded = true;
+                    break;
+                default:
+                    abort();
                 }
-                break;
-            case INVALID_CAS:
-                LOG(EXTENSION_LOG_DEBUG,
-                    "Value changed in memory before restore from disk. "
-                    "Ignored disk value for: %s.", i->getKey().c_str());
-                ++stats.warmDups;
-                succeeded = true;
-                break;
-            case NOT_FOUND:
-                succeeded = true;
-                break;
-            default:
-                abort();
+                if (succeeded || retry-- <= 0) {
+                    break;
+                }
+                rv = vb->ht.insert(*i, policy, shouldEject(), batchPartial);
             }
-        } while (!succeeded && retry-- > 0);
-
-        delete i;
-        val.setValue(NULL);
 
-        if (maybeEnableTraffic) {
-            stopLoading = epstore.maybeEnableTraffic();
-        }
+            if (maybeEnableTraffic) {
+                stopLoading = epstore.maybeEnableTraffic() || stopLoading;
+            }
 
-        switch (warmupState) {
-            case WarmupState::KeyDump:
-                if (stats.warmOOM) {
-                    epstore.getWarmup()->setOOMFailure();
-                    stopLoading = true;
-                } else {
-                    ++stats.warmedUpKeys;
-                }
-                break;
-            case WarmupState::LoadingData:
-            case WarmupState::LoadingAccessLog:
-                if (epstore.getItemEvictionPolicy() == FULL_EVICTION) {
+            switch (warmupState) {
+                case WarmupState::KeyDump:
+                    if (stats.warmOOM) {
+                        epstore.getWarmup()->setOOMFailure();
+                        stopLoading = true;
+                    } else {
+                        ++stats.warmedUpKeys;
+                    }
+                    break;
+                case WarmupState::LoadingData:
+                case WarmupState::LoadingAccessLog:
+                    if (epstore.getItemEvictionPolicy() == FULL_EVICTION) {
+                        ++stats.warmedUpKeys;
+                    }
+                    ++stats.warmedUpValues;
+                    break;
+                default:
                     ++stats.warmedUpKeys;
-                }
-                ++stats.warmedUpValues;
-                break;
-            default:
-                ++stats.warmedUpKeys;
-                ++stats.warmedUpValues;
+                    ++stats.warmedUpValues;
+            }
         }
-    } else {
-        stopLoading = true;
+    }
+
+    for (Item *i : batch) {
         delete i;
     }
+    batch.clear();
+    return stopLoading;
+}
 
-    if (stopLoading) {
-        // warmup has completed, return ENGINE_ENOMEM to
-        // cancel remaining data dumps from couchstore
-        if (epstore.getWarmup()->setComplete()) {
-            epstore.getWarmup()->setWarmupTime();
-            epstore.warmupCompleted();
-            LOG(EXTENSION_LOG_NOTICE, "Warmup completed in %s",
-                    hrtime2text(epstore.getWarmup()->getTime()).c_str());
+void LoadStorageKVPairCallback::finishLoading() {
+    // warmup has completed, return ENGINE_ENOMEM to
+    // cancel remaining data dumps from couchstore
+    if (epstore.getWarmup()->setComplete()) {
+        epstore.getWarmup()->setWarmupTime();
+        epstore.warmupCompleted();
+        LOG(EXTENSION_LOG_NOTICE, "Warmup completed in %s",
+                hrtime2text(epstore.getWarmup()->getTime()).c_str());
 
-        }
-        LOG(EXTENSION_LOG_NOTICE,
-            "Engine warmup is complete, request to stop "
-            "loading remaining database");
-        setStatus(ENGINE_ENOMEM);
-    } else {
-        setStatus(ENGINE_SUCCESS);
     }
+    LOG(EXTENSION_LOG_NOTICE,
+        "Engine warmup is complete, request to stop "
+        "loading remaining database");
 }
 
 void LoadStorageKVPairCallback::purge() {
@@ -596,6 +654,7 @@ void Warmup::keyDumpforShard(uint16_t shardId)
         if (ctx) {
             kvstore->scan(ctx);
             kvstore->destroyScanContext(ctx);
+            load_cb->flush();
         }
     }
 
@@ -709,6 +768,8 @@ void Warmup::loadingAccessLog(uint16_t shardId)
         }
     }
 
+    load_cb->flush();
+
     size_t numItems = store.getEPEngine().getEpStats().warmedUpValues;
     if (success && numItems) {
         LOG(EXTENSION_LOG_NOTICE,
@@ -807,6 +868,9 @@ void Warmup::loadKVPairsforShard(uint16_t shardId)
         if (ctx) {
             errorCode = kvstore->scan(ctx);
             kvstore->destroyScanContext(ctx);
+            if (load_cb->flush()) {
+                errorCode = scan_again;
+            }
             if (errorCode == scan_again) { // ENGINE_ENOMEM
                 // skip loading remaining VBuckets as memory limit was reached
                 break;
@@ -849,6 +913,9 @@ void Warmup::loadDataforShard(uint16_t shardId)
         if (ctx) {
             errorCode = kvstore->scan(ctx);
             kvstore->destroyScanContext(ctx);
+            if (load_cb->flush()) {
+                errorCode = scan_again;
+            }
             if (errorCode == scan_again) { // ENGINE_ENOMEM
                 // skip loading remaining VBuckets as memory limit was reached
                 break;
@@ -70,6 +70,10 @@ private:
 /**
  * Helper class used to insert items into the storage by using
  * the KVStore::dump method to load items from the database
+ *
+ * Items are buffered and inserted into the hash table a batch at a time
+ * (see HashTable::insertBatch), so flush() must be called once the scan
+ * feeding the callback has finished.
  */
 class LoadStorageKVPairCallback : public Callback<GetValue> {
 public:
@@ -81,16 +85,41 @@ public:
           startTime(ep_real_time()),
           hasPurged(false),
           maybeEnableTraffic(_maybeEnableTraffic),
-          warmupState(_warmupState) {}
+          warmupState(_warmupState),
+          batchPartial(false) {}
+
+    ~LoadStorageKVPairCallback();
 
     void callback(GetValue &val);
 
+    /**
+     * Insert any items still buffered.
+     *
+     * @return true if warmup has completed and loading should stop
+     */
+    bool flush();
+
 private:
 
+    //! Number of items inserted into the hash table at a time.
+    static const size_t batchSize = 64;
+
     bool shouldEject() {
         return stats.getTotalMemoryUsed() >= stats.mem_low_wat;
     }
 
+    /**
+     * Insert the buffered items.
+     *
+     * @return true if loading should stop
+     */
+    bool loadBatch();
+
+    /**
+     * Mark warmup as complete, as loading is being stopped.
+     */
+    void finishLoading();
+
     void purge();
 
     VBucketMap &vbuckets;
@@ -100,6 +129,10 @@ private:
     bool        hasPurged;
     bool        maybeEnableTraffic;
     int         warmupState;
+    //! Items (all of one vbucket) waiting to be inserted.
+    std::vector<Item*> batch;
+    //! True if the items in batch are keys and metadata only.
+    bool        batchPartial;
 };
 
 class LoadValueCallback : public Callback<CacheLookup> {
@@ -391,6 +391,99 @@ static enum test_result perf_latency_baseline(ENGINE_HANDLE *h,
     return perf_latency(h, h1, "1_bucket_1_thread_baseline", ITERATIONS);
 }
 
+/* Engine-private opcode fetching several keys at once (see ep_engine.h).
+ */
+static const uint8_t PROTOCOL_BINARY_CMD_EP_GET_MULTI = 0xe0;
+
+/* Benchmark the latency of fetching batches of 10, 100 and 1000 keys with a
+ * single multi-get (EventuallyPersistentStore::getMulti, which takes each
+ * hash table lock once per batch), against back-to-back gets of the same
+ * keys.
+ */
+static enum test_result perf_multi_get_latency(ENGINE_HANDLE *h,
+                                               ENGINE_HANDLE_V1 *h1) {
+    // Only timing front-end performance, not considering persistence.
+    stop_persistence(h, h1);
+
+    const void *cookie = testHarness.create_cookie();
+    const std::string data(100, 'x');
+    const size_t num_docs = 10000;
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < num_docs; i++) {
+        keys.push_back("multi_get_" + std::to_string(i));
+        item* item = NULL;
+        checkeq(ENGINE_SUCCESS,
+                storeCasVb11(h, h1, cookie, OPERATION_SET, keys.back().c_str(),
+                             data.c_str(), data.length(), 0, &item, 0,
+                             /*vBucket*/0, 0, 0),
+                "Failed to store a value");
+        h1->release(h, cookie, item);
+    }
+
+    // Access the keys in a random order, so each batch spans many hash
+    // table buckets.
+    std::mt19937 gen(0);
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    const std::vector<size_t> batch_sizes = {10, 100, 1000};
+    std::vector<std::vector<hrtime_t> > get_timings(batch_sizes.size());
+    std::vector<std::vector<hrtime_t> > multi_timings(batch_sizes.size());
+    for (size_t b = 0; b < batch_sizes.size(); ++b) {
+        const size_t batch_size = batch_sizes[b];
+        for (size_t first = 0; first + batch_size <= num_docs;
+             first += batch_size) {
+            // Multi-get body: (vbucket, key length, key) per key.
+            std::string body;
+            for (size_t i = first; i < first + batch_size; ++i) {
+                const uint16_t vbucket = htons(0);
+                const uint16_t keylen = htons(keys[i].size());
+                body.append(reinterpret_cast<const char*>(&vbucket),
+                            sizeof(vbucket));
+                body.append(reinterpret_cast<const char*>(&keylen),
+                            sizeof(keylen));
+                body.append(keys[i]);
+            }
+            protocol_binary_request_header* pkt =
+                    createPacket(PROTOCOL_BINARY_CMD_EP_GET_MULTI, 0, 0, NULL,
+                                 0, NULL, 0, body.data(), body.size());
+
+            hrtime_t start = gethrtime();
+            checkeq(ENGINE_SUCCESS,
+                    h1->unknown_command(h, cookie, pkt, add_response),
+                    "Failed to multi-get the values");
+            multi_timings[b].push_back(gethrtime() - start);
+            checkeq(PROTOCOL_BINARY_RESPONSE_SUCCESS, last_status.load(),
+                    "Expected the last key of the multi-get to be found");
+            free(pkt);
+
+            start = gethrtime();
+            for (size_t i = first; i < first + batch_size; ++i) {
+                item* item = NULL;
+                checkeq(ENGINE_SUCCESS,
+                        h1->get(h, cookie, &item, keys[i].c_str(),
+                                keys[i].size(), 0),
+                        "Failed to get a value");
+                h1->release(h, cookie, item);
+            }
+            get_timings[b].push_back(gethrtime() - start);
+        }
+    }
+
+    testHarness.destroy_cookie(cookie);
+
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    for (size_t b = 0; b < batch_sizes.size(); ++b) {
+        all_timings.push_back(std::make_pair(
+                std::to_string(batch_sizes[b]) + " keys", &multi_timings[b]));
+        all_timings.push_back(std::make_pair(
+                std::to_string(batch_sizes[b]) + " gets", &get_timings[b]));
+    }
+    output_result("Multi-get latency",
+                  "Latency [Multi-get] - per batch (µs)", all_timings, "µs");
+    return SUCCESS;
+}
+
 /* Benchmark the baseline latency with the defragmenter enabled.
  */
 static enum test_result perf_latency_defragmenter(ENGINE_HANDLE *h,
@@ -576,9 +669,11 @@ enum class Doc_format {
 struct Handle_args {
     Handle_args(ENGINE_HANDLE *_h, ENGINE_HANDLE_V1 *_h1, int _count,
                 Doc_format _type, std::string _name, uint32_t _opaque,
-                uint16_t _vb, bool _getCompressed) :
+                uint16_t _vb, bool _getCompressed,
+                size_t _stepBatchItems = 0) :
         h(_h), h1(_h1), itemCount(_count), typeOfData(_type), name(_name),
-        opaque(_opaque), vb(_vb), retrieveCompressed(_getCompressed)
+        opaque(_opaque), vb(_vb), retrieveCompressed(_getCompressed),
+        stepBatchItems(_stepBatchItems)
     {
         timings.reserve(_count);
         bytes_received.reserve(_count);
@@ -588,6 +683,7 @@ struct Handle_args {
         h(ha.h), h1(ha.h1), itemCount(ha.itemCount),
         typeOfData(ha.typeOfData), name(ha.name), opaque(ha.opaque),
         vb(ha.vb), retrieveCompressed(ha.retrieveCompressed),
+        stepBatchItems(ha.stepBatchItems),
         timings(ha.timings), bytes_received(ha.bytes_received)
     { }
 
@@ -599,6 +695,8 @@ struct Handle_args {
     uint32_t opaque;
     uint16_t vb;
     bool retrieveCompressed;
+    // Messages the DCP producer sends per step (0: as configured)
+    size_t stepBatchItems;
     std::vector<hrtime_t> timings;
     std::vector<size_t> bytes_received;
 };
@@ -784,6 +882,42 @@ static void perf_dcp_client(struct Handle_args *ha) {
     uint32_t bytes_read = 0;
     bool pending_marker_ack = false;
     uint64_t marker_end = 0;
+    bool send_marker_ack = false;
+    uint32_t marker_ack_opaque = 0;
+
+    // A step may send several messages, so each is handled as it arrives.
+    dcp_message_hook = [&]() {
+        switch (dcp_last_op) {
+            case PROTOCOL_BINARY_CMD_DCP_MUTATION:
+            case PROTOCOL_BINARY_CMD_DCP_DELETION:
+                // Check for sentinal (before adding to timings).
+                if (dcp_last_key == SENTINAL_KEY) {
+                    done = true;
+                    break;
+                }
+                ha->timings.push_back(gethrtime());
+                ha->bytes_received.push_back(dcp_last_value.length());
+                bytes_read += dcp_last_packet_size;
+                if (pending_marker_ack && dcp_last_byseqno == marker_end) {
+                    send_marker_ack = true;
+                    marker_ack_opaque = dcp_last_opaque;
+                }
+
+                break;
+
+            case PROTOCOL_BINARY_CMD_DCP_SNAPSHOT_MARKER:
+                if (dcp_last_flags & 8) {
+                    pending_marker_ack = true;
+                    marker_end = dcp_last_snap_end_seqno;
+                }
+                bytes_read += dcp_last_packet_size;
+                break;
+            default:
+                fprintf(stderr, "Unexpected DCP event type received: %d\n",
+                        dcp_last_op);
+                abort();
+        }
+    };
 
     do {
         if (bytes_read > 512) {
@@ -804,45 +938,14 @@ static void perf_dcp_client(struct Handle_args *ha) {
             break;
 
         case ENGINE_WANT_MORE:
-            switch (dcp_last_op) {
-                case PROTOCOL_BINARY_CMD_DCP_MUTATION:
-                case PROTOCOL_BINARY_CMD_DCP_DELETION:
-                    // Check for sentinal (before adding to timings).
-                    if (dcp_last_key == SENTINAL_KEY) {
-                        done = true;
-                        break;
-                    }
-                    ha->timings.push_back(gethrtime());
-                    ha->bytes_received.push_back(dcp_last_value.length());
-                    bytes_read += dcp_last_packet_size;
-                    if (pending_marker_ack && dcp_last_byseqno == marker_end) {
-                        sendDcpAck(ha->h, ha->h1, cookie,
-                                   PROTOCOL_BINARY_CMD_DCP_SNAPSHOT_MARKER,
-                                   PROTOCOL_BINARY_RESPONSE_SUCCESS,
-                                   dcp_last_opaque);
-                    }
-
-                    break;
-
-                case PROTOCOL_BINARY_CMD_DCP_SNAPSHOT_MARKER:
-                    if (dcp_last_flags & 8) {
-                        pending_marker_ack = true;
-                        marker_end = dcp_last_snap_end_seqno;
-                    }
-                    bytes_read += dcp_last_packet_size;
-                    break;
-                case 0:
-                    /* Consider case where no messages were ready on the last
-                     * step call so we will just ignore this case. Note that we
-                     * check for 0 because we clear the dcp_last_op value below.
-                     */
-                    break;
-                default:
-                    fprintf(stderr, "Unexpected DCP event type received: %d\n",
-                            dcp_last_op);
-                    abort();
+            // The messages sent were handled by dcp_message_hook.
+            if (send_marker_ack) {
+                sendDcpAck(ha->h, ha->h1, cookie,
+                           PROTOCOL_BINARY_CMD_DCP_SNAPSHOT_MARKER,
+                           PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                           marker_ack_opaque);
+                send_marker_ack = false;
             }
-            dcp_last_op = 0;
             break;
 
         default:
@@ -851,6 +954,7 @@ static void perf_dcp_client(struct Handle_args *ha) {
         }
     } while (!done);
 
+    dcp_message_hook = nullptr;
     testHarness.destroy_cookie(cookie);
 }
 
@@ -954,29 +1058,18 @@ struct Ret_vals {
     std::vector<size_t> received;
 };
 
-static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
-                                                       ENGINE_HANDLE_V1 *h1,
-                                                       std::string title,
-                                                       Doc_format typeOfData,
-                                                       size_t item_count) {
+/* Runs a loader and a DCP client for each of the iterations in turn, and
+ * prints the bytes received and latencies of each.
+ */
+static enum test_result perf_dcp_iterations(ENGINE_HANDLE *h,
+                                            ENGINE_HANDLE_V1 *h1,
+                                            std::string title,
+                                            size_t item_count,
+                                            std::vector<struct Ret_vals>& iterations) {
 
     std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
     std::vector<std::pair<std::string, std::vector<size_t>*> > all_sizes;
 
-    std::vector<struct Ret_vals> iterations;
-
-    // For Loader & DCP client to get documents as is from vbucket 0
-    struct Handle_args ha1(h, h1, item_count, typeOfData, "As_is",
-                           0xFFFFFF00, 0, false);
-    struct Ret_vals rv1(ha1, item_count);
-    iterations.push_back(rv1);
-
-    // For Loader & DCP client to get documents compressed from vbucket 1
-    struct Handle_args ha2(h, h1, item_count, typeOfData, "Compress",
-                           0xFF000000, 1, true);
-    struct Ret_vals rv2(ha2, item_count);
-    iterations.push_back(rv2);
-
     for (size_t i = 0; i < iterations.size(); ++i) {
         std::vector<hrtime_t> timings;
         cb_thread_t loader_thread, dcp_thread;
@@ -987,6 +1080,12 @@ static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
                 "Failed set_vbucket_state for vbucket");
         wait_for_flusher_to_settle(h, h1);
 
+        if (dcp_ha.stepBatchItems > 0) {
+            set_param(h, h1, protocol_binary_engine_param_dcp,
+                      "dcp_producer_step_batch_items",
+                      std::to_string(dcp_ha.stepBatchItems).c_str());
+        }
+
         cb_assert(cb_create_thread(&loader_thread, load_thread, &load_ha, 0) == 0);
         cb_assert(cb_create_thread(&dcp_thread, dcp_client_thread, &dcp_ha, 0) == 0);
         cb_assert(cb_join_thread(loader_thread) == 0);
@@ -1031,6 +1130,54 @@ static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
+                                                       ENGINE_HANDLE_V1 *h1,
+                                                       std::string title,
+                                                       Doc_format typeOfData,
+                                                       size_t item_count) {
+    std::vector<struct Ret_vals> iterations;
+
+    // For Loader & DCP client to get documents as is from vbucket 0
+    struct Handle_args ha1(h, h1, item_count, typeOfData, "As_is",
+                           0xFFFFFF00, 0, false);
+    struct Ret_vals rv1(ha1, item_count);
+    iterations.push_back(rv1);
+
+    // For Loader & DCP client to get documents compressed from vbucket 1
+    struct Handle_args ha2(h, h1, item_count, typeOfData, "Compress",
+                           0xFF000000, 1, true);
+    struct Ret_vals rv2(ha2, item_count);
+    iterations.push_back(rv2);
+
+    return perf_dcp_iterations(h, h1, title, item_count, iterations);
+}
+
+/* As perf_dcp_latency_and_bandwidth, comparing a producer sending one
+ * message per step against one sending a batch of them.
+ */
+static enum test_result perf_dcp_batched_step_latency_and_bandwidth(
+                                                       ENGINE_HANDLE *h,
+                                                       ENGINE_HANDLE_V1 *h1,
+                                                       std::string title,
+                                                       Doc_format typeOfData,
+                                                       size_t item_count) {
+    std::vector<struct Ret_vals> iterations;
+
+    // For Loader & DCP client to get documents one per step from vbucket 0
+    struct Handle_args ha1(h, h1, item_count, typeOfData, "Step_1",
+                           0xFFFFFF00, 0, false, 1);
+    struct Ret_vals rv1(ha1, item_count);
+    iterations.push_back(rv1);
+
+    // For Loader & DCP client to get documents in batches from vbucket 1
+    struct Handle_args ha2(h, h1, item_count, typeOfData, "Step_64",
+                           0xFF000000, 1, false, 64);
+    struct Ret_vals rv2(ha2, item_count);
+    iterations.push_back(rv2);
+
+    return perf_dcp_iterations(h, h1, title, item_count, iterations);
+}
+
 static enum test_result perf_dcp_latency_with_padded_json(ENGINE_HANDLE *h,
                                                           ENGINE_HANDLE_V1 *h1) {
     return perf_dcp_latency_and_bandwidth(h, h1,
@@ -1052,6 +1199,13 @@ static enum test_result perf_dcp_latency_with_random_binary(ENGINE_HANDLE *h,
                             Doc_format::BINARY_RANDOM, ITERATIONS / 20);
 }
 
+static enum test_result perf_dcp_latency_with_batched_step(ENGINE_HANDLE *h,
+                                                           ENGINE_HANDLE_V1 *h1) {
+    return perf_dcp_batched_step_latency_and_bandwidth(h, h1,
+                            "DCP In-memory (JSON-PADDED) [Step_1 vs. Step_64]",
+                            Doc_format::JSON_PADDED, ITERATIONS / 10);
+}
+
 static enum test_result perf_multi_thread_latency(engine_test_t* test) {
     return perf_latency_baseline_multi_thread_bucket(test,
                                                      1, /* bucket */
@@ -1115,6 +1269,10 @@ BaseTestCase testsuite_testcases[] = {
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209",
                  prepare, cleanup),
+        TestCase("Multi-get latency", perf_multi_get_latency,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
         TestCase("Defragmenter latency", perf_latency_defragmenter,
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209"
@@ -1147,10 +1305,20 @@ BaseTestCase testsuite_testcases[] = {
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209",
                  prepare, cleanup),
+        TestCase("DCP latency (Batched step)",
+                 perf_dcp_latency_with_batched_step,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
         TestCaseV2("Multi thread latency", perf_multi_thread_latency,
                    NULL, NULL,
                    "backend=couchdb;ht_size=393209",
                    prepare, cleanup),
+        TestCaseV2("Multi thread latency (lock-free reads)",
+                   perf_multi_thread_latency,
+                   NULL, NULL,
+                   "backend=couchdb;ht_size=393209;ht_lockfree_reads=true",
+                   prepare, cleanup),
 
         TestCase("DCP impact on front-end latency", perf_latency_dcp_impact,
                  test_setup, teardown,
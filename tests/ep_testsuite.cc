@@ -2432,6 +2432,73 @@ static enum test_result test_bloomfilters(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result test_bloomfilters_counting(ENGINE_HANDLE *h,
+                                                   ENGINE_HANDLE_V1 *h1) {
+    checkeq(std::string("counting"),
+            get_str_stat(h, h1, "ep_bfilter_type"),
+            "Expected a counting bloom filter");
+    checkeq(std::string("ENABLED"),
+            get_str_stat(h, h1, "vb_0:bloom_filter", "vbucket-details 0"),
+            "Vbucket 0's bloom filter wasn't enabled upon setup!");
+
+    int num_read_attempts = get_int_stat_or_default(h, h1, 0,
+                                                    "ep_bg_num_samples");
+    int i;
+    item *it = NULL;
+
+    // Insert 10 items and delete the first 5; the (persisted) deletes are
+    // added to the filter.
+    for (i = 0; i < 10; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                      "somevalue", &it),
+                "Error setting.");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    for (i = 0; i < 5; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        checkeq(ENGINE_SUCCESS,
+                del(h, h1, key.str().c_str(), 0, 0),
+                "Failed remove with value.");
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    checkeq(5,
+            get_int_stat(h, h1, "vb_0:bloom_filter_key_count",
+                         "vbucket-details 0"),
+            "Unexpected no. of keys in bloom filter");
+
+    // Compaction with drop_deletes purges all but the last delete, which
+    // are removed from the filter rather than the filter being rebuilt.
+    useconds_t sleepTime = 128;
+    compact_db(h, h1, 0, 0, 15, 15, 1);
+    while (get_int_stat(h, h1, "ep_pending_compactions") != 0) {
+        decayingSleep(&sleepTime);
+    }
+
+    checkeq(1,
+            get_int_stat(h, h1, "vb_0:bloom_filter_key_count",
+                         "vbucket-details 0"),
+            "Expected purged keys to be removed from the bloom filter");
+
+    // Only the delete which wasn't purged needs a bgFetch.
+    for (i = 0; i < 5; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        get_meta(h, h1, key.str().c_str());
+    }
+    checkeq(num_read_attempts + 1,
+            get_int_stat(h, h1, "ep_bg_num_samples"),
+            "Expected a single bgFetch");
+
+    return SUCCESS;
+}
+
 static enum test_result test_bloomfilters_with_store_apis(ENGINE_HANDLE *h,
                                                           ENGINE_HANDLE_V1 *h1) {
     if (get_bool_stat(h, h1, "ep_bfilter_enabled") == false) {
@@ -6105,6 +6172,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
             {
                 "vb_0",
                 "vb_0:bloom_filter",
+                "vb_0:bloom_filter_fp_rate",
                 "vb_0:bloom_filter_key_count",
                 "vb_0:bloom_filter_size",
                 "vb_0:db_data_size",
@@ -6169,6 +6237,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         },
         {"checkpoint",
             {
+                "vb_0:key_index_mem_usage",
                 "vb_0:last_closed_checkpoint_id",
                 "vb_0:mem_usage",
                 "vb_0:num_checkpoint_items",
@@ -6186,6 +6255,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         },
         {"checkpoint 0",
             {
+                "vb_0:key_index_mem_usage",
                 "vb_0:last_closed_checkpoint_id",
                 "vb_0:mem_usage",
                 "vb_0:num_checkpoint_items",
@@ -6233,7 +6303,11 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_bfilter_fp_prob",
                 "ep_bfilter_key_count",
                 "ep_bfilter_residency_threshold",
+                "ep_bfilter_type",
                 "ep_bg_fetch_delay",
+                "ep_bg_fetchers_per_shard",
+                "ep_chk_expel_enabled",
+                "ep_chk_lockfree_append",
                 "ep_chk_max_items",
                 "ep_chk_period",
                 "ep_chk_remover_stime",
@@ -6242,16 +6316,22 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_config_file",
                 "ep_conflict_resolution_type",
                 "ep_couch_bucket",
+                "ep_couchstore_group_commit_vbuckets",
+                "ep_couchstore_io_uring",
                 "ep_cursor_dropping_lower_mark",
                 "ep_cursor_dropping_upper_mark",
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_shard_concurrency",
+                "ep_dcp_backfill_shared_scans",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
                 "ep_dcp_conn_buffer_size_max",
                 "ep_dcp_conn_buffer_size_perc",
+                "ep_dcp_cursor_batch_bytes",
+                "ep_dcp_cursor_batch_items",
                 "ep_dcp_enable_noop",
                 "ep_dcp_flow_control_policy",
                 "ep_dcp_max_unacked_bytes",
@@ -6259,11 +6339,15 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_dcp_idle_timeout",
                 "ep_dcp_noop_tx_interval",
                 "ep_dcp_producer_snapshot_marker_yield_limit",
+                "ep_dcp_producer_step_batch_bytes",
+                "ep_dcp_producer_step_batch_items",
+                "ep_dcp_producer_sched_quantum",
                 "ep_dcp_consumer_process_buffered_messages_yield_limit",
                 "ep_dcp_consumer_process_buffered_messages_batch_size",
                 "ep_dcp_scan_byte_limit",
                 "ep_dcp_scan_item_limit",
                 "ep_dcp_takeover_max_time",
+                "ep_dcp_takeover_stream_weight",
                 "ep_dcp_value_compression_enabled",
                 "ep_defragmenter_age_threshold",
                 "ep_defragmenter_chunk_duration",
@@ -6275,9 +6359,16 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_exp_pager_stime",
                 "ep_failpartialwarmup",
                 "ep_flushall_enabled",
+                "ep_flusher_adaptive_batching",
+                "ep_flusher_max_batch_delay",
+                "ep_flusher_writers_per_shard",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
+                "ep_ht_bucket_layout",
+                "ep_ht_lockfree_reads",
                 "ep_ht_locks",
+                "ep_ht_resize_batch_size",
+                "ep_ht_resize_incremental",
                 "ep_ht_size",
                 "ep_initfile",
                 "ep_item_eviction_policy",
@@ -6303,6 +6394,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_replication_throttle_cap_pcnt",
                 "ep_replication_throttle_queue_cap",
                 "ep_replication_throttle_threshold",
+                "ep_slab_allocator_enabled",
                 "ep_tap_ack_grace_period",
                 "ep_tap_ack_initial_sequence_number",
                 "ep_tap_ack_interval",
@@ -6678,6 +6770,12 @@ BaseTestCase testsuite_testcases[] = {
         TestCase("test bloomfilters",
                  test_bloomfilters, test_setup,
                  teardown, NULL, prepare, cleanup),
+        TestCase("test bloomfilters (blocked)",
+                 test_bloomfilters, test_setup,
+                 teardown, "bfilter_type=blocked", prepare, cleanup),
+        TestCase("test bloomfilters (counting)",
+                 test_bloomfilters_counting, test_setup,
+                 teardown, "bfilter_type=counting", prepare, cleanup),
         TestCase("test bloomfilters with store apis",
                  test_bloomfilters_with_store_apis, test_setup,
                  teardown, NULL, prepare, cleanup),
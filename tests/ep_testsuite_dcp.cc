@@ -5795,6 +5795,7 @@ BaseTestCase testsuite_testcases[] = {
                     create at least 1000 items when our residency
                     ratio gets to 90%. See test body for more details. */
                  "cursor_dropping_lower_mark=60;cursor_dropping_upper_mark=70;"
+                 "chk_expel_enabled=false;"
                  "chk_remover_stime=1;max_size=6291456;chk_max_items=8000",
                  prepare, cleanup),
         TestCase("test dcp cursor dropping backfill",
@@ -5803,6 +5804,7 @@ BaseTestCase testsuite_testcases[] = {
                   create at least 1000 items when our residency
                   ratio gets to 90%. See test body for more details. */
                  "cursor_dropping_lower_mark=60;cursor_dropping_upper_mark=70;"
+                 "chk_expel_enabled=false;"
                  "chk_remover_stime=1;max_size=6291456;chk_max_items=8000",
                  prepare, cleanup),
         TestCase("test dcp value compression",
@@ -44,9 +44,18 @@ std::string dcp_last_value;
 std::string dcp_last_key;
 vbucket_state_t dcp_last_vbucket_state;
 
+std::function<void()> dcp_message_hook;
+
 static ENGINE_HANDLE *engine_handle = nullptr;
 static ENGINE_HANDLE_V1 *engine_handle_v1 = nullptr;
 
+static ENGINE_ERROR_CODE notify_message_hook() {
+    if (dcp_message_hook) {
+        dcp_message_hook();
+    }
+    return ENGINE_SUCCESS;
+}
+
 extern "C" {
 
 std::vector<std::pair<uint64_t, uint64_t> > dcp_failover_log;
@@ -142,7 +151,7 @@ static ENGINE_ERROR_CODE mock_stream_end(const void *cookie,
     dcp_last_vbucket = vbucket;
     dcp_last_flags = flags;
     dcp_last_packet_size = 28;
-    return ENGINE_SUCCESS;
+    return notify_message_hook();
 }
 
 static ENGINE_ERROR_CODE mock_marker(const void *cookie,
@@ -160,7 +169,7 @@ static ENGINE_ERROR_CODE mock_marker(const void *cookie,
     dcp_last_snap_start_seqno = snap_start_seqno;
     dcp_last_snap_end_seqno = snap_end_seqno;
     dcp_last_flags = flags;
-    return ENGINE_SUCCESS;
+    return notify_message_hook();
 }
 
 static ENGINE_ERROR_CODE mock_mutation(const void* cookie,
@@ -192,7 +201,7 @@ static ENGINE_ERROR_CODE mock_mutation(const void* cookie,
     if (engine_handle_v1 && engine_handle) {
         engine_handle_v1->release(engine_handle, NULL, item);
     }
-    return ENGINE_SUCCESS;
+    return notify_message_hook();
 }
 
 static ENGINE_ERROR_CODE mock_deletion(const void* cookie,
@@ -216,7 +225,7 @@ static ENGINE_ERROR_CODE mock_deletion(const void* cookie,
     dcp_last_revseqno = rev_seqno;
     dcp_last_meta.assign(static_cast<const char*>(meta), nmeta);
     dcp_last_packet_size = 42 + nkey + nmeta;
-    return ENGINE_SUCCESS;
+    return notify_message_hook();
 }
 
 static ENGINE_ERROR_CODE mock_expiration(const void* cookie,
@@ -264,7 +273,7 @@ static ENGINE_ERROR_CODE mock_set_vbucket_state(const void* cookie,
     dcp_last_vbucket = vbucket;
     dcp_last_vbucket_state = state;
     dcp_last_packet_size = 25;
-    return ENGINE_SUCCESS;
+    return notify_message_hook();
 }
 
 static ENGINE_ERROR_CODE mock_noop(const void* cookie,
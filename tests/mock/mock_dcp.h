@@ -23,6 +23,8 @@
 #include <memcached/engine.h>
 #include <memcached/dcp.h>
 
+#include <functional>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +41,14 @@ ENGINE_ERROR_CODE mock_dcp_add_failover_log(vbucket_failover_t* entry,
 
 void clear_dcp_data();
 
+/**
+ * If set, called once each stream message (snapshot marker, mutation,
+ * deletion, stream end or vbucket state) has been recorded in the
+ * dcp_last_* variables, so a caller can see every message sent by a step
+ * which sends several.
+ */
+extern std::function<void()> dcp_message_hook;
+
 std::unique_ptr<dcp_message_producers> get_dcp_producers(ENGINE_HANDLE *_h,
                                                          ENGINE_HANDLE_V1 *_h1);
 
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include "checkpoint.h"
@@ -665,6 +666,145 @@ TEST_F(CheckpointTest, ItemsForCheckpointCursor) {
     EXPECT_EQ(2 * MIN_CHECKPOINT_ITEMS + 3, items.size());
 }
 
+// Test that getItemsForCursor() stops at a limit, but only at the end of a
+// checkpoint
+TEST_F(CheckpointTest, ItemsForCursorLimit) {
+    checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                         MIN_CHECKPOINT_ITEMS,
+                                         /*numCheckpoints*/2,
+                                         /*itemBased*/true,
+                                         /*keepClosed*/false,
+                                         /*enableMerge*/false);
+    createManager();
+
+    queued_item qi;
+    for (unsigned int ii = 0; ii < 2 * MIN_CHECKPOINT_ITEMS; ii++) {
+        qi.reset(new Item("key" + std::to_string(ii), vbucket->getId(),
+                          queue_op_set, /*revSeq*/0, /*bySeq*/0));
+        EXPECT_TRUE(manager->queueDirty(vbucket, qi, true));
+    }
+    EXPECT_EQ(2, manager->getNumCheckpoints());
+
+    /* A limit of one item still returns the whole first checkpoint:
+       op_ckpt_start, MIN_CHECKPOINT_ITEMS items and op_ckpt_end */
+    std::vector<queued_item> items;
+    ItemsForCursor result = manager->getItemsForCursor(
+            CheckpointManager::pCursorName, items, 1, 1);
+    EXPECT_TRUE(result.moreAvailable);
+    EXPECT_EQ(MIN_CHECKPOINT_ITEMS + 2, items.size());
+    EXPECT_EQ(queue_op_checkpoint_end, items.back()->getOperation());
+    EXPECT_EQ(static_cast<uint64_t>(MIN_CHECKPOINT_ITEMS), result.range.end);
+
+    /* The rest are in the open checkpoint */
+    items.clear();
+    result = manager->getItemsForCursor(CheckpointManager::pCursorName, items,
+                                        1, 1);
+    EXPECT_FALSE(result.moreAvailable);
+    EXPECT_EQ(MIN_CHECKPOINT_ITEMS + 1, items.size());
+    EXPECT_EQ(static_cast<uint64_t>(2 * MIN_CHECKPOINT_ITEMS),
+              result.range.end);
+    EXPECT_EQ(0, manager->getNumItemsForCursor(CheckpointManager::pCursorName));
+}
+
+// Test that the values of items every cursor has passed are expelled, and
+// that a cursor registered afterwards starts after them
+TEST_F(CheckpointTest, ExpelUnreferencedItems) {
+    const std::string dcpCursor("dcp");
+    manager->registerCursorBySeqno(dcpCursor, 1000, MustSendCheckpointEnd::NO);
+
+    const std::string value(100, 'x');
+    // An item still referenced outside the checkpoint
+    queued_item held;
+    for (unsigned int ii = 0; ii < 10; ii++) {
+        const std::string key("key" + std::to_string(ii));
+        queued_item qi(new Item(key.c_str(), key.size(), 0, 0, value.c_str(),
+                                value.size()));
+        EXPECT_TRUE(manager->queueDirty(vbucket, qi, true));
+        if (ii == 3) {
+            held = qi;
+        }
+    }
+    const size_t memUsage = manager->getMemoryUsage();
+
+    // Nothing has been read yet
+    EXPECT_EQ(0, manager->expelUnreferencedItems().items);
+
+    std::vector<queued_item> items;
+    manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    items.clear();
+    manager->getAllItemsForCursor(dcpCursor, items);
+    items.clear();
+
+    // All but the last item (where the cursors are) and the held one are
+    // expelled
+    ExpelResult result = manager->expelUnreferencedItems();
+    EXPECT_EQ(8, result.items);
+    EXPECT_GE(result.bytes, 8 * value.size());
+    EXPECT_EQ(memUsage - result.bytes, manager->getMemoryUsage());
+    EXPECT_EQ(value.size(), held->getNBytes());
+    EXPECT_EQ(0, manager->expelUnreferencedItems().items);
+
+    // A new cursor can't start before the last expelled item
+    CursorRegResult reg = manager->registerCursorBySeqno(
+            "dcp2", 1000, MustSendCheckpointEnd::NO);
+    EXPECT_EQ(1010, reg.first);
+    EXPECT_TRUE(reg.second);
+    manager->getAllItemsForCursor("dcp2", items);
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ(1010, items.front()->getBySeqno());
+    EXPECT_EQ(value.size(), items.front()->getNBytes());
+
+    // Expelled items can still be de-duplicated
+    const std::string key("key0");
+    queued_item qi(new Item(key.c_str(), key.size(), 0, 0, value.c_str(),
+                            value.size()));
+    EXPECT_TRUE(manager->queueDirty(vbucket, qi, true));
+    EXPECT_EQ(11, manager->getNumOpenChkItems());
+}
+
+// Test that items queued concurrently (without the queue lock) are all
+// drained into the checkpoints, in seqno order and without gaps
+TEST_F(CheckpointTest, ConcurrentAppend) {
+    checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                         DEFAULT_CHECKPOINT_ITEMS,
+                                         DEFAULT_MAX_CHECKPOINTS,
+                                         /*itemBased*/true,
+                                         /*keepClosed*/false,
+                                         /*enableMerge*/false,
+                                         /*lockfreeAppend*/true);
+    createManager();
+
+    const int numThreads = 4;
+    const int itemsPerThread = 1000;
+    std::vector<std::thread> threads;
+    for (int tt = 0; tt < numThreads; tt++) {
+        threads.emplace_back([this, tt, itemsPerThread]() {
+            for (int ii = 0; ii < itemsPerThread; ii++) {
+                queued_item qi(new Item("key_" + std::to_string(tt) + "_" +
+                                        std::to_string(ii),
+                                        vbucket->getId(), queue_op_set,
+                                        /*revSeq*/0, /*bySeq*/0));
+                manager->queueDirty(vbucket, qi, true);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(1000 + numThreads * itemsPerThread, manager->getHighSeqno());
+
+    std::vector<queued_item> items;
+    manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    int64_t expected = 1000;
+    for (const auto& qi : items) {
+        if (qi->getOperation() == queue_op_set) {
+            EXPECT_EQ(++expected, qi->getBySeqno());
+        }
+    }
+    EXPECT_EQ(1000 + numThreads * itemsPerThread, expected);
+}
+
 // Test the checkpoint cursor movement
 TEST_F(CheckpointTest, CursorMovement) {
     /* We want to have items across 2 checkpoints. Size down the default number
@@ -759,6 +899,64 @@ TEST_F(CheckpointTest, CursorMovement) {
 
 }
 
+// Collapsing closed checkpoints rebuilds the queue of the last closed one;
+// the cursors in it must stay on the items they were at.
+TEST_F(CheckpointTest, CursorsInCollapsedCheckpoint) {
+    checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                         DEFAULT_CHECKPOINT_ITEMS,
+                                         DEFAULT_MAX_CHECKPOINTS,
+                                         /*itemBased*/true,
+                                         /*keepClosed*/false,
+                                         /*enableMerge*/true);
+    createManager();
+    vbucket->setState(vbucket_state_replica);
+
+    // A slow cursor holds on to the first checkpoint.
+    const std::string slow_cursor(TAP_CURSOR_PREFIX + std::to_string(1));
+    manager->registerCursor(slow_cursor, 1, false, MustSendCheckpointEnd::YES);
+
+    for (const std::string prefix : {"a", "b"}) {
+        for (auto ii : {1, 2, 3}) {
+            queued_item qi(new Item(prefix + std::to_string(ii),
+                                    vbucket->getId(), queue_op_set,
+                                    /*revSeq*/0, /*bySeq*/0));
+            EXPECT_TRUE(manager->queueDirty(vbucket, qi, true));
+        }
+        manager->createNewCheckpoint();
+    }
+    EXPECT_EQ(3, manager->getNumCheckpoints());
+
+    // Move the persistence cursor onto b1, in the last closed checkpoint.
+    bool isLastMutationItem;
+    queued_item item;
+    do {
+        item = manager->nextItem(CheckpointManager::pCursorName,
+                                 isLastMutationItem);
+    } while (item->getKey() != "b1");
+
+    bool newCheckpointCreated;
+    manager->removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated);
+    EXPECT_EQ(2, manager->getNumCheckpoints());
+
+    // The persistence cursor carries on after b1...
+    for (const std::string key : {"b2", "b3"}) {
+        item = manager->nextItem(CheckpointManager::pCursorName,
+                                 isLastMutationItem);
+        EXPECT_EQ(key, item->getKey());
+    }
+    // ...and the slow cursor now sees the items of both checkpoints.
+    std::vector<queued_item> items;
+    manager->getAllItemsForCursor(slow_cursor, items);
+    std::vector<std::string> keys;
+    for (const auto &qi : items) {
+        if (!qi->isCheckPointMetaItem()) {
+            keys.push_back(qi->getKey());
+        }
+    }
+    EXPECT_EQ(std::vector<std::string>({"a1", "a2", "a3", "b1", "b2", "b3"}),
+              keys);
+}
+
 /* static storage for environment variable set by putenv(). */
 static char allow_no_stats_env[] = "ALLOW_NO_STATS_UPDATE=yeah";
 
@@ -771,3 +969,122 @@ int main(int argc, char **argv) {
 
     return RUN_ALL_TESTS();
 }
+
+// Iterators into a CheckpointQueue (like cursors and index entries) must
+// remain valid as items are appended and others erased, across chunks.
+TEST(CheckpointQueueTest, StableIterators) {
+    CheckpointQueue queue;
+    std::vector<CheckpointQueue::iterator> positions;
+    const size_t numItems = 3 * CheckpointQueue::chunkSize + 5;
+    for (size_t ii = 0; ii < numItems; ii++) {
+        queued_item qi(new Item("key" + std::to_string(ii), 0, queue_op_set,
+                                /*revSeq*/0, /*bySeq*/ii));
+        queue.push_back(qi);
+        positions.push_back(--queue.end());
+    }
+    EXPECT_EQ(numItems, queue.size());
+
+    // Erase every other item; the rest are still where they were.
+    for (size_t ii = 1; ii < numItems; ii += 2) {
+        queue.erase(positions[ii]);
+    }
+    EXPECT_EQ((numItems + 1) / 2, queue.size());
+    for (size_t ii = 0; ii < numItems; ii += 2) {
+        EXPECT_EQ(static_cast<int64_t>(ii), (*positions[ii])->getBySeqno());
+    }
+
+    // Iteration (both ways) skips the erased items.
+    int64_t expected = 0;
+    for (auto it = queue.begin(); it != queue.end(); ++it, expected += 2) {
+        EXPECT_EQ(expected, (*it)->getBySeqno());
+    }
+    for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+        expected -= 2;
+        EXPECT_EQ(expected, (*it)->getBySeqno());
+    }
+
+    // Popping the last item also drops the erased items before it.
+    queue.pop_back();
+    EXPECT_EQ(static_cast<int64_t>(numItems - 3),
+              queue.back()->getBySeqno());
+}
+
+// A chunk whose items have all been erased is freed and skipped over.
+TEST(CheckpointQueueTest, DeadChunks) {
+    CheckpointQueue queue;
+    std::vector<CheckpointQueue::iterator> positions;
+    const size_t numItems = 3 * CheckpointQueue::chunkSize;
+    for (size_t ii = 0; ii < numItems; ii++) {
+        queued_item qi(new Item("key" + std::to_string(ii), 0, queue_op_set,
+                                /*revSeq*/0, /*bySeq*/ii));
+        queue.push_back(qi);
+        positions.push_back(--queue.end());
+    }
+    const size_t memUsage = queue.memorySize();
+
+    // Erasing items keeps their slots until the whole chunk is dead.
+    const size_t chunkSize = CheckpointQueue::chunkSize;
+    for (size_t ii = chunkSize; ii < 2 * chunkSize - 1; ii++) {
+        queue.erase(positions[ii]);
+    }
+    EXPECT_EQ(memUsage, queue.memorySize());
+    queue.erase(positions[2 * chunkSize - 1]);
+    EXPECT_EQ(memUsage - chunkSize * sizeof(queued_item), queue.memorySize());
+
+    // Iteration goes straight from one live chunk to the next.
+    auto it = positions[chunkSize - 1];
+    EXPECT_EQ(static_cast<int64_t>(2 * chunkSize), (*++it)->getBySeqno());
+    EXPECT_EQ(static_cast<int64_t>(chunkSize - 1), (*--it)->getBySeqno());
+    EXPECT_EQ(2 * chunkSize, queue.size());
+    EXPECT_EQ(2 * chunkSize,
+              static_cast<size_t>(std::distance(queue.begin(), queue.end())));
+
+    // Erasing everything after the first chunk releases the rest.
+    for (size_t ii = 2 * chunkSize; ii < numItems; ii++) {
+        queue.erase(positions[ii]);
+    }
+    EXPECT_EQ(chunkSize * sizeof(queued_item), queue.memorySize());
+    EXPECT_EQ(static_cast<int64_t>(chunkSize - 1), queue.back()->getBySeqno());
+}
+
+TEST(CheckpointIndexTest, SetFindErase) {
+    CheckpointIndex index;
+    std::vector<queued_item> items;
+    const size_t numKeys = 1000;
+    for (size_t ii = 0; ii < numKeys; ii++) {
+        items.push_back(queued_item(new Item("key" + std::to_string(ii), 0,
+                                             queue_op_set, /*revSeq*/0,
+                                             /*bySeq*/ii)));
+        index_entry entry = {CheckpointQueue::iterator(),
+                             static_cast<int64_t>(ii)};
+        index.set(items.back()->getKey(), entry);
+    }
+    EXPECT_EQ(numKeys, index.size());
+    const size_t memUsage = index.memorySize();
+    EXPECT_LT(numKeys * sizeof(index_entry), memUsage);
+
+    // Keys are compared by value, not by the string indexed.
+    for (size_t ii = 0; ii < numKeys; ii++) {
+        index_entry *entry = index.find("key" + std::to_string(ii));
+        ASSERT_NE(nullptr, entry);
+        EXPECT_EQ(static_cast<int64_t>(ii), entry->mutation_id);
+    }
+    EXPECT_EQ(nullptr, index.find("missing"));
+
+    // Re-setting a key (as de-duplication does) replaces its entry.
+    index_entry updated = {CheckpointQueue::iterator(), 5000};
+    index.set(items[7]->getKey(), updated);
+    EXPECT_EQ(numKeys, index.size());
+    EXPECT_EQ(5000, index.find("key7")->mutation_id);
+    // ... without allocating.
+    EXPECT_EQ(memUsage, index.memorySize());
+
+    // Erasing keys leaves the others reachable.
+    for (size_t ii = 0; ii < numKeys; ii += 3) {
+        EXPECT_TRUE(index.erase(items[ii]->getKey()));
+    }
+    EXPECT_FALSE(index.erase("key0"));
+    for (size_t ii = 0; ii < numKeys; ii++) {
+        EXPECT_EQ(ii % 3 != 0, index.find(items[ii]->getKey()) != nullptr);
+    }
+}
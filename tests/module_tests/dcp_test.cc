@@ -23,6 +23,8 @@
  */
 
 #include "connmap.h"
+#include "dcp/backfill.h"
+#include "dcp/backfill-manager.h"
 #include "dcp/dcpconnmap.h"
 #include "dcp/producer.h"
 #include "dcp/stream.h"
@@ -33,6 +35,9 @@
 #include "../mock/mock_dcp_consumer.h"
 
 #include <gtest/gtest.h>
+#include <list>
+#include <map>
+#include <thread>
 
 // Mock of the ActiveStream class. Wraps the real ActiveStream, but exposes
 // normally protected methods publically for test purposes.
@@ -60,13 +65,17 @@ public:
         return nextCheckpointItem();
     }
 
-    const std::queue<DcpResponse*>& public_readyQ() {
+    const RingQueue<DcpResponse*>& public_readyQ() {
         return readyQ;
     }
 
     DcpResponse* public_nextQueuedItem() {
         return nextQueuedItem();
     }
+
+    std::mutex& public_streamMutex() {
+        return streamMutex;
+    }
 };
 
 /* Mock of the PassiveStream class. Wraps the real PassiveStream, but exposes
@@ -309,6 +318,416 @@ TEST_F(StreamTest, test_mb18625) {
         << "Expected no more messages in the readyQ";
 }
 
+static std::vector<uint64_t> seqnoRange(uint64_t first, uint64_t last) {
+    std::vector<uint64_t> seqnos;
+    for (uint64_t seqno = first; seqno <= last; ++seqno) {
+        seqnos.push_back(seqno);
+    }
+    return seqnos;
+}
+
+/* Test callback for stats handling.
+ * 'cookie' is a std::map<std::string, std::string> which stats are
+ * accumulated in.
+ */
+static void add_stat_callback(const char *key, const uint16_t klen,
+                              const char *val, const uint32_t vlen,
+                              const void *cookie) {
+    auto* map = reinterpret_cast<std::map<std::string, std::string>*>(
+            const_cast<void*>(cookie));
+    (*map)[std::string(key, klen)] = std::string(val, vlen);
+}
+
+class BackfillTest : public DCPTest {
+protected:
+    // A disk-only stream, on a connection of its own, whose backfill is
+    // run by the test.
+    struct TestStream {
+        MockActiveStream* mock() {
+            return static_cast<MockActiveStream*>(stream.get());
+        }
+
+        dcp_producer_t producer;
+        stream_t stream;
+        // Seqnos of the mutations taken off the stream so far
+        std::vector<uint64_t> seqnos;
+        // End seqnos of the snapshot markers taken off the stream so far
+        std::vector<uint64_t> markerEnds;
+    };
+
+    void TearDown() override {
+        for (auto& ts : streams) {
+            ts.producer->clearCheckpointProcessorTaskQueues();
+            ts.producer->closeAllStreams();
+        }
+        streams.clear();
+        DCPTest::TearDown();
+    }
+
+    // Store numItems items in vbucket vb and wait for them to be persisted.
+    void store_and_persist(uint16_t vb, size_t numItems) {
+        for (size_t ii = 0; ii < numItems; ++ii) {
+            store_item(vb, "key" + std::to_string(ii), "value");
+        }
+        uint64_t highSeqno = engine->getVBucket(vb)->getHighSeqno();
+        while (engine->getEpStore()->getLastPersistedSeqno(vb) < highSeqno) {
+            usleep(100);
+        }
+    }
+
+    // Add a stream of vbucket vb wanting the seqnos after start up to end.
+    TestStream& add_stream(uint16_t vb, uint64_t start, uint64_t end) {
+        TestStream ts;
+        ts.producer = new DcpProducer(*engine, /*cookie*/nullptr,
+                                      "test_producer_" +
+                                      std::to_string(streams.size()),
+                                      /*notifyOnly*/false);
+        ts.stream = new MockActiveStream(engine, ts.producer,
+                                         ts.producer->getName(),
+                                         DCP_ADD_STREAM_FLAG_DISKONLY,
+                                         /*opaque*/0, vb, start, end,
+                                         /*vb_uuid*/0xabcd,
+                                         /*snap_start_seqno*/start,
+                                         /*snap_end_seqno*/start);
+        ts.stream->setActive();
+        streams.push_back(ts);
+        return streams.back();
+    }
+
+    // Take what the stream's backfill queued off its ready queue, as
+    // sending it would.
+    void drain(TestStream& ts) {
+        std::unique_ptr<DcpResponse> response(
+                                        ts.mock()->public_nextQueuedItem());
+        for (; response;
+             response.reset(ts.mock()->public_nextQueuedItem())) {
+            if (response->getEvent() == DCP_MUTATION) {
+                auto* mutation = static_cast<MutationResponse*>(
+                                                            response.get());
+                ts.producer->recordBackfillManagerBytesSent(
+                                            mutation->getItem()->size());
+                ts.seqnos.push_back(mutation->getBySeqno());
+            } else if (response->getEvent() == DCP_SNAPSHOT_MARKER) {
+                auto* marker = static_cast<SnapshotMarker*>(response.get());
+                ts.markerEnds.push_back(marker->getEndSeqno());
+            }
+        }
+    }
+
+    // Run the backfill until it's finished, draining its stream as it goes.
+    void finish(DCPBackfill& backfill, TestStream& ts) {
+        for (int ii = 0; ii < 100 && backfill.run() != backfill_finished;
+             ++ii) {
+            drain(ts);
+        }
+        drain(ts);
+    }
+
+    std::list<TestStream> streams;
+    const size_t numItems = 10;
+};
+
+/*
+ * Test that a stream joining a scan another stream's backfill opened is
+ * fed by it from its own start seqno on, the backfill of either driving
+ * the scan for both.
+ */
+TEST_F(BackfillTest, StreamsShareScanFromDifferentSeqnos) {
+    store_and_persist(vbid, numItems);
+
+    TestStream& first = add_stream(vbid, 0, numItems);
+    TestStream& second = add_stream(vbid, 5, numItems);
+    DCPBackfill firstBackfill(engine, first.stream, 1, numItems);
+    DCPBackfill secondBackfill(engine, second.stream, 6, numItems);
+
+    // The first backfill opens the scan; the second joins it and reads
+    // the whole snapshot, for both streams.
+    EXPECT_EQ(backfill_success, firstBackfill.run());
+    EXPECT_EQ(backfill_success, secondBackfill.run());
+    drain(first);
+    drain(second);
+    EXPECT_EQ(seqnoRange(1, numItems), first.seqnos);
+    EXPECT_EQ(seqnoRange(6, numItems), second.seqnos);
+
+    finish(firstBackfill, first);
+    finish(secondBackfill, second);
+    EXPECT_EQ(seqnoRange(1, numItems), first.seqnos);
+    EXPECT_EQ(seqnoRange(6, numItems), second.seqnos);
+}
+
+/*
+ * Test that a stream whose backfill buffer is full doesn't hold up the
+ * scan it shares: it is split off, and its backfill carries on from the
+ * first item it didn't take with a scan of its own.
+ */
+TEST_F(BackfillTest, FullBufferSplitsStreamOffScan) {
+    store_and_persist(vbid, numItems);
+
+    TestStream& fast = add_stream(vbid, 0, numItems);
+    // The slow stream's connection only buffers an item at a time.
+    Configuration& config = engine->getConfiguration();
+    const size_t byteLimit = config.getDcpBackfillByteLimit();
+    config.setDcpBackfillByteLimit(1);
+    TestStream& slow = add_stream(vbid, 0, numItems);
+    config.setDcpBackfillByteLimit(byteLimit);
+
+    DCPBackfill fastBackfill(engine, fast.stream, 1, numItems);
+    DCPBackfill slowBackfill(engine, slow.stream, 1, numItems);
+    EXPECT_EQ(backfill_success, fastBackfill.run());
+
+    // Driven by the slow stream's backfill, the scan pauses once the
+    // slow stream's buffer is full...
+    EXPECT_EQ(backfill_success, slowBackfill.run());
+    drain(fast);
+    EXPECT_EQ(seqnoRange(1, 2), fast.seqnos);
+
+    // ...but not when driven by the fast one's, which reads the rest.
+    EXPECT_EQ(backfill_success, fastBackfill.run());
+    drain(fast);
+    drain(slow);
+    EXPECT_EQ(seqnoRange(1, numItems), fast.seqnos);
+    EXPECT_EQ(seqnoRange(1, 1), slow.seqnos);
+
+    finish(fastBackfill, fast);
+    finish(slowBackfill, slow);
+    EXPECT_EQ(seqnoRange(1, numItems), fast.seqnos);
+    EXPECT_EQ(seqnoRange(1, numItems), slow.seqnos);
+}
+
+/*
+ * Test that the scan a split-off stream's backfill carries on with stays
+ * within the disk snapshot already sent: the stream gets no second
+ * snapshot marker, and its backfill isn't counted again.
+ */
+TEST_F(BackfillTest, SplitOffStreamKeepsItsSnapshot) {
+    store_and_persist(vbid, numItems);
+
+    TestStream& fast = add_stream(vbid, 0, numItems);
+    Configuration& config = engine->getConfiguration();
+    const size_t byteLimit = config.getDcpBackfillByteLimit();
+    config.setDcpBackfillByteLimit(1);
+    TestStream& slow = add_stream(vbid, 0, numItems);
+    config.setDcpBackfillByteLimit(byteLimit);
+
+    DCPBackfill fastBackfill(engine, fast.stream, 1, numItems);
+    DCPBackfill slowBackfill(engine, slow.stream, 1, numItems);
+    EXPECT_EQ(backfill_success, fastBackfill.run());
+    EXPECT_EQ(backfill_success, slowBackfill.run());
+    EXPECT_EQ(backfill_success, fastBackfill.run());
+    drain(slow);
+    EXPECT_EQ(seqnoRange(1, 1), slow.seqnos);
+
+    // Items written since are left to the stream's memory snapshot.
+    store_and_persist(vbid, 1);
+
+    // The slow stream has been split off; its backfill opens a scan of its
+    // own.
+    EXPECT_EQ(backfill_success, slowBackfill.run());
+    std::map<std::string, std::string> stats;
+    slow.mock()->addTakeoverStats(add_stat_callback, &stats);
+    EXPECT_EQ(std::to_string(numItems), stats["backfillRemaining"]);
+
+    finish(fastBackfill, fast);
+    finish(slowBackfill, slow);
+    EXPECT_EQ(seqnoRange(1, numItems), slow.seqnos);
+    EXPECT_EQ(std::vector<uint64_t>(1, numItems), slow.markerEnds);
+    EXPECT_EQ(std::vector<uint64_t>(1, numItems), fast.markerEnds);
+}
+
+/*
+ * Test that a scan carries on for the remaining streams once a stream it
+ * was feeding is closed part way through.
+ */
+TEST_F(BackfillTest, StreamDetachesMidScan) {
+    store_and_persist(vbid, numItems);
+
+    TestStream& leaving = add_stream(vbid, 0, numItems);
+    // The remaining stream's backfill pauses the scan after every item.
+    Configuration& config = engine->getConfiguration();
+    const size_t byteLimit = config.getDcpBackfillByteLimit();
+    config.setDcpBackfillByteLimit(1);
+    TestStream& remaining = add_stream(vbid, 0, numItems);
+    config.setDcpBackfillByteLimit(byteLimit);
+
+    DCPBackfill leavingBackfill(engine, leaving.stream, 1, numItems);
+    DCPBackfill remainingBackfill(engine, remaining.stream, 1, numItems);
+    EXPECT_EQ(backfill_success, leavingBackfill.run());
+    EXPECT_EQ(backfill_success, remainingBackfill.run());
+    drain(leaving);
+    drain(remaining);
+    EXPECT_EQ(seqnoRange(1, 2), leaving.seqnos);
+    EXPECT_EQ(seqnoRange(1, 1), remaining.seqnos);
+
+    leaving.stream->setDead(END_STREAM_DISCONNECTED);
+    EXPECT_EQ(backfill_success, leavingBackfill.run());
+    EXPECT_EQ(backfill_finished, leavingBackfill.run());
+
+    finish(remainingBackfill, remaining);
+    drain(leaving);
+    EXPECT_EQ(seqnoRange(1, numItems), remaining.seqnos);
+    EXPECT_EQ(seqnoRange(1, 2), leaving.seqnos);
+}
+
+/*
+ * Test that a connection's backfills of vbuckets of different shards run
+ * at the same time: one shard's backfill runs to completion while the
+ * other's is held up.
+ */
+TEST_F(BackfillTest, ShardsBackfillConcurrently) {
+    const uint16_t otherVbid = 1;
+    const VBucketMap& vbMap = engine->getEpStore()->getVBuckets();
+    ASSERT_NE(vbMap.getShardByVbId(vbid)->getId(),
+              vbMap.getShardByVbId(otherVbid)->getId());
+    engine->setVBucketState(otherVbid, vbucket_state_active, false);
+    store_and_persist(vbid, numItems);
+    store_and_persist(otherVbid, numItems);
+
+    TestStream& held = add_stream(vbid, 0, numItems);
+    TestStream& other = add_stream(otherVbid, 0, numItems);
+    auto manager = std::make_shared<BackfillManager>(engine);
+    manager->schedule(held.stream, 1, numItems);
+    manager->schedule(other.stream, 1, numItems);
+
+    // Hold the first backfill up where it marks the disk snapshot.
+    std::unique_lock<std::mutex> streamLock(
+                                    held.mock()->public_streamMutex());
+    std::thread task([&manager]() {
+        manager->backfill(/*taskId*/0);
+    });
+
+    connection_t conn(held.producer.get());
+    const std::string numRunning = held.producer->getName() +
+                                   ":backfill_num_running";
+    std::map<std::string, std::string> stats;
+    while (stats[numRunning] != "1") {
+        usleep(100);
+        manager->addStats(conn, add_stat_callback, &stats);
+    }
+
+    for (int ii = 0; ii < 10 && other.seqnos.size() < numItems; ++ii) {
+        manager->backfill(/*taskId*/1);
+        drain(other);
+    }
+    EXPECT_EQ(seqnoRange(1, numItems), other.seqnos);
+    manager->addStats(conn, add_stat_callback, &stats);
+    EXPECT_EQ("1", stats[numRunning]);
+
+    streamLock.unlock();
+    task.join();
+    for (int ii = 0; ii < 10 && held.seqnos.size() < numItems; ++ii) {
+        manager->backfill(/*taskId*/0);
+        drain(held);
+    }
+    EXPECT_EQ(seqnoRange(1, numItems), held.seqnos);
+}
+
+/*
+ * Test that responses allocated from a DcpResponsePool are recycled, and
+ * may outlive the pool's owner.
+ */
+TEST(DcpResponsePoolTest, RecyclesResponses) {
+    DcpResponsePool* pool = new DcpResponsePool(1);
+
+    DcpResponse* first = new (*pool) SnapshotMarker(0, 0, 1, 2,
+                                                    MARKER_FLAG_MEMORY);
+    EXPECT_EQ(1, pool->getNumAllocated());
+    void* firstAddr = first;
+    delete first;
+    EXPECT_EQ(0, pool->getNumAllocated());
+    EXPECT_EQ(1, pool->getNumFree());
+
+    DcpResponse* second = new (*pool) SnapshotMarker(0, 0, 3, 4,
+                                                     MARKER_FLAG_MEMORY);
+    EXPECT_EQ(firstAddr, static_cast<void*>(second));
+    EXPECT_EQ(0, pool->getNumFree());
+
+    // Only maxFree free slots are kept.
+    DcpResponse* third = new (*pool) SnapshotMarker(0, 0, 5, 6,
+                                                    MARKER_FLAG_MEMORY);
+    delete second;
+    delete third;
+    EXPECT_EQ(1, pool->getNumFree());
+
+    // The pool lives on until its last response is freed.
+    DcpResponse* last = new (*pool) SnapshotMarker(0, 0, 7, 8,
+                                                   MARKER_FLAG_MEMORY);
+    pool->release();
+    EXPECT_EQ(7, static_cast<SnapshotMarker*>(last)->getStartSeqno());
+    delete last;
+}
+
+/*
+ * Test that an item's value is compressed once, for all the streams sending
+ * it, and that the item's own value is left as it was.
+ */
+TEST(ItemTest, CompressedValueIsShared) {
+    std::string value(1024, 'x');
+    uint8_t datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+    queued_item qi(new Item("key", 3, 0, 0, value.data(), value.size(),
+                            &datatype, 1, 0, 1));
+
+    value_t first, second;
+    size_t memAdded, memFreed;
+    EXPECT_TRUE(qi->getCompressedValue(1.0, first, memAdded, memFreed));
+    EXPECT_EQ(first->getSize(), memAdded);
+    EXPECT_EQ(0, memFreed);
+    EXPECT_EQ(memAdded, qi->getCompressedValMemSize());
+    EXPECT_TRUE(qi->getCompressedValue(1.0, second, memAdded, memFreed));
+    EXPECT_EQ(first.get(), second.get());
+    EXPECT_EQ(0, memAdded);
+    EXPECT_EQ(0, memFreed);
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_COMPRESSED_JSON, first->getDataType());
+    EXPECT_GT(value.size(), first->vlength());
+
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_JSON, qi->getDataType());
+    EXPECT_EQ(value, qi->getValue()->to_s());
+
+    // A different ratio replaces the kept value; one the value doesn't
+    // compress well enough for has it sent as it is.
+    value_t uncompressed;
+    EXPECT_TRUE(qi->getCompressedValue(0.0, uncompressed, memAdded,
+                                       memFreed));
+    EXPECT_EQ(qi->getValue().get(), uncompressed.get());
+    EXPECT_EQ(0, memAdded);
+    EXPECT_EQ(first->getSize(), memFreed);
+    EXPECT_EQ(0, qi->getCompressedValMemSize());
+
+    EXPECT_TRUE(qi->getCompressedValue(1.0, second, memAdded, memFreed));
+    EXPECT_NE(first.get(), second.get());
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_COMPRESSED_JSON, second->getDataType());
+    EXPECT_EQ(second->getSize(), memAdded);
+    EXPECT_EQ(0, memFreed);
+}
+
+/*
+ * Test that a vbucket pushed to the front of a DcpReadyQueue is popped next,
+ * that neither push adds a vbucket already queued, and that the time each
+ * was queued is kept.
+ */
+TEST(DcpReadyQueueTest, PushFrontUnique) {
+    DcpReadyQueue ready;
+    const hrtime_t start = gethrtime();
+
+    EXPECT_TRUE(ready.pushUnique(1));
+    EXPECT_TRUE(ready.pushUnique(2));
+    EXPECT_TRUE(ready.pushFrontUnique(3));
+    EXPECT_FALSE(ready.pushFrontUnique(1));
+    EXPECT_FALSE(ready.pushUnique(3));
+    EXPECT_EQ(3, ready.size());
+
+    uint16_t vbucket;
+    hrtime_t queuedAt;
+    ASSERT_TRUE(ready.popFront(vbucket, queuedAt));
+    EXPECT_EQ(3, vbucket);
+    EXPECT_LE(start, queuedAt);
+    EXPECT_GE(gethrtime(), queuedAt);
+    ASSERT_TRUE(ready.popFront(vbucket));
+    EXPECT_EQ(1, vbucket);
+    ASSERT_TRUE(ready.popFront(vbucket));
+    EXPECT_EQ(2, vbucket);
+    EXPECT_FALSE(ready.popFront(vbucket));
+}
+
 class ConnectionTest : public DCPTest {
 protected:
     ENGINE_ERROR_CODE set_vb_state(uint16_t vbid, vbucket_state_t state) {
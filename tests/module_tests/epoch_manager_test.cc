@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "epoch_manager.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+static std::atomic<size_t> numFreed;
+
+static void countingDelete(void *ptr) {
+    delete static_cast<int*>(ptr);
+    ++numFreed;
+}
+
+class EpochManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        numFreed = 0;
+    }
+};
+
+// Nothing retired while a reader is pinned is freed until it unpins.
+TEST_F(EpochManagerTest, PinnedReaderDefersFree) {
+    EpochManager manager;
+    const size_t n = 4 * EpochManager::reclaimInterval;
+    {
+        EpochManager::Guard guard(manager);
+        ASSERT_TRUE(guard.isPinned());
+        for (size_t i = 0; i < n; ++i) {
+            manager.retire(new int(i), countingDelete);
+        }
+        manager.reclaim();
+        EXPECT_EQ(0, numFreed);
+        EXPECT_EQ(n, manager.getNumRetired());
+    }
+
+    // Two advances are needed before the last retirements are reclaimable.
+    manager.reclaim();
+    manager.reclaim();
+    EXPECT_EQ(n, numFreed);
+    EXPECT_EQ(0, manager.getNumRetired());
+}
+
+// Retired objects are freed periodically without an explicit reclaim().
+TEST_F(EpochManagerTest, RetireReclaims) {
+    EpochManager manager;
+    for (size_t i = 0; i < 4 * EpochManager::reclaimInterval; ++i) {
+        manager.retire(new int(i), countingDelete);
+    }
+    EXPECT_LT(0, numFreed);
+}
+
+// Anything left is freed by the destructor.
+TEST_F(EpochManagerTest, DestructorFrees) {
+    {
+        EpochManager manager;
+        manager.retire(new int(0), countingDelete);
+        EXPECT_EQ(0, numFreed);
+    }
+    EXPECT_EQ(1, numFreed);
+}
+
+// Pinning fails, rather than blocks, once a thread's slots are all taken.
+TEST_F(EpochManagerTest, PinningCanFail) {
+    EpochManager manager;
+    std::vector<std::unique_ptr<EpochManager::Guard> > guards;
+    for (size_t i = 0; i < EpochManager::numSlots; ++i) {
+        guards.emplace_back(new EpochManager::Guard(manager));
+    }
+    EXPECT_FALSE(guards.back()->isPinned());
+}
+
+// Readers dereferencing retired objects never see them freed.
+TEST_F(EpochManagerTest, ConcurrentReaders) {
+    EpochManager manager;
+    std::atomic<int*> shared(new int(0));
+    std::atomic<bool> stop(false);
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&manager, &shared, &stop]() {
+            while (!stop) {
+                EpochManager::Guard guard(manager);
+                if (guard.isPinned()) {
+                    int *p = shared.load();
+                    EXPECT_LE(0, *p);
+                }
+            }
+        });
+    }
+
+    for (int i = 1; i <= 10000; ++i) {
+        int *old = shared.exchange(new int(i));
+        manager.retire(old, countingDelete);
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    delete shared.load();
+}
@@ -39,6 +39,7 @@
 
 #include "programs/engine_testapp/mock_server.h"
 #include <platform/dirutils.h>
+#include <chrono>
 #include <thread>
 
 SynchronousEPEngine::SynchronousEPEngine(const std::string& extra_config)
@@ -72,6 +73,10 @@ SynchronousEPEngine::SynchronousEPEngine(const std::string& extra_config)
     replicationThrottle = new ReplicationThrottle(configuration, stats);
 
     tapConfig = new TapConfig(*this);
+
+    if (configuration.isHtLockfreeReads()) {
+        epochManager.reset(new EpochManager());
+    }
 }
 
 void SynchronousEPEngine::setEPStore(EventuallyPersistentStore* store) {
@@ -374,6 +379,190 @@ TEST_P(EPStoreEvictionTest, GetKeyStatsNMVB) {
                                   /*wantsDeleted*/false));
 }
 
+// getMulti tests /////////////////////////////////////////////////////////////
+
+// Check getMulti returns one result per key, in the order requested.
+TEST_P(EPStoreEvictionTest, GetMulti) {
+    store_item(vbid, "key1", "value1");
+    store_item(vbid, "key2", "value2");
+
+    const get_options_t options = static_cast<get_options_t>(
+            QUEUE_BG_FETCH | HONOR_STATES | TRACK_REFERENCE | DELETE_TEMP);
+    auto results = store->getMulti({{"key2", vbid}, {"missing", vbid},
+                                    {"key1", 1}, {"key1", vbid}},
+                                   cookie, options);
+    ASSERT_EQ(4, results.size());
+
+    ASSERT_EQ(ENGINE_SUCCESS, results[0].getStatus());
+    EXPECT_EQ("value2", results[0].getValue()->getValue()->to_s());
+    delete results[0].getValue();
+
+    EXPECT_EQ(ENGINE_KEY_ENOENT, results[1].getStatus());
+    EXPECT_EQ(ENGINE_NOT_MY_VBUCKET, results[2].getStatus());
+
+    ASSERT_EQ(ENGINE_SUCCESS, results[3].getStatus());
+    EXPECT_EQ("value1", results[3].getValue()->getValue()->to_s());
+    delete results[3].getValue();
+}
+
+// Check the non-resident keys of a getMulti are fetched in a single run of
+// the BgFetcher.
+TEST_P(EPStoreEvictionTest, GetMultiEjected) {
+    const std::vector<std::pair<std::string, uint16_t> > keys = {
+            {"key1", vbid}, {"key2", vbid}, {"key3", vbid}};
+    for (const auto& key : keys) {
+        store_item(vbid, key.first, "value");
+        flush_vbucket_to_disk(vbid);
+        evict_key(vbid, key.first);
+    }
+
+    const get_options_t options = static_cast<get_options_t>(
+            QUEUE_BG_FETCH | HONOR_STATES | TRACK_REFERENCE | DELETE_TEMP);
+    for (const auto& gv : store->getMulti(keys, cookie, options)) {
+        EXPECT_EQ(ENGINE_EWOULDBLOCK, gv.getStatus());
+    }
+
+    MockGlobalTask mockTask(engine->getTaskable(),
+                            TaskId::MultiBGFetcherTask);
+    store->getVBucket(vbid)->getShard()->getBgFetcher()->run(&mockTask);
+
+    for (auto& gv : store->getMulti(keys, cookie, options)) {
+        EXPECT_EQ(ENGINE_SUCCESS, gv.getStatus());
+        delete gv.getValue();
+    }
+}
+
+// Lock-free read tests ///////////////////////////////////////////////////////
+
+class EPStoreLockFreeReadTest : public EventuallyPersistentStoreTest {
+    void SetUp() override {
+        config_string += "ht_lockfree_reads=true";
+        EventuallyPersistentStoreTest::SetUp();
+
+        store->setVBucketState(vbid, vbucket_state_active, false);
+    }
+};
+
+// Check a resident item is read without the lock once it has been referenced,
+// with anything else left to the locked path.
+TEST_F(EPStoreLockFreeReadTest, OptimisticGet) {
+    store_item(vbid, "key", "value");
+    HashTable& ht = store->getVBucket(vbid)->ht;
+
+    Item* itm = ht.optimisticGet("key", vbid, /*trackReference*/false,
+                                 /*hideLockedCas*/false);
+    ASSERT_NE(nullptr, itm);
+    EXPECT_EQ("value", itm->getValue()->to_s());
+    delete itm;
+
+    EXPECT_EQ(nullptr, ht.optimisticGet("missing", vbid, false, false));
+    // Not referenced yet; left for the locked path to reference.
+    EXPECT_EQ(nullptr, ht.optimisticGet("key", vbid, true, false));
+
+    const get_options_t options = static_cast<get_options_t>(
+            QUEUE_BG_FETCH | HONOR_STATES | TRACK_REFERENCE | DELETE_TEMP);
+    for (int i = MIN_NRU_VALUE; i < INITIAL_NRU_VALUE; ++i) {
+        GetValue gv = store->get("key", vbid, cookie, options);
+        ASSERT_EQ(ENGINE_SUCCESS, gv.getStatus());
+        delete gv.getValue();
+    }
+
+    itm = ht.optimisticGet("key", vbid, true, false);
+    ASSERT_NE(nullptr, itm);
+    EXPECT_EQ("value", itm->getValue()->to_s());
+    EXPECT_EQ(MIN_NRU_VALUE, itm->getNRUValue());
+    delete itm;
+
+    // A replaced value stays readable by the copy taken before the replace.
+    itm = ht.optimisticGet("key", vbid, true, false);
+    ASSERT_NE(nullptr, itm);
+    store_item(vbid, "key", "value2");
+    EXPECT_EQ("value", itm->getValue()->to_s());
+    delete itm;
+
+    GetValue gv = store->get("key", vbid, cookie, options);
+    ASSERT_EQ(ENGINE_SUCCESS, gv.getStatus());
+    EXPECT_EQ("value2", gv.getValue()->getValue()->to_s());
+    delete gv.getValue();
+}
+
+// Check lock-free reads racing with resizes never see a bucket array paired
+// with another array's size (which would index past its end).
+TEST_F(EPStoreLockFreeReadTest, OptimisticGetDuringResize) {
+    const int numKeys = 1000;
+    for (int i = 0; i < numKeys; ++i) {
+        store_item(vbid, "key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    HashTable& ht = store->getVBucket(vbid)->ht;
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([this, &ht, &done, numKeys, r]() {
+            ObjectRegistry::onSwitchThread(engine.get());
+            for (int i = r; !done; i = (i + 1) % numKeys) {
+                const std::string key = "key" + std::to_string(i);
+                Item* itm = ht.optimisticGet(key, vbid, false, false);
+                if (itm) {
+                    EXPECT_EQ(key, itm->getKey());
+                    EXPECT_EQ("value" + std::to_string(i),
+                              itm->getValue()->to_s());
+                    delete itm;
+                }
+            }
+        });
+    }
+
+    // Alternate between a table smaller than the number of locks (which
+    // readers must reject) and a much larger one.
+    for (int i = 0; i < 200; ++i) {
+        ht.resize(i % 2 ? 100003 : ht.getNumLocks() - 2);
+    }
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    EXPECT_EQ(numKeys, static_cast<int>(ht.getNumItems()));
+}
+
+// Flusher tests //////////////////////////////////////////////////////////////
+
+class FlusherWritersTest : public EventuallyPersistentStoreTest {
+    void SetUp() override {
+        config_string += "flusher_writers_per_shard=2;max_num_shards=1";
+        EventuallyPersistentStoreTest::SetUp();
+    }
+};
+
+// Check that two writers sharing a shard persist every item of its vbuckets,
+// while the vbuckets are still being created (so some flushes are retried)
+// and more mutations keep requeueing the vbuckets being flushed.
+TEST_F(FlusherWritersTest, TwoWritersOneShard) {
+    const uint16_t numVBuckets = 4;
+    for (uint16_t vb = 0; vb < numVBuckets; ++vb) {
+        store->setVBucketState(vb, vbucket_state_active, false);
+    }
+    ASSERT_TRUE(store->startFlusher());
+
+    const size_t numItems = 2000;
+    for (size_t ii = 0; ii < numItems; ++ii) {
+        store_item(ii % numVBuckets, "key" + std::to_string(ii), "value");
+    }
+
+    EPStats& stats = engine->getEpStats();
+    for (int wait = 0; wait < 1000 && (stats.diskQueueSize.load() > 0 ||
+                                       stats.totalPersisted.load() < numItems);
+         ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(0, stats.diskQueueSize.load());
+    EXPECT_EQ(numItems, stats.totalPersisted.load());
+    for (uint16_t vb = 0; vb < numVBuckets; ++vb) {
+        EXPECT_EQ(0, store->getVBucket(vb)->dirtyQueueSize.load())
+            << "vbucket " << vb << " still has dirty items";
+    }
+}
+
 // Replace tests //////////////////////////////////////////////////////////////
 
 // Test replace against a non-existent key.
@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "configuration.h"
+#include "flush_controller.h"
+
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+class FlushControllerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        stats.mem_low_wat = std::numeric_limits<size_t>::max();
+        controller.reset(new FlushController(config, stats, 1));
+        // Off by default
+        controller->setEnabled(true);
+    }
+
+    // Commit 1000 items in 11ms, 1ms of it syncing, once the controller
+    // samples the queueing rate again (at ~9000 items/s).
+    void recordSampledCommit() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(110));
+        controller->recordCommit(1000, 11000, 1000, true);
+    }
+
+    Configuration config;
+    EPStats stats;
+    std::unique_ptr<FlushController> controller;
+};
+
+TEST_F(FlushControllerTest, NoFeedbackNoLimit) {
+    EXPECT_EQ(0, controller->getTargetBatch());
+    EXPECT_EQ(std::numeric_limits<size_t>::max(),
+              controller->getBatchLimit());
+    EXPECT_EQ(0, controller->getFlushDelay());
+}
+
+TEST_F(FlushControllerTest, CostsSetBatchSizes) {
+    controller->recordCommit(1000, 11000, 1000, true);
+
+    EXPECT_EQ(1000, controller->getSyncCost());
+    EXPECT_EQ(10000, controller->getItemCost());
+    // 400 items take 4 times as long to write as the sync.
+    EXPECT_EQ(400, controller->getTargetBatch());
+    // 50000 items take maxFlushTime to write.
+    EXPECT_EQ(50000, controller->getBatchLimit());
+
+    // Without the sync time the costs are left as they were.
+    controller->recordCommit(1000, 50000, 0, false);
+    EXPECT_EQ(400, controller->getTargetBatch());
+}
+
+TEST_F(FlushControllerTest, DefersUntilBatchFills) {
+    recordSampledCommit();
+    ASSERT_LT(0, controller->getInflowRate());
+
+    // 300 more items take ~33ms to arrive, capped at the 1ms the commit's
+    // sync takes.
+    stats.diskQueueSize = 100;
+    EXPECT_DOUBLE_EQ(0.001, controller->getFlushDelay());
+
+    stats.diskQueueSize = 400;
+    EXPECT_EQ(0, controller->getFlushDelay());
+}
+
+TEST_F(FlushControllerTest, NoDeferral) {
+    recordSampledCommit();
+    stats.diskQueueSize = 100;
+    ASSERT_LT(0, controller->getFlushDelay());
+
+    controller->setMaxDelay(0);
+    EXPECT_EQ(0, controller->getFlushDelay());
+    controller->setMaxDelay(20);
+
+    // Memory is short
+    stats.mem_low_wat = 0;
+    EXPECT_EQ(0, controller->getFlushDelay());
+    stats.mem_low_wat = std::numeric_limits<size_t>::max();
+
+    controller->setEnabled(false);
+    EXPECT_EQ(0, controller->getFlushDelay());
+    EXPECT_EQ(std::numeric_limits<size_t>::max(),
+              controller->getBatchLimit());
+}
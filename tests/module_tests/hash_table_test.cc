@@ -276,6 +276,45 @@ TEST_F(HashTableTest, Resize) {
     verifyFound(h, keys);
 }
 
+TEST_F(HashTableTest, IncrementalResize) {
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    ASSERT_TRUE(h.startIncrementalResize(769));
+    EXPECT_TRUE(h.isResizing());
+    EXPECT_EQ(769, h.getSize());
+
+    // Items are found (and visited) wherever they currently live.
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    // Modify the table part-way through the migration.
+    EXPECT_FALSE(h.continueIncrementalResize(1));
+    EXPECT_TRUE(h.del(keys[0]));
+    store(h, "newKey");
+    EXPECT_EQ(1000, count(h));
+
+    while (!h.continueIncrementalResize(1)) {
+        // Keep migrating...
+    }
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(769, h.getSize());
+    EXPECT_FALSE(h.find(keys[0]));
+    EXPECT_TRUE(h.find("newKey"));
+    keys.erase(keys.begin());
+    verifyFound(h, keys);
+
+    // A blocking resize completes any incremental resize first.
+    ASSERT_TRUE(h.startIncrementalResize(6143));
+    h.resize(3079);
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(3079, h.getSize());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+}
+
 class AccessGenerator : public Generator<bool> {
 public:
 
@@ -620,6 +659,147 @@ TEST_F(HashTableTest, NRUMinimum) {
     EXPECT_EQ(MIN_NRU_VALUE, v->getNRUValue());
 }
 
+// Test fixture for tests which should pass with every bucket layout.
+class HashTableLayoutTest
+    : public ::testing::TestWithParam<HashTable::BucketLayout> {
+protected:
+    HashTableLayoutTest() {
+        alarm(30);
+    }
+};
+
+TEST_P(HashTableLayoutTest, Find) {
+    // Few buckets, so most items overflow the tagged slots.
+    HashTable h(global_stats, 5, 1, GetParam());
+    EXPECT_EQ(GetParam(), h.getBucketLayout());
+    testFind(h);
+}
+
+TEST_P(HashTableLayoutTest, Delete) {
+    HashTable h(global_stats, 5, 1, GetParam());
+    std::vector<std::string> keys = generateKeys(1000);
+    storeMany(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    // Delete every other key; the remainder must still be found.
+    std::vector<std::string> remaining;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 2 == 0) {
+            EXPECT_TRUE(h.del(keys[i]));
+            EXPECT_FALSE(h.find(keys[i]));
+        } else {
+            remaining.push_back(keys[i]);
+        }
+    }
+    EXPECT_EQ(500, count(h));
+    verifyFound(h, remaining);
+
+    // Freed slots are reused.
+    storeMany(h, keys);
+    EXPECT_EQ(1000, count(h));
+    verifyFound(h, keys);
+}
+
+TEST_P(HashTableLayoutTest, DepthCounting) {
+    HashTable h(global_stats, 5, 1, GetParam());
+    std::vector<std::string> keys = generateKeys(100);
+    storeMany(h, keys);
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    EXPECT_EQ(100, depthCounter.size);
+}
+
+TEST_P(HashTableLayoutTest, Resize) {
+    HashTable h(global_stats, 5, 3, GetParam());
+    std::vector<std::string> keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    h.resize(6143);
+    EXPECT_EQ(6143, h.getSize());
+    verifyFound(h, keys);
+
+    ASSERT_TRUE(h.startIncrementalResize(769));
+    while (!h.continueIncrementalResize(7)) {
+        verifyFound(h, keys);
+    }
+    EXPECT_EQ(769, h.getSize());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+}
+
+TEST_P(HashTableLayoutTest, InsertBatch) {
+    HashTable h(global_stats, 47, 3, GetParam());
+    std::vector<std::string> keys = generateKeys(1000);
+
+    std::vector<Item*> items;
+    for (const auto& k : keys) {
+        items.push_back(new Item(k.data(), k.length(), 0, 0, k.c_str(),
+                                 k.length(), NULL, 0, /*cas*/1));
+    }
+    std::vector<mutation_type_t> results;
+    h.insertBatch(items, VALUE_ONLY, false, false, results);
+    ASSERT_EQ(items.size(), results.size());
+    for (auto rv : results) {
+        EXPECT_EQ(NOT_FOUND, rv);
+    }
+    EXPECT_EQ(1000, h.getNumInMemoryItems());
+    verifyFound(h, keys);
+
+    // Re-inserting with a different CAS is rejected (as insert() does),
+    // whichever order the batch is resolved in.
+    items[0]->setCas(2);
+    items[999]->setCas(2);
+    h.insertBatch(items, VALUE_ONLY, false, false, results);
+    for (size_t i = 0; i < results.size(); ++i) {
+        EXPECT_EQ((i == 0 || i == 999) ? INVALID_CAS : NOT_FOUND, results[i]);
+    }
+    EXPECT_EQ(1000, h.getNumInMemoryItems());
+
+    for (Item *i : items) {
+        delete i;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(BucketLayouts,
+                        HashTableLayoutTest,
+                        ::testing::Values(HashTable::BucketLayout::Chained,
+                                          HashTable::BucketLayout::Tagged));
+
+// Measure the rate of successful lookups against tables of 1M, 10M and 50M
+// items, for each bucket layout. Disabled by default as it needs several
+// GB of memory and a few minutes to run.
+TEST_P(HashTableLayoutTest, DISABLED_LookupThroughput) {
+    alarm(0);
+    EPStats stats;
+    stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    for (size_t num_items : {1000000, 10000000, 50000000}) {
+        HashTable h(stats, 0, 0, GetParam());
+        std::vector<std::string> keys = generateKeys(num_items);
+        storeMany(h, keys);
+        h.resize();
+
+        // Look keys up in a random order, so each lookup is a cache miss.
+        std::random_shuffle(keys.begin(), keys.end());
+
+        hrtime_t start = gethrtime();
+        size_t found = 0;
+        for (const auto& key : keys) {
+            if (h.find(key, /*trackReference*/false)) {
+                ++found;
+            }
+        }
+        hrtime_t end = gethrtime();
+        EXPECT_EQ(num_items, found);
+
+        const double duration_s = (end - start) / double(1000 * 1000 * 1000);
+        RecordProperty(("lookups_per_sec_" + std::to_string(num_items)).c_str(),
+                       static_cast<int>(num_items / duration_s));
+        h.clear();
+    }
+}
+
 /* static storage for environment variable set by putenv().
  *
  * (This must be static as putenv() essentially 'takes ownership' of
@@ -28,6 +28,7 @@
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <algorithm>
 #include <unordered_map>
 #include <vector>
 
@@ -269,6 +270,45 @@ TEST(CouchKVStoreTest, CompressedTest) {
     kvstore->destroyScanContext(scanCtx);
 }
 
+// Verify a background fetch of several documents returns all of them when
+// the files are accessed through io_uring (where it is available; otherwise
+// the fetch is as without).
+TEST(CouchKVStoreTest, IoUringGetMulti) {
+    std::string data_dir("/tmp/kvstore-test");
+    CouchbaseDirectoryUtilities::rmrf(data_dir.c_str());
+
+    KVStoreConfig config(1024, 4, data_dir, "couchdb", 0);
+    config.setIoUring(true);
+    auto kvstore = setup_kv_store(config);
+
+    kvstore->begin();
+    WriteCallback wc;
+    const int numItems = 100;
+    for (int i = 0; i < numItems; i++) {
+        std::string key("key" + std::to_string(i));
+        Item item(key.c_str(), key.length(), 0, 0, "value", 5);
+        kvstore->set(item, wc);
+    }
+    EXPECT_TRUE(kvstore->commit());
+
+    vb_bgfetch_queue_t itms;
+    std::vector<std::unique_ptr<VBucketBGFetchItem>> fetches;
+    for (int i = 0; i < numItems; i += 3) {
+        fetches.emplace_back(new VBucketBGFetchItem(nullptr, false));
+        vb_bgfetch_item_ctx_t& ctx = itms["key" + std::to_string(i)];
+        ctx.isMetaOnly = false;
+        ctx.bgfetched_list.push_back(fetches.back().get());
+    }
+    kvstore->getMulti(0, itms);
+
+    for (auto& fetch : fetches) {
+        ASSERT_EQ(ENGINE_SUCCESS, fetch->value.getStatus());
+        EXPECT_EQ(0, strncmp("value", fetch->value.getValue()->getData(),
+                             fetch->value.getValue()->getNBytes()));
+        fetch->delValue();
+    }
+}
+
 // Verify the stats returned from operations are accurate.
 TEST(CouchKVStoreTest, StatsTest) {
     std::string data_dir("/tmp/kvstore-test");
@@ -766,6 +806,46 @@ TEST_F(CouchKVStoreErrorInjectionTest, getMulti_open_doc_with_docinfo) {
     }
 }
 
+/**
+ * Verify CouchKVStore::getMulti reads the document bodies in the order they
+ * are in the file rather than in key order.
+ */
+TEST_F(CouchKVStoreErrorInjectionTest, getMulti_reads_in_file_order) {
+    // Written as key0, key1, ... but found as key0, key1, key10, key11, key2
+    populate_items(12);
+    vb_bgfetch_queue_t itms(make_bgfetch_queue());
+
+    std::vector<cs_off_t> offsets;
+    EXPECT_CALL(ops, pread(_, _, _, _, _)).WillRepeatedly(Invoke(
+        [this, &offsets](couchstore_error_info_t* errinfo,
+                         couch_file_handle handle, void* buf, size_t nbytes,
+                         cs_off_t offset) {
+            offsets.push_back(offset);
+            return ops.get_wrapped()->pread(errinfo, handle, buf, nbytes,
+                                            offset);
+        }));
+    kvstore->getMulti(0, itms);
+
+    // The b-tree follows the documents in the file, so the body reads are
+    // the last ones, all below the b-tree reads before them.
+    ASSERT_FALSE(offsets.empty());
+    std::vector<cs_off_t> suffixMax(offsets.size());
+    suffixMax.back() = offsets.back();
+    for (size_t ii = offsets.size() - 1; ii > 0; --ii) {
+        suffixMax[ii - 1] = std::max(offsets[ii - 1], suffixMax[ii]);
+    }
+    size_t firstBody = 1;
+    cs_off_t btreeMin = offsets.front();
+    while (firstBody < offsets.size() && suffixMax[firstBody] >= btreeMin) {
+        btreeMin = std::min(btreeMin, offsets[firstBody]);
+        ++firstBody;
+    }
+    std::vector<cs_off_t> bodyReads(offsets.begin() + firstBody,
+                                    offsets.end());
+    EXPECT_LE(items.size(), bodyReads.size());
+    EXPECT_TRUE(std::is_sorted(bodyReads.begin(), bodyReads.end()));
+}
+
 /**
  * Injects error during CouchKVStore::compactDB/couchstore_compact_db_ex
  */
@@ -1087,6 +1167,51 @@ TEST_F(CouchKVStoreErrorInjectionTest, closeDB_close_file) {
     }
 }
 
+/**
+ * Verifies that a transaction spanning several vbuckets is group committed:
+ * the data of every file is synced before any of their new headers is
+ * written, and those are then synced together.
+ */
+TEST_F(CouchKVStoreErrorInjectionTest, commit_group_sync) {
+    std::string failoverLog("");
+    vbucket_state state(vbucket_state_active, 0, 0, 0, 0, 0, 0, 0, 0,
+                        failoverLog);
+    kvstore->snapshotVBucket(1, state,
+                             VBStatePersist::VBSTATE_PERSIST_WITHOUT_COMMIT);
+
+    size_t callbacks = 0;
+    CustomCallback<mutation_result> set_callback(
+        [&callbacks](mutation_result result) {
+            EXPECT_EQ(1, result.first);
+            ++callbacks;
+        });
+
+    kvstore->begin();
+    for (uint16_t vb = 0; vb < 2; ++vb) {
+        Item item("key", 3, 0, 0, "value", 5, nullptr, 0, 0, 1, vb);
+        kvstore->set(item, set_callback);
+    }
+    {
+        /* Establish Logger expectation */
+        EXPECT_CALL(logger, mlog(_, _)).Times(AnyNumber());
+
+        /* Establish FileOps expectation */
+        InSequence s;
+        EXPECT_CALL(ops, pwrite(_, _, _, _, _)).Times(AnyNumber());
+        EXPECT_CALL(ops, sync(_, _)).Times(2);
+        EXPECT_CALL(ops, pwrite(_, _, _, _, _)).Times(AtLeast(2));
+        EXPECT_CALL(ops, sync(_, _)).Times(2);
+
+        EXPECT_TRUE(kvstore->commit());
+    }
+    EXPECT_EQ(2, callbacks);
+
+    for (uint16_t vb = 0; vb < 2; ++vb) {
+        GetCallback gc;
+        kvstore->get("key", vb, gc);
+    }
+}
+
 class MockCouchRequest : public CouchRequest {
 public:
     class MetaData {
@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "murmurhash3.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+static const murmurhash3_kernel_t kernels[] = {
+    MURMURHASH3_SCALAR, MURMURHASH3_SSE2, MURMURHASH3_AVX2
+};
+
+static const char *kernelName(murmurhash3_kernel_t kernel) {
+    switch (kernel) {
+    case MURMURHASH3_SCALAR:
+        return "scalar";
+    case MURMURHASH3_SSE2:
+        return "sse2";
+    case MURMURHASH3_AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+static std::vector<char> makeKey(size_t len) {
+    std::vector<char> key(len);
+    for (size_t i = 0; i < len; ++i) {
+        key[i] = static_cast<char>(i * 131 + 7);
+    }
+    return key;
+}
+
+// Every kernel must give exactly what MurmurHash3_x64_128 gives for each
+// seed, whatever the key length (blocks and tail) and number of seeds
+// (whole and partial vectors).
+TEST(MurmurHash3Test, SeedsMatchScalar) {
+    for (murmurhash3_kernel_t kernel : kernels) {
+        uint64_t out[24];
+        std::vector<char> key = makeKey(1);
+        if (!MurmurHash3_x64_128_seeds_using(kernel, key.data(), 1, 0, 1,
+                                             out)) {
+            std::cerr << "Skipping unsupported kernel " << kernelName(kernel)
+                      << std::endl;
+            continue;
+        }
+
+        for (int len = 0; len <= 100; ++len) {
+            key = makeKey(len);
+            for (int n = 1; n <= 20; ++n) {
+                for (uint32_t firstSeed : {0u, 5u, 0xfffffffeu}) {
+                    // Sentinel to catch writes past out[n - 1].
+                    out[n] = 0xdeadbeef;
+                    ASSERT_TRUE(MurmurHash3_x64_128_seeds_using(
+                            kernel, key.data(), len, firstSeed, n, out));
+                    for (int i = 0; i < n; ++i) {
+                        uint64_t expected;
+                        MurmurHash3_x64_128(key.data(), len, firstSeed + i,
+                                            &expected);
+                        ASSERT_EQ(expected, out[i])
+                            << kernelName(kernel) << " len:" << len
+                            << " n:" << n << " seed:" << firstSeed + i;
+                    }
+                    ASSERT_EQ(0xdeadbeef, out[n]);
+                }
+            }
+        }
+    }
+}
+
+TEST(MurmurHash3Test, DefaultKernelIsSupported) {
+    uint64_t out;
+    EXPECT_TRUE(MurmurHash3_x64_128_seeds_using(MurmurHash3_getKernel(),
+                                                "key", 3, 0, 1, &out));
+}
+
+// Not a correctness test; reports the time per key to hash a bloom
+// filter-like number of seeds with each supported kernel.
+TEST(MurmurHash3Test, Microbenchmark) {
+    const int numKeys = 200000;
+    const int numSeeds = 7;
+    std::vector<char> key = makeKey(32);
+
+    for (murmurhash3_kernel_t kernel : kernels) {
+        uint64_t out[numSeeds];
+        uint64_t sink = 0;
+        if (!MurmurHash3_x64_128_seeds_using(kernel, key.data(), 1, 0, 1,
+                                             out)) {
+            continue;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numKeys; ++i) {
+            key[0] = static_cast<char>(i);
+            MurmurHash3_x64_128_seeds_using(kernel, key.data(), key.size(),
+                                            0, numSeeds, out);
+            sink += out[numSeeds - 1];
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "murmurhash3 " << kernelName(kernel) << ": "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          elapsed).count() / numKeys
+                  << " ns/key (" << numSeeds << " seeds, " << key.size()
+                  << " byte keys) [" << (sink & 1) << "]" << std::endl;
+    }
+}
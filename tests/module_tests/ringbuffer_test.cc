@@ -75,12 +75,68 @@ static void testWrapped() {
     cb_assert(v == expected);
 }
 
+static void testQueueFifo() {
+    RingQueue<int> rq(4);
+    cb_assert(rq.empty());
+    for (int ii = 0; ii < 3; ++ii) {
+        rq.push(ii);
+    }
+    cb_assert(rq.size() == 3);
+    cb_assert(rq.front() == 0);
+    rq.pop();
+    // Wraps around the end of the array
+    rq.push(3);
+    rq.push(4);
+    cb_assert(rq.capacity() == 4);
+    for (int ii = 1; ii <= 4; ++ii) {
+        cb_assert(rq.front() == ii);
+        rq.pop();
+    }
+    cb_assert(rq.empty());
+}
+
+static void testQueueGrow() {
+    RingQueue<int> rq(4);
+    rq.push(0);
+    rq.pop();
+    // Grows while wrapped
+    for (int ii = 0; ii < 10; ++ii) {
+        rq.push(ii);
+    }
+    cb_assert(rq.size() == 10);
+    cb_assert(rq.capacity() == 16);
+    for (int ii = 0; ii < 10; ++ii) {
+        cb_assert(rq.front() == ii);
+        rq.pop();
+    }
+    cb_assert(rq.empty());
+}
+
+static void testQueueShrink() {
+    RingQueue<int> rq(4);
+    const int burst = RingQueue<int>::maxIdleCapacity + 1;
+    for (int ii = 0; ii < burst; ++ii) {
+        rq.push(ii);
+    }
+    cb_assert(rq.capacity() > RingQueue<int>::maxIdleCapacity);
+    for (int ii = 0; ii < burst; ++ii) {
+        cb_assert(rq.front() == ii);
+        rq.pop();
+    }
+    cb_assert(rq.capacity() == 4);
+    rq.push(1);
+    cb_assert(rq.front() == 1);
+}
+
 int main() {
 
     testEmpty();
     testPartial();
     testFull();
     testWrapped();
+    testQueueFifo();
+    testQueueGrow();
+    testQueueShrink();
 
     return 0;
 }
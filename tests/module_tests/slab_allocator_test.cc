@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "slab_allocator.h"
+
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(SlabArenaTest, SizeClasses) {
+    SlabArena arena;
+
+    void *small = arena.allocate(1);
+    EXPECT_EQ(SlabArena::sizeClassGranularity, SlabArena::getSlotSize(small));
+    void *mid = arena.allocate(SlabArena::sizeClassGranularity + 1);
+    EXPECT_EQ(2 * SlabArena::sizeClassGranularity,
+              SlabArena::getSlotSize(mid));
+    void *max = arena.allocate(SlabArena::maxObjectSize);
+    EXPECT_EQ(SlabArena::maxObjectSize, SlabArena::getSlotSize(max));
+    EXPECT_EQ(3, arena.getNumSlabs());
+
+    // Anything bigger comes straight from the heap.
+    void *big = arena.allocate(SlabArena::maxObjectSize + 1);
+    EXPECT_EQ(0, SlabArena::getSlotSize(big));
+    EXPECT_EQ(3, arena.getNumSlabs());
+
+    EXPECT_EQ(SlabArena::sizeClassGranularity * 3 + SlabArena::maxObjectSize,
+              arena.getUsedBytes());
+
+    for (void *p : {small, mid, max, big}) {
+        SlabArena::deallocate(p);
+    }
+    EXPECT_EQ(0, arena.getUsedBytes());
+}
+
+TEST(SlabArenaTest, HeapMemory) {
+    // deallocate() must accept memory which didn't come from a slab.
+    void *p = ::operator new(100);
+    EXPECT_EQ(0, SlabArena::getSlotSize(p));
+    EXPECT_FALSE(SlabArena::isInSparseSlab(p));
+    SlabArena::deallocate(p);
+}
+
+TEST(SlabArenaTest, ReuseAndRelease) {
+    SlabArena arena;
+    const size_t size = 64;
+    const size_t count = 10 * SlabArena::slabSize / size;
+
+    std::vector<void*> objects;
+    std::set<void*> unique;
+    for (size_t i = 0; i < count; ++i) {
+        void *p = arena.allocate(size);
+        std::memset(p, 0xff, size);
+        objects.push_back(p);
+        unique.insert(p);
+    }
+    EXPECT_EQ(count, unique.size());
+    const size_t numSlabs = arena.getNumSlabs();
+    EXPECT_GE(numSlabs, 10);
+
+    // Freed slots are reused before any more slabs are created.
+    SlabArena::deallocate(objects.back());
+    void *p = arena.allocate(size);
+    EXPECT_EQ(objects.back(), p);
+    EXPECT_EQ(numSlabs, arena.getNumSlabs());
+
+    // Slabs are released once empty (apart from the one being allocated
+    // from).
+    for (void *o : objects) {
+        SlabArena::deallocate(o);
+    }
+    EXPECT_EQ(1, arena.getNumSlabs());
+    EXPECT_EQ(0, arena.getUsedBytes());
+}
+
+TEST(SlabArenaTest, SparseSlabs) {
+    SlabArena arena;
+    const size_t size = 128;
+    const size_t perSlab = SlabArena::slabSize / size;
+
+    std::vector<void*> objects;
+    for (size_t i = 0; i < 4 * perSlab; ++i) {
+        objects.push_back(arena.allocate(size));
+    }
+
+    // Free most objects, so all but the current slab are sparse.
+    std::vector<void*> remaining;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (i % 8 == 0) {
+            remaining.push_back(objects[i]);
+        } else {
+            SlabArena::deallocate(objects[i]);
+        }
+    }
+    EXPECT_TRUE(SlabArena::isInSparseSlab(remaining.front()));
+
+    // Relocating the objects of sparse slabs (as the defragmenter does)
+    // packs them into fewer slabs.
+    const size_t before = arena.getNumSlabs();
+    for (auto& o : remaining) {
+        if (SlabArena::isInSparseSlab(o)) {
+            void *moved = arena.allocate(size);
+            SlabArena::deallocate(o);
+            o = moved;
+        }
+    }
+    EXPECT_LT(arena.getNumSlabs(), before);
+
+    for (void *o : remaining) {
+        SlabArena::deallocate(o);
+    }
+}